@@ -0,0 +1,189 @@
+// Per-layer convolution kernel selection: runs every legal CMSIS-NN variant
+// of each conv layer on real activations, scores it with the M4 cycle
+// estimator (host/m4_cycles.h), checks that it reproduces the current output,
+// and writes the winners to nn/conv_variants.h, which the model table in
+// nn/nn.c is built from.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "m4_cycles.h"
+#include "testdata.h"
+
+static const uint8_t test_image[DATA_OUT_CH * DATA_OUT_DIM * DATA_OUT_DIM] = IMG_DATA;
+
+// Same placement as get_buffer() in nn/nn.c.
+static q7_t* _buffer(nn_context_t* ctx, uint8_t buf, q7_t* input, q7_t* output)
+{
+	switch (buf) {
+	case NN_BUF_INPUT:
+		return input;
+	case NN_BUF_OUTPUT:
+		return output;
+	case NN_BUF1:
+		return ctx->scratch_buffer;
+	default:
+		return ctx->scratch_buffer + 32768;
+	}
+}
+
+static int _write_header(const char* path, const nn_model_t* m, const uint8_t* best, const double* cycles)
+{
+	FILE* f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	fprintf(f, "// Convolution kernel per layer (nn_conv_variant_t), written by\n"
+	           "// cifar10-autotune from estimated Cortex-M4 cycles. Regenerate with\n"
+	           "//   cifar10-autotune -o nn/conv_variants.h\n"
+	           "// after changing the model.\n\n"
+	           "#ifndef __CONV_VARIANTS_H__\n"
+	           "#define __CONV_VARIANTS_H__\n\n");
+	for (uint8_t i = 0; i < m->layer_count; i++) {
+		const nn_layer_t* l = &m->layers[i];
+		char macro[32];
+
+		if (l->type != NN_LAYER_CONV) {
+			continue;
+		}
+		snprintf(macro, sizeof(macro), "%s_VARIANT", l->name);
+		for (char* c = macro; *c != '\0'; c++) {
+			*c = (*c >= 'a' && *c <= 'z') ? (char)(*c - 'a' + 'A') : *c;
+		}
+		fprintf(f, "#define %s NN_CONV_", macro);
+		for (const char* c = nn_conv_variant_name(best[i]); *c != '\0'; c++) {
+			fputc((*c >= 'a' && *c <= 'z') ? *c - 'a' + 'A' : *c, f);
+		}
+		fprintf(f, "  // %.0f estimated cycles\n", cycles[i]);
+	}
+	fprintf(f, "\n#endif\n");
+	fclose(f);
+	return 0;
+}
+
+static void _usage(const char* prog)
+{
+	fprintf(stderr,
+	        "usage: %s [-c costs.txt] [-o conv_variants.h]\n"
+	        "  -c F  override cost table entries, see cifar10-cycles\n"
+	        "  -o F  write the chosen variants as a header for nn/nn.c\n",
+	        prog);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* out_path = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:o:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			if (m4_cycles_load_costs(optarg) != 0) {
+				return 1;
+			}
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			_usage(argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	static nn_context_t ctx;
+	static q7_t image[sizeof(test_image)];
+	static q7_t in_copy[sizeof(ctx.scratch_buffer)];
+	static q7_t reference[sizeof(ctx.scratch_buffer)];
+	const nn_model_t* m = &cifar10_model;
+	uint8_t best[256];
+	double best_cycles[256];
+	q7_t output[IP1_OUT_DIM];
+	bool ok = true;
+
+	memcpy(image, test_image, sizeof(image));
+	mean_subtract(image);
+	ctx.kernels = &m4_cycles_kernels;
+
+	printf("%-8s %-16s %12s %8s %s\n", "layer", "variant", "cycles", "vs now", "");
+	for (uint8_t i = 0; i < m->layer_count; i++) {
+		const nn_layer_t* l = &m->layers[i];
+		nn_model_t prefix = { .layers = m->layers, .layer_count = i };
+
+		best[i] = l->variant;
+		if (l->type != NN_LAYER_CONV) {
+			continue;
+		}
+
+		nn_run(&prefix, &ctx, image, output);
+		q7_t* in = _buffer(&ctx, l->in_buf, image, output);
+		q7_t* out = _buffer(&ctx, l->out_buf, image, output);
+		const size_t in_size = (size_t)l->in_dim * l->in_dim * l->in_ch;
+		const size_t out_size = (size_t)l->out_dim * l->out_dim * l->out_ch;
+		double current = 0.0;
+
+		memcpy(in_copy, in, in_size);
+
+		// the layer as the model has it now: reference output and cycles
+		nn_model_t layer = { .layers = l, .layer_count = 1 };
+		m4_counts_t before, after;
+		m4_cycles_read(&before);
+		nn_run(&layer, &ctx, image, output);
+		m4_cycles_read(&after);
+		m4_cycles_sub(&after, &before);
+		current = m4_cycles_estimate(&after);
+		memcpy(reference, out, out_size);
+		best_cycles[i] = current;
+
+		for (uint8_t v = NN_CONV_AUTO + 1; v < NN_CONV_VARIANT_COUNT; v++) {
+			nn_layer_t candidate = *l;
+			candidate.variant = v;
+			layer.layers = &candidate;
+
+			if (!nn_conv_variant_ok(&candidate, v)) {
+				printf("%-8s %-16s %12s\n", l->name, nn_conv_variant_name(v), "n/a");
+				continue;
+			}
+
+			memcpy(in, in_copy, in_size);
+			memset(out, 0, out_size);
+			m4_cycles_read(&before);
+			nn_run(&layer, &ctx, image, output);
+			m4_cycles_read(&after);
+			m4_cycles_sub(&after, &before);
+
+			double cycles = m4_cycles_estimate(&after);
+			bool same = memcmp(out, reference, out_size) == 0;
+			printf("%-8s %-16s %12.0f %7.2fx %s\n", l->name, nn_conv_variant_name(v), cycles, current / cycles,
+			       same ? "" : "OUTPUT DIFFERS");
+			if (!same) {
+				ok = false;
+			} else if (cycles < best_cycles[i] || (best[i] == NN_CONV_AUTO && cycles <= best_cycles[i])) {
+				best[i] = v;
+				best_cycles[i] = cycles;
+			}
+		}
+		memcpy(in, in_copy, in_size);
+	}
+
+	printf("\nchosen:");
+	for (uint8_t i = 0; i < m->layer_count; i++) {
+		if (m->layers[i].type == NN_LAYER_CONV) {
+			printf(" %s=%s", m->layers[i].name, nn_conv_variant_name(best[i]));
+		}
+	}
+	printf("\n");
+
+	if (!ok) {
+		fprintf(stderr, "ERROR: some variants do not reproduce the current output\n");
+		return 1;
+	}
+	if (out_path != NULL && _write_header(out_path, m, best, best_cycles) != 0) {
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,207 @@
+// Host batch classifier: runs the firmware network (nn/nn.c + CMSIS-NN, DSP
+// code paths) over CIFAR-10 binary files on all cores and reports throughput
+// and top-1 accuracy, so offline numbers match what the RT core produces.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nn.h"
+
+#include "cifar10_data.h"
+#include "thread_pool.h"
+#ifdef HOST_X86_KERNELS
+#include "nn_x86.h"
+#endif
+
+typedef struct {
+	nn_context_t nn;
+	uint8_t img[CIFAR10_IMG_BYTES];
+	q7_t output[IP1_OUT_DIM];
+} worker_ctx_t;
+
+typedef struct {
+	const cifar10_dataset_t* ds;
+	worker_ctx_t* ctx;
+	uint8_t* predictions;
+} batch_job_t;
+
+// Same rule as main.c: first index holding the maximum score.
+static uint8_t _get_top_prediction(const q7_t* predictions, uint8_t max)
+{
+	uint8_t index = 0;
+	int8_t  max_val = -128;
+	for (uint8_t i = 0; i < max; i++) {
+		if (max_val < predictions[i]) {
+			max_val = predictions[i];
+			index = i;
+		}
+	}
+	return index;
+}
+
+static void _classify_range(void* arg, unsigned worker, size_t begin, size_t end)
+{
+	batch_job_t* job = arg;
+	worker_ctx_t* ctx = &job->ctx[worker];
+
+	for (size_t i = begin; i < end; i++) {
+		uint8_t label;
+		const uint8_t* planar = cifar10_dataset_record(job->ds, i, &label);
+
+		cifar10_planar_to_hwc(planar, ctx->img);
+		run_nn_ctx(&ctx->nn, (q7_t*)ctx->img, ctx->output);
+		job->predictions[i] = _get_top_prediction(ctx->output, IP1_OUT_DIM);
+	}
+}
+
+static double _now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static const nn_kernels_t* _kernels_by_name(const char* name)
+{
+	if (strcmp(name, "cmsis") == 0) {
+		return &nn_cmsis_kernels;
+	}
+#ifdef HOST_X86_KERNELS
+	if (strcmp(name, "x86") == 0) {
+		return nn_x86_kernels();
+	}
+	if (strcmp(name, "sse4.1") == 0) {
+		return nn_x86_kernels_sse41();
+	}
+	if (strcmp(name, "avx2") == 0) {
+		return nn_x86_kernels_avx2();
+	}
+#endif
+	return NULL;
+}
+
+static void _usage(const char* prog)
+{
+	fprintf(stderr,
+	        "usage: %s [-t threads] [-g grain] [-k kernels] [-s] file.bin...\n"
+	        "  -t N  worker threads (default: online CPUs)\n"
+	        "  -g N  images taken per work item (default: 4)\n"
+	        "  -k K  kernel set: cmsis, x86, sse4.1 or avx2 (default: cmsis)\n"
+	        "  -s    sweep 1, 2, 4, ... N threads and report scaling\n",
+	        prog);
+}
+
+int main(int argc, char* argv[])
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned max_threads = (cpus > 0) ? (unsigned)cpus : 1;
+	size_t grain = 4;
+	bool sweep = false;
+	const nn_kernels_t* kernels = &nn_cmsis_kernels;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:g:k:sh")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			grain = (size_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			kernels = _kernels_by_name(optarg);
+			if (kernels == NULL) {
+				fprintf(stderr, "kernel set '%s' is not available\n", optarg);
+				return 2;
+			}
+			break;
+		case 's':
+			sweep = true;
+			break;
+		default:
+			_usage(argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (optind >= argc || max_threads == 0) {
+		_usage(argv[0]);
+		return 2;
+	}
+
+	cifar10_dataset_t ds;
+	if (cifar10_dataset_open(&ds, &argv[optind], (size_t)(argc - optind)) != 0) {
+		return 1;
+	}
+
+	worker_ctx_t* ctx = aligned_alloc(64, ((max_threads * sizeof(worker_ctx_t)) + 63) & ~(size_t)63);
+	uint8_t* predictions = malloc(ds.count);
+	uint8_t* reference = malloc(ds.count);
+	if (ctx == NULL || predictions == NULL || reference == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	memset(ctx, 0, max_threads * sizeof(worker_ctx_t));
+	for (unsigned i = 0; i < max_threads; i++) {
+		ctx[i].nn.kernels = kernels;
+	}
+
+	batch_job_t job = { .ds = &ds, .ctx = ctx, .predictions = predictions };
+	double base_rate = 0.0;
+	bool consistent = true;
+
+	printf("%zu images in %zu file(s), %s kernels\n", ds.count, ds.file_count, kernels->name);
+	printf("%8s %10s %12s %8s %8s\n", "threads", "seconds", "images/s", "speedup", "steals");
+
+	for (unsigned threads = sweep ? 1 : max_threads; threads <= max_threads;) {
+		thread_pool_t* pool = pool_create(threads);
+		if (pool == NULL) {
+			fprintf(stderr, "failed to create %u threads\n", threads);
+			return 1;
+		}
+
+		double start = _now();
+		pool_parallel_for(pool, ds.count, grain, _classify_range, &job);
+		double elapsed = _now() - start;
+		double rate = (double)ds.count / elapsed;
+
+		if (base_rate == 0.0) {
+			base_rate = rate;
+			memcpy(reference, predictions, ds.count);
+		} else if (memcmp(reference, predictions, ds.count) != 0) {
+			consistent = false;
+		}
+
+		printf("%8u %10.3f %12.1f %7.2fx %8llu\n", pool_size(pool), elapsed, rate, rate / base_rate,
+		       (unsigned long long)pool_steals(pool));
+		pool_destroy(pool);
+
+		if (threads == max_threads) {
+			break;
+		}
+		threads = (threads * 2 > max_threads) ? max_threads : threads * 2;
+	}
+
+	size_t correct = 0;
+	for (size_t i = 0; i < ds.count; i++) {
+		uint8_t label;
+		cifar10_dataset_record(&ds, i, &label);
+		correct += (predictions[i] == label);
+	}
+	printf("top-1 accuracy: %.2f%% (%zu/%zu)\n", 100.0 * (double)correct / (double)ds.count, correct, ds.count);
+
+	if (!consistent) {
+		fprintf(stderr, "ERROR: predictions differ between thread counts\n");
+	}
+
+	free(reference);
+	free(predictions);
+	free(ctx);
+	cifar10_dataset_close(&ds);
+	return consistent ? 0 : 1;
+}
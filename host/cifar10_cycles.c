@@ -0,0 +1,142 @@
+// Estimated Cortex-M4 cycles for one inference, per layer, from the DSP
+// instructions and word accesses the emulated CMSIS-NN kernels execute (see
+// host/m4_cycles.h). A kernel change can be judged from this in seconds; the
+// absolute numbers are only as good as the cost table.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "m4_cycles.h"
+#include "testdata.h"
+
+#include "cifar10_data.h"
+
+static const uint8_t test_image[CIFAR10_IMG_BYTES] = IMG_DATA;
+
+static uint64_t _dsp_other(const m4_counts_t* c)
+{
+	uint64_t n = 0;
+	for (int op = M4_OP_SMLAD; op < M4_OP_WORD; op++) {
+		n += c->ops[op];
+	}
+	return n - c->ops[M4_OP_SMLAD] - c->ops[M4_OP_SXTB16];
+}
+
+static uint64_t _scalar(const m4_counts_t* c)
+{
+	uint64_t n = 0;
+	for (int op = M4_OP_CONV_OUT; op < M4_OP_COUNT; op++) {
+		n += c->ops[op];
+	}
+	return n;
+}
+
+static void _print_row(const char* layer, const char* kernel, const m4_counts_t* c, double total)
+{
+	double cycles = m4_cycles_estimate(c);
+
+	printf("%-8s %-20s %10llu %9llu %9llu %9llu %9llu %11.0f %8.1f %6.1f%%\n", layer, kernel,
+	       (unsigned long long)c->ops[M4_OP_SMLAD], (unsigned long long)c->ops[M4_OP_SXTB16],
+	       (unsigned long long)_dsp_other(c), (unsigned long long)c->ops[M4_OP_WORD], (unsigned long long)_scalar(c),
+	       cycles, cycles / M4_CLOCK_HZ * 1e6, (total > 0.0) ? 100.0 * cycles / total : 100.0);
+}
+
+static void _usage(const char* prog)
+{
+	fprintf(stderr,
+	        "usage: %s [-c costs.txt] [-v] [file.bin [index]]\n"
+	        "  -c F  override cost table entries (\"<op> <cycles>\" per line)\n"
+	        "  -v    also print the counts and cost of every op\n"
+	        "Without a file the built-in test image from nn/testdata.h is used.\n",
+	        prog);
+}
+
+int main(int argc, char* argv[])
+{
+	bool verbose = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:vh")) != -1) {
+		switch (opt) {
+		case 'c':
+			if (m4_cycles_load_costs(optarg) != 0) {
+				return 1;
+			}
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			_usage(argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	uint8_t image[CIFAR10_IMG_BYTES];
+	memcpy(image, test_image, sizeof(image));
+
+	if (optind < argc) {
+		cifar10_dataset_t ds;
+		size_t index = (optind + 1 < argc) ? strtoul(argv[optind + 1], NULL, 0) : 0;
+		uint8_t label;
+
+		if (cifar10_dataset_open(&ds, &argv[optind], 1) != 0) {
+			return 1;
+		}
+		if (index >= ds.count) {
+			fprintf(stderr, "index %zu out of range (%zu images)\n", index, ds.count);
+			return 1;
+		}
+		cifar10_planar_to_hwc(cifar10_dataset_record(&ds, index, &label), image);
+		cifar10_dataset_close(&ds);
+	}
+
+	static nn_context_t ctx;
+	const nn_model_t* m = &cifar10_model;
+	m4_counts_t layer_counts[16 + 1], before, total;
+	const char* kernels[16 + 1];
+	q7_t output[IP1_OUT_DIM];
+
+	ctx.kernels = &m4_cycles_kernels;
+	m4_cycles_reset();
+
+	m4_cycles_read(&before);
+	m4_cycles_mean_subtract((q7_t*)image);
+	m4_cycles_read(&layer_counts[0]);
+	m4_cycles_sub(&layer_counts[0], &before);
+	kernels[0] = m4_cycles_last_kernel();
+
+	// one layer at a time, so the counts can be attributed
+	for (uint8_t i = 0; i < m->layer_count; i++) {
+		nn_model_t layer = { .layers = &m->layers[i], .layer_count = 1 };
+
+		m4_cycles_read(&before);
+		nn_run(&layer, &ctx, (q7_t*)image, output);
+		m4_cycles_read(&layer_counts[i + 1]);
+		m4_cycles_sub(&layer_counts[i + 1], &before);
+		kernels[i + 1] = m4_cycles_last_kernel();
+	}
+	m4_cycles_read(&total);
+
+	double total_cycles = m4_cycles_estimate(&total);
+	printf("%-8s %-20s %10s %9s %9s %9s %9s %11s %8s %7s\n", "layer", "kernel", "smlad", "sxtb16", "other dsp",
+	       "ld/st", "scalar", "cycles", "us", "share");
+	_print_row("input", kernels[0], &layer_counts[0], total_cycles);
+	for (uint8_t i = 0; i < m->layer_count; i++) {
+		_print_row(m->layers[i].name, kernels[i + 1], &layer_counts[i + 1], total_cycles);
+	}
+	_print_row("total", "", &total, total_cycles);
+	printf("estimated %.2f ms at %.1f MHz\n", total_cycles / M4_CLOCK_HZ * 1e3, M4_CLOCK_HZ / 1e6);
+
+	if (verbose) {
+		printf("\n%-14s %12s %8s %12s\n", "op", "count", "cycles", "total");
+		for (int op = 0; op < M4_OP_COUNT; op++) {
+			printf("%-14s %12llu %8.2f %12.0f\n", m4_cycles_op_name(op), (unsigned long long)total.ops[op],
+			       m4_cycles_cost(op), (double)total.ops[op] * m4_cycles_cost(op));
+		}
+	}
+	return 0;
+}
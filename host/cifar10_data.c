@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cifar10_data.h"
+
+static int _map_file(const char* path, cifar10_file_t* file)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size == 0 || (size_t)st.st_size % CIFAR10_RECORD_BYTES != 0) {
+		fprintf(stderr, "%s: size %lld is not a multiple of %d-byte records\n", path,
+		        (long long)st.st_size, CIFAR10_RECORD_BYTES);
+		close(fd);
+		return -1;
+	}
+
+	void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+		return -1;
+	}
+	madvise(base, (size_t)st.st_size, MADV_WILLNEED);
+
+	file->base = base;
+	file->size = (size_t)st.st_size;
+	file->count = file->size / CIFAR10_RECORD_BYTES;
+	return 0;
+}
+
+int cifar10_dataset_open(cifar10_dataset_t* ds, char* const* paths, size_t path_count)
+{
+	memset(ds, 0, sizeof(*ds));
+
+	ds->files = calloc(path_count, sizeof(cifar10_file_t));
+	if (ds->files == NULL) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < path_count; i++) {
+		if (_map_file(paths[i], &ds->files[i]) != 0) {
+			cifar10_dataset_close(ds);
+			return -1;
+		}
+		ds->files[i].first = ds->count;
+		ds->count += ds->files[i].count;
+		ds->file_count++;
+	}
+
+	return 0;
+}
+
+void cifar10_dataset_close(cifar10_dataset_t* ds)
+{
+	for (size_t i = 0; i < ds->file_count; i++) {
+		munmap((void*)ds->files[i].base, ds->files[i].size);
+	}
+	free(ds->files);
+	memset(ds, 0, sizeof(*ds));
+}
+
+const uint8_t* cifar10_dataset_record(const cifar10_dataset_t* ds, size_t index, uint8_t* label)
+{
+	size_t lo = 0, hi = ds->file_count;
+
+	// Binary search for the file holding `index`.
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (ds->files[mid].first <= index) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	const uint8_t* record = ds->files[lo].base + (index - ds->files[lo].first) * CIFAR10_RECORD_BYTES;
+	*label = record[0];
+	return record + 1;
+}
+
+void cifar10_planar_to_hwc(const uint8_t* planar, uint8_t* hwc)
+{
+	const size_t plane = 32 * 32;
+
+	for (size_t i = 0; i < plane; i++) {
+		hwc[3 * i + 0] = planar[i];
+		hwc[3 * i + 1] = planar[plane + i];
+		hwc[3 * i + 2] = planar[2 * plane + i];
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef __CIFAR10_DATA_H
+#define __CIFAR10_DATA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CIFAR-10 binary layout ("data_batch_*.bin"): each record is one label byte
+// followed by a 32x32 red plane, a green plane and a blue plane.
+#define CIFAR10_IMG_BYTES    (32 * 32 * 3)
+#define CIFAR10_RECORD_BYTES (1 + CIFAR10_IMG_BYTES)
+
+typedef struct {
+	const uint8_t* base;
+	size_t size;
+	size_t first; // index of the first record of this file in the dataset
+	size_t count;
+} cifar10_file_t;
+
+typedef struct {
+	cifar10_file_t* files;
+	size_t file_count;
+	size_t count; // total number of records
+} cifar10_dataset_t;
+
+// Memory-map every file read-only. Returns 0 on success, -1 on failure (an
+// error has been printed and nothing is left mapped).
+int cifar10_dataset_open(cifar10_dataset_t* ds, char* const* paths, size_t path_count);
+void cifar10_dataset_close(cifar10_dataset_t* ds);
+
+// Pointer to the planar image of record `index`, label stored in *label.
+const uint8_t* cifar10_dataset_record(const cifar10_dataset_t* ds, size_t index, uint8_t* label);
+
+// Convert the planar (CHW) record layout into the interleaved HWC RGB layout
+// the network and the HL app use.
+void cifar10_planar_to_hwc(const uint8_t* planar, uint8_t* hwc);
+
+#endif
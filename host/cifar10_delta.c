@@ -0,0 +1,182 @@
+// Incremental inference (nn/nn_delta.c) on a synthetic slowly changing scene:
+// every frame is the previous one with a square patch replaced, at a random
+// place. Each frame is checked bit-for-bit against a full nn_run(), and both
+// are costed with the M4 cycle estimator.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "m4_cycles.h"
+#include "testdata.h"
+
+#include "cifar10_data.h"
+
+static const uint8_t test_image[CIFAR10_IMG_BYTES] = IMG_DATA;
+
+typedef struct {
+	unsigned frames;
+	uint8_t full_percent;
+	const cifar10_dataset_t* ds; // patch source, random pixels when NULL
+} delta_config_t;
+
+typedef struct {
+	double delta_cycles, full_cycles;
+	uint32_t full_runs, partial_runs, unchanged_runs;
+	unsigned mismatches;
+} delta_result_t;
+
+static double _count(const m4_counts_t* before)
+{
+	m4_counts_t now;
+	m4_cycles_read(&now);
+	m4_cycles_sub(&now, before);
+	return m4_cycles_estimate(&now);
+}
+
+// Paste a size x size square of a random source image, or of noise, at a
+// random place in `frame`.
+static void _change(const delta_config_t* config, unsigned size, uint8_t* frame)
+{
+	uint8_t source[CIFAR10_IMG_BYTES];
+	const unsigned x0 = (unsigned)rand() % (32 - size + 1);
+	const unsigned y0 = (unsigned)rand() % (32 - size + 1);
+
+	if (config->ds != NULL) {
+		uint8_t label;
+		size_t index = (size_t)rand() % config->ds->count;
+		cifar10_planar_to_hwc(cifar10_dataset_record(config->ds, index, &label), source);
+	} else {
+		for (size_t i = 0; i < sizeof(source); i++) {
+			source[i] = (uint8_t)rand();
+		}
+	}
+	for (unsigned y = y0; y < y0 + size; y++) {
+		memcpy(&frame[(y * 32 + x0) * 3], &source[(y * 32 + x0) * 3], size * 3);
+	}
+}
+
+static void _run(const delta_config_t* config, unsigned size, delta_result_t* r)
+{
+	static nn_context_t ctx, ref_ctx;
+	static nn_delta_t delta;
+	uint8_t frame[CIFAR10_IMG_BYTES], input[CIFAR10_IMG_BYTES];
+	q7_t output[IP1_OUT_DIM], ref_output[IP1_OUT_DIM];
+	m4_counts_t before;
+	const nn_model_t* m = &cifar10_model;
+	uint8_t last = 0;
+
+	ctx.kernels = &m4_cycles_kernels;
+	ref_ctx.kernels = &m4_cycles_kernels;
+	nn_delta_init(&delta, m);
+	delta.full_percent = config->full_percent;
+	// The last kept activation, which the fully connected layer reads
+	for (uint8_t i = 0; i < m->layer_count; i++) {
+		last = (delta.act[i] != NULL) ? i : last;
+	}
+	memset(r, 0, sizeof(*r));
+	memcpy(frame, test_image, sizeof(frame));
+
+	// Frame 0 fills the activations and is not counted.
+	for (unsigned f = 0; f <= config->frames; f++) {
+		if (f > 0) {
+			_change(config, size, frame);
+		}
+
+		memcpy(input, frame, sizeof(input));
+		m4_cycles_read(&before);
+		m4_cycles_mean_subtract((q7_t*)input);
+		nn_delta_run(&delta, &ctx, (q7_t*)input, output);
+		double delta_cycles = _count(&before);
+
+		memcpy(input, frame, sizeof(input));
+		m4_cycles_read(&before);
+		m4_cycles_mean_subtract((q7_t*)input);
+		nn_run(m, &ref_ctx, (q7_t*)input, ref_output);
+		double full_cycles = _count(&before);
+
+		// The last pool output is left in BUF2 of the reference context.
+		const nn_layer_t* l = &m->layers[last];
+		if (memcmp(output, ref_output, sizeof(output)) != 0 ||
+		    memcmp(delta.act[last], ref_ctx.scratch_buffer + 32768, (size_t)l->out_dim * l->out_dim * l->out_ch) != 0) {
+			r->mismatches++;
+		}
+		if (f > 0) {
+			r->delta_cycles += delta_cycles;
+			r->full_cycles += full_cycles;
+		}
+	}
+
+	r->full_runs = delta.full_runs - 1;
+	r->partial_runs = delta.partial_runs;
+	r->unchanged_runs = delta.unchanged_runs;
+}
+
+static void _usage(const char* prog)
+{
+	fprintf(stderr,
+	        "usage: %s [-n frames] [-s sizes] [-p percent] [-S seed] [file.bin]\n"
+	        "  -n N  frames per patch size (default 200)\n"
+	        "  -s L  comma-separated side of the square changed per frame, 0-32 (default 0,1,2,4,8,12,16,24,32)\n"
+	        "  -p P  dirty share of a conv layer from which it is run whole (default %d)\n"
+	        "  -S N  random seed (default 1)\n"
+	        "Patches come from random images of the file, or are noise without one.\n",
+	        prog, NN_DELTA_FULL_PERCENT);
+}
+
+int main(int argc, char* argv[])
+{
+	delta_config_t config = { .frames = 200, .full_percent = NN_DELTA_FULL_PERCENT };
+	const char* sizes = "0,1,2,4,8,12,16,24,32";
+	cifar10_dataset_t ds;
+	unsigned seed = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:p:S:h")) != -1) {
+		switch (opt) {
+		case 'n': config.frames = (unsigned)atoi(optarg); break;
+		case 's': sizes = optarg; break;
+		case 'p': config.full_percent = (uint8_t)atoi(optarg); break;
+		case 'S': seed = (unsigned)atoi(optarg); break;
+		default: _usage(argv[0]); return opt == 'h' ? 0 : 2;
+		}
+	}
+	if (optind < argc) {
+		if (cifar10_dataset_open(&ds, &argv[optind], 1) != 0) {
+			return 1;
+		}
+		config.ds = &ds;
+	}
+
+	unsigned failed = 0;
+	printf("%5s %12s %12s %8s %6s %8s %10s %9s\n", "patch", "delta cyc", "full cyc", "speedup", "full", "partial",
+	       "unchanged", "mismatch");
+	for (const char* s = sizes; *s != '\0';) {
+		char* end;
+		unsigned size = (unsigned)strtoul(s, &end, 10);
+		if (end == s || size > 32) {
+			_usage(argv[0]);
+			return 2;
+		}
+		s = (*end == ',') ? end + 1 : end;
+
+		delta_result_t r;
+		srand(seed);
+		_run(&config, size, &r);
+		double frames = (config.frames > 0) ? config.frames : 1;
+		printf("%5u %12.0f %12.0f %7.2fx %6u %8u %10u %9u\n", size, r.delta_cycles / frames, r.full_cycles / frames,
+		       (r.delta_cycles > 0.0) ? r.full_cycles / r.delta_cycles : 0.0, r.full_runs, r.partial_runs,
+		       r.unchanged_runs, r.mismatches);
+		failed += r.mismatches;
+	}
+
+	if (config.ds != NULL) {
+		cifar10_dataset_close(&ds);
+	}
+	if (failed > 0) {
+		printf("FAILED: %u frames differ from the full run\n", failed);
+		return 1;
+	}
+	return 0;
+}
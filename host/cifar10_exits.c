@@ -0,0 +1,398 @@
+// Early exits of cifar10_model (nn_exit_t): evaluation, and training of their
+// heads. Each head's front end is fixed (an average pool of the trunk's
+// activation, see cifar10_exits in nn/nn.c); its fully connected layer is
+// fitted as cifar10-gate fits the gate's, against the full model's answers.
+//
+// Evaluation runs the trunk once per image with every head, and reports, per
+// margin threshold, how often each exit would be taken, how often the answer
+// agrees with the full model, and the average estimated M4 cycles per frame.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "m4_cycles.h"
+
+#include "cifar10_data.h"
+#include "cifar10_fit.h"
+
+#define CLASSES CIFAR10_CLASSES
+#define MAX_MARGINS 16
+#define MAX_HEAD_LAYERS 8
+
+typedef struct {
+	uint8_t top[NN_MAX_EXITS], margin[NN_MAX_EXITS];
+	uint8_t full_top, label;
+} frame_result_t;
+
+// A copy of a model's exits whose classifiers can be replaced
+typedef struct {
+	nn_exit_t exits[NN_MAX_EXITS];
+	nn_layer_t layers[NN_MAX_EXITS][MAX_HEAD_LAYERS];
+	uint8_t fc[NN_MAX_EXITS];  // index of each head's fully connected layer
+	nn_model_t model;
+} exit_heads_t;
+
+static int _heads_init(exit_heads_t* h, const nn_model_t* model)
+{
+	if (model->exit_count == 0 || model->exit_count > NN_MAX_EXITS) {
+		return -1;
+	}
+	h->model = *model;
+	h->model.exits = h->exits;
+	for (uint8_t e = 0; e < model->exit_count; e++) {
+		const nn_exit_t* x = &model->exits[e];
+		if (x->layer_count > MAX_HEAD_LAYERS) {
+			return -1;
+		}
+		h->exits[e] = *x;
+		h->exits[e].layers = h->layers[e];
+		memcpy(h->layers[e], x->layers, x->layer_count * sizeof(nn_layer_t));
+		h->fc[e] = x->layer_count;
+		for (uint8_t i = 0; i < x->layer_count; i++) {
+			const nn_layer_t* l = &x->layers[i];
+			if (l->type == NN_LAYER_FC && l->out_dim == CLASSES && (l->in_buf == NN_BUF1 || l->in_buf == NN_BUF2)) {
+				h->fc[e] = i;
+				break;
+			}
+		}
+		if (h->fc[e] == x->layer_count) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static q7_t* _buffer(nn_context_t* ctx, uint8_t buf)
+{
+	return (buf == NN_BUF1) ? ctx->scratch_buffer : ctx->scratch_buffer + 32768;
+}
+
+static uint8_t _top(const q7_t* scores)
+{
+	uint16_t top;
+	nn_top_k(scores, CLASSES, 1, &top);
+	return (uint8_t)top;
+}
+
+// Called after each trunk layer and each head, so that the cycle estimate can
+// be split between them.
+typedef void (*step_fn)(void* arg, int exit);
+
+// Run the trunk one layer at a time on a mean-subtracted image, and every head
+// where it attaches. With `features`, the heads stop before their classifier
+// and its input is copied there instead, one row of features per exit.
+static void _run(nn_context_t* ctx, const exit_heads_t* h, q7_t* image, frame_result_t* r, q7_t* const* features,
+                 step_fn step, void* arg)
+{
+	const nn_model_t* m = &h->model;
+	q7_t output[CLASSES];
+
+	for (uint8_t i = 0; i < m->layer_count; i++) {
+		nn_model_t layer = { .layers = &m->layers[i], .layer_count = 1 };
+		nn_run(&layer, ctx, image, output);
+		if (step != NULL) {
+			step(arg, -1);
+		}
+		for (uint8_t e = 0; e < m->exit_count; e++) {
+			nn_exit_t x = m->exits[e];
+			if (x.after != i) {
+				continue;
+			}
+			if (features != NULL) {
+				const nn_layer_t* fc = &x.layers[h->fc[e]];
+				x.layer_count = h->fc[e];
+				nn_run_exit(ctx, &x, image, output);
+				memcpy(features[e], _buffer(ctx, fc->in_buf), fc->in_dim);
+				continue;
+			}
+			nn_run_exit(ctx, &x, image, output);
+			r->top[e] = _top(output);
+			r->margin[e] = nn_margin(output, CLASSES);
+			if (step != NULL) {
+				step(arg, e);
+			}
+		}
+	}
+	r->full_top = _top(output);
+}
+
+static void _load(const cifar10_dataset_t* ds, size_t index, uint8_t* image, uint8_t* label)
+{
+	cifar10_planar_to_hwc(cifar10_dataset_record(ds, index, label), image);
+	mean_subtract((q7_t*)image);
+}
+
+// Estimated cycles of the trunk up to each exit plus the heads run by then,
+// and of the whole model with and without the heads.
+typedef struct {
+	m4_counts_t start;
+	double trunk, heads;
+	double exit[NN_MAX_EXITS];
+} cycle_split_t;
+
+static void _split(void* arg, int exit)
+{
+	cycle_split_t* s = arg;
+	m4_counts_t now;
+	m4_cycles_read(&now);
+	m4_cycles_sub(&now, &s->start);
+	double cycles = m4_cycles_estimate(&now);
+	if (exit < 0) {
+		s->trunk += cycles;
+	} else {
+		s->heads += cycles;
+		s->exit[exit] = s->trunk + s->heads;
+	}
+	m4_cycles_read(&s->start);
+}
+
+static void _evaluate(const cifar10_dataset_t* ds, size_t first, size_t count, const exit_heads_t* h,
+                      const unsigned* margins, int margin_count)
+{
+	static nn_context_t ctx;
+	const uint8_t exits = h->model.exit_count;
+	frame_result_t* results = calloc(count, sizeof(*results));
+	uint8_t image[CIFAR10_IMG_BYTES];
+
+	if (results == NULL || count == 0) {
+		fprintf(stderr, "nothing to evaluate\n");
+		free(results);
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		_load(ds, first + i, image, &results[i].label);
+		_run(&ctx, h, (q7_t*)image, &results[i], NULL, NULL, NULL);
+	}
+
+	// Every layer takes the same time whatever the image, so one estimate does.
+	cycle_split_t split = { .trunk = 0.0 };
+	frame_result_t scratch;
+	uint8_t label;
+	ctx.kernels = &m4_cycles_kernels;
+	_load(ds, first, image, &label);
+	m4_cycles_read(&split.start);
+	_run(&ctx, h, (q7_t*)image, &scratch, NULL, _split, &split);
+	ctx.kernels = NULL;
+
+	size_t full_correct = 0;
+	for (size_t i = 0; i < count; i++) {
+		full_correct += results[i].full_top == results[i].label;
+	}
+	printf("%zu images; full model %.1f%% top-1, %.0f cycles, heads %.0f cycles\n", count,
+	       100.0 * full_correct / count, split.trunk, split.heads);
+	for (uint8_t e = 0; e < exits; e++) {
+		size_t agree = 0, correct = 0;
+		for (size_t i = 0; i < count; i++) {
+			agree += results[i].top[e] == results[i].full_top;
+			correct += results[i].top[e] == results[i].label;
+		}
+		printf("%s after %s: %.0f cycles (%.1f%%), agrees %.1f%%, %.1f%% top-1\n", h->exits[e].name,
+		       h->model.layers[h->exits[e].after].name, split.exit[e], 100.0 * split.exit[e] / split.trunk,
+		       100.0 * agree / count, 100.0 * correct / count);
+	}
+
+	printf("%6s", "margin");
+	for (uint8_t e = 0; e < exits; e++) {
+		printf(" %8s", h->exits[e].name);
+	}
+	printf(" %10s %9s %12s %8s\n", "agreement", "top-1", "cycles", "speedup");
+	for (int m = 0; m < margin_count; m++) {
+		size_t taken[NN_MAX_EXITS] = { 0 }, agree = 0, correct = 0;
+		double cycles = 0.0;
+		for (size_t i = 0; i < count; i++) {
+			const frame_result_t* r = &results[i];
+			uint8_t top = r->full_top;
+			double c = split.trunk + split.heads;
+			for (uint8_t e = 0; e < exits; e++) {
+				if (r->margin[e] >= margins[m]) {
+					taken[e]++;
+					top = r->top[e];
+					c = split.exit[e];
+					break;
+				}
+			}
+			agree += top == r->full_top;
+			correct += top == r->label;
+			cycles += c;
+		}
+		cycles /= count;
+		printf("%6u", margins[m]);
+		for (uint8_t e = 0; e < exits; e++) {
+			printf(" %7.1f%%", 100.0 * taken[e] / count);
+		}
+		printf(" %9.2f%% %8.1f%% %12.0f %7.2fx\n", 100.0 * agree / count, 100.0 * correct / count, cycles,
+		       split.trunk / cycles);
+	}
+	free(results);
+}
+
+static int _write_header(const char* path, const exit_heads_t* h, q7_t* const* wq, q7_t (*bq)[CLASSES],
+                         size_t images)
+{
+	FILE* f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	fprintf(f, "// Early exit classifiers of cifar10_model (see cifar10_exits in nn/nn.c),\n"
+	           "// written by cifar10-exits from a training run. Regenerate with\n"
+	           "//   cifar10-exits -o nn/exit_weights.h data_batch_1.bin ...\n"
+	           "// Trained on %zu images.\n\n"
+	           "#ifndef __EXIT_WEIGHTS_H__\n#define __EXIT_WEIGHTS_H__\n\n"
+	           "#define EXITS_TRAINED 1\n",
+	        images);
+	for (uint8_t e = 0; e < h->model.exit_count; e++) {
+		const nn_layer_t* fc = &h->exits[e].layers[h->fc[e]];
+		char prefix[16];
+		snprintf(prefix, sizeof(prefix), "EXIT%u_FC", e + 1);
+		fprintf(f, "\n");
+		cifar10_write_fc(f, prefix, wq[e], bq[e], fc->in_dim, fc->bias_lshift, fc->out_rshift);
+	}
+	fprintf(f, "\n#endif\n");
+	return fclose(f);
+}
+
+// Train every head on the first 80% of the images, write the header, and
+// evaluate the trained exits on the rest.
+static int _train(const cifar10_dataset_t* ds, size_t count, exit_heads_t* h, bool labels, unsigned epochs,
+                  const char* path, const unsigned* margins, int margin_count)
+{
+	static nn_context_t ctx;
+	const uint8_t exits = h->model.exit_count;
+	const size_t train = count * 4 / 5;
+	uint8_t* targets = malloc(train);
+	q7_t* features[NN_MAX_EXITS] = { NULL };
+	q7_t* wq[NN_MAX_EXITS] = { NULL };
+	q7_t bq[NN_MAX_EXITS][CLASSES];
+	int status = -1;
+
+	if (train == 0 || targets == NULL) {
+		fprintf(stderr, "nothing to train on\n");
+		goto done;
+	}
+	for (uint8_t e = 0; e < exits; e++) {
+		uint16_t n = h->exits[e].layers[h->fc[e]].in_dim;
+		features[e] = malloc(train * n);
+		wq[e] = malloc((size_t)CLASSES * n);
+		if (features[e] == NULL || wq[e] == NULL) {
+			fprintf(stderr, "out of memory\n");
+			goto done;
+		}
+	}
+
+	for (size_t i = 0; i < train; i++) {
+		uint8_t image[CIFAR10_IMG_BYTES], label;
+		q7_t* rows[NN_MAX_EXITS];
+		frame_result_t r;
+		for (uint8_t e = 0; e < exits; e++) {
+			rows[e] = features[e] + i * h->exits[e].layers[h->fc[e]].in_dim;
+		}
+		_load(ds, i, image, &label);
+		_run(&ctx, h, (q7_t*)image, &r, rows, NULL, NULL);
+		targets[i] = labels ? label : r.full_top;
+	}
+
+	for (uint8_t e = 0; e < exits; e++) {
+		nn_layer_t* fc = &h->layers[e][h->fc[e]];
+		float* w = malloc(sizeof(float) * CLASSES * fc->in_dim);
+		float b[CLASSES];
+		if (w == NULL) {
+			fprintf(stderr, "out of memory\n");
+			goto done;
+		}
+		fprintf(stderr, "%s:\n", h->exits[e].name);
+		cifar10_fit(features[e], targets, train, fc->in_dim, epochs, w, b);
+		// The trained head, without rebuilding the library
+		cifar10_quantise(w, b, fc->in_dim, wq[e], bq[e], &fc->bias_lshift, &fc->out_rshift);
+		fc->wt = wq[e];
+		fc->bias = bq[e];
+		free(w);
+	}
+	if (_write_header(path, h, wq, bq, train) != 0) {
+		goto done;
+	}
+	printf("wrote %s; held-out images:\n", path);
+	_evaluate(ds, train, count - train, h, margins, margin_count);
+	status = 0;
+
+done:
+	for (uint8_t e = 0; e < exits; e++) {
+		free(features[e]);
+		free(wq[e]);
+	}
+	free(targets);
+	return status;
+}
+
+static void _usage(const char* prog)
+{
+	fprintf(stderr,
+	        "usage: %s [-o exit_weights.h] [-e epochs] [-l] [-n images] [-m margins] file.bin...\n"
+	        "  -o F  train the exit heads on 80%% of the images, write them to F and\n"
+	        "        evaluate them on the rest; without -o the compiled-in heads are evaluated\n"
+	        "  -e N  training epochs (default 8)\n"
+	        "  -l    train on the dataset labels rather than the full model's answers\n"
+	        "  -n N  use at most N images\n"
+	        "  -m L  comma-separated q7 margins to evaluate, the same for every exit\n"
+	        "        (default 0,8,16,32,48,64,96,128)\n",
+	        prog);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* output = NULL;
+	const char* margin_list = "0,8,16,32,48,64,96,128";
+	unsigned epochs = 8, margins[MAX_MARGINS];
+	size_t limit = 0;
+	bool labels = false;
+	int opt, margin_count = 0;
+
+	while ((opt = getopt(argc, argv, "o:e:ln:m:h")) != -1) {
+		switch (opt) {
+		case 'o': output = optarg; break;
+		case 'e': epochs = (unsigned)atoi(optarg); break;
+		case 'l': labels = true; break;
+		case 'n': limit = strtoul(optarg, NULL, 0); break;
+		case 'm': margin_list = optarg; break;
+		default: _usage(argv[0]); return opt == 'h' ? 0 : 2;
+		}
+	}
+	for (const char* s = margin_list; *s != '\0' && margin_count < MAX_MARGINS;) {
+		char* end;
+		margins[margin_count++] = (unsigned)strtoul(s, &end, 10);
+		if (end == s) {
+			_usage(argv[0]);
+			return 2;
+		}
+		s = (*end == ',') ? end + 1 : end;
+	}
+	if (optind >= argc) {
+		_usage(argv[0]);
+		return 2;
+	}
+
+	static exit_heads_t heads;
+	if (_heads_init(&heads, &cifar10_model) != 0) {
+		fprintf(stderr, "unexpected exits in the model\n");
+		return 1;
+	}
+
+	cifar10_dataset_t ds;
+	if (cifar10_dataset_open(&ds, &argv[optind], (size_t)(argc - optind)) != 0) {
+		return 1;
+	}
+	size_t count = (limit != 0 && limit < ds.count) ? limit : ds.count;
+
+	int status = 0;
+	if (output != NULL) {
+		srand(1);
+		status = _train(&ds, count, &heads, labels, epochs, output, margins, margin_count);
+	} else {
+		_evaluate(&ds, 0, count, &heads, margins, margin_count);
+	}
+	cifar10_dataset_close(&ds);
+	return status == 0 ? 0 : 1;
+}
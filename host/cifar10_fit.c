@@ -0,0 +1,114 @@
+#include "cifar10_fit.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLASSES CIFAR10_CLASSES
+
+void cifar10_fit(const int8_t* features, const uint8_t* targets, size_t count, uint16_t n, unsigned epochs,
+                 float* w, float* b)
+{
+	size_t* order = malloc(count * sizeof(*order));
+	float* x = malloc(n * sizeof(*x));
+	const float l2 = 1e-4f;
+
+	memset(w, 0, sizeof(float) * CLASSES * n);
+	memset(b, 0, sizeof(float) * CLASSES);
+	for (size_t i = 0; i < count; i++) {
+		order[i] = i;
+	}
+
+	for (unsigned e = 0; e < epochs; e++) {
+		const float rate = 0.05f / (1.0f + e);
+		double loss = 0.0;
+		size_t correct = 0;
+
+		for (size_t i = count - 1; i > 0; i--) {
+			size_t j = (size_t)rand() % (i + 1), t = order[i];
+			order[i] = order[j];
+			order[j] = t;
+		}
+		for (size_t s = 0; s < count; s++) {
+			const size_t i = order[s];
+			float z[CLASSES], zmax = -1e30f, sum = 0.0f;
+			uint8_t best = 0;
+
+			for (uint16_t k = 0; k < n; k++) {
+				x[k] = features[i * n + k] / 128.0f;
+			}
+			for (int c = 0; c < CLASSES; c++) {
+				z[c] = b[c];
+				for (uint16_t k = 0; k < n; k++) {
+					z[c] += w[c * n + k] * x[k];
+				}
+				if (z[c] > zmax) {
+					zmax = z[c];
+					best = (uint8_t)c;
+				}
+			}
+			for (int c = 0; c < CLASSES; c++) {
+				z[c] = exp2f(z[c] - zmax);
+				sum += z[c];
+			}
+			loss -= log2(z[targets[i]] / sum);
+			correct += best == targets[i];
+			for (int c = 0; c < CLASSES; c++) {
+				float g = (float)M_LN2 * (z[c] / sum - (c == targets[i] ? 1.0f : 0.0f));
+				for (uint16_t k = 0; k < n; k++) {
+					w[c * n + k] -= rate * (g * x[k] + l2 * w[c * n + k]);
+				}
+				b[c] -= rate * g;
+			}
+		}
+		fprintf(stderr, "epoch %u: loss %.3f bits, %.1f%% of targets\n", e + 1, loss / count, 100.0 * correct / count);
+	}
+	free(order);
+	free(x);
+}
+
+// sum(wq * x) is 2^(shift + 7) times sum(w * x / 128).
+void cifar10_quantise(const float* w, const float* b, uint16_t n, int8_t* wq, int8_t* bq, uint16_t* bias_lshift,
+                      uint16_t* out_rshift)
+{
+	float wmax = 1e-9f, bmax = 1e-9f;
+	int shift = 0;
+
+	for (size_t i = 0; i < (size_t)CLASSES * n; i++) {
+		wmax = fmaxf(wmax, fabsf(w[i]));
+	}
+	for (int c = 0; c < CLASSES; c++) {
+		bmax = fmaxf(bmax, fabsf(b[c]));
+	}
+	while (shift < 16 && wmax * (float)(1 << (shift + 1)) <= 127.0f) {
+		shift++;
+	}
+	int lshift = 0;
+	while (bmax * ldexpf(1.0f, shift + 7 - lshift) > 127.0f) {
+		lshift++;
+	}
+
+	for (size_t i = 0; i < (size_t)CLASSES * n; i++) {
+		wq[i] = (int8_t)lrintf(w[i] * (float)(1 << shift));
+	}
+	for (int c = 0; c < CLASSES; c++) {
+		bq[c] = (int8_t)lrintf(b[c] * ldexpf(1.0f, shift + 7 - lshift));
+	}
+	*bias_lshift = (uint16_t)lshift;
+	*out_rshift = (uint16_t)(shift + 7);
+}
+
+void cifar10_write_fc(FILE* f, const char* prefix, const int8_t* wq, const int8_t* bq, uint16_t n,
+                      uint16_t bias_lshift, uint16_t out_rshift)
+{
+	fprintf(f, "#define %s_BIAS_LSHIFT %u\n#define %s_OUT_RSHIFT %u\n#define %s_WT {", prefix, bias_lshift, prefix,
+	        out_rshift, prefix);
+	for (size_t i = 0; i < (size_t)CLASSES * n; i++) {
+		fprintf(f, "%s%d", i ? "," : "", wq[i]);
+	}
+	fprintf(f, "}\n#define %s_BIAS {", prefix);
+	for (int c = 0; c < CLASSES; c++) {
+		fprintf(f, "%s%d", c ? "," : "", bq[c]);
+	}
+	fprintf(f, "}\n");
+}
@@ -0,0 +1,30 @@
+#ifndef __CIFAR10_FIT_H
+#define __CIFAR10_FIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Fully connected classifiers trained on the host for the RT network's small
+// heads (cifar10-gate, cifar10-exits): softmax regression on q7 features,
+// then quantisation for arm_fully_connected_q7.
+#define CIFAR10_CLASSES 10
+
+// Softmax regression of `targets` on `count` feature vectors of `n` q7 values,
+// scaled to [-1, 1), with the base-2 softmax of arm_softmax_q7 so that the
+// logits need no rescaling. w is CLASSES x n, row-major like the CMSIS-NN
+// weights, and b CLASSES. Progress goes to stderr.
+void cifar10_fit(const int8_t* features, const uint8_t* targets, size_t count, uint16_t n, unsigned epochs,
+                 float* w, float* b);
+
+// q7 weights and bias with the shifts arm_fully_connected_q7 applies, for
+// logits in the units of the float model.
+void cifar10_quantise(const float* w, const float* b, uint16_t n, int8_t* wq, int8_t* bq, uint16_t* bias_lshift,
+                      uint16_t* out_rshift);
+
+// The <prefix>_BIAS_LSHIFT, _OUT_RSHIFT, _WT and _BIAS defines of one layer,
+// as in nn/weights.h.
+void cifar10_write_fc(FILE* f, const char* prefix, const int8_t* wq, const int8_t* bq, uint16_t n,
+                      uint16_t bias_lshift, uint16_t out_rshift);
+
+#endif
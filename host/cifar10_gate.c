@@ -0,0 +1,285 @@
+// Gate model of the cascade (nn_cascade_run): evaluation, and training of its
+// classifier. The gate's front end is fixed (conv1's filters at stride 4 and
+// a pool, see cifar10_gate_model); its fully connected layer is fitted to the
+// features by softmax regression, against the full model's answers so that
+// the gate learns to agree with it, and quantised for arm_fully_connected_q7.
+//
+// Evaluation runs both models on every image and reports, per margin
+// threshold, how many images the gate keeps, how often the cascade agrees
+// with the full model, and the average estimated M4 cycles per frame.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "m4_cycles.h"
+
+#include "cifar10_data.h"
+#include "cifar10_fit.h"
+
+#define CLASSES CIFAR10_CLASSES
+#define MAX_MARGINS 16
+
+typedef struct {
+	uint8_t gate_top, full_top, label, margin;
+} frame_result_t;
+
+// The gate's classifier and what feeds it
+typedef struct {
+	uint8_t fc;  // index of the fully connected layer
+	uint16_t features;
+	q7_t* (*input)(nn_context_t* ctx);
+} gate_shape_t;
+
+static q7_t* _buf1(nn_context_t* ctx) { return ctx->scratch_buffer; }
+static q7_t* _buf2(nn_context_t* ctx) { return ctx->scratch_buffer + 32768; }
+
+static int _gate_shape(const nn_model_t* gate, gate_shape_t* shape)
+{
+	for (uint8_t i = 0; i < gate->layer_count; i++) {
+		const nn_layer_t* l = &gate->layers[i];
+		if (l->type == NN_LAYER_FC) {
+			shape->fc = i;
+			shape->features = l->in_dim;
+			shape->input = (l->in_buf == NN_BUF1) ? _buf1 : _buf2;
+			return (l->out_dim == CLASSES && (l->in_buf == NN_BUF1 || l->in_buf == NN_BUF2)) ? 0 : -1;
+		}
+	}
+	return -1;
+}
+
+static uint8_t _top(const q7_t* scores)
+{
+	uint16_t top;
+	nn_top_k(scores, CLASSES, 1, &top);
+	return (uint8_t)top;
+}
+
+// Run both models on one image.
+static void _classify(nn_context_t* ctx, const nn_model_t* gate, const uint8_t* planar, frame_result_t* r)
+{
+	uint8_t image[CIFAR10_IMG_BYTES];
+	q7_t output[CLASSES];
+
+	cifar10_planar_to_hwc(planar, image);
+	mean_subtract((q7_t*)image);
+	nn_run(&cifar10_model, ctx, (q7_t*)image, output);
+	r->full_top = _top(output);
+	nn_run(gate, ctx, (q7_t*)image, output);
+	r->gate_top = _top(output);
+	r->margin = nn_margin(output, CLASSES);
+}
+
+static double _cycles(nn_context_t* ctx, const nn_model_t* model, const uint8_t* planar)
+{
+	uint8_t image[CIFAR10_IMG_BYTES];
+	q7_t output[CLASSES];
+	m4_counts_t before, after;
+
+	cifar10_planar_to_hwc(planar, image);
+	mean_subtract((q7_t*)image);
+	m4_cycles_read(&before);
+	nn_run(model, ctx, (q7_t*)image, output);
+	m4_cycles_read(&after);
+	m4_cycles_sub(&after, &before);
+	return m4_cycles_estimate(&after);
+}
+
+static void _evaluate(const cifar10_dataset_t* ds, size_t first, size_t count, const nn_model_t* gate,
+                      const unsigned* margins, int margin_count)
+{
+	static nn_context_t ctx;
+	frame_result_t* results = calloc(count, sizeof(*results));
+	uint8_t label;
+
+	if (results == NULL || count == 0) {
+		fprintf(stderr, "nothing to evaluate\n");
+		free(results);
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		_classify(&ctx, gate, cifar10_dataset_record(ds, first + i, &results[i].label), &results[i]);
+	}
+
+	// Both models take the same time whatever the image, so one estimate each does.
+	ctx.kernels = &m4_cycles_kernels;
+	double gate_cycles = _cycles(&ctx, gate, cifar10_dataset_record(ds, first, &label));
+	double full_cycles = _cycles(&ctx, &cifar10_model, cifar10_dataset_record(ds, first, &label));
+	ctx.kernels = NULL;
+
+	size_t full_correct = 0;
+	for (size_t i = 0; i < count; i++) {
+		full_correct += results[i].full_top == results[i].label;
+	}
+	printf("%zu images; full model %.1f%% top-1, %.0f cycles; gate %.0f cycles (%.1f%%)\n", count,
+	       100.0 * full_correct / count, full_cycles, gate_cycles, 100.0 * gate_cycles / full_cycles);
+	printf("%6s %8s %10s %9s %12s %8s\n", "margin", "gated", "agreement", "top-1", "cycles", "speedup");
+
+	for (int m = 0; m < margin_count; m++) {
+		size_t gated = 0, agree = 0, correct = 0;
+		for (size_t i = 0; i < count; i++) {
+			const frame_result_t* r = &results[i];
+			uint8_t top = r->full_top;
+			if (r->margin >= margins[m]) {
+				gated++;
+				top = r->gate_top;
+			}
+			agree += top == r->full_top;
+			correct += top == r->label;
+		}
+		double cycles = gate_cycles + full_cycles * (double)(count - gated) / count;
+		printf("%6u %7.1f%% %9.2f%% %8.1f%% %12.0f %7.2fx\n", margins[m], 100.0 * gated / count,
+		       100.0 * agree / count, 100.0 * correct / count, cycles, full_cycles / cycles);
+	}
+	free(results);
+}
+
+static int _write_header(const char* path, const q7_t* wq, const q7_t* bq, uint16_t n, uint16_t bias_lshift,
+                         uint16_t out_rshift, size_t images)
+{
+	FILE* f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	fprintf(f, "// Gate model classifier (see cifar10_gate_model in nn/nn.c), written by\n"
+	           "// cifar10-gate from a training run. Regenerate with\n"
+	           "//   cifar10-gate -o nn/gate_weights.h data_batch_1.bin ...\n"
+	           "// Trained on %zu images.\n\n"
+	           "#ifndef __GATE_WEIGHTS_H__\n#define __GATE_WEIGHTS_H__\n\n"
+	           "#define GATE_TRAINED 1\n\n",
+	        images);
+	cifar10_write_fc(f, "GATE_FC", wq, bq, n, bias_lshift, out_rshift);
+	fprintf(f, "\n#endif\n");
+	return fclose(f);
+}
+
+// Train on the first 80% of the images, write the header, and evaluate the
+// trained gate on the rest.
+static int _train(const cifar10_dataset_t* ds, size_t count, bool labels, unsigned epochs, const char* path,
+                  const unsigned* margins, int margin_count)
+{
+	static nn_context_t ctx;
+	const nn_model_t* gate = &cifar10_gate_model;
+	gate_shape_t shape;
+
+	if (_gate_shape(gate, &shape) != 0) {
+		fprintf(stderr, "unexpected gate model\n");
+		return -1;
+	}
+
+	const uint16_t n = shape.features;
+	const size_t train = count * 4 / 5;
+	nn_model_t front = { .layers = gate->layers, .layer_count = shape.fc };
+	q7_t* features = malloc(train * n);
+	uint8_t* targets = malloc(train);
+	float* w = malloc(sizeof(float) * CLASSES * n);
+	float b[CLASSES];
+	q7_t* wq = malloc((size_t)CLASSES * n);
+	q7_t bq[CLASSES];
+	uint16_t bias_lshift, out_rshift;
+
+	if (train == 0 || features == NULL || targets == NULL || w == NULL || wq == NULL) {
+		fprintf(stderr, "nothing to train on\n");
+		return -1;
+	}
+
+	for (size_t i = 0; i < train; i++) {
+		uint8_t image[CIFAR10_IMG_BYTES], label;
+		q7_t output[CLASSES];
+		cifar10_planar_to_hwc(cifar10_dataset_record(ds, i, &label), image);
+		mean_subtract((q7_t*)image);
+		nn_run(&cifar10_model, &ctx, (q7_t*)image, output);
+		targets[i] = labels ? label : _top(output);
+		nn_run(&front, &ctx, (q7_t*)image, output);
+		memcpy(&features[i * n], shape.input(&ctx), n);
+	}
+
+	cifar10_fit(features, targets, train, n, epochs, w, b);
+	cifar10_quantise(w, b, n, wq, bq, &bias_lshift, &out_rshift);
+	if (_write_header(path, wq, bq, n, bias_lshift, out_rshift, train) != 0) {
+		return -1;
+	}
+	printf("wrote %s; held-out images:\n", path);
+
+	// The trained gate, without rebuilding the library
+	nn_layer_t layers[16];
+	memcpy(layers, gate->layers, gate->layer_count * sizeof(nn_layer_t));
+	layers[shape.fc].wt = wq;
+	layers[shape.fc].bias = bq;
+	layers[shape.fc].bias_lshift = bias_lshift;
+	layers[shape.fc].out_rshift = out_rshift;
+	nn_model_t trained = { .layers = layers, .layer_count = gate->layer_count };
+	_evaluate(ds, train, count - train, &trained, margins, margin_count);
+
+	free(features);
+	free(targets);
+	free(w);
+	free(wq);
+	return 0;
+}
+
+static void _usage(const char* prog)
+{
+	fprintf(stderr,
+	        "usage: %s [-o gate_weights.h] [-e epochs] [-l] [-n images] [-m margins] file.bin...\n"
+	        "  -o F  train the gate classifier on 80%% of the images, write it to F and\n"
+	        "        evaluate it on the rest; without -o the compiled-in gate is evaluated\n"
+	        "  -e N  training epochs (default 8)\n"
+	        "  -l    train on the dataset labels rather than the full model's answers\n"
+	        "  -n N  use at most N images\n"
+	        "  -m L  comma-separated q7 margins to evaluate (default 0,8,16,32,48,64,96,128)\n",
+	        prog);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* output = NULL;
+	const char* margin_list = "0,8,16,32,48,64,96,128";
+	unsigned epochs = 8, margins[MAX_MARGINS];
+	size_t limit = 0;
+	bool labels = false;
+	int opt, margin_count = 0;
+
+	while ((opt = getopt(argc, argv, "o:e:ln:m:h")) != -1) {
+		switch (opt) {
+		case 'o': output = optarg; break;
+		case 'e': epochs = (unsigned)atoi(optarg); break;
+		case 'l': labels = true; break;
+		case 'n': limit = strtoul(optarg, NULL, 0); break;
+		case 'm': margin_list = optarg; break;
+		default: _usage(argv[0]); return opt == 'h' ? 0 : 2;
+		}
+	}
+	for (const char* s = margin_list; *s != '\0' && margin_count < MAX_MARGINS;) {
+		char* end;
+		margins[margin_count++] = (unsigned)strtoul(s, &end, 10);
+		if (end == s) {
+			_usage(argv[0]);
+			return 2;
+		}
+		s = (*end == ',') ? end + 1 : end;
+	}
+	if (optind >= argc) {
+		_usage(argv[0]);
+		return 2;
+	}
+
+	cifar10_dataset_t ds;
+	if (cifar10_dataset_open(&ds, &argv[optind], (size_t)(argc - optind)) != 0) {
+		return 1;
+	}
+	size_t count = (limit != 0 && limit < ds.count) ? limit : ds.count;
+
+	int status = 0;
+	if (output != NULL) {
+		srand(1);
+		status = _train(&ds, count, labels, epochs, output, margins, margin_count);
+	} else {
+		_evaluate(&ds, 0, count, &cifar10_gate_model, margins, margin_count);
+	}
+	cifar10_dataset_close(&ds);
+	return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+// Single-image latency on the host: conv1 and whole-network time versus the
+// number of threads used by the intra-layer parallel convolution, checked
+// bit-for-bit against the serial CMSIS-NN path.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nn.h"
+#include "testdata.h"
+
+#include "cifar10_data.h"
+#include "nn_parallel.h"
+
+static const uint8_t test_image[CIFAR10_IMG_BYTES] = IMG_DATA;
+
+static double _now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec * 1e-3;
+}
+
+static int _cmp_double(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double _median(double* samples, int n)
+{
+	qsort(samples, (size_t)n, sizeof(double), _cmp_double);
+	return samples[n / 2];
+}
+
+// Median time of conv1 alone, run through the same dispatch as nn_run().
+static double _time_conv1(nn_context_t* ctx, const q7_t* in, q7_t* out, int iterations, double* samples)
+{
+	nn_model_t conv1 = { .layers = &cifar10_model.layers[0], .layer_count = 1 };
+
+	for (int i = 0; i < iterations; i++) {
+		double start = _now_us();
+		nn_run(&conv1, ctx, (q7_t*)in, out);
+		samples[i] = _now_us() - start;
+	}
+	memcpy(out, ctx->scratch_buffer, (size_t)CONV1_OUT_DIM * CONV1_OUT_DIM * CONV1_OUT_CH);
+	return _median(samples, iterations);
+}
+
+static double _time_network(nn_context_t* ctx, const uint8_t* image, q7_t* output, int iterations, double* samples)
+{
+	uint8_t img[CIFAR10_IMG_BYTES];
+
+	for (int i = 0; i < iterations; i++) {
+		memcpy(img, image, sizeof(img));
+		double start = _now_us();
+		run_nn_ctx(ctx, (q7_t*)img, output);
+		samples[i] = _now_us() - start;
+	}
+	return _median(samples, iterations);
+}
+
+static void _usage(const char* prog)
+{
+	fprintf(stderr,
+	        "usage: %s [-t threads] [-n iterations] [file.bin [index]]\n"
+	        "  -t N  largest thread count to try (default: online CPUs)\n"
+	        "  -n N  timed runs per measurement, median reported (default: 200)\n"
+	        "Without a file the built-in test image from nn/testdata.h is used.\n",
+	        prog);
+}
+
+int main(int argc, char* argv[])
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned max_threads = (cpus > 0) ? (unsigned)cpus : 1;
+	int iterations = 200;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:n:h")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			_usage(argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+	if (max_threads == 0 || iterations <= 0) {
+		_usage(argv[0]);
+		return 2;
+	}
+
+	uint8_t image[CIFAR10_IMG_BYTES];
+	memcpy(image, test_image, sizeof(image));
+
+	if (optind < argc) {
+		cifar10_dataset_t ds;
+		size_t index = (optind + 1 < argc) ? strtoul(argv[optind + 1], NULL, 0) : 0;
+		uint8_t label;
+
+		if (cifar10_dataset_open(&ds, &argv[optind], 1) != 0) {
+			return 1;
+		}
+		if (index >= ds.count) {
+			fprintf(stderr, "index %zu out of range (%zu images)\n", index, ds.count);
+			return 1;
+		}
+		cifar10_planar_to_hwc(cifar10_dataset_record(&ds, index, &label), image);
+		cifar10_dataset_close(&ds);
+	}
+
+	static nn_context_t ctx;
+	static q7_t conv1_in[CIFAR10_IMG_BYTES];
+	static q7_t conv1_ref[CONV1_OUT_DIM * CONV1_OUT_DIM * CONV1_OUT_CH];
+	static q7_t conv1_out[CONV1_OUT_DIM * CONV1_OUT_DIM * CONV1_OUT_CH];
+	q7_t output_ref[IP1_OUT_DIM], output[IP1_OUT_DIM];
+	double* samples = malloc((size_t)iterations * sizeof(double));
+	bool identical = true;
+
+	if (samples == NULL) {
+		return 1;
+	}
+
+	// conv1 consumes the mean-subtracted image
+	memcpy(conv1_in, image, sizeof(conv1_in));
+	mean_subtract(conv1_in);
+
+	ctx.conv = NULL;
+	double conv1_serial = _time_conv1(&ctx, conv1_in, conv1_ref, iterations, samples);
+	double net_serial = _time_network(&ctx, image, output_ref, iterations, samples);
+
+	printf("%8s %12s %8s %12s %8s %10s\n", "threads", "conv1 us", "speedup", "network us", "speedup", "identical");
+	printf("%8s %12.1f %7.2fx %12.1f %7.2fx %10s\n", "serial", conv1_serial, 1.0, net_serial, 1.0, "-");
+
+	for (unsigned threads = 1; threads <= max_threads;) {
+		if (nn_parallel_init(threads, &cifar10_model) != 0) {
+			fprintf(stderr, "failed to start %u threads\n", threads);
+			return 1;
+		}
+
+		ctx.conv = nn_parallel_conv;
+		double conv1 = _time_conv1(&ctx, conv1_in, conv1_out, iterations, samples);
+		double net = _time_network(&ctx, image, output, iterations, samples);
+		bool same = memcmp(conv1_out, conv1_ref, sizeof(conv1_ref)) == 0 &&
+		            memcmp(output, output_ref, sizeof(output_ref)) == 0;
+		identical = identical && same;
+
+		printf("%8u %12.1f %7.2fx %12.1f %7.2fx %10s\n", nn_parallel_threads(), conv1, conv1_serial / conv1,
+		       net, net_serial / net, same ? "yes" : "NO");
+		nn_parallel_shutdown();
+
+		if (threads == max_threads) {
+			break;
+		}
+		threads = (threads * 2 > max_threads) ? max_threads : threads * 2;
+	}
+
+	free(samples);
+	if (!identical) {
+		fprintf(stderr, "ERROR: parallel results differ from the serial path\n");
+	}
+	return identical ? 0 : 1;
+}
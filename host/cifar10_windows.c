@@ -0,0 +1,235 @@
+// Sliding-window classification (nn/nn_window.c) of frames larger than the
+// network's input. Each frame is a grid of CIFAR-10 images, or of copies of
+// the test image without a file. The heatmap of nn_window_run() is compared,
+// window by window, with cropping the window and classifying it with
+// nn_run(), and both are costed with the M4 cycle estimator.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "m4_cycles.h"
+#include "testdata.h"
+
+#include "cifar10_data.h"
+
+#define CLASSES IP1_OUT_DIM
+#define MAX_DIM 256
+
+static const uint8_t test_image[CIFAR10_IMG_BYTES] = IMG_DATA;
+
+typedef struct {
+	double shared_cycles, window_cycles;
+	size_t windows;
+	// Windows whose top class matches cropping with run_nn(), and cropping
+	// the mean-subtracted frame, which leaves only the shared borders.
+	size_t agree, agree_same_mean;
+	// Windows lined up with the tiled mean image, and how many of them agree
+	// with cropping.
+	size_t tiled, tiled_agree;
+	// Windows lined up with a grid image, and how many of them each way
+	// classifies as that image's label.
+	size_t aligned, shared_correct, window_correct;
+	unsigned mismatches;  // 32x32 frames only, which must match nn_run() exactly
+} windows_result_t;
+
+static double _count(const m4_counts_t* before)
+{
+	m4_counts_t now;
+	m4_cycles_read(&now);
+	m4_cycles_sub(&now, before);
+	return m4_cycles_estimate(&now);
+}
+
+static uint8_t _top(const q7_t* scores)
+{
+	uint16_t top;
+	nn_top_k(scores, CLASSES, 1, &top);
+	return (uint8_t)top;
+}
+
+// Fill `frame` with a grid of random images, their labels in `labels`.
+static void _compose(const cifar10_dataset_t* ds, uint16_t dim, uint8_t* frame, uint8_t* labels)
+{
+	const unsigned tiles = dim / 32;
+	uint8_t image[CIFAR10_IMG_BYTES];
+
+	for (unsigned ty = 0; ty < tiles; ty++) {
+		for (unsigned tx = 0; tx < tiles; tx++) {
+			if (ds != NULL) {
+				size_t index = (size_t)rand() % ds->count;
+				cifar10_planar_to_hwc(cifar10_dataset_record(ds, index, &labels[ty * tiles + tx]), image);
+			} else {
+				memcpy(image, test_image, sizeof(image));
+				labels[ty * tiles + tx] = 0xFF;
+			}
+			for (unsigned y = 0; y < 32; y++) {
+				memcpy(&frame[((ty * 32 + y) * dim + tx * 32) * 3], &image[y * 32 * 3], 32 * 3);
+			}
+		}
+	}
+}
+
+static void _crop(const uint8_t* frame, uint16_t dim, unsigned x0, unsigned y0, uint8_t* image)
+{
+	for (unsigned y = 0; y < 32; y++) {
+		memcpy(&image[y * 32 * 3], &frame[((y0 + y) * dim + x0) * 3], 32 * 3);
+	}
+}
+
+static int _run(const cifar10_dataset_t* ds, uint16_t dim, unsigned frames, bool print, windows_result_t* r)
+{
+	static nn_context_t ctx;
+	static nn_window_t window;
+	static uint8_t frame[MAX_DIM * MAX_DIM * 3], input[MAX_DIM * MAX_DIM * 3];
+	static q7_t heatmap[MAX_DIM * MAX_DIM / 64 * CLASSES];
+	const nn_model_t* m = &cifar10_model;
+	uint8_t labels[(MAX_DIM / 32) * (MAX_DIM / 32)];
+	m4_counts_t before;
+
+	if (nn_window_init(&window, m, dim) != 0) {
+		fprintf(stderr, "%ux%u frames do not fit the network or the scratch buffer\n", dim, dim);
+		return -1;
+	}
+	ctx.kernels = &m4_cycles_kernels;
+	memset(r, 0, sizeof(*r));
+
+	for (unsigned f = 0; f < frames; f++) {
+		_compose(ds, dim, frame, labels);
+
+		memcpy(input, frame, (size_t)dim * dim * 3);
+		m4_cycles_read(&before);
+		nn_window_mean_subtract((q7_t*)input, dim);
+		nn_window_run(&window, &ctx, (q7_t*)input, heatmap);
+		r->shared_cycles += _count(&before);
+
+		for (unsigned cy = 0; cy < window.cells; cy++) {
+			for (unsigned cx = 0; cx < window.cells; cx++) {
+				const q7_t* cell = &heatmap[(cy * window.cells + cx) * CLASSES];
+				uint8_t image[CIFAR10_IMG_BYTES];
+				q7_t output[CLASSES];
+				const uint8_t top = _top(cell);
+
+				_crop(frame, dim, cx * window.stride, cy * window.stride, image);
+				m4_cycles_read(&before);
+				mean_subtract((q7_t*)image);
+				nn_run(m, &ctx, (q7_t*)image, output);
+				r->window_cycles += _count(&before);
+				const uint8_t window_top = _top(output);
+				r->agree += top == window_top;
+				if (dim == 32 && memcmp(cell, output, CLASSES) != 0) {
+					r->mismatches++;
+				}
+
+				_crop(input, dim, cx * window.stride, cy * window.stride, image);
+				nn_run(m, &ctx, (q7_t*)image, output);
+				r->agree_same_mean += top == _top(output);
+
+				// Grid images, and the tiled mean image, start every 32 pixels.
+				if ((cx * window.stride) % 32 == 0 && (cy * window.stride) % 32 == 0) {
+					r->tiled++;
+					r->tiled_agree += top == window_top;
+					uint8_t label = labels[(cy * window.stride / 32) * (dim / 32) + cx * window.stride / 32];
+					if (label != 0xFF) {
+						r->aligned++;
+						r->shared_correct += top == label;
+						r->window_correct += window_top == label;
+					}
+				}
+			}
+		}
+		r->windows += (size_t)window.cells * window.cells;
+
+		if (print && f == 0) {
+			printf("%ux%u frame, top class of each window (stride %u):\n", dim, dim, window.stride);
+			for (unsigned cy = 0; cy < window.cells; cy++) {
+				printf("  ");
+				for (unsigned cx = 0; cx < window.cells; cx++) {
+					printf("%u", _top(&heatmap[(cy * window.cells + cx) * CLASSES]));
+				}
+				printf("\n");
+			}
+		}
+	}
+	return 0;
+}
+
+static void _usage(const char* prog)
+{
+	fprintf(stderr,
+	        "usage: %s [-d dims] [-n frames] [-p] [-S seed] [file.bin...]\n"
+	        "  -d L  comma-separated frame sides, multiples of 32 (default 32,64,96)\n"
+	        "  -n N  frames per side (default 20)\n"
+	        "  -p    print the top class of every window of the first frame\n"
+	        "  -S N  random seed (default 1)\n"
+	        "Frames are grids of random images of the files, or of the test image without any.\n",
+	        prog);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* dims = "32,64,96";
+	unsigned frames = 20, seed = 1;
+	bool print = false;
+	cifar10_dataset_t ds;
+	const cifar10_dataset_t* source = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:n:pS:h")) != -1) {
+		switch (opt) {
+		case 'd': dims = optarg; break;
+		case 'n': frames = (unsigned)atoi(optarg); break;
+		case 'p': print = true; break;
+		case 'S': seed = (unsigned)atoi(optarg); break;
+		default: _usage(argv[0]); return opt == 'h' ? 0 : 2;
+		}
+	}
+	if (optind < argc) {
+		if (cifar10_dataset_open(&ds, &argv[optind], (size_t)(argc - optind)) != 0) {
+			return 1;
+		}
+		source = &ds;
+	}
+	if (frames == 0) {
+		frames = 1;
+	}
+
+	int status = 0;
+	printf("%5s %8s %12s %12s %8s %9s %10s %9s %9s %9s\n", "frame", "windows", "shared cyc", "per-window", "speedup",
+	       "agreement", "same mean", "on grid", "shared", "cropped");
+	for (const char* s = dims; *s != '\0';) {
+		char* end;
+		unsigned dim = (unsigned)strtoul(s, &end, 10);
+		if (end == s || dim < 32 || dim > MAX_DIM || dim % 32 != 0) {
+			_usage(argv[0]);
+			return 2;
+		}
+		s = (*end == ',') ? end + 1 : end;
+
+		windows_result_t r;
+		srand(seed);
+		if (_run(source, (uint16_t)dim, frames, print, &r) != 0) {
+			status = 1;
+			continue;
+		}
+		printf("%5u %8zu %12.0f %12.0f %7.2fx %8.1f%% %9.1f%% %8.1f%%", dim, r.windows / frames, r.shared_cycles / frames,
+		       r.window_cycles / frames, r.window_cycles / r.shared_cycles, 100.0 * r.agree / r.windows,
+		       100.0 * r.agree_same_mean / r.windows, 100.0 * r.tiled_agree / r.tiled);
+		if (r.aligned > 0) {
+			printf(" %8.1f%% %8.1f%%\n", 100.0 * r.shared_correct / r.aligned, 100.0 * r.window_correct / r.aligned);
+		} else {
+			printf(" %9s %9s\n", "-", "-");
+		}
+		if (r.mismatches > 0) {
+			printf("FAILED: %u 32x32 frames differ from nn_run()\n", r.mismatches);
+			status = 1;
+		}
+	}
+
+	if (source != NULL) {
+		cifar10_dataset_close(&ds);
+	}
+	return status;
+}
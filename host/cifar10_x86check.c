@@ -0,0 +1,381 @@
+// Checks the x86 SIMD kernels against the CMSIS-NN ones (DSP code paths, as
+// on the RT core): random tensors for the CIFAR-10 layer shapes and for odd
+// shapes that exercise the remainder loops, then per-layer timings, and
+// optionally the whole network over CIFAR-10 binary files.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nn.h"
+#include "testdata.h"
+
+#include "cifar10_data.h"
+#include "nn_x86.h"
+
+#define MAX_TENSOR (64 * 64 * 64)
+
+static const uint8_t test_image[CIFAR10_IMG_BYTES] = IMG_DATA;
+
+typedef struct {
+	q7_t in[MAX_TENSOR];
+	q7_t in_copy[MAX_TENSOR];
+	q7_t wt[MAX_TENSOR];
+	q7_t bias[1024];
+	q7_t out_ref[MAX_TENSOR];
+	q7_t out[MAX_TENSOR];
+	q15_t bufferA[2 * MAX_TENSOR];
+} check_buffers_t;
+
+static check_buffers_t buf;
+static unsigned failures;
+
+static double _now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec * 1e-3;
+}
+
+static void _fill(q7_t* p, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		p[i] = (q7_t)(rand() & 0xFF);
+	}
+}
+
+static void _compare(const nn_kernels_t* k, const char* what, size_t n)
+{
+	if (memcmp(buf.out_ref, buf.out, n) != 0) {
+		size_t i = 0;
+		while (buf.out_ref[i] == buf.out[i]) {
+			i++;
+		}
+		printf("  FAIL %-8s %-40s byte %zu: cmsis %d, %s %d\n", k->name, what, i, buf.out_ref[i], k->name, buf.out[i]);
+		failures++;
+	}
+}
+
+typedef struct {
+	uint16_t in_x, in_y, ch_in, ch_out, k_x, k_y, pad_x, pad_y, stride_x, stride_y;
+} conv_shape_t;
+
+static uint16_t _out_dim(uint16_t in, uint16_t k, uint16_t pad, uint16_t stride)
+{
+	return (uint16_t)((in + 2 * pad - k) / stride + 1);
+}
+
+static void _check_conv(const nn_kernels_t* k, const conv_shape_t* s)
+{
+	const uint16_t out_x = _out_dim(s->in_x, s->k_x, s->pad_x, s->stride_x);
+	const uint16_t out_y = _out_dim(s->in_y, s->k_y, s->pad_y, s->stride_y);
+	const size_t out_n = (size_t)out_x * out_y * s->ch_out;
+	const bool square = s->in_x == s->in_y && s->k_x == s->k_y && s->pad_x == s->pad_y && s->stride_x == s->stride_y;
+	const bool fast = s->ch_in % 4 == 0 && s->ch_out % 2 == 0;
+	const uint16_t bias_shift = (uint16_t)(rand() % 7);
+	const uint16_t out_shift = (uint16_t)(1 + rand() % 10);
+	char what[96];
+
+	_fill(buf.in, (size_t)s->in_x * s->in_y * s->ch_in);
+	_fill(buf.wt, (size_t)s->ch_out * s->ch_in * s->k_x * s->k_y);
+	_fill(buf.bias, s->ch_out);
+	snprintf(what, sizeof(what), "conv %ux%ux%u->%u k%ux%u p%u,%u s%u,%u", s->in_x, s->in_y, s->ch_in, s->ch_out,
+	         s->k_x, s->k_y, s->pad_x, s->pad_y, s->stride_x, s->stride_y);
+
+#define CONV_NONSQUARE(fn, out)                                                                                        \
+	fn(buf.in, s->in_x, s->in_y, s->ch_in, buf.wt, s->ch_out, s->k_x, s->k_y, s->pad_x, s->pad_y, s->stride_x,       \
+	   s->stride_y, buf.bias, bias_shift, out_shift, out, out_x, out_y, buf.bufferA, NULL)
+#define CONV_SQUARE(fn, out)                                                                                           \
+	fn(buf.in, s->in_x, s->ch_in, buf.wt, s->ch_out, s->k_x, s->pad_x, s->stride_x, buf.bias, bias_shift, out_shift, \
+	   out, out_x, buf.bufferA, NULL)
+
+	CONV_NONSQUARE(nn_cmsis_kernels.conv_basic_nonsquare, buf.out_ref);
+	CONV_NONSQUARE(k->conv_basic_nonsquare, buf.out);
+	_compare(k, what, out_n);
+	if (fast) {
+		CONV_NONSQUARE(k->conv_fast_nonsquare, buf.out);
+		_compare(k, what, out_n);
+	}
+	if (fast && s->k_x == 1 && s->k_y == 1 && s->pad_x == 0 && s->pad_y == 0 && s->stride_x == 1 && s->stride_y == 1) {
+		CONV_NONSQUARE(k->conv_1x1, buf.out);
+		_compare(k, what, out_n);
+	}
+	if (square) {
+		CONV_SQUARE(k->conv_basic, buf.out);
+		_compare(k, what, out_n);
+		if (fast) {
+			CONV_SQUARE(k->conv_fast, buf.out);
+			_compare(k, what, out_n);
+		}
+		if (s->ch_in == 3) {
+			CONV_SQUARE(k->conv_rgb, buf.out);
+			_compare(k, what, out_n);
+		}
+	}
+#undef CONV_SQUARE
+#undef CONV_NONSQUARE
+}
+
+static void _check_pool(const nn_kernels_t* k, bool ave, uint16_t dim, uint16_t ch, uint16_t ker, uint16_t pad,
+                        uint16_t stride)
+{
+	const uint16_t out_dim = _out_dim(dim, ker, pad, stride);
+	const size_t in_n = (size_t)dim * dim * ch;
+	char what[96];
+
+	snprintf(what, sizeof(what), "%s %ux%u->%u k%u p%u s%u", ave ? "avepool" : "maxpool", dim, ch, out_dim, ker, pad,
+	         stride);
+	_fill(buf.in_copy, in_n);
+
+	memcpy(buf.in, buf.in_copy, in_n);
+	(ave ? nn_cmsis_kernels.avepool : nn_cmsis_kernels.maxpool)(buf.in, dim, ch, ker, pad, stride, out_dim,
+	                                                            (q7_t*)buf.bufferA, buf.out_ref);
+	memcpy(buf.in, buf.in_copy, in_n);
+	(ave ? k->avepool : k->maxpool)(buf.in, dim, ch, ker, pad, stride, out_dim, (q7_t*)buf.bufferA, buf.out);
+	_compare(k, what, (size_t)out_dim * out_dim * ch);
+}
+
+static void _check_fc(const nn_kernels_t* k, uint16_t dim_vec, uint16_t rows)
+{
+	const uint16_t bias_shift = (uint16_t)(rand() % 7);
+	const uint16_t out_shift = (uint16_t)(1 + rand() % 10);
+	char what[96];
+
+	snprintf(what, sizeof(what), "fc %u->%u", dim_vec, rows);
+	_fill(buf.in, dim_vec);
+	_fill(buf.wt, (size_t)dim_vec * rows);
+	_fill(buf.bias, rows);
+	nn_cmsis_kernels.fc_opt(buf.in, buf.wt, dim_vec, rows, bias_shift, out_shift, buf.bias, buf.out_ref, buf.bufferA);
+	k->fc_opt(buf.in, buf.wt, dim_vec, rows, bias_shift, out_shift, buf.bias, buf.out, buf.bufferA);
+	_compare(k, what, rows);
+}
+
+static void _check_relu(const nn_kernels_t* k, uint16_t size)
+{
+	char what[96];
+
+	snprintf(what, sizeof(what), "relu %u", size);
+	_fill(buf.out_ref, size);
+	memcpy(buf.out, buf.out_ref, size);
+	nn_cmsis_kernels.relu(buf.out_ref, size);
+	k->relu(buf.out, size);
+	_compare(k, what, size);
+}
+
+static void _check_softmax(const nn_kernels_t* k, uint16_t dim, int spread)
+{
+	char what[96];
+
+	snprintf(what, sizeof(what), "softmax %u spread %d", dim, spread);
+	for (uint16_t i = 0; i < dim; i++) {
+		buf.in[i] = (q7_t)(rand() % (2 * spread + 1) - spread);
+	}
+	nn_cmsis_kernels.softmax(buf.in, dim, buf.out_ref);
+	k->softmax(buf.in, dim, buf.out);
+	_compare(k, what, dim);
+}
+
+static void _check_kernels(const nn_kernels_t* k, int rounds)
+{
+	static const conv_shape_t conv_shapes[] = {
+		// the CIFAR-10 layers
+		{ CONV1_IN_DIM, CONV1_IN_DIM, CONV1_IN_CH, CONV1_OUT_CH, CONV1_KER_DIM, CONV1_KER_DIM, CONV1_PAD, CONV1_PAD, CONV1_STRIDE, CONV1_STRIDE },
+		{ CONV2_IN_DIM, CONV2_IN_DIM, CONV2_IN_CH, CONV2_OUT_CH, CONV2_KER_DIM, CONV2_KER_DIM, CONV2_PAD, CONV2_PAD, CONV2_STRIDE, CONV2_STRIDE },
+		{ CONV3_IN_DIM, CONV3_IN_DIM, CONV3_IN_CH, CONV3_OUT_CH, CONV3_KER_DIM, CONV3_KER_DIM, CONV3_PAD, CONV3_PAD, CONV3_STRIDE, CONV3_STRIDE },
+		// remainders, strides and non-square geometry
+		{ 7, 7, 3, 5, 3, 3, 1, 1, 2, 2 },
+		{ 9, 5, 5, 7, 3, 2, 1, 0, 1, 2 },
+		{ 11, 6, 8, 6, 1, 1, 0, 0, 1, 1 },
+		{ 6, 10, 12, 2, 5, 3, 2, 1, 2, 1 },
+		{ 13, 13, 4, 64, 7, 7, 3, 3, 3, 3 },
+	};
+
+	for (int r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < sizeof(conv_shapes) / sizeof(conv_shapes[0]); i++) {
+			_check_conv(k, &conv_shapes[i]);
+		}
+		_check_pool(k, false, POOL1_IN_DIM, POOL1_IN_CH, POOL1_KER_DIM, POOL1_PAD, POOL1_STRIDE);
+		_check_pool(k, true, POOL2_IN_DIM, POOL2_IN_CH, POOL2_KER_DIM, POOL2_PAD, POOL2_STRIDE);
+		_check_pool(k, true, POOL3_IN_DIM, POOL3_IN_CH, POOL3_KER_DIM, POOL3_PAD, POOL3_STRIDE);
+		_check_pool(k, false, 15, 7, 3, 1, 2);
+		_check_pool(k, true, 15, 7, 3, 1, 2);
+		_check_pool(k, true, 20, 33, 5, 2, 3);
+		_check_fc(k, IP1_IN_DIM, IP1_OUT_DIM);
+		_check_fc(k, 37, 13);
+		_check_fc(k, 20, 6);
+		_check_fc(k, 3, 2);
+		_check_relu(k, CONV1_OUT_DIM * CONV1_OUT_DIM * CONV1_OUT_CH);
+		_check_relu(k, 67);
+		_check_softmax(k, IP1_OUT_DIM, 128);
+		_check_softmax(k, 37, 10);
+		_check_softmax(k, 7, 3);
+	}
+}
+
+// Median time of each CIFAR-10 layer with kernel set k, on the activations of
+// the test image.
+static void _time_layers(const nn_kernels_t* k, nn_context_t* ctx, int iterations, double* us)
+{
+	const nn_model_t* m = &cifar10_model;
+	double* samples = malloc((size_t)iterations * sizeof(double));
+	q7_t img[CIFAR10_IMG_BYTES];
+	q7_t output[IP1_OUT_DIM];
+
+	ctx->kernels = k;
+	memcpy(img, test_image, sizeof(img));
+	mean_subtract(img);
+
+	for (uint8_t i = 0; i < m->layer_count; i++) {
+		nn_model_t prefix = { .layers = m->layers, .layer_count = i };
+		nn_model_t layer = { .layers = &m->layers[i], .layer_count = 1 };
+
+		for (int n = 0; n < iterations; n++) {
+			// pooling is input-destructive, so rebuild the layer input every time
+			nn_run(&prefix, ctx, img, output);
+			double start = _now_us();
+			nn_run(&layer, ctx, img, output);
+			samples[n] = _now_us() - start;
+		}
+		for (int a = 1; a < iterations; a++) {
+			for (int b = a; b > 0 && samples[b - 1] > samples[b]; b--) {
+				double t = samples[b];
+				samples[b] = samples[b - 1];
+				samples[b - 1] = t;
+			}
+		}
+		us[i] = samples[iterations / 2];
+	}
+	free(samples);
+}
+
+static bool _check_dataset(const nn_kernels_t* k, nn_context_t* ref_ctx, nn_context_t* ctx, char** files, size_t n)
+{
+	cifar10_dataset_t ds;
+	uint8_t img[CIFAR10_IMG_BYTES];
+	q7_t out_ref[IP1_OUT_DIM], out[IP1_OUT_DIM];
+	size_t mismatches = 0;
+
+	if (cifar10_dataset_open(&ds, files, n) != 0) {
+		return false;
+	}
+	ref_ctx->kernels = &nn_cmsis_kernels;
+	ctx->kernels = k;
+	for (size_t i = 0; i < ds.count; i++) {
+		uint8_t label;
+		cifar10_planar_to_hwc(cifar10_dataset_record(&ds, i, &label), img);
+		run_nn_ctx(ref_ctx, (q7_t*)img, out_ref);
+		cifar10_planar_to_hwc(cifar10_dataset_record(&ds, i, &label), img);
+		run_nn_ctx(ctx, (q7_t*)img, out);
+		mismatches += (memcmp(out_ref, out, sizeof(out)) != 0);
+	}
+	printf("%s: %zu/%zu images with different network output\n", k->name, mismatches, ds.count);
+	cifar10_dataset_close(&ds);
+	return mismatches == 0;
+}
+
+static void _usage(const char* prog)
+{
+	fprintf(stderr,
+	        "usage: %s [-r rounds] [-n iterations] [file.bin...]\n"
+	        "  -r N  random test rounds per kernel set (default: 20)\n"
+	        "  -n N  timing iterations per layer (default: 200)\n"
+	        "  files: also compare the whole network over these CIFAR-10 files\n",
+	        prog);
+}
+
+int main(int argc, char* argv[])
+{
+	int rounds = 20;
+	int iterations = 200;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:n:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			_usage(argv[0]);
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+	if (rounds < 0 || iterations < 1) {
+		_usage(argv[0]);
+		return 2;
+	}
+
+	const nn_kernels_t* sets[] = { nn_x86_kernels_sse41(), nn_x86_kernels_avx2() };
+	const size_t set_count = sizeof(sets) / sizeof(sets[0]);
+	nn_context_t* ref_ctx = calloc(1, sizeof(nn_context_t));
+	nn_context_t* ctx = calloc(1, sizeof(nn_context_t));
+	if (ref_ctx == NULL || ctx == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	srand(1);
+	for (size_t s = 0; s < set_count; s++) {
+		if (sets[s] == NULL) {
+			printf("%s kernels: not supported by this CPU\n", s == 0 ? "x86-sse4.1" : "x86-avx2");
+			continue;
+		}
+		unsigned before = failures;
+		_check_kernels(sets[s], rounds);
+		printf("%s kernels: %s\n", sets[s]->name, failures == before ? "bit-exact" : "MISMATCH");
+	}
+
+	const nn_model_t* m = &cifar10_model;
+	double ref_us[16], us[2][16];
+	_time_layers(&nn_cmsis_kernels, ref_ctx, iterations, ref_us);
+	for (size_t s = 0; s < set_count; s++) {
+		if (sets[s] != NULL) {
+			_time_layers(sets[s], ctx, iterations, us[s]);
+		}
+	}
+
+	printf("\n%-8s %10s", "layer", "cmsis us");
+	for (size_t s = 0; s < set_count; s++) {
+		if (sets[s] != NULL) {
+			printf(" %12s %8s", sets[s]->name, "speedup");
+		}
+	}
+	printf("\n");
+	double ref_total = 0.0, total[2] = { 0.0, 0.0 };
+	for (uint8_t i = 0; i < m->layer_count; i++) {
+		ref_total += ref_us[i];
+		printf("%-8s %10.1f", m->layers[i].name, ref_us[i]);
+		for (size_t s = 0; s < set_count; s++) {
+			if (sets[s] != NULL) {
+				total[s] += us[s][i];
+				printf(" %12.1f %7.2fx", us[s][i], ref_us[i] / us[s][i]);
+			}
+		}
+		printf("\n");
+	}
+	printf("%-8s %10.1f", "total", ref_total);
+	for (size_t s = 0; s < set_count; s++) {
+		if (sets[s] != NULL) {
+			printf(" %12.1f %7.2fx", total[s], ref_total / total[s]);
+		}
+	}
+	printf("\n");
+
+	bool ok = failures == 0;
+	if (optind < argc) {
+		for (size_t s = 0; s < set_count; s++) {
+			if (sets[s] != NULL) {
+				ok &= _check_dataset(sets[s], ref_ctx, ctx, &argv[optind], (size_t)(argc - optind));
+			}
+		}
+	}
+
+	free(ctx);
+	free(ref_ctx);
+	return ok ? 0 : 1;
+}
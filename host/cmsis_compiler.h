@@ -0,0 +1,235 @@
+/*
+ * Host (x86/Linux) stand-in for cmsis_compiler.h.
+ *
+ * The host build defines ARM_MATH_DSP so that CMSIS-NN compiles exactly the
+ * same SIMD code paths as the Cortex-M4F firmware. On ARM those paths use the
+ * DSP intrinsics from cmsis_gcc.h; here they are provided as plain C
+ * emulations with identical (bit-exact) semantics. This header is found ahead
+ * of CMSIS/Core/Include because host/ comes first on the include path.
+ */
+
+#ifndef HOST_CMSIS_COMPILER_H
+#define HOST_CMSIS_COMPILER_H
+
+#include_next "cmsis_compiler.h"
+
+#if defined(ARM_MATH_DSP) && !(defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1))
+
+#include <stdint.h>
+
+static inline int32_t __host_ssat(int32_t val, uint32_t sat)
+{
+	const int32_t max = (int32_t)((1U << (sat - 1U)) - 1U);
+	const int32_t min = -1 - max;
+	return (val > max) ? max : ((val < min) ? min : val);
+}
+
+static inline int32_t __host_lo16(uint32_t x) { return (int16_t)(x & 0xFFFFU); }
+static inline int32_t __host_hi16(uint32_t x) { return (int16_t)(x >> 16); }
+static inline int32_t __host_byte(uint32_t x, int n) { return (int8_t)((x >> (8 * n)) & 0xFFU); }
+
+static inline uint32_t __host_pack16(int32_t lo, int32_t hi)
+{
+	return ((uint32_t)hi << 16) | ((uint32_t)lo & 0xFFFFU);
+}
+
+// Instruction counting for the M4 cycle estimator (host/m4_cycles.h), a no-op
+// unless the translation unit is built with HOST_CYCLE_COUNT.
+#ifndef HOST_DSP_COUNT
+#define HOST_DSP_COUNT(op) ((void)0)
+#endif
+
+__STATIC_FORCEINLINE uint32_t __QADD8(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SIMD_ADD);
+	uint32_t r = 0;
+	for (int n = 0; n < 4; n++) {
+		r |= ((uint32_t)__host_ssat(__host_byte(x, n) + __host_byte(y, n), 8) & 0xFFU) << (8 * n);
+	}
+	return r;
+}
+
+__STATIC_FORCEINLINE uint32_t __QSUB8(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SIMD_ADD);
+	uint32_t r = 0;
+	for (int n = 0; n < 4; n++) {
+		r |= ((uint32_t)__host_ssat(__host_byte(x, n) - __host_byte(y, n), 8) & 0xFFU) << (8 * n);
+	}
+	return r;
+}
+
+__STATIC_FORCEINLINE uint32_t __QADD16(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SIMD_ADD);
+	return __host_pack16(__host_ssat(__host_lo16(x) + __host_lo16(y), 16),
+	                     __host_ssat(__host_hi16(x) + __host_hi16(y), 16));
+}
+
+__STATIC_FORCEINLINE uint32_t __QSUB16(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SIMD_ADD);
+	return __host_pack16(__host_ssat(__host_lo16(x) - __host_lo16(y), 16),
+	                     __host_ssat(__host_hi16(x) - __host_hi16(y), 16));
+}
+
+__STATIC_FORCEINLINE uint32_t __SHADD16(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SIMD_ADD);
+	return __host_pack16((__host_lo16(x) + __host_lo16(y)) >> 1, (__host_hi16(x) + __host_hi16(y)) >> 1);
+}
+
+__STATIC_FORCEINLINE uint32_t __SHSUB16(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SIMD_ADD);
+	return __host_pack16((__host_lo16(x) - __host_lo16(y)) >> 1, (__host_hi16(x) - __host_hi16(y)) >> 1);
+}
+
+__STATIC_FORCEINLINE uint32_t __QASX(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SIMD_ADD);
+	return __host_pack16(__host_ssat(__host_lo16(x) - __host_hi16(y), 16),
+	                     __host_ssat(__host_hi16(x) + __host_lo16(y), 16));
+}
+
+__STATIC_FORCEINLINE uint32_t __SHASX(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SIMD_ADD);
+	return __host_pack16((__host_lo16(x) - __host_hi16(y)) >> 1, (__host_hi16(x) + __host_lo16(y)) >> 1);
+}
+
+__STATIC_FORCEINLINE uint32_t __QSAX(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SIMD_ADD);
+	return __host_pack16(__host_ssat(__host_lo16(x) + __host_hi16(y), 16),
+	                     __host_ssat(__host_hi16(x) - __host_lo16(y), 16));
+}
+
+__STATIC_FORCEINLINE uint32_t __SHSAX(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SIMD_ADD);
+	return __host_pack16((__host_lo16(x) + __host_hi16(y)) >> 1, (__host_hi16(x) - __host_lo16(y)) >> 1);
+}
+
+__STATIC_FORCEINLINE int32_t __QADD(int32_t x, int32_t y)
+{
+	HOST_DSP_COUNT(QADD);
+	int64_t r = (int64_t)x + y;
+	return (r > INT32_MAX) ? INT32_MAX : ((r < INT32_MIN) ? INT32_MIN : (int32_t)r);
+}
+
+__STATIC_FORCEINLINE int32_t __QSUB(int32_t x, int32_t y)
+{
+	HOST_DSP_COUNT(QADD);
+	int64_t r = (int64_t)x - y;
+	return (r > INT32_MAX) ? INT32_MAX : ((r < INT32_MIN) ? INT32_MIN : (int32_t)r);
+}
+
+// The multiply-accumulate forms wrap modulo 2^32 like the hardware (which
+// only sets the Q flag on overflow), so accumulate in uint32_t.
+static inline uint32_t __host_smuad(uint32_t x, uint32_t y)
+{
+	return (uint32_t)(__host_lo16(x) * __host_lo16(y)) + (uint32_t)(__host_hi16(x) * __host_hi16(y));
+}
+
+static inline uint32_t __host_smuadx(uint32_t x, uint32_t y)
+{
+	return (uint32_t)(__host_lo16(x) * __host_hi16(y)) + (uint32_t)(__host_hi16(x) * __host_lo16(y));
+}
+
+static inline uint32_t __host_smusdx(uint32_t x, uint32_t y)
+{
+	return (uint32_t)(__host_lo16(x) * __host_hi16(y)) - (uint32_t)(__host_hi16(x) * __host_lo16(y));
+}
+
+__STATIC_FORCEINLINE uint32_t __SMUAD(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SMUAD);
+	return __host_smuad(x, y);
+}
+
+__STATIC_FORCEINLINE uint32_t __SMUADX(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SMUAD);
+	return __host_smuadx(x, y);
+}
+
+__STATIC_FORCEINLINE uint32_t __SMUSD(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SMUAD);
+	return (uint32_t)(__host_lo16(x) * __host_lo16(y)) - (uint32_t)(__host_hi16(x) * __host_hi16(y));
+}
+
+__STATIC_FORCEINLINE uint32_t __SMUSDX(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SMUAD);
+	return __host_smusdx(x, y);
+}
+
+__STATIC_FORCEINLINE uint32_t __SMLAD(uint32_t x, uint32_t y, uint32_t sum)
+{
+	HOST_DSP_COUNT(SMLAD);
+	return sum + __host_smuad(x, y);
+}
+
+__STATIC_FORCEINLINE uint32_t __SMLADX(uint32_t x, uint32_t y, uint32_t sum)
+{
+	HOST_DSP_COUNT(SMLAD);
+	return sum + __host_smuadx(x, y);
+}
+
+__STATIC_FORCEINLINE uint32_t __SMLSDX(uint32_t x, uint32_t y, uint32_t sum)
+{
+	HOST_DSP_COUNT(SMLAD);
+	return sum + __host_smusdx(x, y);
+}
+
+__STATIC_FORCEINLINE uint64_t __SMLALD(uint32_t x, uint32_t y, uint64_t sum)
+{
+	HOST_DSP_COUNT(SMLALD);
+	return sum + (uint64_t)((int64_t)__host_lo16(x) * __host_lo16(y) + (int64_t)__host_hi16(x) * __host_hi16(y));
+}
+
+__STATIC_FORCEINLINE uint64_t __SMLALDX(uint32_t x, uint32_t y, uint64_t sum)
+{
+	HOST_DSP_COUNT(SMLALD);
+	return sum + (uint64_t)((int64_t)__host_lo16(x) * __host_hi16(y) + (int64_t)__host_hi16(x) * __host_lo16(y));
+}
+
+__STATIC_FORCEINLINE int32_t __SMMLA(int32_t x, int32_t y, int32_t sum)
+{
+	HOST_DSP_COUNT(SMMLA);
+	return (int32_t)((int64_t)(((uint64_t)(int64_t)sum << 32) + (uint64_t)((int64_t)x * y)) >> 32);
+}
+
+__STATIC_FORCEINLINE uint32_t __SXTB16(uint32_t x)
+{
+	HOST_DSP_COUNT(SXTB16);
+	return __host_pack16(__host_byte(x, 0), __host_byte(x, 2));
+}
+
+__STATIC_FORCEINLINE uint32_t __SXTAB16(uint32_t x, uint32_t y)
+{
+	HOST_DSP_COUNT(SXTB16);
+	return __host_pack16(__host_lo16(x) + __host_byte(y, 0), __host_hi16(x) + __host_byte(y, 2));
+}
+
+#define __PKHBT(ARG1, ARG2, ARG3) ( HOST_DSP_COUNT(PKH),                                \
+                                    ((((uint32_t)(ARG1))          ) & 0x0000FFFFUL) | \
+                                    ((((uint32_t)(ARG2)) << (ARG3)) & 0xFFFF0000UL) )
+
+#define __PKHTB(ARG1, ARG2, ARG3) ( HOST_DSP_COUNT(PKH),                                \
+                                    ((((uint32_t)(ARG1))          ) & 0xFFFF0000UL) | \
+                                    ((((uint32_t)(ARG2)) >> (ARG3)) & 0x0000FFFFUL) )
+
+#ifdef HOST_CYCLE_COUNT
+// cmsis_gcc.h already provides portable C versions of these; wrap them so
+// they are counted too. A macro does not expand inside its own definition.
+#define __SSAT(ARG1, ARG2) (HOST_DSP_COUNT(SAT), __SSAT((ARG1), (ARG2)))
+#define __USAT(ARG1, ARG2) (HOST_DSP_COUNT(SAT), __USAT((ARG1), (ARG2)))
+#define __ROR(ARG1, ARG2) (HOST_DSP_COUNT(ROR), __ROR((ARG1), (ARG2)))
+#endif
+
+#endif /* ARM_MATH_DSP on a non-DSP host */
+
+#endif /* HOST_CMSIS_COMPILER_H */
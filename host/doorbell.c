@@ -0,0 +1,77 @@
+#include <errno.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "doorbell.h"
+
+static long _futex(uint32_t* addr, int op, uint32_t val, const struct timespec* timeout)
+{
+	// Not FUTEX_PRIVATE_FLAG: the doorbell may be in a mapping shared with another process.
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+void doorbell_init(doorbell_t* db)
+{
+	memset(db, 0, sizeof(*db));
+}
+
+void doorbell_ring(doorbell_t* db)
+{
+	__atomic_add_fetch(&db->seq, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&db->rings, 1, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&db->waiters, __ATOMIC_SEQ_CST) != 0) {
+		_futex(&db->seq, FUTEX_WAKE, 1, NULL);
+	}
+}
+
+uint32_t doorbell_read(const doorbell_t* db)
+{
+	return __atomic_load_n(&db->seq, __ATOMIC_ACQUIRE);
+}
+
+int doorbell_wait(doorbell_t* db, uint32_t seen, int64_t timeout_ns)
+{
+	struct timespec deadline, ts, *tsp = NULL;
+
+	if (timeout_ns >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ns / 1000000000;
+		deadline.tv_nsec += timeout_ns % 1000000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	// The waiter count is raised before the counter is re-checked, so a ring
+	// either sees it and wakes us or happened early enough for the check.
+	__atomic_add_fetch(&db->waiters, 1, __ATOMIC_SEQ_CST);
+	int ret = 0;
+	while (__atomic_load_n(&db->seq, __ATOMIC_SEQ_CST) == seen) {
+		if (timeout_ns >= 0) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			int64_t left = (int64_t)(deadline.tv_sec - now.tv_sec) * 1000000000 + (deadline.tv_nsec - now.tv_nsec);
+			if (left <= 0) {
+				ret = -1;
+				break;
+			}
+			ts.tv_sec = left / 1000000000;
+			ts.tv_nsec = left % 1000000000;
+			tsp = &ts;
+		}
+		if (_futex(&db->seq, FUTEX_WAIT, seen, tsp) == -1 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+			ret = -1;
+			break;
+		}
+	}
+	__atomic_sub_fetch(&db->waiters, 1, __ATOMIC_SEQ_CST);
+
+	if (ret == 0) {
+		__atomic_add_fetch(&db->wakes, 1, __ATOMIC_RELAXED);
+	}
+	return ret;
+}
@@ -0,0 +1,39 @@
+#ifndef __DOORBELL_H
+#define __DOORBELL_H
+
+#include <stdint.h>
+
+// Host counterpart of the mailbox interrupt and WFI used by the RT core
+// (WaitForRequest in main.c). A doorbell is a counter that the producer bumps
+// after publishing data; the consumer sleeps on a futex until it changes.
+// It may live in memory shared between processes.
+//
+// Consumer, mirroring the firmware's check-then-sleep under PRIMASK:
+//     for (;;) {
+//         uint32_t seen = doorbell_read(db);
+//         while (ring has data) handle it;
+//         doorbell_wait(db, seen, -1);
+//     }
+// A ring between doorbell_read() and doorbell_wait() changes the counter,
+// so the wait returns at once instead of losing the wakeup.
+typedef struct {
+	uint32_t seq;
+	uint32_t waiters;
+	uint64_t rings;
+	uint64_t wakes;
+} doorbell_t;
+
+void doorbell_init(doorbell_t* db);
+
+// Publish: everything written before the call is visible to a consumer that
+// returns from doorbell_wait(). The futex syscall is skipped when nobody
+// sleeps, which is the common case under load.
+void doorbell_ring(doorbell_t* db);
+
+uint32_t doorbell_read(const doorbell_t* db);
+
+// Sleep until the counter differs from `seen` or `timeout_ns` elapses
+// (negative: no timeout). Returns 0 when rung, -1 on timeout.
+int doorbell_wait(doorbell_t* db, uint32_t seen, int64_t timeout_ns);
+
+#endif
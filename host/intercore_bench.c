@@ -0,0 +1,371 @@
+// Microbenchmarks for the shared buffer ring code (mt3620-intercore.c) over
+// host memory: cost per message and copy bandwidth of EnqueueData and
+// DequeueData against payload size, source alignment and wraparound.
+//   - ping-pong: one message each way per round trip, the ring always empty;
+//   - stream: bursts of messages one way, one doorbell per message, then the
+//     reader drains them; "batch" does the same with EnqueueDataBatch and
+//     DequeueDataBatch, one doorbell per burst;
+//   - mixed: streams a repeating pattern of sizes, e.g. small control frames
+//     between 1 KiB fragments;
+//   - wrap: every message placed to straddle the end of the buffer, against
+//     the same message placed at the start; the difference is the cost of
+//     splitting the copies in two.
+// Both ends run on this thread, so the numbers are the ring code's own cost
+// (bookkeeping, barriers, copies, doorbell writes) without the cross-core
+// transfer that intercore-wake and intercore-load measure. The mailbox
+// registers are stubbed here; doorbell writes are only counted.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#define CYCLES_NOTE "cycles are TSC ticks"
+#else
+#define CYCLES_NOTE "no cycle counter"
+#endif
+
+#include "mt3620-intercore.h"
+
+#define MAX_SIZES 32
+#define MAX_MESSAGE 4096
+#define MAX_BURST 64
+#define REPEATS 5
+
+// Register access from mt3620-intercore.c: the doorbell is the only write.
+static uint64_t doorbells;
+
+void WriteReg8(uintptr_t baseAddr, size_t offset, uint8_t value)
+{
+	(void)baseAddr;
+	(void)offset;
+	(void)value;
+}
+
+void WriteReg32(uintptr_t baseAddr, size_t offset, uint32_t value)
+{
+	(void)baseAddr;
+	(void)offset;
+	(void)value;
+	doorbells++;
+}
+
+uint32_t ReadReg32(uintptr_t baseAddr, size_t offset)
+{
+	(void)baseAddr;
+	(void)offset;
+	return 0;
+}
+
+uint32_t BlockIrqs(void) { return 0; }
+void RestoreIrqs(uint32_t prevBasePri) { (void)prevBasePri; }
+void DisableIrqs(void) {}
+void EnableIrqs(void) {}
+void WaitForInterrupt(void) {}
+void _putchar(char character) { (void)character; }
+
+// Two buffers as laid out in shared memory: header, then data. Ring a->b
+// lives in a's data area and is tracked by a->writePosition and
+// b->readPosition; ring b->a the other way round.
+typedef struct {
+	BufferHeader* a;
+	BufferHeader* b;
+	uint32_t size;
+} bench_rings_t;
+
+typedef struct {
+	double ns;       // per message
+	double cycles;   // per message, TSC
+	double mbps;     // payload bytes per second, one way
+	double doorbells; // per message
+	double wrapped;  // fraction of messages that wrapped
+} bench_result_t;
+
+static uint8_t src_buf[MAX_MESSAGE + 64] __attribute__((aligned(64)));
+static uint8_t dst_buf[MAX_MESSAGE + 64] __attribute__((aligned(64)));
+static unsigned misalign;
+
+static uint64_t _now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t _ticks(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static uint32_t _block_bytes(uint32_t size)
+{
+	return (sizeof(uint32_t) + size + RINGBUFFER_ALIGNMENT - 1) & ~(uint32_t)(RINGBUFFER_ALIGNMENT - 1);
+}
+
+static BufferHeader* _alloc_buffer(uint32_t size)
+{
+	BufferHeader* header = aligned_alloc(64, sizeof(BufferHeader) + size);
+	if (header != NULL) {
+		memset(header, 0, sizeof(BufferHeader) + size);
+	}
+	return header;
+}
+
+// Empty both rings, with their positions at `position`.
+static void _reset(bench_rings_t* r, uint32_t position)
+{
+	r->a->writePosition = position;
+	r->b->readPosition = position;
+	r->b->writePosition = position;
+	r->a->readPosition = position;
+}
+
+static bool _wraps(uint32_t position, uint32_t size, uint32_t buf_size)
+{
+	return position + sizeof(uint32_t) + size > buf_size;
+}
+
+static void _finish(bench_result_t* res, uint64_t ns, uint64_t ticks, uint64_t messages, uint64_t bytes,
+                    uint64_t rung, uint64_t wrapped)
+{
+	res->ns = (double)ns / messages;
+	res->cycles = (double)ticks / messages;
+	res->mbps = (double)bytes / ((double)ns * 1e-9) / 1e6;
+	res->doorbells = (double)rung / messages;
+	res->wrapped = (double)wrapped / messages;
+}
+
+static void _ping_pong(bench_rings_t* r, uint32_t size, uint64_t rounds, bench_result_t* res)
+{
+	const uint8_t* src = src_buf + misalign;
+	uint8_t* dst = dst_buf + misalign;
+	uint64_t wrapped = 0;
+
+	_reset(r, 0);
+	uint64_t rung = doorbells;
+	uint64_t start = _now_ns(), t0 = _ticks();
+	for (uint64_t i = 0; i < rounds; i++) {
+		uint32_t n = MAX_MESSAGE;
+		wrapped += _wraps(r->a->writePosition, size, r->size);
+		EnqueueData(r->b, r->a, r->size, src, size);
+		DequeueData(r->b, r->a, r->size, dst, &n);
+		n = MAX_MESSAGE;
+		wrapped += _wraps(r->b->writePosition, size, r->size);
+		EnqueueData(r->a, r->b, r->size, dst, size);
+		DequeueData(r->a, r->b, r->size, dst, &n);
+	}
+	_finish(res, _now_ns() - start, _ticks() - t0, rounds * 2, rounds * 2 * size, doorbells - rung, wrapped);
+}
+
+// Stream `messages` messages a->b in bursts, cycling through `sizes`.
+static void _stream(bench_rings_t* r, const uint32_t* sizes, int size_count, uint32_t burst, bool batch,
+                    uint64_t messages, bench_result_t* res)
+{
+	const uint8_t* src = src_buf + misalign;
+	uint8_t* dst = dst_buf + misalign;
+	IntercoreMessage batch_msgs[MAX_BURST];
+	uint32_t dest_sizes[MAX_BURST];
+	uint64_t sent = 0, bytes = 0, wrapped = 0;
+	int next_size = 0;
+
+	// The batch reader copies the messages back to back.
+	static uint8_t batch_dst[MAX_BURST * MAX_MESSAGE];
+
+	_reset(r, 0);
+	uint64_t rung = doorbells;
+	uint64_t start = _now_ns(), t0 = _ticks();
+	while (sent < messages) {
+		uint32_t space = GetWriteSpace(r->b, r->a, r->size);
+		uint32_t count = 0;
+		uint32_t position = r->a->writePosition;
+
+		for (; count < burst && sent + count < messages; count++) {
+			uint32_t size = sizes[(next_size + count) % size_count];
+			uint32_t needed = _block_bytes(size);
+			if (needed + RINGBUFFER_ALIGNMENT > space) {
+				break;
+			}
+			space -= needed;
+			wrapped += _wraps(position, size, r->size);
+			position = (position + needed) % r->size;
+			batch_msgs[count].data = src;
+			batch_msgs[count].size = size;
+			bytes += size;
+		}
+
+		if (batch) {
+			EnqueueDataBatch(r->b, r->a, r->size, batch_msgs, count);
+			DequeueDataBatch(r->b, r->a, r->size, batch_dst + misalign, sizeof(batch_dst) - misalign, dest_sizes,
+			                 count);
+		} else {
+			for (uint32_t i = 0; i < count; i++) {
+				EnqueueData(r->b, r->a, r->size, src, batch_msgs[i].size);
+			}
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t n = MAX_MESSAGE;
+				DequeueData(r->b, r->a, r->size, dst, &n);
+			}
+		}
+		next_size = (next_size + count) % size_count;
+		sent += count;
+	}
+	_finish(res, _now_ns() - start, _ticks() - t0, sent, bytes, doorbells - rung, wrapped);
+}
+
+// One message a->b from `position` each time: near the end of the buffer so
+// that it wraps, or at the start.
+static void _placed(bench_rings_t* r, uint32_t size, bool wrap, uint64_t messages, bench_result_t* res)
+{
+	const uint8_t* src = src_buf + misalign;
+	uint8_t* dst = dst_buf + misalign;
+	// The size word must fit before the end; the data then splits roughly in half.
+	uint32_t position = wrap ? (r->size - _block_bytes(size / 2)) : 0;
+
+	uint64_t rung = doorbells;
+	uint64_t start = _now_ns(), t0 = _ticks();
+	for (uint64_t i = 0; i < messages; i++) {
+		uint32_t n = MAX_MESSAGE;
+		r->a->writePosition = position;
+		r->b->readPosition = position;
+		EnqueueData(r->b, r->a, r->size, src, size);
+		DequeueData(r->b, r->a, r->size, dst, &n);
+	}
+	_finish(res, _now_ns() - start, _ticks() - t0, messages, messages * size, doorbells - rung,
+	        wrap && _wraps(position, size, r->size) ? messages : 0);
+}
+
+// Keep the fastest of several repetitions, the least disturbed by the rest of
+// the system.
+static void _keep_best(bench_result_t* best, const bench_result_t* r, int repeat)
+{
+	if (repeat == 0 || r->ns < best->ns) {
+		*best = *r;
+	}
+}
+
+static int _parse_sizes(const char* list, uint32_t* sizes)
+{
+	int count = 0;
+
+	for (const char* p = list; *p != '\0';) {
+		char* endp;
+		long v = strtol(p, &endp, 10);
+		if (endp == p || v <= 0 || v > MAX_MESSAGE || count == MAX_SIZES) {
+			return -1;
+		}
+		sizes[count++] = (uint32_t)v;
+		p = (*endp == ',') ? endp + 1 : endp;
+	}
+	return count;
+}
+
+static void _usage(const char* argv0)
+{
+	fprintf(stderr,
+	        "usage: %s [-s sizes] [-x mix] [-n messages] [-B burst] [-b buffer_log2] [-o offset]\n"
+	        "  -s  comma-separated payload sizes (default 16,20,32,64,100,128,256,512,1000,1024)\n"
+	        "  -x  comma-separated size pattern for the mixed stream (default 16,1024,1024,1024)\n"
+	        "  -n  messages per measurement (default 200000)\n"
+	        "  -B  messages per streamed burst (default 8)\n"
+	        "  -b  log2 of each buffer's size (default 14)\n"
+	        "  -o  misalignment of the source and destination, in bytes (default 0)\n",
+	        argv0);
+}
+
+int main(int argc, char** argv)
+{
+	const char* size_list = "16,20,32,64,100,128,256,512,1000,1024";
+	const char* mix_list = "16,1024,1024,1024";
+	uint32_t sizes[MAX_SIZES], mix[MAX_SIZES];
+	uint64_t messages = 200000;
+	unsigned burst = 8, buffer_log2 = 14;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:x:n:B:b:o:h")) != -1) {
+		switch (opt) {
+		case 's': size_list = optarg; break;
+		case 'x': mix_list = optarg; break;
+		case 'n': messages = strtoull(optarg, NULL, 10); break;
+		case 'B': burst = (unsigned)atoi(optarg); break;
+		case 'b': buffer_log2 = (unsigned)atoi(optarg); break;
+		case 'o': misalign = (unsigned)atoi(optarg); break;
+		default: _usage(argv[0]); return opt == 'h' ? 0 : 1;
+		}
+	}
+	int size_count = _parse_sizes(size_list, sizes);
+	int mix_count = _parse_sizes(mix_list, mix);
+	if (size_count <= 0 || mix_count <= 0 || messages == 0 || burst < 1 || burst > MAX_BURST ||
+	    buffer_log2 < 12 || buffer_log2 > 24 || misalign > 63) {
+		_usage(argv[0]);
+		return 1;
+	}
+
+	bench_rings_t rings = { .size = (1u << buffer_log2) - sizeof(BufferHeader) };
+	rings.a = _alloc_buffer(rings.size);
+	rings.b = _alloc_buffer(rings.size);
+	if (rings.a == NULL || rings.b == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	memset(src_buf, 0x5a, sizeof(src_buf));
+
+	printf("%u-byte rings, bursts of %u, best of %d x %llu messages, buffers misaligned by %u\n", rings.size,
+	       burst, REPEATS, (unsigned long long)messages, misalign);
+	printf("per message: ns, cycles (%s) and doorbells; MB/s of payload one way; wrap = messages\n"
+	       "that wrapped; start/wrap = one message at the start / across the end; split = wrap - start\n",
+	       CYCLES_NOTE);
+	printf("%6s %5s | %8s %7s | %8s %7s %6s %5s | %8s %7s %5s | %8s %8s %7s\n", "size", "pad", "pingpong",
+	       "cycles", "stream", "MB/s", "bells", "wrap", "batch", "MB/s", "bells", "start", "wrap", "split");
+
+	for (int i = 0; i < size_count; i++) {
+		uint32_t size = sizes[i];
+		bench_result_t pp, st, ba, at_start, at_end;
+
+		if (_block_bytes(size) * burst + RINGBUFFER_ALIGNMENT > rings.size) {
+			fprintf(stderr, "%u-byte messages: a burst does not fit in the ring\n", size);
+			continue;
+		}
+		for (int repeat = 0; repeat < REPEATS; repeat++) {
+			bench_result_t r;
+			_ping_pong(&rings, size, messages / 2, &r);
+			_keep_best(&pp, &r, repeat);
+			_stream(&rings, &size, 1, burst, false, messages, &r);
+			_keep_best(&st, &r, repeat);
+			_stream(&rings, &size, 1, burst, true, messages, &r);
+			_keep_best(&ba, &r, repeat);
+			_placed(&rings, size, false, messages, &r);
+			_keep_best(&at_start, &r, repeat);
+			_placed(&rings, size, true, messages, &r);
+			_keep_best(&at_end, &r, repeat);
+		}
+
+		double pad = 1.0 - (double)size / _block_bytes(size);
+		printf("%6u %4.0f%% | %8.1f %7.0f | %8.1f %7.0f %6.2f %4.1f%% | %8.1f %7.0f %5.2f | %8.1f %8.1f %+7.1f\n",
+		       size, pad * 100, pp.ns, pp.cycles, st.ns, st.mbps, st.doorbells, st.wrapped * 100, ba.ns,
+		       ba.mbps, ba.doorbells, at_start.ns, at_end.ns, at_end.ns - at_start.ns);
+	}
+
+	bench_result_t st, ba;
+	for (int repeat = 0; repeat < REPEATS; repeat++) {
+		bench_result_t r;
+		_stream(&rings, mix, mix_count, burst, false, messages, &r);
+		_keep_best(&st, &r, repeat);
+		_stream(&rings, mix, mix_count, burst, true, messages, &r);
+		_keep_best(&ba, &r, repeat);
+	}
+	printf("mixed %s: stream %.1f ns (%.0f MB/s, %.2f doorbells), batch %.1f ns (%.0f MB/s, %.2f doorbells)"
+	       " per message\n",
+	       mix_list, st.ns, st.mbps, st.doorbells, ba.ns, ba.mbps, ba.doorbells);
+
+	free(rings.a);
+	free(rings.b);
+	return 0;
+}
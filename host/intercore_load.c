@@ -0,0 +1,850 @@
+// Load generator for the intercore protocol: runs the RT core firmware on the
+// host emulator (host/mt3620_host.c) and offers images at 1x-10x its inference
+// rate, or at given frame rates, open loop and optionally in bursts, from a
+// stand-in for the HL app. It is the regression benchmark for protocol and
+// scheduling changes; -C prints CSV for keeping results. With credit flow control
+// the sender keeps at most the advertised number of requests outstanding and
+// sleeps on the doorbell otherwise; without it the sender pushes fragments
+// whenever an image is waiting and busy-retries while the buffer is full.
+// Images that arrive while the sender's queue is full are shed. The latest and
+// abandon modes are credit mode with latest-frame-wins requests, letting the
+// RT core drop stale images itself (abandon also interrupts inference). With
+// -c the sender also sends CONTROL_STATS probes, answered between layers, and
+// reports their latency and the cost of the RT core's yield points.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nn.h"
+#include "testdata.h"
+
+#include "cifar10_data.h"
+#include "intercore-protocol.h"
+#include "m4_cycles.h"
+#include "mt3620_host.h"
+
+#define MAX_QUEUE 64
+#define MAX_OUTSTANDING 256
+#define MAX_AGGREGATED 1024
+#define FRAGMENTS ((CIFAR10_IMG_BYTES + FRAME_FRAGMENT_SIZE - 1) / FRAME_FRAGMENT_SIZE)
+
+static const uint8_t test_image[CIFAR10_IMG_BYTES] = IMG_DATA;
+
+typedef enum {
+	MODE_CREDIT,
+	MODE_GREEDY,
+	MODE_LATEST,
+	MODE_ABANDON,
+	MODE_AGGREGATE,
+	MODE_COUNT,
+} load_mode_t;
+
+static const char* const mode_names[MODE_COUNT] = { "credit", "greedy", "latest", "abandon", "aggregate" };
+
+typedef struct {
+	double arrival;
+	uint32_t id;
+	// Written over the first pixels, so that images differ unless they repeat one on purpose
+	uint32_t stamp;
+	bool dark;
+	bool started;
+	uint32_t fragments_sent;
+} pending_image_t;
+
+typedef struct {
+	// Results
+	uint64_t offered;
+	uint64_t shed;
+	uint64_t completed;
+	uint64_t errors;
+	uint64_t superseded;
+	uint64_t wrong;
+	uint64_t retries;
+	uint64_t summaries;
+	uint64_t cached;
+	uint64_t no_content;
+	// From the ResultPayload of completed images: RT queue wait and inference cycles, and
+	// top-1 score, summed
+	double rt_queue_cycles;
+	double rt_inference_cycles;
+	double top_score;
+	double* latency;
+	// Bytes of the HL -> RT ring in use: time-weighted sum and peak
+	double occupancy_sum;
+	uint32_t occupancy_max;
+	uint64_t probes;
+	double* probe_latency;
+	// Configuration commands the RT app answered with 0, one bit per ControlCommand
+	uint32_t rejected;
+	ControlStats control;
+	// Telemetry page: first and last samples, reads, reads that had to retry or failed, and the
+	// deepest RT queue seen
+	TelemetryPage telemetry_start;
+	TelemetryPage telemetry;
+	uint64_t telemetry_reads;
+	uint64_t telemetry_retried;
+	uint64_t telemetry_failed;
+	uint32_t queue_depth_max;
+	double hl_cpu_ms;
+	double elapsed;
+	mt3620_host_stats_t stats;
+} load_result_t;
+
+static mt3620_host_hl_t* hl;
+static uint8_t frames[FRAGMENTS][FRAME_PAYLOAD_OFFSET + FRAME_FRAGMENT_SIZE];
+// The same fragments with a black image, for the pre-filter
+static uint8_t dark_frames[FRAGMENTS][FRAME_PAYLOAD_OFFSET + FRAME_FRAGMENT_SIZE];
+static uint8_t expected_class;
+static uint32_t next_id = 1;
+
+static double _now(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int _cmp_double(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void _build_frames(uint8_t flags)
+{
+	for (uint32_t i = 0; i < FRAGMENTS; i++) {
+		uint32_t offset = i * FRAME_FRAGMENT_SIZE;
+		uint32_t length = CIFAR10_IMG_BYTES - offset < FRAME_FRAGMENT_SIZE ? CIFAR10_IMG_BYTES - offset : FRAME_FRAGMENT_SIZE;
+		FrameHeader header = {
+			.version = FRAME_VERSION,
+			.flags = flags,
+			.fragmentIndex = (uint8_t)i,
+			.fragmentCount = FRAGMENTS,
+			.payloadLength = (uint16_t)length,
+		};
+		memset(frames[i], 0, FRAME_ENVELOPE_SIZE);
+		memcpy(&frames[i][FRAME_ENVELOPE_SIZE], &header, sizeof(header));
+		memcpy(&frames[i][FRAME_PAYLOAD_OFFSET], &test_image[offset], length);
+		memcpy(dark_frames[i], frames[i], FRAME_PAYLOAD_OFFSET);
+		memset(&dark_frames[i][FRAME_PAYLOAD_OFFSET], 0, length);
+	}
+}
+
+static uint32_t _frame_size(uint32_t fragment)
+{
+	FrameHeader header;
+	memcpy(&header, &frames[fragment][FRAME_ENVELOPE_SIZE], sizeof(header));
+	return FRAME_PAYLOAD_OFFSET + header.payloadLength;
+}
+
+// Send the remaining fragments of an image with one doorbell, leaving
+// FRAME_CONTROL_HEADROOM bytes of the ring for control frames. Returns true
+// once all of them are in the shared buffer.
+static bool _send(pending_image_t* image)
+{
+	IntercoreMessage messages[FRAGMENTS];
+	uint32_t count = 0;
+	uint32_t space = GetWriteSpace(hl->inbound, hl->outbound, hl->buf_size);
+	uint32_t needed = FRAME_CONTROL_HEADROOM + RINGBUFFER_ALIGNMENT;
+
+	for (uint32_t i = image->fragments_sent; i < FRAGMENTS; i++, count++) {
+		needed += (sizeof(uint32_t) + _frame_size(i) + RINGBUFFER_ALIGNMENT - 1) & ~(RINGBUFFER_ALIGNMENT - 1);
+		if (needed > space) {
+			break;
+		}
+		uint8_t* frame = image->dark ? dark_frames[i] : frames[i];
+		FrameHeader* header = (FrameHeader*)&frame[FRAME_ENVELOPE_SIZE];
+		header->requestId = image->id;
+		if (i == 0 && !image->dark) {
+			memcpy(&frame[FRAME_PAYLOAD_OFFSET], &image->stamp, sizeof(image->stamp));
+		}
+		messages[count].data = frame;
+		messages[count].size = _frame_size(i);
+	}
+	// The fragments point at shared templates, so copy them out one batch at a time.
+	image->fragments_sent += EnqueueDataBatch(hl->inbound, hl->outbound, hl->buf_size, messages, count);
+	return image->fragments_sent == FRAGMENTS;
+}
+
+typedef struct {
+	double arrival[MAX_OUTSTANDING];
+	uint32_t id[MAX_OUTSTANDING];
+	bool used[MAX_OUTSTANDING];
+	uint32_t count;
+	uint16_t credits;
+	// Control probe in flight, and when it was sent
+	bool probing;
+	double probe_sent;
+	// Arrival times of FRAME_FLAG_AGGREGATE images not yet counted in a summary, in order
+	double aggregated[MAX_AGGREGATED];
+	uint32_t aggregated_head, aggregated_tail;
+} outstanding_t;
+
+#define PROBE_ID 0xFFFFFFFFu
+// Control frames that configure the RT app, numbered by command. Their replies only record
+// whether the command was accepted.
+#define CONFIG_ID(command) (0xFFFFFF00u | (command))
+
+static const char* const config_names[] = {
+	[CONTROL_WINDOW_IMAGES] = "window", [CONTROL_CACHE] = "cache", [CONTROL_FILTER] = "filter",
+	[CONTROL_DELTA] = "delta", [CONTROL_CASCADE] = "cascade", [CONTROL_EXITS] = "exits",
+};
+
+// Send a control frame. Returns false if the shared buffer is full.
+static bool _send_control(uint32_t id, uint8_t command, uint32_t argument)
+{
+	uint8_t frame[FRAME_PAYLOAD_OFFSET + sizeof(ControlRequest)] = { 0 };
+	FrameHeader header = {
+		.version = FRAME_VERSION,
+		.flags = FRAME_FLAG_CONTROL,
+		.fragmentCount = 1,
+		.requestId = id,
+		.payloadLength = sizeof(ControlRequest),
+	};
+	ControlRequest request = { .command = command, .argument = argument };
+
+	memcpy(&frame[FRAME_ENVELOPE_SIZE], &header, sizeof(header));
+	memcpy(&frame[FRAME_PAYLOAD_OFFSET], &request, sizeof(request));
+	return EnqueueData(hl->inbound, hl->outbound, hl->buf_size, frame, sizeof(frame)) == 0;
+}
+
+// Handle every reply in the shared buffer.
+static void _receive(outstanding_t* out, load_result_t* result)
+{
+	uint8_t reply[256];
+	uint32_t size = sizeof(reply);
+
+	while (DequeueData(hl->outbound, hl->inbound, hl->buf_size, reply, &size) == 0) {
+		FrameHeader header;
+		size_t slot;
+
+		if (size >= FRAME_PAYLOAD_OFFSET) {
+			memcpy(&header, &reply[FRAME_ENVELOPE_SIZE], sizeof(header));
+			out->credits = header.credits;
+
+			if (header.flags & FRAME_FLAG_AGGREGATE) {
+				// A window closes on the oldest images sent, since they are classified in order.
+				AggregateSummary summary;
+				if (size >= FRAME_PAYLOAD_OFFSET + sizeof(summary)) {
+					memcpy(&summary, &reply[FRAME_PAYLOAD_OFFSET], sizeof(summary));
+					double now = _now(CLOCK_MONOTONIC);
+					for (uint32_t i = 0; i < summary.images + summary.empty && out->aggregated_head != out->aggregated_tail; i++) {
+						double arrival = out->aggregated[out->aggregated_head++ % MAX_AGGREGATED];
+						if (i < summary.images) {
+							result->latency[result->completed++] = now - arrival;
+						}
+					}
+					result->wrong += summary.images - summary.counts[expected_class];
+					result->no_content += summary.empty;
+					result->top_score += (double)summary.scoreSums[expected_class];
+					result->summaries++;
+				}
+				size = sizeof(reply);
+				continue;
+			}
+
+			if (header.flags & FRAME_FLAG_CONTROL) {
+				if (out->probing && header.requestId == PROBE_ID && size >= FRAME_PAYLOAD_OFFSET + sizeof(ControlStats)) {
+					memcpy(&result->control, &reply[FRAME_PAYLOAD_OFFSET], sizeof(ControlStats));
+					result->probe_latency[result->probes++] = _now(CLOCK_MONOTONIC) - out->probe_sent;
+					out->probing = false;
+				} else if (header.requestId != PROBE_ID && (header.requestId & 0xFFFFFF00u) == CONFIG_ID(0) &&
+				           size > FRAME_PAYLOAD_OFFSET && reply[FRAME_PAYLOAD_OFFSET] == 0) {
+					result->rejected |= 1u << (header.requestId & 0x1F);
+				}
+				size = sizeof(reply);
+				continue;
+			}
+
+			slot = header.requestId % MAX_OUTSTANDING;
+			if (out->used[slot] && out->id[slot] == header.requestId) {
+				out->used[slot] = false;
+				out->count--;
+				if ((header.flags & FRAME_FLAG_ERROR) && reply[FRAME_PAYLOAD_OFFSET] == FRAME_ERROR_SUPERSEDED) {
+					result->superseded++;
+				} else if ((header.flags & FRAME_FLAG_ERROR) && reply[FRAME_PAYLOAD_OFFSET] == FRAME_ERROR_NO_CONTENT) {
+					result->no_content++;
+				} else if (header.flags & FRAME_FLAG_ERROR) {
+					result->errors++;
+				} else {
+					ResultPayload payload = { 0 };
+					if (size >= FRAME_PAYLOAD_OFFSET + sizeof(payload)) {
+						memcpy(&payload, &reply[FRAME_PAYLOAD_OFFSET], sizeof(payload));
+					}
+					result->latency[result->completed++] = _now(CLOCK_MONOTONIC) - out->arrival[slot];
+					result->cached += (header.flags & FRAME_FLAG_CACHED) != 0;
+					result->wrong += (payload.requestId != header.requestId || payload.classes[0] != expected_class);
+					result->rt_queue_cycles += payload.queueCycles;
+					result->rt_inference_cycles += payload.inferenceCycles;
+					result->top_score += payload.scores[0];
+				}
+			}
+		}
+		size = sizeof(reply);
+	}
+}
+
+// Sample the HL -> RT ring occupancy, before and after each round of sends.
+// The occupancy last seen is taken to hold until now.
+static void _sample_occupancy(load_result_t* result, uint32_t* occupancy, double* sampled)
+{
+	double now = _now(CLOCK_MONOTONIC);
+
+	result->occupancy_sum += *occupancy * (now - *sampled);
+	*sampled = now;
+	*occupancy = hl->buf_size - GetWriteSpace(hl->inbound, hl->outbound, hl->buf_size);
+	if (*occupancy > result->occupancy_max) {
+		result->occupancy_max = *occupancy;
+	}
+}
+
+// Sample the telemetry page the RT core publishes in its buffer header. A consistent copy is
+// checked for going backwards, which a torn read would show.
+static void _sample_telemetry(load_result_t* result)
+{
+	TelemetryPage page;
+	int retries = ReadHeaderWords(hl->inbound, (uint32_t*)&page, sizeof(page) / sizeof(uint32_t), 16);
+
+	result->telemetry_reads++;
+	if (retries != 0) {
+		result->telemetry_retried++;
+	}
+	if (retries == -1 || page.version != TELEMETRY_VERSION) {
+		result->telemetry_failed++;
+		return;
+	}
+	if (result->telemetry.version != 0 && (page.heartbeat < result->telemetry.heartbeat ||
+	                                       page.inferences < result->telemetry.inferences)) {
+		result->telemetry_failed++;
+		return;
+	}
+	if (page.queueDepth > result->queue_depth_max) {
+		result->queue_depth_max = page.queueDepth;
+	}
+	if (result->telemetry_start.version == 0) {
+		result->telemetry_start = page;
+	}
+	result->telemetry = page;
+}
+
+typedef struct {
+	double seconds;
+	double probe_rate;
+	unsigned queue_cap;
+	unsigned burst;
+	unsigned window;
+	// CONTROL_CACHE argument, and the fraction of images that repeat the previous one
+	uint32_t cache;
+	double repeat;
+	// CONTROL_FILTER argument, and the fraction of images that are black
+	uint32_t filter;
+	double dark;
+	// CONTROL_DELTA, CONTROL_CASCADE and CONTROL_EXITS arguments
+	uint32_t delta;
+	uint32_t cascade;
+	uint32_t exits;
+} load_config_t;
+
+static void _run(load_mode_t mode, double rate, const load_config_t* config, load_result_t* result)
+{
+	double seconds = config->seconds, probe_rate = config->probe_rate;
+	unsigned queue_cap = config->queue_cap;
+	static pending_image_t queue[MAX_QUEUE];
+	static outstanding_t out;
+	unsigned head = 0, count = 0;
+	double period = config->burst / rate;
+	bool credit = mode != MODE_GREEDY && mode != MODE_AGGREGATE;
+	bool aggregate = mode == MODE_AGGREGATE;
+	double flushed = 0.0;
+	uint32_t stamp = 0;
+
+	_build_frames(mode == MODE_LATEST ? FRAME_FLAG_LATEST :
+	              mode == MODE_ABANDON ? FRAME_FLAG_LATEST | FRAME_FLAG_ABANDON :
+	              mode == MODE_AGGREGATE ? FRAME_FLAG_AGGREGATE : 0);
+
+	memset(&out, 0, sizeof(out));
+	out.credits = FRAME_INITIAL_CREDITS;
+	_send_control(CONFIG_ID(CONTROL_CACHE), CONTROL_CACHE, config->cache);
+	_send_control(CONFIG_ID(CONTROL_FILTER), CONTROL_FILTER, config->filter);
+	_send_control(CONFIG_ID(CONTROL_DELTA), CONTROL_DELTA, config->delta);
+	_send_control(CONFIG_ID(CONTROL_CASCADE), CONTROL_CASCADE, config->cascade);
+	_send_control(CONFIG_ID(CONTROL_EXITS), CONTROL_EXITS, config->exits);
+	if (aggregate) {
+		_send_control(CONFIG_ID(CONTROL_WINDOW_IMAGES), CONTROL_WINDOW_IMAGES, config->window);
+	}
+	mt3620_host_stats_t before;
+	mt3620_host_stats(&before);
+
+	double start = _now(CLOCK_MONOTONIC);
+	double cpu_start = _now(CLOCK_THREAD_CPUTIME_ID);
+	double next_arrival = start;
+	double next_probe = probe_rate > 0 ? start : 1e300;
+	double end = start + seconds;
+	double sampled = start;
+	uint32_t occupancy = 0;
+
+	while (true) {
+		double now = _now(CLOCK_MONOTONIC);
+		uint32_t seen = doorbell_read(&hl->data);
+
+		_sample_occupancy(result, &occupancy, &sampled);
+		_sample_telemetry(result);
+
+		for (; next_arrival <= now && next_arrival < end; next_arrival += period) {
+			for (unsigned b = 0; b < config->burst; b++) {
+				result->offered++;
+				if (count == queue_cap) {
+					// Shed the oldest image that has not started, or the new one if the
+					// only image queued is being sent.
+					unsigned victim = queue[head].started ? 1 : 0;
+					result->shed++;
+					if (victim == count) {
+						continue;
+					}
+					for (unsigned i = victim; i + 1 < count; i++) {
+						queue[(head + i) % MAX_QUEUE] = queue[(head + i + 1) % MAX_QUEUE];
+					}
+					count--;
+				}
+				if (stamp == 0 || (double)rand() / RAND_MAX >= config->repeat) {
+					stamp = next_id;
+				}
+				queue[(head + count) % MAX_QUEUE] =
+					(pending_image_t){ .arrival = next_arrival, .id = next_id++, .stamp = stamp,
+					                   .dark = (double)rand() / RAND_MAX < config->dark };
+				count++;
+			}
+		}
+
+		_receive(&out, result);
+
+		// One probe at a time; a late one is sent as soon as the previous has been answered.
+		if (now >= next_probe && now < end && !out.probing && _send_control(PROBE_ID, CONTROL_STATS, 0)) {
+			out.probing = true;
+			out.probe_sent = now;
+			next_probe += 1.0 / probe_rate;
+		}
+
+		// Start or continue images while the RT core has granted credit for them.
+		bool blocked = false;
+		while (count > 0 && !blocked) {
+			pending_image_t* image = &queue[head];
+			if (!image->started && aggregate) {
+				// Not answered one by one: only remember the arrival for the summary.
+				if (out.aggregated_tail - out.aggregated_head == MAX_AGGREGATED) {
+					break;
+				}
+				out.aggregated[out.aggregated_tail++ % MAX_AGGREGATED] = image->arrival;
+				image->started = true;
+			}
+			if (!image->started) {
+				if (credit && out.count >= out.credits) {
+					break;
+				}
+				if (out.count == MAX_OUTSTANDING) {
+					break;
+				}
+				size_t slot = image->id % MAX_OUTSTANDING;
+				out.arrival[slot] = image->arrival;
+				out.id[slot] = image->id;
+				out.used[slot] = true;
+				out.count++;
+				image->started = true;
+			}
+			if (_send(image)) {
+				head = (head + 1) % MAX_QUEUE;
+				count--;
+			} else {
+				blocked = true;
+			}
+		}
+
+		_sample_occupancy(result, &occupancy, &sampled);
+
+		bool aggregating = out.aggregated_head != out.aggregated_tail;
+		if (next_arrival >= end && count == 0 && out.count == 0 && !out.probing && !aggregating) {
+			break;
+		}
+		// Everything is sent: have the last, partly filled window sent. The window command
+		// would overtake images still in the ring, so wait for the telemetry page to show them
+		// all classified, and repeat it in case one was not.
+		const TelemetryPage* t = &result->telemetry;
+		const TelemetryPage* t0 = &result->telemetry_start;
+		bool classified = t->inferences - t0->inferences + t->filtered - t0->filtered >= out.aggregated_tail;
+		if (next_arrival >= end && count == 0 && aggregating && now >= flushed + (classified ? 0.01 : 0.1) &&
+		    _send_control(CONFIG_ID(CONTROL_WINDOW_IMAGES), CONTROL_WINDOW_IMAGES, config->window)) {
+			flushed = now;
+		}
+		if (now > end + 5.0) {
+			fprintf(stderr, "timed out with %u requests outstanding\n",
+			        out.count + out.aggregated_tail - out.aggregated_head);
+			break;
+		}
+
+		if (blocked && !credit && !aggregate) {
+			// Shared buffer full: retry straight away.
+			result->retries++;
+			continue;
+		}
+		if (blocked) {
+			// Wait for the RT core to free buffer space.
+			doorbell_wait(&hl->space, doorbell_read(&hl->space), 200000);
+			continue;
+		}
+		double wake = next_arrival < end ? next_arrival : end + 0.01;
+		if (next_probe < wake && !out.probing) {
+			wake = next_probe;
+		}
+		double wait = wake - _now(CLOCK_MONOTONIC);
+		if (wait > 0) {
+			doorbell_wait(&hl->data, seen, (int64_t)(wait * 1e9));
+		}
+	}
+
+	result->elapsed = _now(CLOCK_MONOTONIC) - start;
+	result->hl_cpu_ms = (_now(CLOCK_THREAD_CPUTIME_ID) - cpu_start) * 1e3;
+	mt3620_host_stats(&result->stats);
+	result->stats.rt_doorbells -= before.rt_doorbells;
+	result->stats.rt_interrupts -= before.rt_interrupts;
+	result->stats.hl_data_rings -= before.hl_data_rings;
+	result->stats.hl_space_rings -= before.hl_space_rings;
+}
+
+static double _inference_seconds(int iterations)
+{
+	static nn_context_t ctx;
+	uint8_t image[CIFAR10_IMG_BYTES];
+	q7_t output[10];
+
+	double start = _now(CLOCK_MONOTONIC);
+	for (int i = 0; i < iterations; i++) {
+		memcpy(image, test_image, sizeof(image));
+		run_nn_ctx(&ctx, (q7_t*)image, output);
+	}
+	double seconds = (_now(CLOCK_MONOTONIC) - start) / iterations;
+
+	expected_class = 0;
+	for (uint8_t i = 1; i < 10; i++) {
+		if (output[i] > output[expected_class]) {
+			expected_class = i;
+		}
+	}
+	return seconds;
+}
+
+static double _percentile(const double* sorted, uint64_t count, double p)
+{
+	return count > 0 ? sorted[(uint64_t)(count * p)] : 0.0;
+}
+
+static void _print_header(bool csv)
+{
+	if (csv) {
+		printf("mode,load,fps,burst,offered,done_per_s,shed,superseded,errors,p50_ms,p99_ms,p999_ms,"
+		       "occupancy_avg,occupancy_max,retries,hl_cpu,rt_doorbells,rt_irqs,hl_doorbells,"
+		       "probes,probe_p50_ms,probe_p99_ms,yield_cycles,rt_inferences,rt_depth_max,rt_dropped,"
+		       "rt_ring_full,rt_stalls,rt_max_cycles,telemetry_failed\n");
+		return;
+	}
+	printf("%-9s %5s %7s %6s %6s %6s %8s %8s %8s %9s %9s %6s %6s\n", "mode", "load", "done/s", "shed",
+	       "super", "errors", "p50 ms", "p99 ms", "p999 ms", "ring avg", "ring max", "hl cpu", "irqs");
+}
+
+static void _print_result(bool csv, load_mode_t mode, double load, double fps, const load_config_t* config,
+                          load_result_t* r)
+{
+	qsort(r->latency, r->completed, sizeof(double), _cmp_double);
+	qsort(r->probe_latency, r->probes, sizeof(double), _cmp_double);
+
+	double p50 = _percentile(r->latency, r->completed, 0.5);
+	double p99 = _percentile(r->latency, r->completed, 0.99);
+	double p999 = _percentile(r->latency, r->completed, 0.999);
+	double occupancy = r->occupancy_sum / r->elapsed / hl->buf_size;
+	double occupancy_max = (double)r->occupancy_max / hl->buf_size;
+	double cpu = r->hl_cpu_ms / (r->elapsed * 1e3);
+	uint64_t hl_doorbells = r->stats.hl_data_rings + r->stats.hl_space_rings;
+	const ControlStats* c = &r->control;
+	double yield = c->yieldChecks ? (double)c->yieldCycles / c->yieldChecks : 0.0;
+	const TelemetryPage* t = &r->telemetry;
+	const TelemetryPage* t0 = &r->telemetry_start;
+
+	if (csv) {
+		printf("%s,%.2f,%.1f,%u,%llu,%.1f,%llu,%llu,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%llu,%.3f,%llu,%llu,%llu,"
+		       "%llu,%.3f,%.3f,%.0f,%u,%u,%u,%u,%u,%u,%llu\n",
+		       mode_names[mode], load, fps, config->burst, (unsigned long long)r->offered,
+		       r->completed / r->elapsed, (unsigned long long)r->shed, (unsigned long long)r->superseded,
+		       (unsigned long long)r->errors, p50 * 1e3, p99 * 1e3, p999 * 1e3, occupancy, occupancy_max,
+		       (unsigned long long)r->retries, cpu, (unsigned long long)r->stats.rt_doorbells,
+		       (unsigned long long)r->stats.rt_interrupts, (unsigned long long)hl_doorbells,
+		       (unsigned long long)r->probes, _percentile(r->probe_latency, r->probes, 0.5) * 1e3,
+		       _percentile(r->probe_latency, r->probes, 0.99) * 1e3, yield, t->inferences - t0->inferences,
+		       r->queue_depth_max, t->dropped - t0->dropped, t->replyRingFull - t0->replyRingFull,
+		       t->receiveStalls - t0->receiveStalls, t->maxInferenceCycles,
+		       (unsigned long long)r->telemetry_failed);
+		return;
+	}
+
+	printf("%-9s %4.1fx %7.1f %6llu %6llu %6llu %8.2f %8.2f %8.2f %8.0f%% %8.0f%% %5.0f%% %6llu\n",
+	       mode_names[mode], load, r->completed / r->elapsed, (unsigned long long)r->shed,
+	       (unsigned long long)r->superseded, (unsigned long long)r->errors, p50 * 1e3, p99 * 1e3,
+	       p999 * 1e3, occupancy * 100, occupancy_max * 100, cpu * 100,
+	       (unsigned long long)r->stats.rt_interrupts);
+	printf("  offered %llu, doorbells HL->RT %llu, RT->HL %llu (%llu data, %llu space)",
+	       (unsigned long long)r->offered, (unsigned long long)r->stats.rt_doorbells,
+	       (unsigned long long)hl_doorbells, (unsigned long long)r->stats.hl_data_rings,
+	       (unsigned long long)r->stats.hl_space_rings);
+	if (r->retries > 0) {
+		printf(", %llu retries", (unsigned long long)r->retries);
+	}
+	printf("\n");
+	if (r->probes > 0) {
+		printf("  %llu control probes: p50 %.3f ms, p99 %.3f ms; %u yield points, %.0f cycles each\n",
+		       (unsigned long long)r->probes, _percentile(r->probe_latency, r->probes, 0.5) * 1e3,
+		       _percentile(r->probe_latency, r->probes, 0.99) * 1e3, c->yieldChecks, yield);
+	}
+	for (uint32_t i = 0; i < sizeof(config_names) / sizeof(config_names[0]); i++) {
+		if (((r->rejected >> i) & 1) && config_names[i] != NULL) {
+			printf("  the RT app rejected the %s setting\n", config_names[i]);
+		}
+	}
+	if (r->no_content > 0) {
+		printf("  %llu images turned away by the pre-filter\n", (unsigned long long)r->no_content);
+	}
+	if (r->summaries > 0) {
+		printf("  %llu window summaries for %llu images\n", (unsigned long long)r->summaries,
+		       (unsigned long long)r->completed);
+	}
+	if (r->rt_inference_cycles > 0) {
+		printf("  results: RT queue wait %.2f ms, inference %.2f ms, top-1 score %.0f%% (averages)",
+		       r->rt_queue_cycles / r->completed / M4_CLOCK_HZ * 1e3,
+		       r->rt_inference_cycles / r->completed / M4_CLOCK_HZ * 1e3, r->top_score / r->completed / 1.27);
+		if (t->cacheHits + t->cacheMisses > t0->cacheHits + t0->cacheMisses) {
+			printf("; %llu from the cache, %u hits, %u misses", (unsigned long long)r->cached,
+			       t->cacheHits - t0->cacheHits, t->cacheMisses - t0->cacheMisses);
+		}
+		printf("\n");
+	}
+	printf("  telemetry: %u inferences, %u dropped, queue depth max %u, %u ring full, %u stalls; "
+	       "inference %u cycles, max %u; %llu reads, %llu retried, %llu failed\n",
+	       t->inferences - t0->inferences, t->dropped - t0->dropped, r->queue_depth_max,
+	       t->replyRingFull - t0->replyRingFull, t->receiveStalls - t0->receiveStalls,
+	       t->lastInferenceCycles, t->maxInferenceCycles, (unsigned long long)r->telemetry_reads,
+	       (unsigned long long)r->telemetry_retried, (unsigned long long)r->telemetry_failed);
+	if (r->wrong > 0) {
+		printf("  %llu replies with the wrong class\n", (unsigned long long)r->wrong);
+	}
+}
+
+// Parse a comma-separated list of positive numbers.
+static int _parse_list(const char* list, double* values, int max)
+{
+	int count = 0;
+
+	for (const char* p = list; *p != '\0';) {
+		char* endp;
+		double v = strtod(p, &endp);
+		if (endp == p || v <= 0 || count == max) {
+			return -1;
+		}
+		values[count++] = v;
+		p = (*endp == ',') ? endp + 1 : endp;
+	}
+	return count;
+}
+
+static int _parse_modes(const char* list, bool* enabled)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "%s", list);
+	for (char* name = strtok(buf, ","); name != NULL; name = strtok(NULL, ",")) {
+		int mode;
+		for (mode = 0; mode < MODE_COUNT && strcmp(name, mode_names[mode]) != 0; mode++) {
+		}
+		if (mode == MODE_COUNT) {
+			return -1;
+		}
+		enabled[mode] = true;
+	}
+	return 0;
+}
+
+// off, exact or perceptual[:bits] to a CONTROL_CACHE argument.
+static int _parse_cache(const char* arg, uint32_t* cache)
+{
+	if (strcmp(arg, "off") == 0) {
+		*cache = CACHE_OFF;
+	} else if (strcmp(arg, "exact") == 0) {
+		*cache = CACHE_EXACT;
+	} else if (strncmp(arg, "perceptual", 10) == 0 && (arg[10] == '\0' || arg[10] == ':')) {
+		uint32_t bits = (arg[10] == ':') ? (uint32_t)atoi(&arg[11]) : 0;
+		if (bits > 64) {
+			return -1;
+		}
+		*cache = CACHE_PERCEPTUAL | bits << 8;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+static void _usage(const char* argv0)
+{
+	fprintf(stderr,
+	        "usage: %s [-m multipliers | -r fps] [-M modes] [-t seconds] [-B burst] [-q queue]\n"
+	        "          [-b buffer_log2] [-c probes/s] [-w images] [-k cache] [-D repeat]\n"
+	        "          [-f mean:variance] [-z dark] [-e percent] [-g margin]\n"
+	        "          [-x margins] [-C] [-v]\n"
+	        "  -m  comma-separated offered load, in multiples of the inference rate (default 1,2,4,6,8,10)\n"
+	        "  -r  comma-separated offered load, in images per second\n"
+	        "  -M  comma-separated modes among credit,greedy,latest,abandon,aggregate (default all)\n"
+	        "  -t  seconds per load level (default 1)\n"
+	        "  -B  images arriving together, at the same average rate (default 1)\n"
+	        "  -q  images the sender may queue before shedding the oldest (default 4)\n"
+	        "  -b  log2 of each shared buffer's size (default 14)\n"
+	        "  -c  control probes per second mixed with the images, 0 for none (default 0)\n"
+	        "  -w  images per window in aggregate mode (default %d)\n"
+	        "  -k  RT result cache: off, exact or perceptual[:bits] (default off)\n"
+	        "  -D  fraction of images repeating the previous one (default 0)\n"
+	        "  -f  RT pre-filter thresholds, per channel (default 0:0, off)\n"
+	        "  -z  fraction of black images (default 0)\n"
+	        "  -e  RT incremental inference, with the dirty percentage from which a layer is\n"
+	        "      computed whole, 0 for the RT default (default off)\n"
+	        "  -g  RT gate model margin, q7, 0 for no gate (default 0)\n"
+	        "  -x  comma-separated RT early exit margins, q7, 0 for an exit off (default 0,0)\n"
+	        "  -C  print CSV\n"
+	        "  -v  print the firmware's debug output\n",
+	        argv0, AGGREGATE_DEFAULT_IMAGES);
+}
+
+int main(int argc, char** argv)
+{
+	const char* multipliers = "1,2,4,6,8,10";
+	const char* rates = NULL;
+	bool modes[MODE_COUNT] = { false };
+	bool csv = false;
+	load_config_t config = {
+		.seconds = 1.0, .probe_rate = 0.0, .queue_cap = 4, .burst = 1, .window = AGGREGATE_DEFAULT_IMAGES
+	};
+	unsigned buffer_log2 = 14;
+	double loads[32];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:r:M:t:B:q:b:c:w:k:D:f:z:e:g:x:Cvh")) != -1) {
+		switch (opt) {
+		case 'm': multipliers = optarg; break;
+		case 'r': rates = optarg; break;
+		case 'M':
+			if (_parse_modes(optarg, modes) != 0) {
+				_usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 't': config.seconds = atof(optarg); break;
+		case 'B': config.burst = (unsigned)atoi(optarg); break;
+		case 'q': config.queue_cap = (unsigned)atoi(optarg); break;
+		case 'b': buffer_log2 = (unsigned)atoi(optarg); break;
+		case 'c': config.probe_rate = atof(optarg); break;
+		case 'w': config.window = (unsigned)atoi(optarg); break;
+		case 'k':
+			if (_parse_cache(optarg, &config.cache) != 0) {
+				_usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'D': config.repeat = atof(optarg); break;
+		case 'f': {
+			unsigned mean = 0, variance = 0;
+			if (sscanf(optarg, "%u:%u", &mean, &variance) != 2 || mean > 255 || variance > 65535) {
+				_usage(argv[0]);
+				return 1;
+			}
+			config.filter = FILTER_ARGUMENT(mean, variance);
+			break;
+		}
+		case 'z': config.dark = atof(optarg); break;
+		case 'e': {
+			unsigned percent = (unsigned)atoi(optarg);
+			if (percent > 100) {
+				_usage(argv[0]);
+				return 1;
+			}
+			config.delta = 1 | percent << 8;
+			break;
+		}
+		case 'g': config.cascade = (uint32_t)atoi(optarg) & 0xFF; break;
+		case 'x': {
+			// Zero is a valid margin, so not _parse_list()
+			const char* p = optarg;
+			config.exits = 0;
+			for (int i = 0; *p != '\0'; i++) {
+				char* endp;
+				unsigned long margin = strtoul(p, &endp, 10);
+				if (endp == p || margin > 255 || i == EARLY_EXITS) {
+					_usage(argv[0]);
+					return 1;
+				}
+				config.exits |= (uint32_t)margin << (i * 8);
+				p = (*endp == ',') ? endp + 1 : endp;
+			}
+			break;
+		}
+		case 'C': csv = true; break;
+		case 'v': mt3620_host_log(true); break;
+		default: _usage(argv[0]); return opt == 'h' ? 0 : 1;
+		}
+	}
+	int load_count = _parse_list(rates != NULL ? rates : multipliers, loads, 32);
+	if (load_count <= 0 || config.seconds <= 0 || config.probe_rate < 0 || config.burst < 1 ||
+	    config.queue_cap < 1 || config.queue_cap > MAX_QUEUE) {
+		_usage(argv[0]);
+		return 1;
+	}
+	bool any = false;
+	for (int mode = 0; mode < MODE_COUNT; mode++) {
+		any |= modes[mode];
+	}
+	for (int mode = 0; mode < MODE_COUNT && !any; mode++) {
+		modes[mode] = true;
+	}
+
+	double inference = _inference_seconds(50);
+
+	hl = mt3620_host_boot(buffer_log2);
+	if (hl == NULL) {
+		fprintf(stderr, "failed to start the emulated RT core\n");
+		return 1;
+	}
+
+	if (!csv) {
+		printf("inference %.3f ms (%.0f images/s), %u-byte buffers, sender queue %u, bursts of %u\n",
+		       inference * 1e3, 1.0 / inference, 1u << buffer_log2, config.queue_cap, config.burst);
+	}
+	_print_header(csv);
+
+	for (int i = 0; i < load_count; i++) {
+		double fps = (rates != NULL) ? loads[i] : loads[i] / inference;
+
+		for (int mode = 0; mode < MODE_COUNT; mode++) {
+			if (!modes[mode]) {
+				continue;
+			}
+			load_result_t result = { 0 };
+			size_t max = (size_t)(config.seconds * fps) + config.burst + 16;
+			result.latency = calloc(max + MAX_QUEUE + MAX_OUTSTANDING, sizeof(double));
+			result.probe_latency = calloc((size_t)(config.seconds * config.probe_rate) + 2, sizeof(double));
+
+			_run((load_mode_t)mode, fps, &config, &result);
+			_print_result(csv, (load_mode_t)mode, fps * inference, fps, &config, &result);
+
+			free(result.latency);
+			free(result.probe_latency);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,239 @@
+// Wake-up latency of the RT core firmware and idle CPU cost of the HL side's
+// doorbell wait versus busy-polling. The firmware runs on the host emulator
+// (host/mt3620_host.c), idle between messages: the HL side sends CONTROL_STATS
+// frames at a fixed interval, in bursts written with one doorbell, through
+// the real ring (EnqueueDataBatch) and mailbox. The RT core takes them in its
+// mailbox interrupt, wakes from WFI in WaitForRequest, answers them and rings
+// back. For every burst the tool reports when the RT main loop woke, from the
+// cycle counter in the telemetry page it publishes on every wakeup, and for
+// every message when its reply was dequeued on the HL side, which either
+// sleeps on the RT -> HL doorbell or spins on DequeueData.
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "intercore-protocol.h"
+#include "mt3620_host.h"
+
+#define MAX_BURST 32
+
+static mt3620_host_hl_t* hl;
+
+typedef struct {
+	double* round_trip;  // doorbell to reply dequeued, per message, us
+	double* wake;        // doorbell to RT main loop awake, per burst, us
+	int replies;
+	int wakes;
+	uint64_t wakeups;    // HL waits that returned with replies
+	double cpu_ms;
+	double wall_ms;
+	mt3620_host_stats_t stats;
+} wake_result_t;
+
+static double _now(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int _cmp_double(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static int _telemetry(TelemetryPage* page)
+{
+	int retries = ReadHeaderWords(hl->inbound, (uint32_t*)page, sizeof(*page) / sizeof(uint32_t), 16);
+	return (retries == -1 || page->version != TELEMETRY_VERSION) ? -1 : 0;
+}
+
+// Write a burst of CONTROL_STATS frames, numbered from `first`, with one doorbell.
+static bool _send_burst(uint32_t first, int count)
+{
+	static uint8_t frames[MAX_BURST][FRAME_PAYLOAD_OFFSET + sizeof(ControlRequest)];
+	IntercoreMessage messages[MAX_BURST];
+	ControlRequest request = { .command = CONTROL_STATS };
+
+	for (int i = 0; i < count; i++) {
+		FrameHeader header = {
+			.version = FRAME_VERSION,
+			.flags = FRAME_FLAG_CONTROL,
+			.fragmentCount = 1,
+			.requestId = first + (uint32_t)i,
+			.payloadLength = sizeof(ControlRequest),
+		};
+		memset(frames[i], 0, FRAME_ENVELOPE_SIZE);
+		memcpy(&frames[i][FRAME_ENVELOPE_SIZE], &header, sizeof(header));
+		memcpy(&frames[i][FRAME_PAYLOAD_OFFSET], &request, sizeof(request));
+		messages[i].data = frames[i];
+		messages[i].size = sizeof(frames[i]);
+	}
+	return EnqueueDataBatch(hl->inbound, hl->outbound, hl->buf_size, messages, (uint32_t)count) == (uint32_t)count;
+}
+
+// Dequeue every reply in the shared buffer. Returns how many there were.
+static int _receive(const double* sent, int messages, wake_result_t* r)
+{
+	uint8_t reply[256];
+	uint32_t size = sizeof(reply);
+	int received = 0;
+
+	while (DequeueData(hl->outbound, hl->inbound, hl->buf_size, reply, &size) == 0) {
+		double now = _now(CLOCK_MONOTONIC);
+		FrameHeader header;
+		if (size >= FRAME_PAYLOAD_OFFSET) {
+			memcpy(&header, &reply[FRAME_ENVELOPE_SIZE], sizeof(header));
+			if ((header.flags & FRAME_FLAG_CONTROL) && header.requestId < (uint32_t)messages) {
+				r->round_trip[r->replies++] = (now - sent[header.requestId]) * 1e6;
+				received++;
+			}
+		}
+		size = sizeof(reply);
+	}
+	return received;
+}
+
+static void _run(bool spin, int messages, int burst, int interval_us, wake_result_t* r)
+{
+	double* sent = calloc((size_t)messages, sizeof(double));
+	double interval = interval_us * 1e-6;
+	mt3620_host_stats_t before;
+	TelemetryPage page;
+	uint32_t heartbeat = 0, rang = 0;
+
+	mt3620_host_stats(&before);
+	double start = _now(CLOCK_MONOTONIC);
+	double cpu_start = _now(CLOCK_THREAD_CPUTIME_ID);
+	double next = start;
+	int count = 0;
+
+	while (r->replies < messages) {
+		double now = _now(CLOCK_MONOTONIC);
+		if (now > next + 1.0) {
+			fprintf(stderr, "timed out with %d replies outstanding\n", count - r->replies);
+			break;
+		}
+
+		// The RT core publishes its telemetry page every time it wakes, before it answers.
+		if (count > 0 && r->replies == count && _telemetry(&page) == 0 && page.heartbeat != heartbeat) {
+			r->wake[r->wakes++] = (double)(uint32_t)(page.updateCycle - rang) * 1e6 / MT3620_HOST_CLOCK_HZ;
+			heartbeat = page.heartbeat;
+		}
+
+		if (count < messages && now >= next) {
+			int n = (messages - count < burst) ? messages - count : burst;
+			if (_telemetry(&page) == 0) {
+				heartbeat = page.heartbeat;
+			}
+			rang = mt3620_host_cycles();
+			for (int i = 0; i < n; i++) {
+				sent[count + i] = now;
+			}
+			if (!_send_burst((uint32_t)count, n)) {
+				fprintf(stderr, "shared buffer full\n");
+				break;
+			}
+			count += n;
+			next += interval;
+			continue;
+		}
+
+		uint32_t seen = doorbell_read(&hl->data);
+		if (_receive(sent, messages, r) > 0) {
+			r->wakeups++;
+			continue;
+		}
+		if (!spin) {
+			double wait = (count < messages ? next : now + 0.1) - now;
+			doorbell_wait(&hl->data, seen, (int64_t)(wait * 1e9));
+		}
+	}
+
+	r->wall_ms = (_now(CLOCK_MONOTONIC) - start) * 1e3;
+	r->cpu_ms = (_now(CLOCK_THREAD_CPUTIME_ID) - cpu_start) * 1e3;
+	mt3620_host_stats(&r->stats);
+	r->stats.rt_doorbells -= before.rt_doorbells;
+	r->stats.rt_interrupts -= before.rt_interrupts;
+	r->stats.hl_data_rings -= before.hl_data_rings;
+	r->stats.hl_space_rings -= before.hl_space_rings;
+	free(sent);
+}
+
+static void _print(const char* name, int messages, const wake_result_t* r)
+{
+	if (r->replies == 0) {
+		printf("%-8s no replies\n", name);
+		return;
+	}
+	qsort(r->round_trip, (size_t)r->replies, sizeof(double), _cmp_double);
+	qsort(r->wake, (size_t)r->wakes, sizeof(double), _cmp_double);
+	double wake50 = r->wakes ? r->wake[r->wakes / 2] : 0.0;
+	double wake99 = r->wakes ? r->wake[(size_t)r->wakes * 99 / 100] : 0.0;
+	printf("%-8s %9.1f %9.1f %9.1f %9.1f %9.1f %8.1f%% %9.2f %9.2f %9.2f\n", name, wake50, wake99,
+	       r->round_trip[r->replies / 2], r->round_trip[(size_t)r->replies * 99 / 100],
+	       r->round_trip[r->replies - 1], 100.0 * r->cpu_ms / r->wall_ms,
+	       (double)r->replies / (double)(r->wakeups ? r->wakeups : 1),
+	       (double)r->stats.rt_interrupts / messages, (double)r->stats.hl_data_rings / messages);
+}
+
+static void _usage(const char* argv0)
+{
+	fprintf(stderr, "usage: %s [-n messages] [-b burst] [-i interval_us] [-v]\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+	int messages = 5000, burst = 1, interval_us = 200;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:b:i:vh")) != -1) {
+		switch (opt) {
+		case 'n': messages = atoi(optarg); break;
+		case 'b': burst = atoi(optarg); break;
+		case 'i': interval_us = atoi(optarg); break;
+		case 'v': mt3620_host_log(true); break;
+		default: _usage(argv[0]); return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (messages < 1 || burst < 1 || burst > MAX_BURST || interval_us < 1) {
+		_usage(argv[0]);
+		return 1;
+	}
+
+	hl = mt3620_host_boot(14);
+	if (hl == NULL) {
+		fprintf(stderr, "failed to start the emulated RT core\n");
+		return 1;
+	}
+	// Wait for the firmware to publish its first telemetry page, once it is idle.
+	TelemetryPage page;
+	double boot = _now(CLOCK_MONOTONIC);
+	while (_telemetry(&page) != 0) {
+		if (_now(CLOCK_MONOTONIC) > boot + 5.0) {
+			fprintf(stderr, "the emulated RT core did not start\n");
+			return 1;
+		}
+		doorbell_wait(&hl->data, doorbell_read(&hl->data), 1000000);
+	}
+
+	printf("%d messages, %d per doorbell, every %d us\n", messages, burst, interval_us);
+	printf("%-8s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n", "HL wait", "wake p50", "wake p99", "reply p50",
+	       "reply p99", "reply max", "HL cpu", "msg/wake", "RT irq", "RT rings");
+	const char* names[2] = { "doorbell", "spin" };
+	for (int spin = 0; spin < 2; spin++) {
+		wake_result_t r = { 0 };
+		r.round_trip = calloc((size_t)messages, sizeof(double));
+		r.wake = calloc((size_t)messages, sizeof(double));
+		_run(spin != 0, messages, burst, interval_us, &r);
+		_print(names[spin], messages, &r);
+		free(r.round_trip);
+		free(r.wake);
+	}
+	return 0;
+}
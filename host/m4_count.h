@@ -0,0 +1,87 @@
+/*
+ * Instruction counters behind the M4 cycle estimator (host/m4_cycles.h).
+ *
+ * The counting build of the inference library is compiled with
+ * HOST_CYCLE_COUNT and this header force-included (-include m4_count.h), so
+ * that it is seen before any CMSIS header. The DSP intrinsic emulations in
+ * host/cmsis_compiler.h then bump a counter per call, and the word loads and
+ * stores CMSIS-NN makes through __SIMD32 and the arm_nn_read_* helpers are
+ * counted here.
+ */
+
+#ifndef HOST_M4_COUNT_H
+#define HOST_M4_COUNT_H
+
+#include <stdint.h>
+
+typedef enum {
+	// DSP instructions, counted by the intrinsic emulations
+	M4_OP_SMLAD,    // SMLAD, SMLADX, SMLSDX
+	M4_OP_SMUAD,    // SMUAD, SMUADX, SMUSD, SMUSDX
+	M4_OP_SMLALD,   // SMLALD, SMLALDX
+	M4_OP_SMMLA,
+	M4_OP_SXTB16,   // SXTB16, SXTAB16
+	M4_OP_PKH,      // PKHBT, PKHTB
+	M4_OP_SIMD_ADD, // QADD8/16, QSUB8/16, SHADD16, SHSUB16, QASX, SHASX, QSAX, SHSAX
+	M4_OP_QADD,     // QADD, QSUB
+	M4_OP_SAT,      // SSAT, USAT
+	M4_OP_ROR,
+	M4_OP_WORD,     // 32-bit LDR/STR through __SIMD32 or arm_nn_read_*
+	// Scalar work the emulation cannot see, counted by the kernel wrappers in
+	// m4_cycles.c in units of each kernel's inner loop
+	M4_OP_CALL,
+	M4_OP_CONV_OUT,     // one requantised convolution output
+	M4_OP_IM2COL_ELEM,  // one bytewise im2col copy (channels beyond a multiple of 4)
+	M4_OP_FC_ROW,       // one fully-connected output
+	M4_OP_MAXPOOL_ELEM, // one byte compare in a pooling window
+	M4_OP_AVEPOOL_ELEM, // one division in the scale-back loop
+	M4_OP_RELU_ELEM,
+	M4_OP_SOFTMAX_ELEM,
+	M4_OP_MEAN_ELEM,    // one pixel byte of mean_subtract()
+	M4_OP_COUNT
+} m4_op_t;
+
+extern _Thread_local uint64_t m4_op_counts[M4_OP_COUNT];
+
+#ifdef HOST_CYCLE_COUNT
+
+#define HOST_DSP_COUNT(op) ((void)m4_op_counts[M4_OP_##op]++)
+
+// Build the support header with its word readers renamed, then route every
+// later use through a counting wrapper. read_and_pad*() call the renamed
+// reader internally, so they are wrapped themselves.
+#define arm_nn_read_q15x2_ia __cmsis_arm_nn_read_q15x2_ia
+#define arm_nn_read_q7x4_ia __cmsis_arm_nn_read_q7x4_ia
+#define arm_nn_read_q15x2 __cmsis_arm_nn_read_q15x2
+#define arm_nn_read_q7x4 __cmsis_arm_nn_read_q7x4
+#define read_and_pad __cmsis_read_and_pad
+#define read_and_pad_reordered __cmsis_read_and_pad_reordered
+#include "arm_nnsupportfunctions.h"
+#undef arm_nn_read_q15x2_ia
+#undef arm_nn_read_q7x4_ia
+#undef arm_nn_read_q15x2
+#undef arm_nn_read_q7x4
+#undef read_and_pad
+#undef read_and_pad_reordered
+
+#define arm_nn_read_q15x2_ia(p) (HOST_DSP_COUNT(WORD), __cmsis_arm_nn_read_q15x2_ia(p))
+#define arm_nn_read_q7x4_ia(p) (HOST_DSP_COUNT(WORD), __cmsis_arm_nn_read_q7x4_ia(p))
+#define arm_nn_read_q15x2(p) (HOST_DSP_COUNT(WORD), __cmsis_arm_nn_read_q15x2(p))
+#define arm_nn_read_q7x4(p) (HOST_DSP_COUNT(WORD), __cmsis_arm_nn_read_q7x4(p))
+#define read_and_pad(src, out1, out2) (HOST_DSP_COUNT(WORD), __cmsis_read_and_pad((src), (out1), (out2)))
+#define read_and_pad_reordered(src, out1, out2) \
+	(HOST_DSP_COUNT(WORD), __cmsis_read_and_pad_reordered((src), (out1), (out2)))
+
+static inline void* __host_count_word(void* addr)
+{
+	HOST_DSP_COUNT(WORD);
+	return addr;
+}
+
+// Same lvalue as the arm_math.h definition, so "*__SIMD32(p)++" still works.
+#undef __SIMD32
+#define __SIMD32(addr) (*(__SIMD32_TYPE**)__host_count_word(&(addr)))
+
+#endif /* HOST_CYCLE_COUNT */
+
+#endif /* HOST_M4_COUNT_H */
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "m4_cycles.h"
+
+_Thread_local uint64_t m4_op_counts[M4_OP_COUNT];
+static _Thread_local const char* last_kernel;
+
+static const char* const op_names[M4_OP_COUNT] = {
+	[M4_OP_SMLAD] = "smlad",
+	[M4_OP_SMUAD] = "smuad",
+	[M4_OP_SMLALD] = "smlald",
+	[M4_OP_SMMLA] = "smmla",
+	[M4_OP_SXTB16] = "sxtb16",
+	[M4_OP_PKH] = "pkh",
+	[M4_OP_SIMD_ADD] = "simd_add",
+	[M4_OP_QADD] = "qadd",
+	[M4_OP_SAT] = "sat",
+	[M4_OP_ROR] = "ror",
+	[M4_OP_WORD] = "word",
+	[M4_OP_CALL] = "call",
+	[M4_OP_CONV_OUT] = "conv_out",
+	[M4_OP_IM2COL_ELEM] = "im2col_elem",
+	[M4_OP_FC_ROW] = "fc_row",
+	[M4_OP_MAXPOOL_ELEM] = "maxpool_elem",
+	[M4_OP_AVEPOOL_ELEM] = "avepool_elem",
+	[M4_OP_RELU_ELEM] = "relu_elem",
+	[M4_OP_SOFTMAX_ELEM] = "softmax_elem",
+	[M4_OP_MEAN_ELEM] = "mean_elem",
+};
+
+// Cycles per counted event. DSP instructions issue in one cycle on the M4.
+// The loop branch (1 + 1..3 refill), pointer arithmetic and byte loads around
+// them are not visible to the emulation, so "word" carries the load/store
+// plus its share of the inner-loop overhead, and the scalar entries are
+// whole loop iterations read off the code generated for the RT core.
+// Calibrate by timing a layer on the board (DWT->CYCCNT) and overriding the
+// entries with m4_cycles_load_costs().
+static double op_costs[M4_OP_COUNT] = {
+	[M4_OP_SMLAD] = 1.0,
+	[M4_OP_SMUAD] = 1.0,
+	[M4_OP_SMLALD] = 1.0,
+	[M4_OP_SMMLA] = 1.0,
+	[M4_OP_SXTB16] = 1.0,
+	[M4_OP_PKH] = 1.0,
+	[M4_OP_SIMD_ADD] = 1.0,
+	[M4_OP_QADD] = 1.0,
+	[M4_OP_SAT] = 1.0,
+	[M4_OP_ROR] = 1.0,
+	[M4_OP_WORD] = 2.5,
+	[M4_OP_CALL] = 40.0,
+	[M4_OP_CONV_OUT] = 10.0,
+	[M4_OP_IM2COL_ELEM] = 4.0,
+	[M4_OP_FC_ROW] = 10.0,
+	[M4_OP_MAXPOOL_ELEM] = 4.0,
+	[M4_OP_AVEPOOL_ELEM] = 12.0,
+	[M4_OP_RELU_ELEM] = 6.0,
+	[M4_OP_SOFTMAX_ELEM] = 24.0,
+	[M4_OP_MEAN_ELEM] = 9.0,
+};
+
+static inline void _count(m4_op_t op, uint64_t n)
+{
+	m4_op_counts[op] += n;
+}
+
+static void _count_call(const char* kernel)
+{
+	last_kernel = kernel;
+	_count(M4_OP_CALL, 1);
+}
+
+// The basic kernels widen each input pixel with arm_q7_to_q15_no_shift(),
+// whose words are counted; its ch_in % 4 tail is copied byte by byte.
+static void _count_im2col(uint64_t out_pixels, uint32_t kernel_area, uint16_t ch_im_in)
+{
+	_count(M4_OP_IM2COL_ELEM, out_pixels * kernel_area * (ch_im_in % 4));
+}
+
+#define COUNTED_CONV(fn, kernel, bytewise_im2col)                                                                      \
+	static arm_status _##fn(const q7_t* in, const uint16_t dim_im_in, const uint16_t ch_im_in, const q7_t* wt,         \
+	                        const uint16_t ch_im_out, const uint16_t dim_kernel, const uint16_t padding,               \
+	                        const uint16_t stride, const q7_t* bias, const uint16_t bias_shift,                        \
+	                        const uint16_t out_shift, q7_t* out, const uint16_t dim_im_out, q15_t* bufferA,            \
+	                        q7_t* bufferB)                                                                             \
+	{                                                                                                                  \
+		_count_call(kernel);                                                                                           \
+		_count(M4_OP_CONV_OUT, (uint64_t)dim_im_out * dim_im_out * ch_im_out);                                         \
+		if (bytewise_im2col) {                                                                                         \
+			_count_im2col((uint64_t)dim_im_out * dim_im_out, (uint32_t)dim_kernel * dim_kernel, ch_im_in);             \
+		}                                                                                                              \
+		return fn(in, dim_im_in, ch_im_in, wt, ch_im_out, dim_kernel, padding, stride, bias, bias_shift, out_shift,    \
+		          out, dim_im_out, bufferA, bufferB);                                                                  \
+	}
+
+#define COUNTED_CONV_NONSQUARE(fn, kernel, bytewise_im2col)                                                            \
+	static arm_status _##fn(const q7_t* in, const uint16_t dim_im_in_x, const uint16_t dim_im_in_y,                    \
+	                        const uint16_t ch_im_in, const q7_t* wt, const uint16_t ch_im_out,                         \
+	                        const uint16_t dim_kernel_x, const uint16_t dim_kernel_y, const uint16_t padding_x,        \
+	                        const uint16_t padding_y, const uint16_t stride_x, const uint16_t stride_y,                \
+	                        const q7_t* bias, const uint16_t bias_shift, const uint16_t out_shift, q7_t* out,          \
+	                        const uint16_t dim_im_out_x, const uint16_t dim_im_out_y, q15_t* bufferA,                  \
+	                        q7_t* bufferB)                                                                             \
+	{                                                                                                                  \
+		_count_call(kernel);                                                                                           \
+		_count(M4_OP_CONV_OUT, (uint64_t)dim_im_out_x * dim_im_out_y * ch_im_out);                                     \
+		if (bytewise_im2col) {                                                                                         \
+			_count_im2col((uint64_t)dim_im_out_x * dim_im_out_y, (uint32_t)dim_kernel_x * dim_kernel_y, ch_im_in);     \
+		}                                                                                                              \
+		return fn(in, dim_im_in_x, dim_im_in_y, ch_im_in, wt, ch_im_out, dim_kernel_x, dim_kernel_y, padding_x,        \
+		          padding_y, stride_x, stride_y, bias, bias_shift, out_shift, out, dim_im_out_x, dim_im_out_y,         \
+		          bufferA, bufferB);                                                                                   \
+	}
+
+COUNTED_CONV(arm_convolve_HWC_q7_RGB, "conv_rgb", 0)
+COUNTED_CONV(arm_convolve_HWC_q7_basic, "conv_basic", 1)
+COUNTED_CONV(arm_convolve_HWC_q7_fast, "conv_fast", 0)
+COUNTED_CONV_NONSQUARE(arm_convolve_HWC_q7_basic_nonsquare, "conv_basic_nonsquare", 1)
+COUNTED_CONV_NONSQUARE(arm_convolve_HWC_q7_fast_nonsquare, "conv_fast_nonsquare", 0)
+COUNTED_CONV_NONSQUARE(arm_convolve_1x1_HWC_q7_fast_nonsquare, "conv_1x1", 0)
+
+// Both pooling kernels run an x pass over dim_im_in rows and a y pass over
+// dim_im_out rows.
+static uint64_t _pool_elements(uint16_t dim_im_in, uint16_t ch_im_in, uint16_t dim_im_out)
+{
+	return ((uint64_t)dim_im_in * dim_im_out + (uint64_t)dim_im_out * dim_im_out) * ch_im_in;
+}
+
+static void _arm_maxpool_q7_HWC(q7_t* in, const uint16_t dim_im_in, const uint16_t ch_im_in, const uint16_t dim_kernel,
+                                const uint16_t padding, const uint16_t stride, const uint16_t dim_im_out, q7_t* bufferA,
+                                q7_t* out)
+{
+	_count_call("maxpool");
+	// compare_and_replace_if_larger_q7() compares bytewise after its word loads
+	_count(M4_OP_MAXPOOL_ELEM, _pool_elements(dim_im_in, ch_im_in, dim_im_out) * (dim_kernel - 1));
+	arm_maxpool_q7_HWC(in, dim_im_in, ch_im_in, dim_kernel, padding, stride, dim_im_out, bufferA, out);
+}
+
+static void _arm_avepool_q7_HWC(q7_t* in, const uint16_t dim_im_in, const uint16_t ch_im_in, const uint16_t dim_kernel,
+                                const uint16_t padding, const uint16_t stride, const uint16_t dim_im_out, q7_t* bufferA,
+                                q7_t* out)
+{
+	_count_call("avepool");
+	_count(M4_OP_AVEPOOL_ELEM, _pool_elements(dim_im_in, ch_im_in, dim_im_out));
+	arm_avepool_q7_HWC(in, dim_im_in, ch_im_in, dim_kernel, padding, stride, dim_im_out, bufferA, out);
+}
+
+static void _arm_relu_q7(q7_t* data, uint16_t size)
+{
+	_count_call("relu");
+	_count(M4_OP_RELU_ELEM, size);
+	arm_relu_q7(data, size);
+}
+
+static arm_status _arm_fully_connected_q7_opt(const q7_t* vec, const q7_t* mat, const uint16_t dim_vec,
+                                              const uint16_t num_of_rows, const uint16_t bias_shift,
+                                              const uint16_t out_shift, const q7_t* bias, q7_t* out,
+                                              q15_t* vec_buffer)
+{
+	_count_call("fc_opt");
+	_count(M4_OP_FC_ROW, num_of_rows);
+	return arm_fully_connected_q7_opt(vec, mat, dim_vec, num_of_rows, bias_shift, out_shift, bias, out, vec_buffer);
+}
+
+static void _arm_softmax_q7(const q7_t* in, const uint16_t dim_vec, q7_t* out)
+{
+	_count_call("softmax");
+	_count(M4_OP_SOFTMAX_ELEM, dim_vec);
+	arm_softmax_q7(in, dim_vec, out);
+}
+
+const nn_kernels_t m4_cycles_kernels = {
+	.name = "cmsis-counted",
+	.conv_rgb = _arm_convolve_HWC_q7_RGB,
+	.conv_basic = _arm_convolve_HWC_q7_basic,
+	.conv_fast = _arm_convolve_HWC_q7_fast,
+	.conv_basic_nonsquare = _arm_convolve_HWC_q7_basic_nonsquare,
+	.conv_fast_nonsquare = _arm_convolve_HWC_q7_fast_nonsquare,
+	.conv_1x1 = _arm_convolve_1x1_HWC_q7_fast_nonsquare,
+	.maxpool = _arm_maxpool_q7_HWC,
+	.avepool = _arm_avepool_q7_HWC,
+	.relu = _arm_relu_q7,
+	.fc_opt = _arm_fully_connected_q7_opt,
+	.softmax = _arm_softmax_q7,
+};
+
+void m4_cycles_mean_subtract(q7_t* image_data)
+{
+	_count_call("mean_subtract");
+	_count(M4_OP_MEAN_ELEM, DATA_OUT_CH * DATA_OUT_DIM * DATA_OUT_DIM);
+	mean_subtract(image_data);
+}
+
+void m4_cycles_reset(void)
+{
+	memset(m4_op_counts, 0, sizeof(m4_op_counts));
+	last_kernel = NULL;
+}
+
+void m4_cycles_read(m4_counts_t* counts)
+{
+	memcpy(counts->ops, m4_op_counts, sizeof(counts->ops));
+}
+
+void m4_cycles_sub(m4_counts_t* after, const m4_counts_t* before)
+{
+	for (int i = 0; i < M4_OP_COUNT; i++) {
+		after->ops[i] -= before->ops[i];
+	}
+}
+
+const char* m4_cycles_last_kernel(void)
+{
+	return (last_kernel != NULL) ? last_kernel : "-";
+}
+
+const char* m4_cycles_op_name(m4_op_t op)
+{
+	return op_names[op];
+}
+
+double m4_cycles_cost(m4_op_t op)
+{
+	return op_costs[op];
+}
+
+double m4_cycles_estimate(const m4_counts_t* counts)
+{
+	double cycles = 0.0;
+	for (int i = 0; i < M4_OP_COUNT; i++) {
+		cycles += (double)counts->ops[i] * op_costs[i];
+	}
+	return cycles;
+}
+
+int m4_cycles_load_costs(const char* path)
+{
+	FILE* f = fopen(path, "r");
+	char line[128];
+	int lineno = 0;
+
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char name[32];
+		double cycles;
+		int op;
+
+		lineno++;
+		line[strcspn(line, "#\n")] = '\0';
+		if (line[strspn(line, " \t")] == '\0') {
+			continue;
+		}
+		if (sscanf(line, "%31s %lf", name, &cycles) != 2) {
+			fprintf(stderr, "%s:%d: expected \"<op> <cycles>\"\n", path, lineno);
+			fclose(f);
+			return -1;
+		}
+		for (op = 0; op < M4_OP_COUNT && strcmp(op_names[op], name) != 0; op++) {
+		}
+		if (op == M4_OP_COUNT) {
+			fprintf(stderr, "%s:%d: unknown op '%s'\n", path, lineno, name);
+			fclose(f);
+			return -1;
+		}
+		op_costs[op] = cycles;
+	}
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef __M4_CYCLES_H
+#define __M4_CYCLES_H
+
+#include "m4_count.h"
+#include "nn.h"
+
+// Cortex-M4 cycle estimate for the host build: the counting library
+// (cifar10nn_cycles, built with HOST_CYCLE_COUNT) tallies the DSP intrinsics
+// and word loads/stores CMSIS-NN executes, the kernel wrappers below add the
+// scalar loop work the emulation cannot see, and a cost table turns the
+// counts into cycles. Counters are per thread.
+
+// Clock of the MT3620 real-time cores.
+#define M4_CLOCK_HZ 197600000.0
+
+typedef struct {
+	uint64_t ops[M4_OP_COUNT];
+} m4_counts_t;
+
+// nn_cmsis_kernels with every call counted.
+extern const nn_kernels_t m4_cycles_kernels;
+
+// mean_subtract() with its scalar work counted.
+void m4_cycles_mean_subtract(q7_t* image_data);
+
+void m4_cycles_reset(void);
+void m4_cycles_read(m4_counts_t* counts);
+// after -= before
+void m4_cycles_sub(m4_counts_t* after, const m4_counts_t* before);
+
+// Name of the kernel the last counted call went to.
+const char* m4_cycles_last_kernel(void);
+
+const char* m4_cycles_op_name(m4_op_t op);
+double m4_cycles_cost(m4_op_t op);
+double m4_cycles_estimate(const m4_counts_t* counts);
+
+// Override cost table entries from a file of "<op name> <cycles>" lines, '#'
+// starts a comment. Returns 0 on success, -1 (with a message) otherwise.
+int m4_cycles_load_costs(const char* path);
+
+#endif
@@ -0,0 +1,311 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "mt3620_host.h"
+
+// Addresses and registers used by the firmware.
+#define MAILBOX_BASE 0x21050000u
+#define MAILBOX_CMD_POP0 0x50
+#define MAILBOX_DATA_POP0 0x54
+#define MAILBOX_FIFO_POP_CNT 0x58
+#define MAILBOX_SW_TX_INT_PORT 0x14
+#define MAILBOX_SW_RX_INT_EN 0x18
+#define MAILBOX_SW_RX_INT_STS 0x1C
+#define NVIC_ISER_BASE 0xE000E100u
+#define DWT_CYCCNT 0xE0001004u
+
+// Exception number of the first interrupt, see INT_TO_EXC in main.c.
+#define EXCEPTION_IRQ0 16
+#define MAILBOX_IRQ INTERCORE_IRQ
+
+extern const uintptr_t ExceptionVectorTable[];
+
+// Only its address is used, as the initial stack pointer.
+uint32_t StackTop;
+
+static struct {
+	mt3620_host_hl_t hl;
+	bool log;
+
+	// Mailbox command FIFO, filled before the firmware starts.
+	uint32_t fifo_cmd[4];
+	uint32_t fifo_data[4];
+	unsigned fifo_head, fifo_count;
+
+	// Emulated PRIMASK/BASEPRI: held by masked code and by interrupt handlers.
+	pthread_mutex_t core;
+	pthread_cond_t taken_cv;
+	uint64_t taken;
+
+	// Pending mailbox interrupt.
+	pthread_mutex_t irq_lock;
+	pthread_cond_t irq_cv;
+	uint32_t rx_status;
+	uint32_t rx_enable;
+	uint32_t nvic_enable[4];
+	bool pending;
+
+	mt3620_host_stats_t stats;
+} host = {
+	.core = PTHREAD_MUTEX_INITIALIZER,
+	.taken_cv = PTHREAD_COND_INITIALIZER,
+	.irq_lock = PTHREAD_MUTEX_INITIALIZER,
+	.irq_cv = PTHREAD_COND_INITIALIZER,
+};
+
+static _Thread_local bool hl_thread;
+
+void DebugUARTInit(void)
+{
+}
+
+void _putchar(char character)
+{
+	if (host.log) {
+		fputc(character, stderr);
+	}
+}
+
+void mt3620_host_log(bool enable)
+{
+	host.log = enable;
+}
+
+void mt3620_host_stats(mt3620_host_stats_t* stats)
+{
+	pthread_mutex_lock(&host.irq_lock);
+	*stats = host.stats;
+	pthread_mutex_unlock(&host.irq_lock);
+}
+
+// Called with irq_lock held.
+static void _update_pending(void)
+{
+	bool enabled = (host.nvic_enable[MAILBOX_IRQ / 32] >> (MAILBOX_IRQ % 32)) & 1;
+	if (enabled && (host.rx_status & host.rx_enable) && !host.pending) {
+		host.pending = true;
+		pthread_cond_signal(&host.irq_cv);
+	}
+}
+
+static void _mailbox_write(size_t offset, uint32_t value)
+{
+	switch (offset) {
+	case MAILBOX_SW_TX_INT_PORT:
+		if (hl_thread) {
+			// HL -> RT: raise the RT core's software interrupt.
+			pthread_mutex_lock(&host.irq_lock);
+			host.stats.rt_doorbells++;
+			host.rx_status |= value;
+			_update_pending();
+			pthread_mutex_unlock(&host.irq_lock);
+		} else {
+			if (value & (1u << 0)) {
+				__atomic_add_fetch(&host.stats.hl_data_rings, 1, __ATOMIC_RELAXED);
+				doorbell_ring(&host.hl.data);
+			}
+			if (value & (1u << 1)) {
+				__atomic_add_fetch(&host.stats.hl_space_rings, 1, __ATOMIC_RELAXED);
+				doorbell_ring(&host.hl.space);
+			}
+		}
+		break;
+	case MAILBOX_SW_RX_INT_EN:
+		pthread_mutex_lock(&host.irq_lock);
+		host.rx_enable = value;
+		_update_pending();
+		pthread_mutex_unlock(&host.irq_lock);
+		break;
+	case MAILBOX_SW_RX_INT_STS:
+		// Write 1 to clear.
+		pthread_mutex_lock(&host.irq_lock);
+		host.rx_status &= ~value;
+		pthread_mutex_unlock(&host.irq_lock);
+		break;
+	}
+}
+
+static uint32_t _mailbox_read(size_t offset)
+{
+	uint32_t value = 0;
+
+	switch (offset) {
+	case MAILBOX_FIFO_POP_CNT:
+		return host.fifo_count;
+	case MAILBOX_DATA_POP0:
+		return host.fifo_count ? host.fifo_data[host.fifo_head] : 0;
+	case MAILBOX_CMD_POP0:
+		if (host.fifo_count) {
+			value = host.fifo_cmd[host.fifo_head++];
+			host.fifo_count--;
+		}
+		return value;
+	case MAILBOX_SW_RX_INT_STS:
+		pthread_mutex_lock(&host.irq_lock);
+		value = host.rx_status;
+		pthread_mutex_unlock(&host.irq_lock);
+		return value;
+	}
+	return 0;
+}
+
+uint32_t mt3620_host_cycles(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	double seconds = (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+	return (uint32_t)(uint64_t)(seconds * MT3620_HOST_CLOCK_HZ);
+}
+
+void WriteReg8(uintptr_t baseAddr, size_t offset, uint8_t value)
+{
+	// NVIC priorities are not modelled, there is a single interrupt.
+	(void)baseAddr;
+	(void)offset;
+	(void)value;
+}
+
+void WriteReg32(uintptr_t baseAddr, size_t offset, uint32_t value)
+{
+	if (baseAddr == MAILBOX_BASE) {
+		_mailbox_write(offset, value);
+	} else if (baseAddr == NVIC_ISER_BASE && offset / 4 < 4) {
+		pthread_mutex_lock(&host.irq_lock);
+		host.nvic_enable[offset / 4] |= value;
+		_update_pending();
+		pthread_mutex_unlock(&host.irq_lock);
+	}
+	// Clock, UART and debug registers are ignored.
+}
+
+uint32_t ReadReg32(uintptr_t baseAddr, size_t offset)
+{
+	if (baseAddr == MAILBOX_BASE) {
+		return _mailbox_read(offset);
+	}
+	if (baseAddr + offset == DWT_CYCCNT) {
+		return mt3620_host_cycles();
+	}
+	return 0;
+}
+
+uint32_t BlockIrqs(void)
+{
+	pthread_mutex_lock(&host.core);
+	return 0;
+}
+
+void RestoreIrqs(uint32_t prevBasePri)
+{
+	(void)prevBasePri;
+	pthread_mutex_unlock(&host.core);
+}
+
+void DisableIrqs(void)
+{
+	pthread_mutex_lock(&host.core);
+}
+
+void EnableIrqs(void)
+{
+	pthread_mutex_unlock(&host.core);
+}
+
+void WaitForInterrupt(void)
+{
+	// Called with the core lock held, like WFI with PRIMASK set: a pending
+	// interrupt is taken as soon as the lock is released, and wakes us.
+	uint64_t start = host.taken;
+	while (host.taken == start) {
+		pthread_cond_wait(&host.taken_cv, &host.core);
+	}
+}
+
+static void* _interrupt_thread(void* arg)
+{
+	Callback handler = (Callback)ExceptionVectorTable[EXCEPTION_IRQ0 + MAILBOX_IRQ];
+	(void)arg;
+
+	for (;;) {
+		pthread_mutex_lock(&host.irq_lock);
+		while (!host.pending) {
+			pthread_cond_wait(&host.irq_cv, &host.irq_lock);
+		}
+		host.pending = false;
+		host.stats.rt_interrupts++;
+		pthread_mutex_unlock(&host.irq_lock);
+
+		pthread_mutex_lock(&host.core);
+		handler();
+		host.taken++;
+		pthread_cond_broadcast(&host.taken_cv);
+		pthread_mutex_unlock(&host.core);
+
+		// A doorbell that arrived while the handler ran is still in the status register.
+		pthread_mutex_lock(&host.irq_lock);
+		_update_pending();
+		pthread_mutex_unlock(&host.irq_lock);
+	}
+	return NULL;
+}
+
+static void* _reset_thread(void* arg)
+{
+	Callback reset = (Callback)ExceptionVectorTable[1];
+	(void)arg;
+
+	reset();
+	return NULL;
+}
+
+// The mailbox carries 32-bit addresses, so the buffers must be below 4 GiB.
+static void* _alloc_shared(size_t size)
+{
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	return (p == MAP_FAILED) ? NULL : p;
+}
+
+mt3620_host_hl_t* mt3620_host_boot(unsigned buffer_log2)
+{
+	size_t size = (size_t)1 << buffer_log2;
+	if (buffer_log2 < 8 || buffer_log2 > 24) {
+		return NULL;
+	}
+
+	uint8_t* rt_outbound = _alloc_shared(size);
+	uint8_t* rt_inbound = _alloc_shared(size);
+	if (rt_outbound == NULL || rt_inbound == NULL) {
+		return NULL;
+	}
+
+	host.hl.outbound = (BufferHeader*)rt_inbound;
+	host.hl.inbound = (BufferHeader*)rt_outbound;
+	host.hl.buf_size = (uint32_t)(size - sizeof(BufferHeader));
+	doorbell_init(&host.hl.data);
+	doorbell_init(&host.hl.space);
+
+	// Buffer base address with the size (log2) in the low bits, see GetIntercoreBuffers.
+	host.fifo_cmd[0] = 0xba5e0001;
+	host.fifo_data[0] = (uint32_t)(uintptr_t)rt_outbound | buffer_log2;
+	host.fifo_cmd[1] = 0xba5e0002;
+	host.fifo_data[1] = (uint32_t)(uintptr_t)rt_inbound | buffer_log2;
+	host.fifo_cmd[2] = 0xba5e0003;
+	host.fifo_data[2] = 0;
+	host.fifo_count = 3;
+
+	hl_thread = true;
+
+	pthread_t irq, core;
+	if (pthread_create(&irq, NULL, _interrupt_thread, NULL) != 0 ||
+		pthread_create(&core, NULL, _reset_thread, NULL) != 0) {
+		return NULL;
+	}
+	pthread_detach(irq);
+	pthread_detach(core);
+
+	return &host.hl;
+}
@@ -0,0 +1,60 @@
+#ifndef __MT3620_HOST_H
+#define __MT3620_HOST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mt3620-intercore.h"
+#include "doorbell.h"
+
+// Runs the RT core firmware (main.c, mt3620-intercore.c, ...) unmodified on
+// Linux. mt3620-baremetal.h routes register access and interrupt masking
+// here when AzureSphere_HOST is defined:
+//   - the firmware starts on its own thread from the reset vector of
+//     ExceptionVectorTable, as the core would;
+//   - the mailbox command FIFO delivers the shared buffer addresses, and
+//     SW_TX_INT_PORT / SW_RX_INT_EN / SW_RX_INT_STS drive the doorbells;
+//   - interrupts are delivered by a separate thread that calls the handler in
+//     ExceptionVectorTable. BlockIrqs() and DisableIrqs() take a lock that the
+//     handler also holds, and WaitForInterrupt() sleeps until a handler has run,
+//     which reproduces the masking the firmware relies on;
+//   - the DWT cycle counter advances at 197.6 MHz of wall-clock time.
+//
+// The caller plays the high-level application. It uses the same ring
+// functions with the buffers swapped (EnqueueData(hl.inbound, hl.outbound, ...)
+// writes to the RT core), and a mailbox write from its thread interrupts the
+// RT core instead of itself.
+
+typedef struct {
+	// HL -> RT buffer (the RT core's inbound) and RT -> HL buffer.
+	BufferHeader* outbound;
+	BufferHeader* inbound;
+	uint32_t buf_size;
+	// Rung when the RT core has written a block, and when it has read one.
+	doorbell_t data;
+	doorbell_t space;
+} mt3620_host_hl_t;
+
+typedef struct {
+	uint64_t rt_doorbells;    // HL -> RT doorbells rung
+	uint64_t rt_interrupts;   // mailbox interrupts taken by the RT core
+	uint64_t hl_data_rings;   // RT -> HL "block written" doorbells
+	uint64_t hl_space_rings;  // RT -> HL "block read" doorbells
+} mt3620_host_stats_t;
+
+// Allocate two 2^buffer_log2 byte shared buffers, queue the buffer setup
+// messages and start the firmware. The calling thread becomes the HL side.
+// Returns the HL view of the buffers, or NULL on failure. Once per process.
+mt3620_host_hl_t* mt3620_host_boot(unsigned buffer_log2);
+
+// Send the firmware's Log_Debug output to stderr (default: discarded).
+void mt3620_host_log(bool enable);
+
+void mt3620_host_stats(mt3620_host_stats_t* stats);
+
+// The RT core's cycle counter (DWT_CYCCNT) as the firmware reads it, which
+// advances at MT3620_HOST_CLOCK_HZ of wall-clock time.
+#define MT3620_HOST_CLOCK_HZ 197600000.0
+uint32_t mt3620_host_cycles(void);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nn_parallel.h"
+#include "thread_pool.h"
+
+typedef struct {
+	q15_t* col;  // im2col buffer, 2 columns as in the CMSIS kernels
+	q7_t* slab;  // input rows of one band, zero rows where the layer pads
+} band_scratch_t;
+
+typedef struct {
+	const nn_kernels_t* kernels;
+	const nn_layer_t* layer;
+	const q7_t* in;
+	q7_t* out;
+} band_job_t;
+
+static thread_pool_t* pool;
+static band_scratch_t* scratch;
+
+int nn_parallel_init(unsigned threads, const nn_model_t* model)
+{
+	size_t col_size = 0, slab_size = 0;
+
+	for (uint8_t i = 0; i < model->layer_count; i++) {
+		const nn_layer_t* l = &model->layers[i];
+		if (l->type != NN_LAYER_CONV) {
+			continue;
+		}
+		size_t col = 2 * (size_t)l->in_ch * l->ker_dim * l->ker_dim * sizeof(q15_t);
+		size_t slab = ((size_t)(l->out_dim - 1) * l->stride + l->ker_dim) * l->in_dim * l->in_ch;
+		col_size = (col > col_size) ? col : col_size;
+		slab_size = (slab > slab_size) ? slab : slab_size;
+	}
+
+	pool = pool_create(threads);
+	if (pool == NULL) {
+		return -1;
+	}
+
+	scratch = calloc(pool_size(pool), sizeof(band_scratch_t));
+	if (scratch == NULL) {
+		nn_parallel_shutdown();
+		return -1;
+	}
+
+	for (unsigned i = 0; i < pool_size(pool); i++) {
+		scratch[i].col = aligned_alloc(64, (col_size + 63) & ~(size_t)63);
+		scratch[i].slab = aligned_alloc(64, (slab_size + 63) & ~(size_t)63);
+		if (scratch[i].col == NULL || scratch[i].slab == NULL) {
+			nn_parallel_shutdown();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void nn_parallel_shutdown(void)
+{
+	if (scratch != NULL) {
+		for (unsigned i = 0; i < pool_size(pool); i++) {
+			free(scratch[i].col);
+			free(scratch[i].slab);
+		}
+		free(scratch);
+		scratch = NULL;
+	}
+
+	pool_destroy(pool);
+	pool = NULL;
+}
+
+unsigned nn_parallel_threads(void)
+{
+	return (pool != NULL) ? pool_size(pool) : 1;
+}
+
+// Output rows [y0, y1) of a convolution layer. The input rows the band needs,
+// including the zero rows of the top/bottom padding, are copied into a slab so
+// the nonsquare kernels can run with padding_y = 0; horizontal padding is left
+// to the kernel. Every output is the same exact integer sum as in the serial
+// kernels, hence bit-identical.
+static void _conv_band(void* arg, unsigned worker, size_t y0, size_t y1)
+{
+	const band_job_t* job = arg;
+	const nn_layer_t* l = job->layer;
+	band_scratch_t* s = &scratch[worker];
+
+	const size_t row_bytes = (size_t)l->in_dim * l->in_ch;
+	const int first = (int)y0 * l->stride - l->pad;
+	const int rows = (int)(y1 - y0 - 1) * l->stride + l->ker_dim;
+
+	for (int r = 0; r < rows; r++) {
+		int src = first + r;
+		if (src < 0 || src >= l->in_dim) {
+			memset(s->slab + r * row_bytes, 0, row_bytes);
+		} else {
+			memcpy(s->slab + r * row_bytes, job->in + src * row_bytes, row_bytes);
+		}
+	}
+
+	q7_t* out = job->out + y0 * l->out_dim * l->out_ch;
+	if (l->in_ch % 4 == 0 && l->out_ch % 2 == 0) {
+		job->kernels->conv_fast_nonsquare(s->slab, l->in_dim, (uint16_t)rows, l->in_ch, l->wt, l->out_ch,
+		                                   l->ker_dim, l->ker_dim, l->pad, 0, l->stride, l->stride, l->bias,
+		                                   l->bias_lshift, l->out_rshift, out, l->out_dim, (uint16_t)(y1 - y0),
+		                                   s->col, NULL);
+	} else {
+		job->kernels->conv_basic_nonsquare(s->slab, l->in_dim, (uint16_t)rows, l->in_ch, l->wt, l->out_ch,
+		                                    l->ker_dim, l->ker_dim, l->pad, 0, l->stride, l->stride, l->bias,
+		                                    l->bias_lshift, l->out_rshift, out, l->out_dim, (uint16_t)(y1 - y0),
+		                                    s->col, NULL);
+	}
+}
+
+void nn_parallel_conv(nn_context_t* ctx, const nn_layer_t* layer, const q7_t* in, q7_t* out)
+{
+	band_job_t job = { .kernels = nn_kernels(ctx), .layer = layer, .in = in, .out = out };
+	// Two bands per worker: big enough to amortise the slab copy, small
+	// enough to leave something to steal.
+	size_t grain = layer->out_dim / (2 * pool_size(pool));
+
+	pool_parallel_for(pool, layer->out_dim, grain, _conv_band, &job);
+}
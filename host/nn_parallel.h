@@ -0,0 +1,24 @@
+#ifndef __NN_PARALLEL_H
+#define __NN_PARALLEL_H
+
+#include "nn.h"
+
+// Intra-layer parallel execution for the host build. Convolution layers are
+// split into bands of output rows that run on a thread pool, each worker with
+// its own im2col buffer; the call returns once every band is done, so the
+// next layer sees a complete tensor. Results are bit-identical to the serial
+// CMSIS-NN path.
+//
+// Usage: nn_parallel_init() once, then set ctx->conv = nn_parallel_conv on
+// the context passed to run_nn_ctx(). Only one inference may use the pool at
+// a time.
+
+// Start `threads` workers (including the caller) and size their scratch
+// buffers for the convolution layers of `model`. Returns 0 on success.
+int nn_parallel_init(unsigned threads, const nn_model_t* model);
+void nn_parallel_shutdown(void);
+unsigned nn_parallel_threads(void);
+
+void nn_parallel_conv(nn_context_t* ctx, const nn_layer_t* layer, const q7_t* in, q7_t* out);
+
+#endif
@@ -0,0 +1,63 @@
+#include <immintrin.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arm_nnsupportfunctions.h"
+#include "nn_x86.h"
+
+// Per-thread scratch for the widened weights and im2col patch of the
+// convolution kernels. The CMSIS bufferA is only sized for two q15 columns.
+static _Thread_local int16_t* x86_scratch;
+static _Thread_local size_t x86_scratch_size;
+
+static int16_t* _get_scratch(size_t elements)
+{
+	if (elements > x86_scratch_size) {
+		free(x86_scratch);
+		x86_scratch = aligned_alloc(32, (elements * sizeof(int16_t) + 31) & ~(size_t)31);
+		x86_scratch_size = (x86_scratch != NULL) ? elements : 0;
+	}
+	return x86_scratch;
+}
+
+// The kernels are written once in nn_x86_impl.h and compiled for each
+// instruction set, so the CPU can be picked at run time.
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#define X86_AVX2 0
+#define X86_SUFFIX sse41
+#define X86_NAME "x86-sse4.1"
+#include "nn_x86_impl.h"
+#undef X86_NAME
+#undef X86_SUFFIX
+#undef X86_AVX2
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define X86_AVX2 1
+#define X86_SUFFIX avx2
+#define X86_NAME "x86-avx2"
+#include "nn_x86_impl.h"
+#undef X86_NAME
+#undef X86_SUFFIX
+#undef X86_AVX2
+#pragma GCC pop_options
+
+const nn_kernels_t* nn_x86_kernels_sse41(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.1") ? &nn_x86_kernels_table_sse41 : NULL;
+}
+
+const nn_kernels_t* nn_x86_kernels_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") ? &nn_x86_kernels_table_avx2 : NULL;
+}
+
+const nn_kernels_t* nn_x86_kernels(void)
+{
+	const nn_kernels_t* k = nn_x86_kernels_avx2();
+	return (k != NULL) ? k : nn_x86_kernels_sse41();
+}
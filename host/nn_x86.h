@@ -0,0 +1,19 @@
+#ifndef __NN_X86_H
+#define __NN_X86_H
+
+#include "nn.h"
+
+// x86 SIMD versions of the q7 kernels nn_run() uses (HWC convolutions,
+// max/average pooling, ReLU, fully-connected q7_opt and softmax). Each one
+// reproduces the integer arithmetic of the CMSIS-NN ARM_MATH_DSP path
+// exactly, so outputs are byte-identical to the Cortex-M4 build.
+
+// Best kernel set this CPU supports (AVX2, then SSE4.1), or NULL when neither
+// is available and the CMSIS-NN kernels must be used.
+const nn_kernels_t* nn_x86_kernels(void);
+
+// A specific kernel set, NULL if the CPU lacks the instructions.
+const nn_kernels_t* nn_x86_kernels_sse41(void);
+const nn_kernels_t* nn_x86_kernels_avx2(void);
+
+#endif
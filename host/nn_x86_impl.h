@@ -0,0 +1,532 @@
+// Kernel bodies for nn_x86.c. Included once per instruction set with
+// X86_AVX2 (0 or 1), X86_SUFFIX and X86_NAME defined, inside a matching
+// "#pragma GCC target". Not a standalone header.
+
+#ifndef X86_FN
+#define X86_CAT2(a, b) a##_##b
+#define X86_CAT(a, b) X86_CAT2(a, b)
+#define X86_FN(name) X86_CAT(name, X86_SUFFIX)
+#endif
+
+static inline q7_t X86_FN(sat_q7)(int32_t v)
+{
+	return (q7_t)((v > 127) ? 127 : ((v < -128) ? -128 : v));
+}
+
+// dst[i] = (q15_t)src[i]
+static inline void X86_FN(widen_q7)(const q7_t* src, int16_t* dst, int n)
+{
+	int i = 0;
+#if X86_AVX2
+	for (; i + 16 <= n; i += 16) {
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(src + i))));
+	}
+#endif
+	for (; i + 8 <= n; i += 8) {
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)(src + i))));
+	}
+	for (; i < n; i++) {
+		dst[i] = src[i];
+	}
+}
+
+static inline int32_t X86_FN(hsum_epi32)(__m128i s)
+{
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+	return _mm_cvtsi128_si32(s);
+}
+
+// Sum of a[i] * b[i] for n int16 values, n a multiple of 16. pmaddwd wraps
+// like SMLAD, and -32768 never occurs in widened q7 data.
+static inline uint32_t X86_FN(dot_q15)(const int16_t* a, const int16_t* b, int n)
+{
+#if X86_AVX2
+	__m256i acc = _mm256_setzero_si256();
+	for (int i = 0; i < n; i += 16) {
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(a + i)),
+		                                              _mm256_loadu_si256((const __m256i*)(b + i))));
+	}
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+#else
+	__m128i s = _mm_setzero_si128();
+	for (int i = 0; i < n; i += 8) {
+		s = _mm_add_epi32(s, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(a + i)),
+		                                    _mm_loadu_si128((const __m128i*)(b + i))));
+	}
+#endif
+	return (uint32_t)X86_FN(hsum_epi32)(s);
+}
+
+// HWC q7 convolution with arbitrary geometry. Every output is
+// SSAT((bias << bias_shift) + NN_ROUND(out_shift) + sum(w * x)) >> out_shift,
+// the same exact integer the CMSIS-NN basic, fast and RGB kernels compute.
+static arm_status X86_FN(conv_generic)(const q7_t* in, int in_x, int in_y, int ch_in, const q7_t* wt, int ch_out,
+                                       int k_x, int k_y, int pad_x, int pad_y, int stride_x, int stride_y,
+                                       const q7_t* bias, uint16_t bias_shift, uint16_t out_shift, q7_t* out,
+                                       int out_x, int out_y)
+{
+	const int k = ch_in * k_x * k_y;
+	const int k16 = (k + 15) & ~15;
+	int16_t* w16 = _get_scratch((size_t)k16 * (ch_out + 1));
+
+	if (w16 == NULL) {
+		return ARM_MATH_ARGUMENT_ERROR;
+	}
+	int16_t* patch = w16 + (size_t)k16 * ch_out;
+
+	// Widen the weights once per call, each row zero-padded to k16.
+	for (int oc = 0; oc < ch_out; oc++) {
+		X86_FN(widen_q7)(wt + oc * k, w16 + oc * k16, k);
+		memset(w16 + oc * k16 + k, 0, (size_t)(k16 - k) * sizeof(int16_t));
+	}
+	memset(patch + k, 0, (size_t)(k16 - k) * sizeof(int16_t));
+
+	for (int y = 0; y < out_y; y++) {
+		for (int x = 0; x < out_x; x++) {
+			int16_t* p = patch;
+
+			// im2col, zero where the window hangs over the padding
+			for (int ky = 0; ky < k_y; ky++) {
+				int iy = y * stride_y - pad_y + ky;
+				for (int kx = 0; kx < k_x; kx++) {
+					int ix = x * stride_x - pad_x + kx;
+					if (iy < 0 || iy >= in_y || ix < 0 || ix >= in_x) {
+						memset(p, 0, (size_t)ch_in * sizeof(int16_t));
+					} else {
+						X86_FN(widen_q7)(in + (iy * in_x + ix) * ch_in, p, ch_in);
+					}
+					p += ch_in;
+				}
+			}
+
+			q7_t* o = out + (y * out_x + x) * ch_out;
+			for (int oc = 0; oc < ch_out; oc++) {
+				uint32_t sum = ((uint32_t)(int32_t)bias[oc] << bias_shift) + NN_ROUND(out_shift);
+				sum += X86_FN(dot_q15)(patch, w16 + oc * k16, k16);
+				o[oc] = X86_FN(sat_q7)((int32_t)sum >> out_shift);
+			}
+		}
+	}
+
+	return ARM_MATH_SUCCESS;
+}
+
+static arm_status X86_FN(conv_rgb)(const q7_t* in, const uint16_t dim_im_in, const uint16_t ch_im_in,
+                                   const q7_t* wt, const uint16_t ch_im_out, const uint16_t dim_kernel,
+                                   const uint16_t padding, const uint16_t stride, const q7_t* bias,
+                                   const uint16_t bias_shift, const uint16_t out_shift, q7_t* out,
+                                   const uint16_t dim_im_out, q15_t* bufferA, q7_t* bufferB)
+{
+	(void)bufferA;
+	(void)bufferB;
+	if (ch_im_in != 3) {
+		return ARM_MATH_SIZE_MISMATCH;
+	}
+	return X86_FN(conv_generic)(in, dim_im_in, dim_im_in, ch_im_in, wt, ch_im_out, dim_kernel, dim_kernel, padding,
+	                            padding, stride, stride, bias, bias_shift, out_shift, out, dim_im_out, dim_im_out);
+}
+
+static arm_status X86_FN(conv_basic)(const q7_t* in, const uint16_t dim_im_in, const uint16_t ch_im_in,
+                                     const q7_t* wt, const uint16_t ch_im_out, const uint16_t dim_kernel,
+                                     const uint16_t padding, const uint16_t stride, const q7_t* bias,
+                                     const uint16_t bias_shift, const uint16_t out_shift, q7_t* out,
+                                     const uint16_t dim_im_out, q15_t* bufferA, q7_t* bufferB)
+{
+	(void)bufferA;
+	(void)bufferB;
+	return X86_FN(conv_generic)(in, dim_im_in, dim_im_in, ch_im_in, wt, ch_im_out, dim_kernel, dim_kernel, padding,
+	                            padding, stride, stride, bias, bias_shift, out_shift, out, dim_im_out, dim_im_out);
+}
+
+static arm_status X86_FN(conv_fast)(const q7_t* in, const uint16_t dim_im_in, const uint16_t ch_im_in,
+                                    const q7_t* wt, const uint16_t ch_im_out, const uint16_t dim_kernel,
+                                    const uint16_t padding, const uint16_t stride, const q7_t* bias,
+                                    const uint16_t bias_shift, const uint16_t out_shift, q7_t* out,
+                                    const uint16_t dim_im_out, q15_t* bufferA, q7_t* bufferB)
+{
+	(void)bufferA;
+	(void)bufferB;
+	if (ch_im_in % 4 != 0 || ch_im_out % 2 != 0) {
+		return ARM_MATH_SIZE_MISMATCH;
+	}
+	return X86_FN(conv_generic)(in, dim_im_in, dim_im_in, ch_im_in, wt, ch_im_out, dim_kernel, dim_kernel, padding,
+	                            padding, stride, stride, bias, bias_shift, out_shift, out, dim_im_out, dim_im_out);
+}
+
+static arm_status X86_FN(conv_basic_nonsquare)(const q7_t* in, const uint16_t dim_im_in_x, const uint16_t dim_im_in_y,
+                                               const uint16_t ch_im_in, const q7_t* wt, const uint16_t ch_im_out,
+                                               const uint16_t dim_kernel_x, const uint16_t dim_kernel_y,
+                                               const uint16_t padding_x, const uint16_t padding_y,
+                                               const uint16_t stride_x, const uint16_t stride_y, const q7_t* bias,
+                                               const uint16_t bias_shift, const uint16_t out_shift, q7_t* out,
+                                               const uint16_t dim_im_out_x, const uint16_t dim_im_out_y,
+                                               q15_t* bufferA, q7_t* bufferB)
+{
+	(void)bufferA;
+	(void)bufferB;
+	return X86_FN(conv_generic)(in, dim_im_in_x, dim_im_in_y, ch_im_in, wt, ch_im_out, dim_kernel_x, dim_kernel_y,
+	                            padding_x, padding_y, stride_x, stride_y, bias, bias_shift, out_shift, out,
+	                            dim_im_out_x, dim_im_out_y);
+}
+
+static arm_status X86_FN(conv_fast_nonsquare)(const q7_t* in, const uint16_t dim_im_in_x, const uint16_t dim_im_in_y,
+                                              const uint16_t ch_im_in, const q7_t* wt, const uint16_t ch_im_out,
+                                              const uint16_t dim_kernel_x, const uint16_t dim_kernel_y,
+                                              const uint16_t padding_x, const uint16_t padding_y,
+                                              const uint16_t stride_x, const uint16_t stride_y, const q7_t* bias,
+                                              const uint16_t bias_shift, const uint16_t out_shift, q7_t* out,
+                                              const uint16_t dim_im_out_x, const uint16_t dim_im_out_y,
+                                              q15_t* bufferA, q7_t* bufferB)
+{
+	(void)bufferA;
+	(void)bufferB;
+	if (ch_im_in % 4 != 0 || ch_im_out % 2 != 0) {
+		return ARM_MATH_SIZE_MISMATCH;
+	}
+	return X86_FN(conv_generic)(in, dim_im_in_x, dim_im_in_y, ch_im_in, wt, ch_im_out, dim_kernel_x, dim_kernel_y,
+	                            padding_x, padding_y, stride_x, stride_y, bias, bias_shift, out_shift, out,
+	                            dim_im_out_x, dim_im_out_y);
+}
+
+static arm_status X86_FN(conv_1x1)(const q7_t* in, const uint16_t dim_im_in_x, const uint16_t dim_im_in_y,
+                                    const uint16_t ch_im_in, const q7_t* wt, const uint16_t ch_im_out,
+                                    const uint16_t dim_kernel_x, const uint16_t dim_kernel_y, const uint16_t padding_x,
+                                    const uint16_t padding_y, const uint16_t stride_x, const uint16_t stride_y,
+                                    const q7_t* bias, const uint16_t bias_shift, const uint16_t out_shift, q7_t* out,
+                                    const uint16_t dim_im_out_x, const uint16_t dim_im_out_y, q15_t* bufferA,
+                                    q7_t* bufferB)
+{
+	(void)bufferA;
+	(void)bufferB;
+	if (ch_im_in % 4 != 0 || ch_im_out % 2 != 0 || dim_kernel_x != 1 || dim_kernel_y != 1 || padding_x != 0 ||
+	    padding_y != 0 || stride_x != 1 || stride_y != 1) {
+		return ARM_MATH_SIZE_MISMATCH;
+	}
+	return X86_FN(conv_generic)(in, dim_im_in_x, dim_im_in_y, ch_im_in, wt, ch_im_out, 1, 1, 0, 0, 1, 1, bias,
+	                            bias_shift, out_shift, out, dim_im_out_x, dim_im_out_y);
+}
+
+// base[i] = max(base[i], target[i])
+static inline void X86_FN(max_q7)(q7_t* base, const q7_t* target, int n)
+{
+	int i = 0;
+#if X86_AVX2
+	for (; i + 32 <= n; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(base + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(target + i));
+		_mm256_storeu_si256((__m256i*)(base + i), _mm256_max_epi8(a, b));
+	}
+#endif
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(base + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(target + i));
+		_mm_storeu_si128((__m128i*)(base + i), _mm_max_epi8(a, b));
+	}
+	for (; i < n; i++) {
+		if (target[i] > base[i]) {
+			base[i] = target[i];
+		}
+	}
+}
+
+// base[i] = sat16(base[i] + target[i]), as QADD16 in accumulate_q7_to_q15()
+static inline void X86_FN(accumulate_q7)(int16_t* base, const q7_t* target, int n)
+{
+	int i = 0;
+#if X86_AVX2
+	for (; i + 16 <= n; i += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(base + i));
+		__m256i b = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(target + i)));
+		_mm256_storeu_si256((__m256i*)(base + i), _mm256_adds_epi16(a, b));
+	}
+#endif
+	for (; i + 8 <= n; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(base + i));
+		__m128i b = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)(target + i)));
+		_mm_storeu_si128((__m128i*)(base + i), _mm_adds_epi16(a, b));
+	}
+	for (; i < n; i++) {
+		int32_t v = base[i] + target[i];
+		base[i] = (int16_t)((v > 32767) ? 32767 : ((v < -32768) ? -32768 : v));
+	}
+}
+
+// target[i] = buffer[i] / count, C division (truncates toward zero). The float
+// quotient is exact enough to truncate correctly for |buffer| < 2^15 and
+// count < 256, which covers any pooling window; larger counts stay scalar.
+static inline void X86_FN(scale_back_q15)(const int16_t* buffer, q7_t* target, int n, int count)
+{
+	int i = 0;
+
+	if (count < 256) {
+		const __m128 divisor = _mm_set1_ps((float)count);
+		for (; i + 8 <= n; i += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(buffer + i));
+			__m128i lo = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(v)), divisor));
+			__m128i hi = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(v, 8))), divisor));
+			__m128i q = _mm_packs_epi32(lo, hi);
+			_mm_storel_epi64((__m128i*)(target + i), _mm_packs_epi16(q, q));
+		}
+	}
+	for (; i < n; i++) {
+		target[i] = (q7_t)(buffer[i] / count);
+	}
+}
+
+// Same two-pass, in-place structure as the ARM_MATH_DSP arm_maxpool_q7_HWC():
+// pool along x into Im_in, then along y into Im_out.
+static void X86_FN(maxpool)(q7_t* Im_in, const uint16_t dim_im_in, const uint16_t ch_im_in, const uint16_t dim_kernel,
+                            const uint16_t padding, const uint16_t stride, const uint16_t dim_im_out, q7_t* bufferA,
+                            q7_t* Im_out)
+{
+	(void)bufferA;
+
+	for (int i_y = 0; i_y < dim_im_in; i_y++) {
+		for (int i_x = 0; i_x < dim_im_out; i_x++) {
+			q7_t* target = Im_in + (i_y * dim_im_in + i_x) * ch_im_in;
+			q7_t* win_start = (i_x * stride - padding < 0) ? target : Im_in + (i_y * dim_im_in + i_x * stride - padding) * ch_im_in;
+			q7_t* win_stop = (i_x * stride - padding + dim_kernel >= dim_im_in)
+			                 ? Im_in + (i_y * dim_im_in + dim_im_in) * ch_im_in
+			                 : Im_in + (i_y * dim_im_in + i_x * stride - padding + dim_kernel) * ch_im_in;
+
+			memmove(target, win_start, ch_im_in);
+			for (win_start += ch_im_in; win_start < win_stop; win_start += ch_im_in) {
+				X86_FN(max_q7)(target, win_start, ch_im_in);
+			}
+		}
+	}
+
+	for (int i_y = 0; i_y < dim_im_out; i_y++) {
+		q7_t* target = Im_out + i_y * dim_im_out * ch_im_in;
+		q7_t* row_start = (i_y * stride - padding < 0) ? Im_in : Im_in + (i_y * stride - padding) * dim_im_in * ch_im_in;
+		q7_t* row_end = (i_y * stride - padding + dim_kernel >= dim_im_in)
+		                ? Im_in + dim_im_in * dim_im_in * ch_im_in
+		                : Im_in + (i_y * stride - padding + dim_kernel) * dim_im_in * ch_im_in;
+
+		memmove(target, row_start, dim_im_out * ch_im_in);
+		for (row_start += ch_im_in * dim_im_in; row_start < row_end; row_start += dim_im_in * ch_im_in) {
+			X86_FN(max_q7)(target, row_start, dim_im_out * ch_im_in);
+		}
+	}
+}
+
+// Same two-pass structure, accumulation and truncating divisions as the
+// ARM_MATH_DSP arm_avepool_q7_HWC(), which rounds differently from the
+// reference C version.
+static void X86_FN(avepool)(q7_t* Im_in, const uint16_t dim_im_in, const uint16_t ch_im_in, const uint16_t dim_kernel,
+                            const uint16_t padding, const uint16_t stride, const uint16_t dim_im_out, q7_t* bufferA,
+                            q7_t* Im_out)
+{
+	int16_t* buffer = (int16_t*)bufferA;
+
+	for (int i_y = 0; i_y < dim_im_in; i_y++) {
+		for (int i_x = 0; i_x < dim_im_out; i_x++) {
+			q7_t* target = Im_in + (i_y * dim_im_in + i_x) * ch_im_in;
+			q7_t* win_start = (i_x * stride - padding < 0) ? target : Im_in + (i_y * dim_im_in + i_x * stride - padding) * ch_im_in;
+			q7_t* win_stop = (i_x * stride - padding + dim_kernel >= dim_im_in)
+			                 ? Im_in + (i_y * dim_im_in + dim_im_in) * ch_im_in
+			                 : Im_in + (i_y * dim_im_in + i_x * stride - padding + dim_kernel) * ch_im_in;
+			int count = 1;
+
+			X86_FN(widen_q7)(win_start, buffer, ch_im_in);
+			for (win_start += ch_im_in; win_start < win_stop; win_start += ch_im_in) {
+				X86_FN(accumulate_q7)(buffer, win_start, ch_im_in);
+				count++;
+			}
+			X86_FN(scale_back_q15)(buffer, target, ch_im_in, count);
+		}
+	}
+
+	for (int i_y = 0; i_y < dim_im_out; i_y++) {
+		q7_t* target = Im_out + i_y * dim_im_out * ch_im_in;
+		q7_t* row_start = (i_y * stride - padding < 0) ? Im_in : Im_in + (i_y * stride - padding) * dim_im_in * ch_im_in;
+		q7_t* row_end = (i_y * stride - padding + dim_kernel >= dim_im_in)
+		                ? Im_in + dim_im_in * dim_im_in * ch_im_in
+		                : Im_in + (i_y * stride - padding + dim_kernel) * dim_im_in * ch_im_in;
+		int count = 1;
+
+		X86_FN(widen_q7)(row_start, buffer, dim_im_out * ch_im_in);
+		for (row_start += ch_im_in * dim_im_in; row_start < row_end; row_start += dim_im_in * ch_im_in) {
+			X86_FN(accumulate_q7)(buffer, row_start, dim_im_out * ch_im_in);
+			count++;
+		}
+		X86_FN(scale_back_q15)(buffer, target, dim_im_out * ch_im_in, count);
+	}
+}
+
+static void X86_FN(relu)(q7_t* data, uint16_t size)
+{
+	int i = 0;
+#if X86_AVX2
+	for (; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+		_mm256_storeu_si256((__m256i*)(data + i), _mm256_max_epi8(v, _mm256_setzero_si256()));
+	}
+#endif
+	for (; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+		_mm_storeu_si128((__m128i*)(data + i), _mm_max_epi8(v, _mm_setzero_si128()));
+	}
+	for (; i < size; i++) {
+		if (data[i] < 0) {
+			data[i] = 0;
+		}
+	}
+}
+
+// arm_fully_connected_q7_opt() weight layout: rows in groups of four, and for
+// every four columns c..c+3 a 16-byte block
+//   r0c r1c r0c2 r1c2  r2c r3c r2c2 r3c2  r0c1 r1c1 r0c3 r1c3  r2c1 r3c1 r2c3 r3c3
+// followed by the leftover columns as r0 r1 r2 r3 each. Leftover rows are
+// stored row-major. The block is shuffled so that pmaddwd pairs (c, c+2) and
+// (c+1, c+3) of the same row.
+static arm_status X86_FN(fc_opt)(const q7_t* pV, const q7_t* pM, const uint16_t dim_vec, const uint16_t num_of_rows,
+                                 const uint16_t bias_shift, const uint16_t out_shift, const q7_t* bias, q7_t* pOut,
+                                 q15_t* vec_buffer)
+{
+	const __m128i wshuf = _mm_setr_epi8(0, 2, 1, 3, 4, 6, 5, 7, 8, 10, 9, 11, 12, 14, 13, 15);
+	const __m128i even = _mm_setr_epi8(0, 1, 4, 5, 0, 1, 4, 5, 0, 1, 4, 5, 0, 1, 4, 5);
+	const __m128i odd = _mm_setr_epi8(2, 3, 6, 7, 2, 3, 6, 7, 2, 3, 6, 7, 2, 3, 6, 7);
+	const q7_t* pB = pM;
+	int row = 0;
+
+	(void)vec_buffer;
+
+	for (; row + 4 <= num_of_rows; row += 4) {
+		int32_t sums[4];
+		int col = 0;
+#if X86_AVX2
+		__m256i acc = _mm256_setzero_si256();
+		for (; col + 4 <= dim_vec; col += 4, pB += 16) {
+			int32_t v4;
+			memcpy(&v4, pV + col, sizeof(v4));
+			__m128i v = _mm_cvtepi8_epi16(_mm_cvtsi32_si128(v4));
+			__m256i act = _mm256_set_m128i(_mm_shuffle_epi8(v, odd), _mm_shuffle_epi8(v, even));
+			__m256i w = _mm256_cvtepi8_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)pB), wshuf));
+			acc = _mm256_add_epi32(acc, _mm256_madd_epi16(w, act));
+		}
+		_mm_storeu_si128((__m128i*)sums, _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)));
+#else
+		__m128i acc = _mm_setzero_si128();
+		for (; col + 4 <= dim_vec; col += 4, pB += 16) {
+			int32_t v4;
+			memcpy(&v4, pV + col, sizeof(v4));
+			__m128i v = _mm_cvtepi8_epi16(_mm_cvtsi32_si128(v4));
+			__m128i w = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)pB), wshuf);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_cvtepi8_epi16(w), _mm_shuffle_epi8(v, even)));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_cvtepi8_epi16(_mm_srli_si128(w, 8)), _mm_shuffle_epi8(v, odd)));
+		}
+		_mm_storeu_si128((__m128i*)sums, acc);
+#endif
+		for (; col < dim_vec; col++, pB += 4) {
+			for (int j = 0; j < 4; j++) {
+				sums[j] = (int32_t)((uint32_t)sums[j] + (uint32_t)(pV[col] * pB[j]));
+			}
+		}
+		for (int j = 0; j < 4; j++) {
+			uint32_t sum = ((uint32_t)(int32_t)bias[row + j] << bias_shift) + NN_ROUND(out_shift) + (uint32_t)sums[j];
+			pOut[row + j] = X86_FN(sat_q7)((int32_t)sum >> out_shift);
+		}
+	}
+
+	for (; row < num_of_rows; row++, pB += dim_vec) {
+		__m128i acc = _mm_setzero_si128();
+		int col = 0;
+		for (; col + 8 <= dim_vec; col += 8) {
+			__m128i v = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)(pV + col)));
+			__m128i w = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)(pB + col)));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(v, w));
+		}
+		uint32_t sum = ((uint32_t)(int32_t)bias[row] << bias_shift) + NN_ROUND(out_shift) + (uint32_t)X86_FN(hsum_epi32)(acc);
+		for (; col < dim_vec; col++) {
+			sum += (uint32_t)(pV[col] * pB[col]);
+		}
+		pOut[row] = X86_FN(sat_q7)((int32_t)sum >> out_shift);
+	}
+
+	return ARM_MATH_SUCCESS;
+}
+
+// arm_softmax_q7() as built for the RT core (no ARM_MATH_LOOPUNROLL):
+// base = max - 8, sum of 2^USAT(x - base, 3), out = SSAT((2^20 / sum) >> USAT(13 + base - x, 5), 8).
+static void X86_FN(softmax)(const q7_t* vec_in, const uint16_t dim_vec, q7_t* p_out)
+{
+	int i = 0;
+	int32_t max = -128;
+
+	__m128i m = _mm_set1_epi8(-128);
+	for (; i + 16 <= dim_vec; i += 16) {
+		m = _mm_max_epi8(m, _mm_loadu_si128((const __m128i*)(vec_in + i)));
+	}
+	m = _mm_max_epi8(m, _mm_srli_si128(m, 8));
+	m = _mm_max_epi8(m, _mm_srli_si128(m, 4));
+	m = _mm_max_epi8(m, _mm_srli_si128(m, 2));
+	m = _mm_max_epi8(m, _mm_srli_si128(m, 1));
+	max = (int8_t)_mm_extract_epi8(m, 0);
+	for (; i < dim_vec; i++) {
+		if (vec_in[i] > max) {
+			max = vec_in[i];
+		}
+	}
+
+	const int32_t base = max - 8;
+	uint32_t sum = 0;
+	i = 0;
+#if X86_AVX2
+	{
+		const __m256i vbase = _mm256_set1_epi32(base);
+		const __m256i one = _mm256_set1_epi32(1);
+		__m256i acc = _mm256_setzero_si256();
+		for (; i + 8 <= dim_vec; i += 8) {
+			__m256i x = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(vec_in + i)));
+			__m256i shift = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(x, vbase), _mm256_setzero_si256()),
+			                                 _mm256_set1_epi32(7));
+			acc = _mm256_add_epi32(acc, _mm256_sllv_epi32(one, shift));
+		}
+		sum = (uint32_t)X86_FN(hsum_epi32)(_mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)));
+	}
+#endif
+	for (; i < dim_vec; i++) {
+		int32_t shift = vec_in[i] - base;
+		shift = (shift < 0) ? 0 : ((shift > 7) ? 7 : shift);
+		sum += 1U << shift;
+	}
+
+	const int32_t output_base = (1 << 20) / (int32_t)sum;
+	i = 0;
+#if X86_AVX2
+	{
+		const __m256i vbase = _mm256_set1_epi32(13 + base);
+		const __m256i vout = _mm256_set1_epi32(output_base);
+		for (; i + 8 <= dim_vec; i += 8) {
+			__m256i x = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(vec_in + i)));
+			__m256i shift = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(vbase, x), _mm256_setzero_si256()),
+			                                 _mm256_set1_epi32(31));
+			__m256i r = _mm256_srav_epi32(vout, shift);
+			__m128i q = _mm_packs_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+			_mm_storel_epi64((__m128i*)(p_out + i), _mm_packs_epi16(q, q));
+		}
+	}
+#endif
+	for (; i < dim_vec; i++) {
+		int32_t shift = 13 + base - vec_in[i];
+		shift = (shift < 0) ? 0 : ((shift > 31) ? 31 : shift);
+		p_out[i] = X86_FN(sat_q7)(output_base >> shift);
+	}
+}
+
+static const nn_kernels_t X86_FN(nn_x86_kernels_table) = {
+	.name = X86_NAME,
+	.conv_rgb = X86_FN(conv_rgb),
+	.conv_basic = X86_FN(conv_basic),
+	.conv_fast = X86_FN(conv_fast),
+	.conv_basic_nonsquare = X86_FN(conv_basic_nonsquare),
+	.conv_fast_nonsquare = X86_FN(conv_fast_nonsquare),
+	.conv_1x1 = X86_FN(conv_1x1),
+	.maxpool = X86_FN(maxpool),
+	.avepool = X86_FN(avepool),
+	.relu = X86_FN(relu),
+	.fc_opt = X86_FN(fc_opt),
+	.softmax = X86_FN(softmax),
+};
@@ -0,0 +1,228 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+struct worker {
+	pthread_mutex_t lock;
+	size_t begin;
+	size_t end;
+	uint64_t steals;
+	unsigned id;
+	pthread_t thread;
+	thread_pool_t* pool;
+} __attribute__((aligned(64)));
+
+struct thread_pool {
+	unsigned size;
+	struct worker* workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start_cv;
+	pthread_cond_t done_cv;
+	uint64_t generation;
+	unsigned active;
+	bool quit;
+
+	pool_range_fn fn;
+	void* arg;
+	size_t grain;
+};
+
+static bool _take_own(struct worker* w, size_t grain, size_t* begin, size_t* end)
+{
+	bool ok = false;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->begin < w->end) {
+		*begin = w->begin;
+		*end = (w->end - w->begin > grain) ? w->begin + grain : w->end;
+		w->begin = *end;
+		ok = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return ok;
+}
+
+static bool _steal(struct worker* thief)
+{
+	thread_pool_t* pool = thief->pool;
+
+	for (unsigned i = 1; i < pool->size; i++) {
+		struct worker* victim = &pool->workers[(thief->id + i) % pool->size];
+		size_t begin = 0, end = 0;
+
+		pthread_mutex_lock(&victim->lock);
+		size_t remaining = victim->end - victim->begin;
+		if (remaining > 0) {
+			end = victim->end;
+			begin = end - (remaining + 1) / 2;
+			victim->end = begin;
+		}
+		pthread_mutex_unlock(&victim->lock);
+
+		if (begin < end) {
+			pthread_mutex_lock(&thief->lock);
+			thief->begin = begin;
+			thief->end = end;
+			pthread_mutex_unlock(&thief->lock);
+			thief->steals++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void _run_share(struct worker* w)
+{
+	thread_pool_t* pool = w->pool;
+	size_t begin, end;
+
+	do {
+		while (_take_own(w, pool->grain, &begin, &end)) {
+			pool->fn(pool->arg, w->id, begin, end);
+		}
+	} while (_steal(w));
+}
+
+static void* _worker_main(void* param)
+{
+	struct worker* w = param;
+	thread_pool_t* pool = w->pool;
+	uint64_t seen = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->quit && pool->generation == seen) {
+			pthread_cond_wait(&pool->start_cv, &pool->lock);
+		}
+		if (pool->quit) {
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		_run_share(w);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->active == 0) {
+			pthread_cond_signal(&pool->done_cv);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+thread_pool_t* pool_create(unsigned threads)
+{
+	if (threads == 0) {
+		threads = 1;
+	}
+
+	thread_pool_t* pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+	if (posix_memalign((void**)&pool->workers, 64, threads * sizeof(struct worker)) != 0) {
+		free(pool);
+		return NULL;
+	}
+
+	pool->size = threads;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start_cv, NULL);
+	pthread_cond_init(&pool->done_cv, NULL);
+
+	for (unsigned i = 0; i < threads; i++) {
+		struct worker* w = &pool->workers[i];
+		pthread_mutex_init(&w->lock, NULL);
+		w->begin = w->end = 0;
+		w->steals = 0;
+		w->id = i;
+		w->pool = pool;
+	}
+
+	for (unsigned i = 1; i < threads; i++) {
+		if (pthread_create(&pool->workers[i].thread, NULL, _worker_main, &pool->workers[i]) != 0) {
+			// Run with the workers that did start.
+			pool->size = i;
+			break;
+		}
+	}
+
+	return pool;
+}
+
+void pool_destroy(thread_pool_t* pool)
+{
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start_cv);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (unsigned i = 1; i < pool->size; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+	for (unsigned i = 0; i < pool->size; i++) {
+		pthread_mutex_destroy(&pool->workers[i].lock);
+	}
+
+	pthread_cond_destroy(&pool->done_cv);
+	pthread_cond_destroy(&pool->start_cv);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool);
+}
+
+unsigned pool_size(const thread_pool_t* pool)
+{
+	return pool->size;
+}
+
+void pool_parallel_for(thread_pool_t* pool, size_t count, size_t grain, pool_range_fn fn, void* arg)
+{
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->grain = (grain == 0) ? 1 : grain;
+
+	for (unsigned i = 0; i < pool->size; i++) {
+		struct worker* w = &pool->workers[i];
+		w->begin = count * i / pool->size;
+		w->end = count * (i + 1) / pool->size;
+		w->steals = 0;
+	}
+
+	if (pool->size > 1) {
+		pthread_mutex_lock(&pool->lock);
+		pool->active = pool->size - 1;
+		pool->generation++;
+		pthread_cond_broadcast(&pool->start_cv);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	_run_share(&pool->workers[0]);
+
+	if (pool->size > 1) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->active > 0) {
+			pthread_cond_wait(&pool->done_cv, &pool->lock);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+uint64_t pool_steals(const thread_pool_t* pool)
+{
+	uint64_t steals = 0;
+	for (unsigned i = 0; i < pool->size; i++) {
+		steals += pool->workers[i].steals;
+	}
+	return steals;
+}
@@ -0,0 +1,29 @@
+#ifndef __THREAD_POOL_H
+#define __THREAD_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Range callback: process items [begin, end) on behalf of worker `worker`
+// (0 .. pool_size() - 1). Worker ids are stable, so callers can index
+// per-thread state such as an nn_context_t with them.
+typedef void (*pool_range_fn)(void* arg, unsigned worker, size_t begin, size_t end);
+
+typedef struct thread_pool thread_pool_t;
+
+// Create a pool with `threads` workers in total. The thread calling
+// pool_parallel_for() acts as worker 0, so `threads - 1` pthreads are started.
+thread_pool_t* pool_create(unsigned threads);
+void pool_destroy(thread_pool_t* pool);
+unsigned pool_size(const thread_pool_t* pool);
+
+// Run fn over [0, count) and return once every item has been processed.
+// Each worker starts with an equal contiguous share and takes at most `grain`
+// items per call to fn; a worker that runs dry steals the upper half of the
+// remaining range of another worker.
+void pool_parallel_for(thread_pool_t* pool, size_t count, size_t grain, pool_range_fn fn, void* arg);
+
+// Number of successful steals during the last pool_parallel_for().
+uint64_t pool_steals(const thread_pool_t* pool);
+
+#endif
@@ -0,0 +1,338 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef INTERCORE_PROTOCOL_H
+#define INTERCORE_PROTOCOL_H
+
+#include <stdint.h>
+
+/// <summary>
+/// <para>Wire format of the messages exchanged with the high-level application. Every
+/// message in the shared buffer starts with the 20-byte envelope added by the application
+/// runtime (sender component ID and a reserved word), followed by a <see cref="FrameHeader" />
+/// and then the frame payload.</para>
+/// <para>An image is sent as one request made of fragments. Every fragment but the last
+/// carries exactly <see cref="FRAME_FRAGMENT_SIZE" /> bytes, so a fragment's offset within the
+/// image is fragmentIndex * FRAME_FRAGMENT_SIZE. Fragments may arrive in any order and several
+/// requests may be in flight; each reply carries the request ID it answers.</para>
+/// <para>A classified image is answered with a <see cref="ResultPayload" />, an error with
+/// one <see cref="FrameError" /> byte.</para>
+/// <para>Flow control is credit based. Every reply advertises in <c>credits</c> how many
+/// requests the sender may have outstanding (sent, not yet answered by a reply with the same
+/// request ID). The real-time application derives it from its free image slots and from how many
+/// images its inbound buffer holds, so a sender that respects it never has a fragment waiting
+/// for space on either side. Until the first reply a sender may assume
+/// <see cref="FRAME_INITIAL_CREDITS" />, or ask with a <see cref="FRAME_FLAG_CREDIT" /> frame.
+/// </para>
+/// <para>Requests flagged <see cref="FRAME_FLAG_LATEST" /> are latest-frame-wins: when one is
+/// complete, older such requests still waiting for inference are answered with
+/// <see cref="FRAME_ERROR_SUPERSEDED" /> instead of being run. Requests without the flag are
+/// always run in order.</para>
+/// <para>Requests flagged <see cref="FRAME_FLAG_AGGREGATE" /> are not answered one by one:
+/// their results are counted into an aggregation window, answered by one
+/// <see cref="AggregateSummary" /> when the window closes. They take no credit; the sender
+/// writes them while the shared buffer has room, and the real-time application reads them as
+/// fast as it classifies them. Errors are still answered per request.</para>
+/// <para>Frames flagged <see cref="FRAME_FLAG_CONTROL" /> carry a <see cref="ControlRequest" />.
+/// They are not image requests and take no credit; a sender should have at most
+/// <see cref="CONTROL_QUEUE_SIZE" /> outstanding. They are serviced between layers of the
+/// inference in progress, and answered by a reply with the same flag and request ID.</para>
+/// <para>Control and credit frames make up the control lane, image fragments the bulk lane.
+/// The lanes share each ring but are consumed independently, each in its own order: when the
+/// real-time application cannot take a fragment yet, it still looks past it for control frames.
+/// For a control frame to find room at all, senders keep
+/// <see cref="FRAME_CONTROL_HEADROOM" /> bytes of the ring free of fragments.</para>
+/// </summary>
+
+/// <summary>Size of the application runtime envelope preceding the frame header.</summary>
+#define FRAME_ENVELOPE_SIZE 20
+
+/// <summary>Protocol version carried in every frame.</summary>
+#define FRAME_VERSION 2
+
+/// <summary>Maximum payload of one fragment; the shared buffer limits messages to 1 KiB
+/// of user data.</summary>
+#define FRAME_FRAGMENT_SIZE 1024
+
+/// <summary>Frame is a reply from the real-time application.</summary>
+#define FRAME_FLAG_REPLY 0x01
+/// <summary>Reply reports an error; the payload is one <see cref="FrameError" /> byte.</summary>
+#define FRAME_FLAG_ERROR 0x02
+/// <summary>Credit query without payload, answered by a reply with the same flag.</summary>
+#define FRAME_FLAG_CREDIT 0x04
+/// <summary>Request supersedes older requests with this flag that have not started.</summary>
+#define FRAME_FLAG_LATEST 0x08
+/// <summary>With <see cref="FRAME_FLAG_LATEST" />, also stop the inference of an older
+/// latest-frame-wins request at its next layer boundary, unless the request before it was
+/// stopped that way.</summary>
+#define FRAME_FLAG_ABANDON 0x10
+/// <summary>Control frame, see <see cref="ControlRequest" />.</summary>
+#define FRAME_FLAG_CONTROL 0x20
+/// <summary>Request counted into the aggregation window instead of answered; also set on the
+/// <see cref="AggregateSummary" /> reply.</summary>
+#define FRAME_FLAG_AGGREGATE 0x40
+/// <summary>Reply answered from the result cache, without running inference; see
+/// <see cref="CONTROL_CACHE" />.</summary>
+#define FRAME_FLAG_CACHED 0x80
+
+/// <summary>Ring space, in bytes, a sender leaves free when writing fragments so that control
+/// frames can always be written.</summary>
+#define FRAME_CONTROL_HEADROOM 256
+
+/// <summary>Requests a sender may have outstanding before it has seen any reply.</summary>
+#define FRAME_INITIAL_CREDITS 1
+
+/// <summary>Error codes carried by replies with <see cref="FRAME_FLAG_ERROR" />.</summary>
+typedef enum {
+    /// <summary>Unsupported protocol version.</summary>
+    FRAME_ERROR_VERSION = 1,
+    /// <summary>Fragment index, count or length inconsistent with the request.</summary>
+    FRAME_ERROR_BAD_FRAGMENT = 2,
+    /// <summary>The partially received request was dropped to make room for a new one.</summary>
+    FRAME_ERROR_EVICTED = 3,
+    /// <summary>A newer <see cref="FRAME_FLAG_LATEST" /> request replaced this one.</summary>
+    FRAME_ERROR_SUPERSEDED = 4,
+    /// <summary>The request was cancelled by a <see cref="CONTROL_CANCEL" /> frame.</summary>
+    FRAME_ERROR_CANCELLED = 5,
+    /// <summary>The pre-filter found nothing to classify: the image is too dark or too
+    /// uniform, see <see cref="CONTROL_FILTER" />.</summary>
+    FRAME_ERROR_NO_CONTENT = 6,
+} FrameError;
+
+/// <summary>Header following the envelope in every message, little-endian.</summary>
+typedef struct __attribute__((packed)) {
+    /// <summary><see cref="FRAME_VERSION" />.</summary>
+    uint8_t version;
+    /// <summary>FRAME_FLAG_* bits.</summary>
+    uint8_t flags;
+    /// <summary>Position of this fragment within the request, from 0.</summary>
+    uint8_t fragmentIndex;
+    /// <summary>Number of fragments making up the request.</summary>
+    uint8_t fragmentCount;
+    /// <summary>Chosen by the sender, echoed in the reply.</summary>
+    uint32_t requestId;
+    /// <summary>Bytes of payload following this header.</summary>
+    uint16_t payloadLength;
+    /// <summary>In replies, the number of requests the sender may have outstanding.
+    /// Zero in requests.</summary>
+    uint16_t credits;
+} FrameHeader;
+
+/// <summary>Offset of the frame payload from the start of a message.</summary>
+#define FRAME_PAYLOAD_OFFSET (FRAME_ENVELOPE_SIZE + sizeof(FrameHeader))
+
+/// <summary>Classes reported in a <see cref="ResultPayload" />.</summary>
+#define RESULT_TOP_K 3
+
+/// <summary>Payload of the reply to a classified image.</summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>The request answered, as in the frame header.</summary>
+    uint32_t requestId;
+    /// <summary>Most likely classes, best first.</summary>
+    uint8_t classes[RESULT_TOP_K];
+    /// <summary>Softmax output for each of <c>classes</c>, q7: 127 is a probability of
+    /// about 1.</summary>
+    int8_t scores[RESULT_TOP_K];
+    /// <summary>Cycles spent classifying the image, 197.6 MHz.</summary>
+    uint32_t inferenceCycles;
+    /// <summary>Cycles from the last fragment arriving to inference starting.</summary>
+    uint32_t queueCycles;
+} ResultPayload;
+
+/// <summary>Control frames the real-time application holds before it stops reading the
+/// shared buffer.</summary>
+#define CONTROL_QUEUE_SIZE 4
+
+/// <summary>Commands carried by control frames. Each describes how it reads the 32-bit
+/// <see cref="ControlRequest" /> argument.</summary>
+typedef enum {
+    /// <summary>Cancel the image request <c>argument</c>, whether queued or being classified.
+    /// It is answered with <see cref="FRAME_ERROR_CANCELLED" />; the control reply payload is
+    /// one byte, 1 if the request was found.</summary>
+    CONTROL_CANCEL = 1,
+    /// <summary>Reply with a <see cref="ControlStats" /> payload.</summary>
+    CONTROL_STATS = 2,
+    /// <summary>Send the open aggregation window now, and close the following ones once they
+    /// hold <c>argument</c> images; zero leaves them open until the next window command.
+    /// The control reply payload is one byte, 1.</summary>
+    CONTROL_WINDOW_IMAGES = 3,
+    /// <summary>As <see cref="CONTROL_WINDOW_IMAGES" />, but windows close
+    /// <c>argument</c> milliseconds after their first image, at most
+    /// <see cref="AGGREGATE_MAX_MS" />. The control reply payload is one byte, 1 if the
+    /// window was accepted, 0 if it was too long and nothing changed.</summary>
+    CONTROL_WINDOW_MS = 4,
+    /// <summary>Set the result cache to the <see cref="CacheMode" /> in the low byte of
+    /// <c>argument</c>, and drop its entries. For <see cref="CACHE_PERCEPTUAL" /> the next byte
+    /// is the number of perceptual hash bits two images may differ by and still share a result.
+    /// The control reply payload is one byte, 1 if the mode is known.</summary>
+    CONTROL_CACHE = 5,
+    /// <summary>Set the pre-filter thresholds, packed with <see cref="FILTER_ARGUMENT" /> in
+    /// <c>argument</c>. Images whose channel means are all below the mean threshold (dark), or
+    /// whose channel variances are all below the variance threshold (blank or uniform), are
+    /// answered with <see cref="FRAME_ERROR_NO_CONTENT" /> without inference. A zero threshold
+    /// disables its test; both are zero until set. The control reply payload is one byte, 1.
+    /// </summary>
+    CONTROL_FILTER = 6,
+    /// <summary>Turn incremental inference on (1) or off (0), per the low byte of
+    /// <c>argument</c>. While on, each image is diffed against the last one classified and
+    /// only the regions of the network it affects are computed again, for the same result; the
+    /// next byte is the dirty share of a layer, in percent, from which it is computed whole,
+    /// zero for the default of 90. The control reply payload is one byte, 1 if accepted.
+    /// </summary>
+    CONTROL_DELTA = 7,
+    /// <summary>Run a small gate model before the full network, and keep its answer when its
+    /// top softmax score leads the second by at least the low byte of <c>argument</c>, q7
+    /// (e.g. 64 for half the probability range). Zero, the default, turns the gate off. The
+    /// control reply payload is one byte, 1 if accepted; 0, and the gate stays off, when the
+    /// firmware was built without trained gate weights.</summary>
+    CONTROL_CASCADE = 8,
+    /// <summary>Set the early exits of the network: byte <c>n</c> of <c>argument</c> is the
+    /// margin of exit <c>n</c>, up to <see cref="EARLY_EXITS" />. After the layers an exit
+    /// follows, its small classifier head runs, and when its top softmax score leads the second
+    /// by at least the margin, q7, its answer is returned and the rest of the network skipped.
+    /// Zero, the default, leaves an exit's head unrun. Incremental inference bypasses the exits.
+    /// The control reply payload is one byte, 1 if accepted; 0, and the exits stay off, when
+    /// the firmware was built without trained exit heads.</summary>
+    CONTROL_EXITS = 9,
+} ControlCommand;
+
+/// <summary>Early exits of the network, after conv1's and conv2's pooled outputs; see
+/// <see cref="CONTROL_EXITS" />.</summary>
+#define EARLY_EXITS 2
+
+/// <summary><see cref="CONTROL_FILTER" /> argument: mean threshold 0-255 and variance
+/// threshold 0-65535, per channel of 8-bit pixels.</summary>
+#define FILTER_ARGUMENT(minMean, minVariance) ((uint32_t)(minMean) | (uint32_t)(minVariance) << 8)
+
+/// <summary>
+/// How images are matched against the results of earlier ones, which are then returned without
+/// inference and flagged <see cref="FRAME_FLAG_CACHED" />. The cache holds the last few distinct
+/// images.
+/// </summary>
+typedef enum {
+    CACHE_OFF = 0,
+    /// <summary>Identical images, by a 64-bit hash of the data. The default.</summary>
+    CACHE_EXACT = 1,
+    /// <summary>Near-duplicate images, by a 64-bit average hash of 8x8 blocks of 4x4 pixels: one
+    /// bit per block, set if it is brighter than the image average. Trades accuracy for hits on a
+    /// static camera whose frames differ by noise.</summary>
+    CACHE_PERCEPTUAL = 2,
+} CacheMode;
+
+/// <summary>Payload of a control frame.</summary>
+typedef struct __attribute__((packed)) {
+    /// <summary><see cref="ControlCommand" />.</summary>
+    uint8_t command;
+    /// <summary>Argument of the command, packed as its <see cref="ControlCommand" /> entry
+    /// describes; zero for commands that take none.</summary>
+    uint32_t argument;
+} ControlRequest;
+
+/// <summary>Images per aggregation window until a window command is received.</summary>
+#define AGGREGATE_DEFAULT_IMAGES 64
+
+/// <summary>Longest time window, limited by the 32-bit cycle counter.</summary>
+#define AGGREGATE_MAX_MS 20000
+
+/// <summary>Classes counted in an <see cref="AggregateSummary" />.</summary>
+#define AGGREGATE_CLASSES 10
+
+/// <summary>
+/// <para>Payload of the reply, flagged <see cref="FRAME_FLAG_AGGREGATE" />, that closes an
+/// aggregation window. Its request ID is the window number, counting from 0.</para>
+/// <para>Windows are closed by the image that fills them, or for time windows by the first
+/// image or wakeup after their time is up: the real-time application has no timer, so
+/// <c>cycles</c> can run past the window length when traffic stops. Empty windows are not
+/// sent.</para>
+/// </summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Window number, as in the frame header.</summary>
+    uint32_t window;
+    /// <summary>Images classified in the window.</summary>
+    uint32_t images;
+    /// <summary>Cycles from the first image classified in the window to its close.</summary>
+    uint32_t cycles;
+    /// <summary>Images per top class.</summary>
+    uint16_t counts[AGGREGATE_CLASSES];
+    /// <summary>Sum over the images of each class's q7 softmax output.</summary>
+    uint32_t scoreSums[AGGREGATE_CLASSES];
+    /// <summary>Images turned away by the pre-filter, not included in <c>images</c> but counted
+    /// towards the window length.</summary>
+    uint32_t empty;
+} AggregateSummary;
+
+/// <summary>Layout version of <see cref="TelemetryPage" />, zero until the page is first
+/// published.</summary>
+#define TELEMETRY_VERSION 1
+
+/// <summary>
+/// <para>Live counters the real-time application publishes in the reserved words of its
+/// outbound buffer header (the high-level application's inbound buffer) with
+/// PublishHeaderWords, after every inference and every wakeup. The high-level application
+/// samples them with ReadHeaderWords at any rate, without messages or interrupts.</para>
+/// <para>An idle real-time application does not update the page; a credit query makes it
+/// wake up and publish, so a stale heartbeat after one means it is stuck.</para>
+/// </summary>
+typedef struct {
+    /// <summary><see cref="TELEMETRY_VERSION" />.</summary>
+    uint32_t version;
+    /// <summary>Incremented on every update.</summary>
+    uint32_t heartbeat;
+    /// <summary>Inferences completed.</summary>
+    uint32_t inferences;
+    /// <summary>Cycles taken by the last inference, and the most taken by one.</summary>
+    uint32_t lastInferenceCycles;
+    uint32_t maxInferenceCycles;
+    /// <summary>Complete images waiting for inference.</summary>
+    uint32_t queueDepth;
+    /// <summary>Images dropped: superseded (queued or abandoned), cancelled, or evicted while
+    /// incomplete.</summary>
+    uint32_t dropped;
+    /// <summary>Replies lost because the outbound ring was full.</summary>
+    uint32_t replyRingFull;
+    /// <summary>Times a fragment was left in the inbound ring for lack of a free slot.</summary>
+    uint32_t receiveStalls;
+    /// <summary>Cycle counter at the update, 197.6 MHz.</summary>
+    uint32_t updateCycle;
+    /// <summary>Result cache lookups that hit, and that missed.</summary>
+    uint32_t cacheHits;
+    uint32_t cacheMisses;
+    /// <summary>Images turned away by the pre-filter.</summary>
+    uint32_t filtered;
+} TelemetryPage;
+
+/// <summary>Reply payload of <see cref="CONTROL_STATS" />.</summary>
+typedef struct __attribute__((packed)) {
+    /// <summary>Image requests classified.</summary>
+    uint32_t served;
+    /// <summary>Requests superseded while queued, and during inference.</summary>
+    uint32_t dropped;
+    uint32_t abandoned;
+    /// <summary>Requests cancelled by <see cref="CONTROL_CANCEL" />.</summary>
+    uint32_t cancelled;
+    /// <summary>Checks for control frames made between layers, and the cycles they took.</summary>
+    uint32_t yieldChecks;
+    uint32_t yieldCycles;
+    /// <summary>Result cache lookups that hit, and that missed.</summary>
+    uint32_t cacheHits;
+    uint32_t cacheMisses;
+    /// <summary>Images turned away by the pre-filter.</summary>
+    uint32_t filtered;
+    /// <summary>Incremental inferences that computed the whole network (first image, or too
+    /// much changed), part of it, and only the classifier because the image was the same; see
+    /// <see cref="CONTROL_DELTA" />.</summary>
+    uint32_t deltaFull;
+    uint32_t deltaPartial;
+    uint32_t deltaUnchanged;
+    /// <summary>Images the gate model answered, and images it passed on to the full network; see
+    /// <see cref="CONTROL_CASCADE" />.</summary>
+    uint32_t cascadeGated;
+    uint32_t cascadePassed;
+    /// <summary>Images answered by each early exit, and the cycles that saved against the
+    /// last image that went through the whole network; see <see cref="CONTROL_EXITS" />.
+    /// </summary>
+    uint32_t exitsTaken[EARLY_EXITS];
+    uint64_t exitCyclesSaved;
+} ControlStats;
+
+#endif // #ifndef INTERCORE_PROTOCOL_H
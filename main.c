@@ -7,6 +7,9 @@
 
 #include "mt3620-baremetal.h"
 #include "mt3620-intercore.h"
+#include "intercore-protocol.h"
+#include "reassembly.h"
+#include "resultcache.h"
 
 #include "nn.h"
 
@@ -14,7 +17,7 @@
 #define CFIAR10_HEIGHT  32
 #define CFIAR10_DEPTH   3
 
-static uint8_t Cifar10ImgBuf[CFIAR10_WIDTH * CFIAR10_HEIGHT * CFIAR10_DEPTH];
+static ReassemblyTable Requests;
 static const char* cifar10_label[] = {"Plane", "Car", "Bird", "Cat", "Deer", "Dog", "Frog", "Horse", "Ship", "Truck" };
 
 static const uintptr_t IO_CM4_RGU = 0x2101000C;
@@ -47,7 +50,8 @@ __attribute__((used)) = {
 	[14] = (uintptr_t)DefaultExceptionHandler, // PendSV
 	[15] = (uintptr_t)DefaultExceptionHandler, // SysTick
 
-	[INT_TO_EXC(0)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler };
+	[INT_TO_EXC(0)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler,
+	[INT_TO_EXC(INTERCORE_IRQ)] = (uintptr_t)MT3620_HandleMailboxIrq11 };
 
 static _Noreturn void DefaultExceptionHandler(void)
 {
@@ -56,17 +60,659 @@ static _Noreturn void DefaultExceptionHandler(void)
 	}
 }
 
-static uint8_t _get_top_prediction(q7_t* predictions, uint8_t max)
+
+// Shared buffers, set once by RTCoreMain before the mailbox interrupt is enabled.
+static BufferHeader *Outbound, *Inbound;
+static uint32_t SharedBufSize;
+
+// Requests the HL app may have outstanding, advertised in every reply.
+static uint16_t Credits;
+
+// Shared buffer space taken by one full-size fragment: size word, frame and alignment padding.
+#define FRAGMENT_BLOCK_SIZE \
+	((sizeof(uint32_t) + FRAME_PAYLOAD_OFFSET + FRAME_FRAGMENT_SIZE + RINGBUFFER_ALIGNMENT - 1) & ~(RINGBUFFER_ALIGNMENT - 1))
+
+// Completed requests waiting for inference, in arrival order. Filled by ReceiveFragments,
+// which runs in the mailbox interrupt, and emptied by the main loop with IRQs blocked.
+static ReassemblySlot *ReadyQueue[REASSEMBLY_SLOTS];
+static volatile uint32_t ReadyHead, ReadyTail;
+
+// Request the main loop is running inference on, set and cleared with IRQs masked. AbandonError
+// is set to the FrameError to answer it with when a newer FRAME_FLAG_ABANDON request supersedes
+// it or a control frame cancels it; inference stops at the next layer boundary.
+static ReassemblySlot *volatile Running;
+static volatile uint8_t AbandonError;
+
+// Requests abandoned in a row for a newer one. After ABANDON_STREAK_MAX the running request is
+// finished whatever arrives, or images coming faster than one inference would never complete.
+#define ABANDON_STREAK_MAX 1
+static volatile uint8_t AbandonStreak;
+
+// Control frames waiting for the next yield point, queued by the interrupt.
+typedef struct {
+	uint8_t envelope[FRAME_ENVELOPE_SIZE];
+	uint32_t requestId;
+	ControlRequest request;
+} ControlFrame;
+
+static ControlFrame ControlQueue[CONTROL_QUEUE_SIZE];
+static volatile uint32_t ControlHead, ControlTail;
+
+// Positions of control-lane frames handled while looking past a stalled fragment. They are
+// still in the shared buffer and are skipped once the read position reaches them.
+#define LOOKAHEAD_MAX 8
+static uint32_t HandledAhead[LOOKAHEAD_MAX];
+static uint32_t HandledAheadCount;
+
+// Image requests classified. Latest-frame-wins requests answered with FRAME_ERROR_SUPERSEDED:
+// dropped while queued, or abandoned part way through inference. Requests cancelled.
+static uint32_t Served, Dropped, Abandoned, Cancelled;
+
+// Pre-filter thresholds set by CONTROL_FILTER, zero when off, and the images it turned away.
+static uint8_t FilterMinMean;
+static uint16_t FilterMinVariance;
+static uint32_t Filtered;
+
+// Checks for control frames made between layers, and the cycles spent in them.
+static uint32_t YieldChecks, YieldCycles;
+
+// Aggregation window for FRAME_FLAG_AGGREGATE requests, see AggregateSummary. It closes after
+// WindowImages images or WindowCycles cycles, whichever is set, and is answered to the envelope
+// of its last image. Only the main loop touches it.
+static AggregateSummary Window;
+static uint8_t WindowEnvelope[FRAME_ENVELOPE_SIZE];
+static uint32_t WindowImages = AGGREGATE_DEFAULT_IMAGES, WindowCycles, WindowStart;
+
+// Results of recent images, returned without inference when the same image comes again. The
+// mode is set by CONTROL_CACHE; only the main loop touches either.
+static ResultCache Cache;
+static uint8_t CurrentCacheMode = CACHE_EXACT;
+
+// Incremental inference state, set by CONTROL_DELTA. Its kept activations take most of SYSRAM,
+// leaving TCM to the weights and the image slots; only the main loop touches it. SYSRAM is not
+// loaded or cleared, nn_delta_init sets it up.
+static nn_delta_t Delta __attribute__((section(".sysram")));
+static bool DeltaEnabled;
+
+// Gate model run ahead of the full network, off while its margin is zero; set by CONTROL_CASCADE.
+static nn_cascade_t Cascade = { .gate = &cifar10_gate_model, .model = &cifar10_model };
+
+// Early exit margins set by CONTROL_EXITS, all zero (off) until then. The cycles of the last
+// image that went through the whole network are the baseline for the cycles the exits saved.
+static nn_exit_policy_t Exits;
+_Static_assert(EARLY_EXITS <= NN_MAX_EXITS, "ControlStats counts more exits than the executor has");
+static uint32_t FullNetworkCycles;
+static uint64_t ExitCyclesSaved;
+#define NO_EXIT 0xFF
+
+// Live counters published in the outbound buffer header, see TelemetryPage. Only the main loop
+// publishes; the interrupt only bumps the counters it reads.
+static TelemetryPage Telemetry = { .version = TELEMETRY_VERSION };
+_Static_assert(sizeof(TelemetryPage) <= HEADER_WORDS_MAX * sizeof(uint32_t), "TelemetryPage must fit the header");
+static uint32_t ReplyRingFull, ReceiveStalls;
+
+// Release received blocks to the HL app after 8 fragments or 1ms, whichever comes first, and at
+// the end of every burst.
+static const CoalescePolicy ReceivePolicy = { .maxBlocks = 8, .maxCycles = 197600 };
+
+// Largest reply payload.
+#define MAX_SIZE(a, b) ((a) > (b) ? (a) : (b))
+#define REPLY_PAYLOAD_MAX \
+	MAX_SIZE(sizeof(AggregateSummary), MAX_SIZE(sizeof(ControlStats), sizeof(ResultPayload)))
+
+// Send a reply frame. Replies cannot be lost for lack of space as long as the HL app respects
+// the credits.
+static void SendFrame(const uint8_t *envelope, uint32_t requestId, uint8_t flags, const void *payload,
+					  uint16_t length)
+{
+	uint8_t reply[FRAME_PAYLOAD_OFFSET + REPLY_PAYLOAD_MAX];
+	FrameHeader header = {
+		.version = FRAME_VERSION,
+		.flags = FRAME_FLAG_REPLY | flags,
+		.fragmentIndex = 0,
+		.fragmentCount = 1,
+		.requestId = requestId,
+		.payloadLength = length,
+		.credits = Credits };
+
+	__builtin_memcpy(&reply[0], envelope, FRAME_ENVELOPE_SIZE);
+	__builtin_memcpy(&reply[FRAME_ENVELOPE_SIZE], &header, sizeof(header));
+	__builtin_memcpy(&reply[FRAME_PAYLOAD_OFFSET], payload, length);
+	if (EnqueueData(Inbound, Outbound, SharedBufSize, &reply[0], FRAME_PAYLOAD_OFFSET + length) == -1) {
+		ReplyRingFull++;
+	}
+}
+
+// Reply with a one-byte payload, a FrameError if FRAME_FLAG_ERROR is set.
+static void SendReply(const uint8_t *envelope, uint32_t requestId, uint8_t flags, uint8_t value)
+{
+	SendFrame(envelope, requestId, flags, &value, 1);
+}
+
+static bool IsLatest(const ReassemblySlot *slot, uint32_t requestId)
+{
+	(void)requestId;
+	return (slot->flags & FRAME_FLAG_LATEST) != 0;
+}
+
+static bool HasRequestId(const ReassemblySlot *slot, uint32_t requestId)
+{
+	return slot->requestId == requestId;
+}
+
+// Answer the queued requests `match` selects with `error` and free their slots, keeping the
+// others in order. Call with IRQs blocked or from the interrupt. Returns how many were dropped.
+static uint32_t DropQueued(bool (*match)(const ReassemblySlot *, uint32_t), uint32_t requestId,
+						   uint8_t error)
+{
+	uint32_t kept = ReadyHead;
+	uint32_t dropped = 0;
+
+	for (uint32_t i = ReadyHead; i != ReadyTail; i++) {
+		ReassemblySlot *slot = ReadyQueue[i % REASSEMBLY_SLOTS];
+		if (match(slot, requestId)) {
+			SendReply(slot->envelope, slot->requestId, FRAME_FLAG_ERROR, error);
+			ReassemblyRelease(&Requests, slot);
+			dropped++;
+		} else {
+			ReadyQueue[kept % REASSEMBLY_SLOTS] = slot;
+			kept++;
+		}
+	}
+	ReadyTail = kept;
+	return dropped;
+}
+
+// A latest-frame-wins request is complete: answer the older ones still queued without running
+// them, and ask the main loop to give up on the one it is running if the sender wants that and
+// the last few have not been given up already.
+static void SupersedeOlder(const ReassemblySlot *newest)
+{
+	Dropped += DropQueued(IsLatest, 0, FRAME_ERROR_SUPERSEDED);
+
+	ReassemblySlot *running = Running;
+	if ((newest->flags & FRAME_FLAG_ABANDON) && running != NULL && (running->flags & FRAME_FLAG_LATEST) &&
+		AbandonError == 0 && AbandonStreak < ABANDON_STREAK_MAX) {
+		AbandonError = FRAME_ERROR_SUPERSEDED;
+	}
+}
+
+// Send the open aggregation window, unless it is empty, and start the next. Call with IRQs
+// blocked; replies are shared with the interrupt.
+static void CloseWindow(void)
 {
-	uint8_t index = 0;
-	int8_t  max_val = -128;
-	for (uint8_t i = 0; i < max; i++) {
-		if (max_val < predictions[i]) {
-			max_val = predictions[i];
-			index = i;
+	if (Window.images + Window.empty == 0) {
+		return;
+	}
+	uint32_t next = Window.window + 1;
+	Window.cycles = ReadCycleCounter() - WindowStart;
+	SendFrame(WindowEnvelope, Window.window, FRAME_FLAG_AGGREGATE, &Window, sizeof(Window));
+	__builtin_memset(&Window, 0, sizeof(Window));
+	Window.window = next;
+}
+
+// Close the aggregation window if it is full or its time is up. Call with IRQs blocked.
+static void CheckWindow(void)
+{
+	uint32_t images = Window.images + Window.empty;
+
+	if (images == 0) {
+		return;
+	}
+	if ((WindowImages != 0 && images >= WindowImages) ||
+		(WindowCycles != 0 && ReadCycleCounter() - WindowStart >= WindowCycles)) {
+		CloseWindow();
+	}
+}
+
+// Count a classified image into the aggregation window, or with no output one the pre-filter
+// turned away.
+static void Aggregate(const ReassemblySlot *request, const q7_t *output, uint8_t top)
+{
+	if (Window.images + Window.empty == 0) {
+		WindowStart = ReadCycleCounter();
+	}
+	__builtin_memcpy(&WindowEnvelope[0], request->envelope, FRAME_ENVELOPE_SIZE);
+	if (output == NULL) {
+		Window.empty++;
+		return;
+	}
+	Window.images++;
+	Window.counts[top]++;
+	for (uint8_t i = 0; i < AGGREGATE_CLASSES; i++) {
+		Window.scoreSums[i] += (uint32_t)output[i];
+	}
+}
+
+// Queue a control frame for the main loop. Returns false if the queue is full; the frame then
+// stays in the shared buffer until the next yield point has made room. A frame whose request
+// is not all in the message is answered with an error, whatever its header claims.
+static bool QueueControl(RingBlock *block, const uint8_t *envelope, const FrameHeader *header)
+{
+	if (header->payloadLength < sizeof(ControlRequest) ||
+		block->blockSize < FRAME_PAYLOAD_OFFSET + sizeof(ControlRequest)) {
+		SendReply(envelope, header->requestId, FRAME_FLAG_ERROR, FRAME_ERROR_BAD_FRAGMENT);
+		return true;
+	}
+	if (ControlTail - ControlHead == CONTROL_QUEUE_SIZE) {
+		return false;
+	}
+
+	ControlFrame *frame = &ControlQueue[ControlTail % CONTROL_QUEUE_SIZE];
+	if (CopyFromBlock(block, FRAME_PAYLOAD_OFFSET, &frame->request, sizeof(frame->request)) != 0) {
+		SendReply(envelope, header->requestId, FRAME_FLAG_ERROR, FRAME_ERROR_BAD_FRAGMENT);
+		return true;
+	}
+	__builtin_memcpy(&frame->envelope[0], envelope, FRAME_ENVELOPE_SIZE);
+	frame->requestId = header->requestId;
+	ControlTail++;
+	return true;
+}
+
+static void ReceiveFragments(void);
+
+// Answer the queued control frames. They run in the main loop rather than in the interrupt so
+// that commands can act on the inference in progress; called between layers and when idle.
+static void ServiceControl(void)
+{
+	uint32_t prevBasePri = BlockIrqs();
+
+	while (ControlHead != ControlTail) {
+		ControlFrame *frame = &ControlQueue[ControlHead % CONTROL_QUEUE_SIZE];
+		ReassemblySlot *running = Running;
+
+		switch (frame->request.command) {
+		case CONTROL_CANCEL: {
+			uint8_t found = 0;
+			uint32_t requestId = frame->request.argument;
+			uint32_t dropped = DropQueued(HasRequestId, requestId, FRAME_ERROR_CANCELLED);
+			if (dropped != 0) {
+				Cancelled += dropped;
+				found = 1;
+			} else if (running != NULL && running->requestId == requestId) {
+				if (AbandonError == 0) {
+					AbandonError = FRAME_ERROR_CANCELLED;
+				}
+				found = 1;
+			}
+			SendFrame(frame->envelope, frame->requestId, FRAME_FLAG_CONTROL, &found, 1);
+			break;
+		}
+		case CONTROL_STATS: {
+			ControlStats stats = {
+				.served = Served,
+				.dropped = Dropped,
+				.abandoned = Abandoned,
+				.cancelled = Cancelled,
+				.yieldChecks = YieldChecks,
+				.yieldCycles = YieldCycles,
+				.cacheHits = Cache.hits,
+				.cacheMisses = Cache.misses,
+				.filtered = Filtered,
+				.deltaFull = Delta.full_runs,
+				.deltaPartial = Delta.partial_runs,
+				.deltaUnchanged = Delta.unchanged_runs,
+				.cascadeGated = Cascade.gated,
+				.cascadePassed = Cascade.passed,
+				.exitsTaken = { Exits.taken[0], Exits.taken[1] },
+				.exitCyclesSaved = ExitCyclesSaved };
+			SendFrame(frame->envelope, frame->requestId, FRAME_FLAG_CONTROL, &stats, sizeof(stats));
+			break;
+		}
+		case CONTROL_CACHE: {
+			uint8_t mode = frame->request.argument & 0xFF;
+			uint8_t known = mode == CACHE_OFF || mode == CACHE_EXACT || mode == CACHE_PERCEPTUAL;
+			if (known) {
+				CurrentCacheMode = mode;
+				ResultCacheReset(&Cache, mode == CACHE_PERCEPTUAL ? (frame->request.argument >> 8) & 0xFF : 0);
+			}
+			SendFrame(frame->envelope, frame->requestId, FRAME_FLAG_CONTROL, &known, 1);
+			break;
+		}
+		case CONTROL_FILTER: {
+			uint8_t accepted = 1;
+			FilterMinMean = frame->request.argument & 0xFF;
+			FilterMinVariance = (frame->request.argument >> 8) & 0xFFFF;
+			SendFrame(frame->envelope, frame->requestId, FRAME_FLAG_CONTROL, &accepted, 1);
+			break;
 		}
+		case CONTROL_DELTA: {
+			uint8_t on = frame->request.argument & 0xFF;
+			uint8_t percent = (frame->request.argument >> 8) & 0xFF;
+			uint8_t accepted = on <= 1 && percent <= 100;
+			if (accepted) {
+				// The kept activations stay valid while off, as nothing else writes them.
+				DeltaEnabled = on;
+				Delta.full_percent = (percent != 0) ? percent : NN_DELTA_FULL_PERCENT;
+			}
+			SendFrame(frame->envelope, frame->requestId, FRAME_FLAG_CONTROL, &accepted, 1);
+			break;
+		}
+		case CONTROL_CASCADE: {
+			// A gate without trained weights never keeps an image, it would only add its cost.
+			uint8_t margin = frame->request.argument & 0xFF;
+			uint8_t accepted = cifar10_gate_trained || margin == 0;
+			if (accepted) {
+				Cascade.margin = margin;
+			}
+			SendFrame(frame->envelope, frame->requestId, FRAME_FLAG_CONTROL, &accepted, 1);
+			break;
+		}
+		case CONTROL_EXITS: {
+			// Heads without trained weights never stop a run, they would only add their cost.
+			uint32_t margins = frame->request.argument & (uint32_t)((1ULL << (EARLY_EXITS * 8)) - 1);
+			uint8_t accepted = cifar10_exits_trained || margins == 0;
+			for (uint8_t i = 0; i < EARLY_EXITS && accepted; i++) {
+				Exits.margin[i] = (margins >> (i * 8)) & 0xFF;
+			}
+			SendFrame(frame->envelope, frame->requestId, FRAME_FLAG_CONTROL, &accepted, 1);
+			break;
+		}
+		case CONTROL_WINDOW_IMAGES:
+		case CONTROL_WINDOW_MS: {
+			uint32_t length = frame->request.argument;
+			uint8_t accepted = frame->request.command == CONTROL_WINDOW_IMAGES || length <= AGGREGATE_MAX_MS;
+			if (accepted) {
+				CloseWindow();
+				WindowImages = (frame->request.command == CONTROL_WINDOW_IMAGES) ? length : 0;
+				WindowCycles = (frame->request.command == CONTROL_WINDOW_MS) ? length * 197600 : 0;
+			}
+			SendFrame(frame->envelope, frame->requestId, FRAME_FLAG_CONTROL, &accepted, 1);
+			break;
+		}
+		default:
+			SendReply(frame->envelope, frame->requestId, FRAME_FLAG_CONTROL | FRAME_FLAG_ERROR,
+					  FRAME_ERROR_BAD_FRAGMENT);
+			break;
+		}
+		ControlHead++;
+	}
+
+	// A cancelled request's slot, or the room made in the control queue, may let stalled
+	// fragments through.
+	ReceiveFragments();
+	RestoreIrqs(prevBasePri);
+}
+
+// Layer hook of the inference context, the yield point between layers. The common case is a
+// single comparison; stops the inference once it has been superseded or cancelled.
+static int YieldPoint(nn_context_t *ctx, uint8_t nextLayer)
+{
+	(void)ctx;
+	(void)nextLayer;
+	uint32_t start = ReadCycleCounter();
+
+	if (ControlHead != ControlTail) {
+		ServiceControl();
+	}
+
+	YieldChecks++;
+	YieldCycles += ReadCycleCounter() - start;
+	return AbandonError != 0 ? 1 : 0;
+}
+
+// Handle one fragment from the shared buffer, queueing its request once it is complete.
+// Returns false if no slot can take it; the caller then leaves it in the shared buffer.
+static bool HandleMessage(RingBlock *block)
+{
+	uint8_t envelope[FRAME_ENVELOPE_SIZE];
+	FrameHeader header;
+	ReassemblyEviction evicted;
+	uint8_t error;
+
+	// Messages too short to hold a frame header are dropped, there is nobody to reply to.
+	if (block->blockSize < FRAME_PAYLOAD_OFFSET) {
+		return true;
+	}
+	CopyFromBlock(block, 0, &envelope[0], FRAME_ENVELOPE_SIZE);
+	CopyFromBlock(block, FRAME_ENVELOPE_SIZE, &header, sizeof(header));
+
+	if (header.flags & FRAME_FLAG_CREDIT) {
+		SendReply(envelope, header.requestId, FRAME_FLAG_CREDIT, 0);
+		return true;
+	}
+
+	if (header.flags & FRAME_FLAG_CONTROL) {
+		return QueueControl(block, envelope, &header);
+	}
+
+	if (block->blockSize < FRAME_PAYLOAD_OFFSET + header.payloadLength) {
+		SendReply(envelope, header.requestId, FRAME_FLAG_ERROR, FRAME_ERROR_BAD_FRAGMENT);
+		return true;
+	}
+
+	// Every slot holds a complete image waiting for inference; retry after one is released.
+	if (!ReassemblyHasRoom(&Requests, &header)) {
+		return false;
+	}
+
+	// The fragment is copied straight from the shared buffer to its place in the image.
+	uint8_t *dest = ReassemblyPrepare(&Requests, &header, envelope, &evicted, &error);
+	ReassemblySlot *complete = NULL;
+	if (dest != NULL) {
+		CopyFromBlock(block, FRAME_PAYLOAD_OFFSET, dest, header.payloadLength);
+		complete = ReassemblyCommit(&Requests, &header);
+	}
+
+	if (evicted.valid) {
+		SendReply(evicted.envelope, evicted.requestId, FRAME_FLAG_ERROR, FRAME_ERROR_EVICTED);
+	}
+	if (error != 0) {
+		SendReply(envelope, header.requestId, FRAME_FLAG_ERROR, error);
+	}
+
+	if (complete != NULL) {
+		if (complete->flags & FRAME_FLAG_LATEST) {
+			SupersedeOlder(complete);
+		}
+		complete->readyCycle = ReadCycleCounter();
+		ReadyQueue[ReadyTail % REASSEMBLY_SLOTS] = complete;
+		ReadyTail++;
+	}
+	return true;
+}
+
+static bool IsControlLane(const FrameHeader *header)
+{
+	return (header->flags & (FRAME_FLAG_CONTROL | FRAME_FLAG_CREDIT)) != 0;
+}
+
+static bool WasHandledAhead(uint32_t position)
+{
+	for (uint32_t i = 0; i < HandledAheadCount; i++) {
+		if (HandledAhead[i] == position) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Forget a position handled ahead, returning whether it was one.
+static bool TakeHandledAhead(uint32_t position)
+{
+	for (uint32_t i = 0; i < HandledAheadCount; i++) {
+		if (HandledAhead[i] == position) {
+			HandledAhead[i] = HandledAhead[--HandledAheadCount];
+			return true;
+		}
+	}
+	return false;
+}
+
+// The block at `position` follows one that cannot be taken yet: handle the control-lane frames
+// from there on, so that they do not wait behind the image fragments.
+static void LookAhead(const RingBatch *batch, uint32_t position)
+{
+	RingBlock block;
+	FrameHeader header;
+
+	while (HandledAheadCount < LOOKAHEAD_MAX && PeekAhead(Inbound, SharedBufSize, batch, position, &block) == 0) {
+		if (block.blockSize >= FRAME_PAYLOAD_OFFSET && !WasHandledAhead(position)) {
+			CopyFromBlock(&block, FRAME_ENVELOPE_SIZE, &header, sizeof(header));
+			if (IsControlLane(&header)) {
+				if (!HandleMessage(&block)) {
+					break;
+				}
+				HandledAhead[HandledAheadCount++] = position;
+			}
+		}
+		position = block.nextPosition;
+	}
+}
+
+// Drain the inbound buffer into the reassembly slots. Runs in the mailbox interrupt, so
+// fragments of the next images are received while the main loop runs inference. Blocks are
+// released in batches, each with a single doorbell to the HL app. While a fragment waits for a
+// slot, control-lane frames behind it are still handled.
+static void ReceiveFragments(void)
+{
+	RingBatch batch;
+	RingBlock block;
+	bool more = true;
+
+	while (more) {
+		uint32_t handled = 0;
+
+		BeginReadBatch(Outbound, Inbound, &batch);
+		while (true) {
+			// Only add the block to the batch if it was consumed.
+			RingBatch next = batch;
+			uint32_t position = batch.localPosition;
+			if (PeekBatch(Inbound, SharedBufSize, &next, &block) == -1) {
+				break;
+			}
+			if (!TakeHandledAhead(position) && !HandleMessage(&block)) {
+				LookAhead(&batch, block.nextPosition);
+				ReceiveStalls++;
+				more = false;
+				break;
+			}
+			batch = next;
+			handled++;
+			if (BatchShouldCommit(&batch, &ReceivePolicy)) {
+				CommitReadBatch(Outbound, &batch);
+			}
+		}
+		CommitReadBatch(Outbound, &batch);
+
+		// Look again for blocks written while this batch was handled.
+		if (handled == 0) {
+			more = false;
+		}
+	}
+}
+
+// Average hash of the image for CACHE_PERCEPTUAL: one bit per block of 4x4 pixels, set if the
+// block's R+G+B sum is above the mean of all blocks.
+static uint64_t PerceptualHash(const uint8_t *image)
+{
+	uint32_t sums[64] = { 0 };
+	uint32_t total = 0;
+	uint64_t hash = 0;
+
+	for (uint32_t y = 0; y < CFIAR10_HEIGHT; y++) {
+		for (uint32_t x = 0; x < CFIAR10_WIDTH; x++) {
+			const uint8_t *pixel = &image[(y * CFIAR10_WIDTH + x) * CFIAR10_DEPTH];
+			sums[(y / 4) * 8 + x / 4] += pixel[0] + pixel[1] + pixel[2];
+		}
+	}
+	for (uint32_t i = 0; i < 64; i++) {
+		total += sums[i];
+	}
+	for (uint32_t i = 0; i < 64; i++) {
+		if (sums[i] * 64 > total) {
+			hash |= 1ULL << i;
+		}
+	}
+	return hash;
+}
+
+// Whether the pre-filter finds nothing to classify: every channel darker than the mean threshold,
+// or flatter than the variance threshold. A few cycles per byte, under 1% of an inference.
+static bool HasNoContent(const ReassemblySlot *request)
+{
+	nn_image_stats_t stats;
+	bool dark = FilterMinMean != 0;
+	bool uniform = FilterMinVariance != 0;
+
+	if (!dark && !uniform) {
+		return false;
+	}
+	nn_image_stats(&request->data[0], CFIAR10_WIDTH * CFIAR10_HEIGHT, &stats);
+	for (int c = 0; c < CFIAR10_DEPTH; c++) {
+		dark = dark && stats.mean[c] < FilterMinMean;
+		uniform = uniform && stats.variance[c] < FilterMinVariance;
+	}
+	return dark || uniform;
+}
+
+// Look an image up in the result cache, before inference overwrites it. Returns the cached
+// network output, or NULL with the key to insert the result under.
+static const int8_t *LookupCache(const ReassemblySlot *request, uint64_t *key)
+{
+	*key = (CurrentCacheMode == CACHE_PERCEPTUAL) ? PerceptualHash(&request->data[0]) : request->hash;
+	return ResultCacheLookup(&Cache, *key);
+}
+
+// Publish the counters for the HL app to sample. Called from the main loop only.
+static void PublishTelemetry(void)
+{
+	Telemetry.heartbeat++;
+	Telemetry.inferences = Served;
+	Telemetry.queueDepth = ReadyTail - ReadyHead;
+	Telemetry.dropped = Dropped + Abandoned + Cancelled + Requests.evicted;
+	Telemetry.replyRingFull = ReplyRingFull;
+	Telemetry.receiveStalls = ReceiveStalls;
+	Telemetry.updateCycle = ReadCycleCounter();
+	Telemetry.cacheHits = Cache.hits;
+	Telemetry.cacheMisses = Cache.misses;
+	Telemetry.filtered = Filtered;
+	PublishHeaderWords(Outbound, (const uint32_t *)&Telemetry, sizeof(Telemetry) / sizeof(uint32_t));
+}
+
+// Classify an image, with the gate model first if CONTROL_CASCADE set a margin, and the full
+// network through the delta path if CONTROL_DELTA turned it on. Exits.last_exit tells whether
+// the full network ran through nn_run(), and how far.
+static int RunNetwork(q7_t *image, q7_t *output)
+{
+	Exits.last_exit = NO_EXIT;
+	if (Cascade.margin == 0) {
+		return DeltaEnabled ? run_nn_delta(&Delta, image, output) : run_nn(image, output);
+	}
+	Cascade.delta = DeltaEnabled ? &Delta : NULL;
+	mean_subtract(image);
+	return nn_cascade_run(&Cascade, nn_default_context(), image, output);
+}
+
+// Sleep until a complete request is queued, and take it. Control frames are answered meanwhile.
+static ReassemblySlot *WaitForRequest(void)
+{
+	ReassemblySlot *slot;
+
+	while (true) {
+		DisableIrqs();
+		if (ControlHead != ControlTail) {
+			EnableIrqs();
+			ServiceControl();
+			continue;
+		}
+		if (ReadyHead != ReadyTail) {
+			slot = ReadyQueue[ReadyHead % REASSEMBLY_SLOTS];
+			ReadyHead++;
+			Running = slot;
+			AbandonError = 0;
+			EnableIrqs();
+			return slot;
+		}
+		WaitForInterrupt();
+		EnableIrqs();
+		PublishTelemetry();
+
+		// A time window may have run out while idle.
+		uint32_t prevBasePri = BlockIrqs();
+		CheckWindow();
+		RestoreIrqs(prevBasePri);
 	}
-	return index;
 }
 
 _Noreturn void RTCoreMain(void)
@@ -80,46 +726,124 @@ _Noreturn void RTCoreMain(void)
 	DebugUARTInit();
 	Log_Debug("Exmaple to run NN inference on RTcore for cifar-10 dataset\r\n");
 
-	BufferHeader *outbound, *inbound;
-	uint32_t sharedBufSize = 0;
-
-	if (GetIntercoreBuffers(&outbound, &inbound, &sharedBufSize) == -1) {
+	if (GetIntercoreBuffers(&Outbound, &Inbound, &SharedBufSize) == -1) {
 		Log_Debug("ERROR: GetIntercoreBuffers failed\r\n");
 		while (1);
 	}
 
-	const size_t payloadStart = 20;
-	const uint32_t maxInterCoreBufSize = 1024;
-	uint32_t piece = 0;
-	uint32_t recvSize = maxInterCoreBufSize + payloadStart;
-	uint8_t recvBuf[maxInterCoreBufSize + payloadStart];
 	q7_t output_data[10];
-	uint8_t top_index;
+	uint16_t top[RESULT_TOP_K];
+	ResultPayload result;
+	uint32_t prevBasePri;
+
+	// With no more than one request per image slot outstanding, every fragment finds a slot as
+	// soon as it arrives. Limiting them to the images the inbound buffer holds as well means the
+	// HL app never waits for buffer space either.
+	uint32_t imagesInBuffer = (SharedBufSize - RINGBUFFER_ALIGNMENT) / (FRAGMENT_BLOCK_SIZE * REASSEMBLY_MAX_FRAGMENTS);
+	Credits = (imagesInBuffer < REASSEMBLY_SLOTS) ? imagesInBuffer : REASSEMBLY_SLOTS;
+	if (Credits == 0) {
+		Credits = 1;
+	}
+
+	EnableCycleCounter();
+	nn_default_context()->layer_hook = YieldPoint;
+	nn_default_context()->exits = &Exits;
+	nn_delta_init(&Delta, &cifar10_model);
+	ReassemblyInit(&Requests);
+	EnableIntercoreInterrupt(2, ReceiveFragments);
+
+	// Pick up anything sent before the interrupt was enabled.
+	prevBasePri = BlockIrqs();
+	ReceiveFragments();
+	RestoreIrqs(prevBasePri);
+
+	PublishTelemetry();
 
 	while (1) {
+		ReassemblySlot *request = WaitForRequest();
+		uint8_t error = 0;
+		uint8_t flags = 0;
+		uint8_t keyMode = CurrentCacheMode;
+		uint64_t key = 0;
+		const int8_t *cached = NULL;
+		uint32_t start = ReadCycleCounter();
 
-		// waiting for incoming data
-		if (DequeueData(outbound, inbound, sharedBufSize, &recvBuf[0], &recvSize) == -1) {
-			continue;
-		}
+		result.requestId = request->requestId;
+		result.queueCycles = start - request->readyCycle;
 
-		// 3072 = 1024 x 3, as the maximum allowed user payload is 1024, we need split into 3 buffer. (HL and RT core must be synced)
-		if (piece < 3) {
-			memcpy(&Cifar10ImgBuf[piece * maxInterCoreBufSize], &recvBuf[payloadStart], maxInterCoreBufSize);
-			piece++;
+		// input = 32x32x3 RGB data, output = Possibility of each class
+		if (request->size != CFIAR10_WIDTH * CFIAR10_HEIGHT * CFIAR10_DEPTH) {
+			error = FRAME_ERROR_BAD_FRAGMENT;
+		} else if (HasNoContent(request)) {
+			error = FRAME_ERROR_NO_CONTENT;
+			Filtered++;
+		} else if (keyMode != CACHE_OFF && (cached = LookupCache(request, &key)) != NULL) {
+			__builtin_memcpy(&output_data[0], cached, sizeof(output_data));
+			flags = FRAME_FLAG_CACHED;
+		} else if (RunNetwork((q7_t *)&request->data[0], output_data) == NN_ABANDONED) {
+			error = AbandonError;
+			if (error == FRAME_ERROR_SUPERSEDED) {
+				Abandoned++;
+			} else {
+				Cancelled++;
+			}
+		} else {
+			Telemetry.lastInferenceCycles = ReadCycleCounter() - start;
+			if (Telemetry.lastInferenceCycles > Telemetry.maxInferenceCycles) {
+				Telemetry.maxInferenceCycles = Telemetry.lastInferenceCycles;
+			}
+			if (Exits.last_exit == cifar10_model.exit_count) {
+				FullNetworkCycles = Telemetry.lastInferenceCycles;
+			} else if (Exits.last_exit != NO_EXIT && FullNetworkCycles > Telemetry.lastInferenceCycles) {
+				ExitCyclesSaved += FullNetworkCycles - Telemetry.lastInferenceCycles;
+			}
+			// A control frame may have changed the cache mode during inference.
+			if (keyMode != CACHE_OFF && keyMode == CurrentCacheMode) {
+				ResultCacheInsert(&Cache, key, output_data);
+			}
 		}
+		AbandonStreak = (error == FRAME_ERROR_SUPERSEDED) ? AbandonStreak + 1 : 0;
 
-		if (piece == 3) {
-			piece = 0;
-
-			// input = 32x32x3 RGB data, output = Possibility of each class
-			run_nn(&Cifar10ImgBuf[0], output_data);
-			top_index = _get_top_prediction(output_data, 10);
-			Log_Debug("%s\r\n", cifar10_label[top_index]);
+		if (error == 0) {
+			result.inferenceCycles = ReadCycleCounter() - start;
+			nn_top_k(output_data, 10, RESULT_TOP_K, top);
+			for (uint8_t i = 0; i < RESULT_TOP_K; i++) {
+				result.classes[i] = (uint8_t)top[i];
+				result.scores[i] = output_data[top[i]];
+			}
+			Log_Debug("%s\r\n", cifar10_label[top[0]]);
+		}
 
+		// Replies and the reassembly table are shared with the interrupt.
+		prevBasePri = BlockIrqs();
+		if (error == FRAME_ERROR_NO_CONTENT && (request->flags & FRAME_FLAG_AGGREGATE)) {
+			Aggregate(request, NULL, 0);
+		} else if (error != 0) {
+			SendReply(request->envelope, request->requestId, FRAME_FLAG_ERROR, error);
+		} else if (request->flags & FRAME_FLAG_AGGREGATE) {
+			Aggregate(request, output_data, result.classes[0]);
+		} else {
 			// Send the result back to HL core
-			recvBuf[payloadStart] = top_index;
-			EnqueueData(inbound, outbound, sharedBufSize, &recvBuf[0], payloadStart + 1);
+			SendFrame(request->envelope, request->requestId, flags, &result, sizeof(result));
+		}
+		CheckWindow();
+		Running = NULL;
+		ReassemblyRelease(&Requests, request);
+		// The released slot may let a stalled fragment through.
+		ReceiveFragments();
+		if (error == 0) {
+			Served++;
+		}
+		RestoreIrqs(prevBasePri);
+		PublishTelemetry();
+
+		if (error == 0 && Served % 64 == 0) {
+			const IntercoreStats *stats = GetIntercoreStats();
+			Log_Debug("Blocks read %u, doorbells %u (%u interrupts saved)\r\n", stats->blocksRead,
+					  stats->readDoorbells, stats->blocksRead - stats->readDoorbells);
+			Log_Debug("Superseded: %u dropped, %u abandoned, %u cancelled\r\n", Dropped, Abandoned, Cancelled);
+			Log_Debug("Yield points: %u, %u cycles each\r\n", YieldChecks,
+					  YieldChecks ? YieldCycles / YieldChecks : 0);
 		}
 	}
 }
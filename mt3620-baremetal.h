@@ -14,6 +14,11 @@ static const uintptr_t NVIC_ISER_BASE = 0xE000E100;
 /// <summary>Base address of NVIC Interrupt Priority Registers, ARM DDI 0403E.b S3.4.3.</summary>
 static const uintptr_t NVIC_IPR_BASE = 0xE000E400;
 
+/// <summary>Debug Exception and Monitor Control Register, ARM DDI 0403E.d SC1.6.5.</summary>
+static const uintptr_t DEMCR = 0xE000EDFC;
+/// <summary>Base address of Data Watchpoint and Trace unit, ARM DDI 0403E.d SC1.8.7.</summary>
+static const uintptr_t DWT_BASE = 0xE0001000;
+
 /// <summary>The IOM4 cores on the MT3620 use three bits to encode interrupt priorities.</summary>
 #define IRQ_PRIORITY_BITS 3
 
@@ -22,6 +27,19 @@ static const uintptr_t NVIC_IPR_BASE = 0xE000E400;
 /// </summary>
 typedef void (*Callback)(void);
 
+#if defined(AzureSphere_HOST)
+// Host builds run the firmware against an emulated core and mailbox (host/mt3620_host.c),
+// which supplies register access and interrupt masking in place of the definitions below.
+void WriteReg8(uintptr_t baseAddr, size_t offset, uint8_t value);
+void WriteReg32(uintptr_t baseAddr, size_t offset, uint32_t value);
+uint32_t ReadReg32(uintptr_t baseAddr, size_t offset);
+uint32_t BlockIrqs(void);
+void RestoreIrqs(uint32_t prevBasePri);
+void DisableIrqs(void);
+void EnableIrqs(void);
+void WaitForInterrupt(void);
+#else
+
 /// <summary>
 /// Write the supplied 8-bit value to an address formed from the supplied base
 /// address and offset.
@@ -60,6 +78,7 @@ static inline uint32_t ReadReg32(uintptr_t baseAddr, size_t offset)
 {
     return *(volatile uint32_t *)(baseAddr + offset);
 }
+#endif
 
 /// <summary>
 /// <para>Read a 32-bit register from the supplied address, clear the supplied bits,
@@ -97,6 +116,7 @@ static inline void SetReg32(uintptr_t baseAddr, size_t offset, uint32_t setBits)
     WriteReg32(baseAddr, offset, value);
 }
 
+#if !defined(AzureSphere_HOST)
 /// <summary>
 /// <para>Blocks interrupts at priority 1 level and above.</para>
 /// <para>Pair this with a call to <see cref="RestoreIrqs" /> to unblock interrupts.</para>
@@ -106,7 +126,7 @@ static inline void SetReg32(uintptr_t baseAddr, size_t offset, uint32_t setBits)
 static inline uint32_t BlockIrqs(void)
 {
     uint32_t prevBasePri;
-    uint32_t newBasePri = 1; // block IRQs priority 1 and above
+    uint32_t newBasePri = 1U << (8 - IRQ_PRIORITY_BITS); // block IRQs priority 1 and above
 
     __asm__("mrs %0, BASEPRI" : "=r"(prevBasePri) :);
     __asm__("msr BASEPRI, %0" : : "r"(newBasePri));
@@ -122,6 +142,56 @@ static inline void RestoreIrqs(uint32_t prevBasePri)
     __asm__("msr BASEPRI, %0" : : "r"(prevBasePri));
 }
 
+/// <summary>
+/// <para>Masks all configurable interrupts by setting PRIMASK.</para>
+/// <para>Unlike <see cref="BlockIrqs" />, an interrupt which becomes pending while PRIMASK is
+/// set still wakes the core from <see cref="WaitForInterrupt" />, so a wakeup condition can be
+/// checked and slept on without a race. Pair this with a call to <see cref="EnableIrqs" />.</para>
+/// </summary>
+static inline void DisableIrqs(void)
+{
+    __asm__ volatile("cpsid i" : : : "memory");
+}
+
+/// <summary>
+/// Clears PRIMASK, so that interrupts masked by <see cref="DisableIrqs" /> are taken.
+/// </summary>
+static inline void EnableIrqs(void)
+{
+    __asm__ volatile("cpsie i\n\tisb" : : : "memory");
+}
+
+/// <summary>
+/// <para>Sleeps until an interrupt is pending, ARM DDI 0403E.d SB1.5.19.</para>
+/// <para>Outstanding memory accesses are completed first.</para>
+/// </summary>
+static inline void WaitForInterrupt(void)
+{
+    __asm__ volatile("dsb\n\twfi" : : : "memory");
+}
+#endif
+
+/// <summary>
+/// <para>Starts the DWT cycle counter, which counts core clock cycles and wraps every
+/// 2^32 cycles (about 21.7 seconds at 197.6MHz).</para>
+/// <para><see cref="ReadCycleCounter" /></para>
+/// </summary>
+static inline void EnableCycleCounter(void)
+{
+    SetReg32(DEMCR, 0, 1U << 24);  // TRCENA
+    WriteReg32(DWT_BASE, 0x04, 0); // CYCCNT
+    SetReg32(DWT_BASE, 0x00, 1U);  // CTRL.CYCCNTENA
+}
+
+/// <summary>
+/// Reads the DWT cycle counter started by <see cref="EnableCycleCounter" />. Differences
+/// between two readings are correct across a wrap when computed as uint32_t.
+/// </summary>
+static inline uint32_t ReadCycleCounter(void)
+{
+    return ReadReg32(DWT_BASE, 0x04);
+}
+
 /// <summary>
 /// <para>Set NVIC priority for the supplied interrupt.</para>
 /// <para>See ARM DDI 0403E.d SB3.4.9, Interrupt Priority Registers, NVIC_IPR0-NVIC_IPR123.</para>
@@ -10,6 +10,10 @@
 
 static const uintptr_t MAILBOX_BASE = 0x21050000;
 
+static Callback mailboxDataCallback = NULL;
+
+static IntercoreStats intercoreStats;
+
 static void ReceiveMessage(uint32_t *command, uint32_t *data);
 static uint32_t GetBufferSize(uint32_t bufferBase);
 static BufferHeader *GetBufferHeader(uint32_t bufferBase);
@@ -37,7 +41,7 @@ static uint32_t GetBufferSize(uint32_t bufferBase)
 
 static BufferHeader *GetBufferHeader(uint32_t bufferBase)
 {
-    return (BufferHeader *)(bufferBase & ~0x1F);
+    return (BufferHeader *)(uintptr_t)(bufferBase & ~0x1F);
 }
 
 int GetIntercoreBuffers(BufferHeader **outbound, BufferHeader **inbound, uint32_t *bufSize)
@@ -76,6 +80,29 @@ int GetIntercoreBuffers(BufferHeader **outbound, BufferHeader **inbound, uint32_
     return 0;
 }
 
+void EnableIntercoreInterrupt(uint8_t priority, Callback dataCallback)
+{
+    mailboxDataCallback = dataCallback;
+
+    // SW_RX_INT_EN[0] = 1 -> interrupt when the HL app has written a block. Reads by the HL app
+    // (bit 1) are left masked, nothing waits for them and each would be a spurious wakeup.
+    WriteReg32(MAILBOX_BASE, 0x18, 1U << 0);
+
+    SetNvicPriority(INTERCORE_IRQ, priority);
+    EnableNvicInterrupt(INTERCORE_IRQ);
+}
+
+void MT3620_HandleMailboxIrq11(void)
+{
+    // SW_RX_INT_STS: write 1 to clear the pending bits.
+    uint32_t status = ReadReg32(MAILBOX_BASE, 0x1C);
+    WriteReg32(MAILBOX_BASE, 0x1C, status);
+
+    if (mailboxDataCallback != NULL) {
+        mailboxDataCallback();
+    }
+}
+
 static uint8_t *DataAreaOffset8(BufferHeader *header, size_t offset)
 {
     // Data storage area following header in buffer.
@@ -97,78 +124,112 @@ static uint32_t RoundUp(uint32_t value, uint32_t alignment)
     return (value + (alignment - 1)) & ~(alignment - 1);
 }
 
-int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize, const void *src,
-                uint32_t dataSize)
+// Split the block data that starts after the size word at position into the span up to the
+// end of the buffer and the remainder, which wraps around to the start.
+static void DescribeBlock(BufferHeader *header, uint32_t bufSize, uint32_t position,
+                          uint32_t blockSize, RingBlock *block)
 {
-    uint32_t remoteReadPosition = inbound->readPosition;
-    uint32_t localWritePosition = outbound->writePosition;
-
-    if (remoteReadPosition >= bufSize) {
-		Log_Debug("EnqueueData: remoteReadPosition invalid\r\n");
-        return -1;
+    uint32_t dataToEnd = bufSize - position - sizeof(uint32_t);
+    uint32_t firstSize = (blockSize < dataToEnd) ? blockSize : dataToEnd;
+
+    block->data[0] = DataAreaOffset8(header, position + sizeof(uint32_t));
+    block->size[0] = firstSize;
+    block->data[1] = DataAreaOffset8(header, 0);
+    block->size[1] = blockSize - firstSize;
+    block->blockSize = blockSize;
+
+    // Round position to next aligned block, and wraparound end of buffer if required.
+    position = RoundUp(position + sizeof(uint32_t) + blockSize, RINGBUFFER_ALIGNMENT);
+    if (position >= bufSize) {
+        position -= bufSize;
     }
+    block->nextPosition = position;
+}
 
+// Free space between the local write position and the remote read position.
+static uint32_t SpaceBetween(uint32_t bufSize, uint32_t remoteReadPosition, uint32_t localWritePosition)
+{
     // If the read pointer is behind the write pointer, then the free space wraps around.
-    uint32_t availSpace;
     if (remoteReadPosition <= localWritePosition) {
-        availSpace = remoteReadPosition - localWritePosition + bufSize;
+        return remoteReadPosition - localWritePosition + bufSize;
     } else {
-        availSpace = remoteReadPosition - localWritePosition;
+        return remoteReadPosition - localWritePosition;
+    }
+}
+
+// Reserve a block at localWritePosition, given where the high-level application has read up to.
+static int ReserveAt(BufferHeader *outbound, uint32_t bufSize, uint32_t remoteReadPosition,
+                     uint32_t localWritePosition, uint32_t dataSize, RingBlock *block)
+{
+    if (remoteReadPosition >= bufSize) {
+		Log_Debug("ReserveWrite: remoteReadPosition invalid\r\n");
+        return -1;
     }
 
+    uint32_t availSpace = SpaceBetween(bufSize, remoteReadPosition, localWritePosition);
+
     // If there isn't enough space to enqueue a block, then abort the operation.
     if (availSpace < sizeof(uint32_t) + dataSize + RINGBUFFER_ALIGNMENT) {
-		Log_Debug("EnqueueData: not enough space to enqueue block\r\n");
+		Log_Debug("ReserveWrite: not enough space to enqueue block\r\n");
         return -1;
     }
 
-    // Write up to end of buffer. If the block ends before then, only write up to the end of the
-    // block.
-    uint32_t dataToEnd = bufSize - localWritePosition;
-
     // There must be enough space between the write pointer and the end of the buffer to store the
     // block size as a contiguous 4-byte value. The remainder of message can wrap around.
-    if (dataToEnd < sizeof(uint32_t)) {
-		Log_Debug("EnqueueData: not enough space for block size\r\n");
+    if (bufSize - localWritePosition < sizeof(uint32_t)) {
+		Log_Debug("ReserveWrite: not enough space for block size\r\n");
         return -1;
     }
 
-    uint32_t writeToEnd = sizeof(uint32_t) + dataSize;
-    if (dataToEnd < writeToEnd) {
-        writeToEnd = dataToEnd;
-    }
-
     // Write block size to first word in block.
     *DataAreaOffset32(outbound, localWritePosition) = dataSize;
-    writeToEnd -= sizeof(uint32_t);
-
-    const uint8_t *src8 = src;
-    uint8_t *dest8 = DataAreaOffset8(outbound, localWritePosition + sizeof(uint32_t));
+    DescribeBlock(outbound, bufSize, localWritePosition, dataSize, block);
+    return 0;
+}
 
-    __builtin_memcpy(dest8, src8, writeToEnd);
-    __builtin_memcpy(DataAreaOffset8(outbound, 0), src8 + writeToEnd, dataSize - writeToEnd);
+int ReserveWrite(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize, uint32_t dataSize,
+                 RingBlock *block)
+{
+    return ReserveAt(outbound, bufSize, inbound->readPosition, outbound->writePosition, dataSize,
+                     block);
+}
 
-    // Advance write position.
-    localWritePosition =
-        RoundUp(localWritePosition + sizeof(uint32_t) + dataSize, RINGBUFFER_ALIGNMENT);
-    if (localWritePosition >= bufSize) {
-        localWritePosition -= bufSize;
-    }
-    outbound->writePosition = localWritePosition;
+// Make blocks up to position visible to the high-level application and ring its doorbell.
+static void PublishWrite(BufferHeader *outbound, uint32_t position)
+{
+    // The block contents must be visible before the new write position.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    outbound->writePosition = position;
 
     // SW_TX_INT_PORT[0] = 1 -> indicate message received.
     WriteReg32(MAILBOX_BASE, 0x14, 1U << 0);
-    return 0;
+    intercoreStats.writeDoorbells++;
 }
 
-int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize, void *dest,
-                uint32_t *dataSize)
+// Hand the space of blocks read up to position back to the high-level application.
+static void PublishRead(BufferHeader *outbound, uint32_t position)
 {
-    uint32_t remoteWritePosition = inbound->writePosition;
-    uint32_t localReadPosition = outbound->readPosition;
+    // Finish reading the block before handing its space back.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    outbound->readPosition = position;
 
+    // SW_TX_INT_PORT[1] = 1 -> indicate message received.
+    WriteReg32(MAILBOX_BASE, 0x14, 1U << 1);
+    intercoreStats.readDoorbells++;
+}
+
+void CommitWrite(BufferHeader *outbound, const RingBlock *block)
+{
+    PublishWrite(outbound, block->nextPosition);
+    intercoreStats.blocksWritten++;
+}
+
+// Find the block at localReadPosition, given where the high-level application has written up to.
+static int PeekAt(BufferHeader *inbound, uint32_t bufSize, uint32_t remoteWritePosition,
+                  uint32_t localReadPosition, RingBlock *block)
+{
     if (remoteWritePosition >= bufSize) {
-		Log_Debug("DequeueData: remoteWritePosition invalid\r\n");
+		Log_Debug("PeekData: remoteWritePosition invalid\r\n");
         return -1;
     }
 
@@ -185,7 +246,7 @@ int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
     // There must be at least four contiguous bytes to hold the block size.
     if (availData < sizeof(uint32_t)) {
         if (availData > 0) {
-			Log_Debug("DequeueData: availData < 4 bytes\r\n");
+			Log_Debug("PeekData: availData < 4 bytes\r\n");
         }
 
         return -1;
@@ -193,52 +254,281 @@ int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
 
     size_t dataToEnd = bufSize - localReadPosition;
     if (dataToEnd < sizeof(uint32_t)) {
-		Log_Debug("DequeueData: dataToEnd < 4 bytes\r\n");
+		Log_Debug("PeekData: dataToEnd < 4 bytes\r\n");
         return -1;
     }
 
+    // Read the block only after seeing the write position that covers it.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
     uint32_t blockSize = *DataAreaOffset32(inbound, localReadPosition);
 
     // Ensure the block size is no greater than the available data.
     if (blockSize + sizeof(uint32_t) > availData) {
-		Log_Debug("DequeueData: message size greater than available data\r\n");
+		Log_Debug("PeekData: message size greater than available data\r\n");
         return -1;
     }
 
-    // Abort if the caller-supplied buffer is not large enough to hold the message.
-    if (blockSize > *dataSize) {
-		Log_Debug("DequeueData: message too large for buffer\r\n");
-        *dataSize = blockSize;
+    DescribeBlock(inbound, bufSize, localReadPosition, blockSize, block);
+    return 0;
+}
+
+int PeekData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize, RingBlock *block)
+{
+    return PeekAt(inbound, bufSize, inbound->writePosition, outbound->readPosition, block);
+}
+
+void CommitRead(BufferHeader *outbound, const RingBlock *block)
+{
+    PublishRead(outbound, block->nextPosition);
+    intercoreStats.blocksRead++;
+}
+
+void BeginReadBatch(BufferHeader *outbound, BufferHeader *inbound, RingBatch *batch)
+{
+    batch->remotePosition = inbound->writePosition;
+    batch->localPosition = outbound->readPosition;
+    batch->count = 0;
+    batch->startCycle = 0;
+}
+
+int PeekBatch(BufferHeader *inbound, uint32_t bufSize, RingBatch *batch, RingBlock *block)
+{
+    if (PeekAt(inbound, bufSize, batch->remotePosition, batch->localPosition, block) == -1) {
         return -1;
     }
+    if (batch->count++ == 0) {
+        batch->startCycle = ReadCycleCounter();
+    }
+    batch->localPosition = block->nextPosition;
+    return 0;
+}
 
-    // Tell the caller the actual block size.
-    *dataSize = blockSize;
+int PeekAhead(BufferHeader *inbound, uint32_t bufSize, const RingBatch *batch, uint32_t position,
+              RingBlock *block)
+{
+    return PeekAt(inbound, bufSize, batch->remotePosition, position, block);
+}
 
-    // Read up to the end of the buffer. If the block ends before then, only read up to the end
-    // of the block.
-    uint32_t readFromEnd = dataToEnd - sizeof(uint32_t);
-    if (blockSize < readFromEnd) {
-        readFromEnd = blockSize;
+void CommitReadBatch(BufferHeader *outbound, RingBatch *batch)
+{
+    if (batch->count == 0) {
+        return;
+    }
+    PublishRead(outbound, batch->localPosition);
+    intercoreStats.blocksRead += batch->count;
+    batch->count = 0;
+}
+
+void BeginWriteBatch(BufferHeader *inbound, BufferHeader *outbound, RingBatch *batch)
+{
+    batch->remotePosition = inbound->readPosition;
+    batch->localPosition = outbound->writePosition;
+    batch->count = 0;
+    batch->startCycle = 0;
+}
+
+int ReserveBatch(BufferHeader *outbound, uint32_t bufSize, RingBatch *batch, uint32_t dataSize,
+                 RingBlock *block)
+{
+    if (ReserveAt(outbound, bufSize, batch->remotePosition, batch->localPosition, dataSize,
+                  block) == -1) {
+        return -1;
+    }
+    if (batch->count++ == 0) {
+        batch->startCycle = ReadCycleCounter();
+    }
+    batch->localPosition = block->nextPosition;
+    return 0;
+}
+
+void CommitWriteBatch(BufferHeader *outbound, RingBatch *batch)
+{
+    if (batch->count == 0) {
+        return;
+    }
+    PublishWrite(outbound, batch->localPosition);
+    intercoreStats.blocksWritten += batch->count;
+    batch->count = 0;
+}
+
+bool BatchShouldCommit(const RingBatch *batch, const CoalescePolicy *policy)
+{
+    if (batch->count == 0) {
+        return false;
+    }
+    return batch->count >= policy->maxBlocks ||
+           ReadCycleCounter() - batch->startCycle >= policy->maxCycles;
+}
+
+const IntercoreStats *GetIntercoreStats(void)
+{
+    return &intercoreStats;
+}
+
+int CopyFromBlock(const RingBlock *block, uint32_t offset, void *dest, uint32_t size)
+{
+    if (offset > block->blockSize || size > block->blockSize - offset) {
+        return -1;
     }
 
-    const uint8_t *src8 = DataAreaOffset8(inbound, localReadPosition + sizeof(uint32_t));
     uint8_t *dest8 = dest;
-    __builtin_memcpy(dest8, src8, readFromEnd);
+    if (offset < block->size[0]) {
+        uint32_t first = block->size[0] - offset;
+        if (first > size) {
+            first = size;
+        }
+        __builtin_memcpy(dest8, block->data[0] + offset, first);
+        dest8 += first;
+        size -= first;
+        offset = 0;
+    } else {
+        offset -= block->size[0];
+    }
     // If block wrapped around the end of the buffer, then read remainder from start.
-    __builtin_memcpy(dest8 + readFromEnd, DataAreaOffset8(inbound, 0), blockSize - readFromEnd);
+    __builtin_memcpy(dest8, block->data[1] + offset, size);
+    return 0;
+}
+
+int CopyToBlock(const RingBlock *block, uint32_t offset, const void *src, uint32_t size)
+{
+    if (offset > block->blockSize || size > block->blockSize - offset) {
+        return -1;
+    }
 
-    // Round read position to next aligned block, and wraparound end of buffer if required.
-    localReadPosition =
-        RoundUp(localReadPosition + sizeof(uint32_t) + blockSize, RINGBUFFER_ALIGNMENT);
-    if (localReadPosition >= bufSize) {
-        localReadPosition -= bufSize;
+    const uint8_t *src8 = src;
+    if (offset < block->size[0]) {
+        uint32_t first = block->size[0] - offset;
+        if (first > size) {
+            first = size;
+        }
+        __builtin_memcpy(block->data[0] + offset, src8, first);
+        src8 += first;
+        size -= first;
+        offset = 0;
+    } else {
+        offset -= block->size[0];
     }
+    __builtin_memcpy(block->data[1] + offset, src8, size);
+    return 0;
+}
 
-    outbound->readPosition = localReadPosition;
+void PublishHeaderWords(BufferHeader *outbound, const uint32_t *words, uint32_t count)
+{
+    uint32_t sequence = outbound->reserved[0];
 
-    // SW_TX_INT_PORT[1] = 1 -> indicate message received.
-    WriteReg32(MAILBOX_BASE, 0x14, 1U << 1);
+    // Odd while the words are inconsistent.
+    __atomic_store_n(&outbound->reserved[0], sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (uint32_t i = 0; i < count && i < HEADER_WORDS_MAX; i++) {
+        __atomic_store_n(&outbound->reserved[1 + i], words[i], __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    __atomic_store_n(&outbound->reserved[0], sequence + 2, __ATOMIC_RELAXED);
+}
+
+int ReadHeaderWords(const BufferHeader *header, uint32_t *words, uint32_t count, uint32_t maxRetries)
+{
+    for (uint32_t attempt = 0; attempt <= maxRetries; attempt++) {
+        uint32_t before = __atomic_load_n(&header->reserved[0], __ATOMIC_RELAXED);
+        if (before & 1) {
+            continue;
+        }
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        for (uint32_t i = 0; i < count && i < HEADER_WORDS_MAX; i++) {
+            words[i] = __atomic_load_n(&header->reserved[1 + i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&header->reserved[0], __ATOMIC_RELAXED) == before) {
+            return (int)attempt;
+        }
+    }
+    return -1;
+}
 
+uint32_t GetWriteSpace(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize)
+{
+    uint32_t remoteReadPosition = inbound->readPosition;
+    if (remoteReadPosition >= bufSize) {
+        return 0;
+    }
+    return SpaceBetween(bufSize, remoteReadPosition, outbound->writePosition);
+}
+
+int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize, const void *src,
+                uint32_t dataSize)
+{
+    RingBlock block;
+
+    if (ReserveWrite(inbound, outbound, bufSize, dataSize, &block) == -1) {
+        return -1;
+    }
+    CopyToBlock(&block, 0, src, dataSize);
+    CommitWrite(outbound, &block);
     return 0;
 }
+
+int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize, void *dest,
+                uint32_t *dataSize)
+{
+    RingBlock block;
+
+    if (PeekData(outbound, inbound, bufSize, &block) == -1) {
+        return -1;
+    }
+
+    // Abort if the caller-supplied buffer is not large enough to hold the message.
+    if (block.blockSize > *dataSize) {
+		Log_Debug("DequeueData: message too large for buffer\r\n");
+        *dataSize = block.blockSize;
+        return -1;
+    }
+
+    // Tell the caller the actual block size.
+    *dataSize = block.blockSize;
+    CopyFromBlock(&block, 0, dest, block.blockSize);
+    CommitRead(outbound, &block);
+    return 0;
+}
+
+uint32_t EnqueueDataBatch(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
+                          const IntercoreMessage *messages, uint32_t count)
+{
+    RingBatch batch;
+    RingBlock block;
+    uint32_t sent;
+
+    BeginWriteBatch(inbound, outbound, &batch);
+    for (sent = 0; sent < count; sent++) {
+        if (ReserveBatch(outbound, bufSize, &batch, messages[sent].size, &block) == -1) {
+            break;
+        }
+        CopyToBlock(&block, 0, messages[sent].data, messages[sent].size);
+    }
+    CommitWriteBatch(outbound, &batch);
+    return sent;
+}
+
+uint32_t DequeueDataBatch(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
+                          void *dest, uint32_t destSize, uint32_t *sizes, uint32_t maxCount)
+{
+    RingBatch batch;
+    RingBlock block;
+    uint8_t *dest8 = dest;
+    uint32_t received = 0;
+
+    BeginReadBatch(outbound, inbound, &batch);
+    while (received < maxCount) {
+        // Stop before a message that does not fit, leaving it for the next call.
+        RingBatch next = batch;
+        if (PeekBatch(inbound, bufSize, &next, &block) == -1 || block.blockSize > destSize) {
+            break;
+        }
+        batch = next;
+        CopyFromBlock(&block, 0, dest8, block.blockSize);
+        sizes[received++] = block.blockSize;
+        dest8 += block.blockSize;
+        destSize -= block.blockSize;
+    }
+    CommitReadBatch(outbound, &batch);
+    return received;
+}
@@ -4,8 +4,11 @@
 #ifndef MT3620_INTERCORE_H
 #define MT3620_INTERCORE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "mt3620-baremetal.h"
+
 /// <summary>
 /// There are two buffers, inbound and outbound, which are used to track
 /// how much data has been written to, and read from, each shared buffer.
@@ -23,10 +26,15 @@ typedef struct {
     /// <para>Dequeue function uses this value to store the last position read from by
     /// the real-time application.</para>
     uint32_t readPosition;
-    /// <summary>Reserved for alignment.</summary>
+    /// <summary>Not used by the ring. The owner of the header can publish data here for the
+    /// other side with <see cref="PublishHeaderWords" />.</summary>
     uint32_t reserved[14];
 } BufferHeader;
 
+/// <summary>Words <see cref="PublishHeaderWords" /> can publish; the first reserved word holds
+/// the sequence count.</summary>
+#define HEADER_WORDS_MAX 13
+
 /// <summary>Blocks inside the shared buffer have this alignment.</summary>
 #define RINGBUFFER_ALIGNMENT 16
 
@@ -44,6 +52,58 @@ typedef struct {
 /// <returns>0 on success, -1 on failure.</returns>
 int GetIntercoreBuffers(BufferHeader **outbound, BufferHeader **inbound, uint32_t *bufSize);
 
+/// <summary>Mailbox software interrupt, raised when the high-level application signals that
+/// it has written to or read from the shared buffers.</summary>
+#define INTERCORE_IRQ 11
+
+/// <summary>
+/// <para>Enables the mailbox software interrupt, so that the application can sleep with WFI
+/// until the high-level application writes a block.</para>
+/// <para><see cref="MT3620_HandleMailboxIrq11" /> must be installed in the exception vector
+/// table at INT_TO_EXC(<see cref="INTERCORE_IRQ" />).</para>
+/// </summary>
+/// <param name="priority">NVIC priority of the interrupt.</param>
+/// <param name="dataCallback">Called in interrupt context each time the high-level application
+/// signals a write, or NULL. It can receive data while the main loop is busy; code outside
+/// the interrupt that shares state with it must use <see cref="BlockIrqs" />.</param>
+void EnableIntercoreInterrupt(uint8_t priority, Callback dataCallback);
+
+/// <summary>Mailbox software interrupt handler, acknowledges the interrupt and runs the
+/// callback passed to <see cref="EnableIntercoreInterrupt" />.</summary>
+void MT3620_HandleMailboxIrq11(void);
+
+/// <summary>
+/// <para>Publish <paramref name="count" /> words in the reserved words of the outbound buffer
+/// header, where the high-level application can sample them at any time without a message.
+/// </para>
+/// <para>The words are guarded by a sequence count (a seqlock): it is odd while they are
+/// being written, and readers retry if it changed while they copied. Only one context may
+/// publish.</para>
+/// </summary>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="words">The words to publish.</param>
+/// <param name="count">Number of words, at most <see cref="HEADER_WORDS_MAX" />.</param>
+void PublishHeaderWords(BufferHeader *outbound, const uint32_t *words, uint32_t count);
+
+/// <summary>
+/// Read words published with <see cref="PublishHeaderWords" />, from the other side.
+/// </summary>
+/// <param name="header">The buffer header they were published in.</param>
+/// <param name="words">Receives the words.</param>
+/// <param name="count">Number of words, at most <see cref="HEADER_WORDS_MAX" />.</param>
+/// <param name="maxRetries">Attempts to make while an update is in progress.</param>
+/// <returns>Number of retries needed, or -1 if no consistent copy was read.</returns>
+int ReadHeaderWords(const BufferHeader *header, uint32_t *words, uint32_t count, uint32_t maxRetries);
+
+/// <summary>
+/// Free space in the outbound buffer, in bytes. A block of n data bytes takes
+/// RoundUp(4 + n, <see cref="RINGBUFFER_ALIGNMENT" />) bytes of it, and a write must leave at
+/// least <see cref="RINGBUFFER_ALIGNMENT" /> bytes free. Used by senders that keep room for
+/// urgent messages.
+/// </summary>
+uint32_t GetWriteSpace(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize);
+
 /// <summary>
 /// Add data to the shared buffer, to be read by the high-level application.
 /// </summary>
@@ -76,4 +136,203 @@ int EnqueueData(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
 int DequeueData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize, void *dest,
                 uint32_t *dataSize);
 
+/// <summary>
+/// <para>A block in the shared buffer, returned by <see cref="PeekData" /> and
+/// <see cref="ReserveWrite" />. The block data may wrap around the end of the buffer,
+/// so it is described as up to two contiguous spans; span[1] is empty unless it wraps.</para>
+/// <para>The pointers refer directly to shared memory and remain valid until the block
+/// is committed.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Start of each span.</summary>
+    uint8_t *data[2];
+    /// <summary>Length of each span in bytes.</summary>
+    uint32_t size[2];
+    /// <summary>Total length of the block data in bytes.</summary>
+    uint32_t blockSize;
+    /// <summary>Buffer position following the block, used by the commit functions.</summary>
+    uint32_t nextPosition;
+} RingBlock;
+
+/// <summary>
+/// Find the next block written by the high-level application without copying or consuming
+/// it. Call <see cref="CommitRead" /> once the data is no longer needed.
+/// </summary>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="inbound">The inbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="bufSize">Total size of shared buffer in bytes.</param>
+/// <param name="block">On success, describes the block data in the shared buffer.</param>
+/// <returns>0 if a block is available, -1 otherwise.</returns>
+int PeekData(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize, RingBlock *block);
+
+/// <summary>
+/// Release a block obtained from <see cref="PeekData" /> so that the high-level application
+/// can reuse its space. Blocks must be committed in the order they were peeked.
+/// </summary>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="block">The block returned by <see cref="PeekData" />.</param>
+void CommitRead(BufferHeader *outbound, const RingBlock *block);
+
+/// <summary>
+/// Reserve space for a block of <paramref name="dataSize" /> bytes in the shared buffer, to be
+/// filled in place and published with <see cref="CommitWrite" />.
+/// </summary>
+/// <param name="inbound">The inbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="bufSize">
+/// The total buffer size, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="dataSize">Length of the block data in bytes.</param>
+/// <param name="block">On success, describes where the block data must be written.</param>
+/// <returns>0 if the space was reserved, -1 otherwise.</returns>
+int ReserveWrite(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize, uint32_t dataSize,
+                 RingBlock *block);
+
+/// <summary>
+/// Publish a block obtained from <see cref="ReserveWrite" /> to the high-level application.
+/// </summary>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="block">The block returned by <see cref="ReserveWrite" />.</param>
+void CommitWrite(BufferHeader *outbound, const RingBlock *block);
+
+/// <summary>
+/// Copy <paramref name="size" /> bytes starting at <paramref name="offset" /> within a block to
+/// <paramref name="dest" />, following the wrap if there is one.
+/// </summary>
+/// <returns>0 on success, -1 if the range is outside the block.</returns>
+int CopyFromBlock(const RingBlock *block, uint32_t offset, void *dest, uint32_t size);
+
+/// <summary>
+/// Copy <paramref name="size" /> bytes from <paramref name="src" /> to
+/// <paramref name="offset" /> within a block, following the wrap if there is one.
+/// </summary>
+/// <returns>0 on success, -1 if the range is outside the block.</returns>
+int CopyToBlock(const RingBlock *block, uint32_t offset, const void *src, uint32_t size);
+
+/// <summary>
+/// <para>A run of blocks read or written with one update of the shared position and one
+/// doorbell, instead of one of each per block.</para>
+/// <para>The other side's position is read once when the batch begins. Blocks added to the batch
+/// are not visible to, or released to, the high-level application until the batch is committed.
+/// Do not mix single-block calls with an open batch in the same direction.</para>
+/// </summary>
+typedef struct {
+    /// <summary>Position of the high-level application, read when the batch began.</summary>
+    uint32_t remotePosition;
+    /// <summary>Position following the last block added to the batch.</summary>
+    uint32_t localPosition;
+    /// <summary>Blocks added since the batch began or was last committed.</summary>
+    uint32_t count;
+    /// <summary>Cycle counter when the first of those blocks was added.</summary>
+    uint32_t startCycle;
+} RingBatch;
+
+/// <summary>When to commit a batch that is still growing.</summary>
+typedef struct {
+    /// <summary>Commit once the batch holds this many blocks.</summary>
+    uint32_t maxBlocks;
+    /// <summary>Commit once the first block of the batch is this many cycles old, so that
+    /// the other side is not kept waiting by a long burst.</summary>
+    uint32_t maxCycles;
+} CoalescePolicy;
+
+/// <summary>Blocks transferred and doorbells rung since boot. Each doorbell is one interrupt
+/// on the high-level side, so blocks minus doorbells is the number of interrupts saved.</summary>
+typedef struct {
+    uint32_t blocksRead;
+    uint32_t readDoorbells;
+    uint32_t blocksWritten;
+    uint32_t writeDoorbells;
+} IntercoreStats;
+
+/// <summary>A message for <see cref="EnqueueDataBatch" />.</summary>
+typedef struct {
+    const void *data;
+    uint32_t size;
+} IntercoreMessage;
+
+/// <summary>Start a batch of reads, see <see cref="PeekBatch" />.</summary>
+/// <param name="outbound">The outbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="inbound">The inbound buffer, as obtained from <see cref="GetIntercoreBuffers" />.
+/// </param>
+/// <param name="batch">The batch to start.</param>
+void BeginReadBatch(BufferHeader *outbound, BufferHeader *inbound, RingBatch *batch);
+
+/// <summary>
+/// Find the block following the last one in the batch and add it to the batch. Its data stays
+/// valid until <see cref="CommitReadBatch" />.
+/// </summary>
+/// <returns>0 if a block is available, -1 otherwise.</returns>
+int PeekBatch(BufferHeader *inbound, uint32_t bufSize, RingBatch *batch, RingBlock *block);
+
+/// <summary>
+/// <para>Find the block at <paramref name="position" />, the nextPosition of a block returned by
+/// <see cref="PeekBatch" /> or by this function, without adding it to the batch. This lets the
+/// reader look past blocks it cannot consume yet, for example to pick out urgent messages.</para>
+/// <para>The block stays in the shared buffer: PeekBatch returns it again once the blocks before
+/// it have been consumed, so the caller must remember which ones it has already handled.</para>
+/// </summary>
+/// <returns>0 if a block is available at that position, -1 otherwise.</returns>
+int PeekAhead(BufferHeader *inbound, uint32_t bufSize, const RingBatch *batch, uint32_t position,
+              RingBlock *block);
+
+/// <summary>
+/// Release every block of the batch to the high-level application with one doorbell. The batch
+/// stays open and can continue.
+/// </summary>
+void CommitReadBatch(BufferHeader *outbound, RingBatch *batch);
+
+/// <summary>Start a batch of writes, see <see cref="ReserveBatch" />.</summary>
+void BeginWriteBatch(BufferHeader *inbound, BufferHeader *outbound, RingBatch *batch);
+
+/// <summary>
+/// Reserve space for a block following the last one in the batch, to be filled in place.
+/// </summary>
+/// <returns>0 if the space was reserved, -1 otherwise.</returns>
+int ReserveBatch(BufferHeader *outbound, uint32_t bufSize, RingBatch *batch, uint32_t dataSize,
+                 RingBlock *block);
+
+/// <summary>
+/// Publish every block of the batch to the high-level application with one doorbell. The batch
+/// stays open and can continue.
+/// </summary>
+void CommitWriteBatch(BufferHeader *outbound, RingBatch *batch);
+
+/// <summary>
+/// Whether a batch has reached either threshold of <paramref name="policy" />. A batch must
+/// still be committed when the caller runs out of blocks, whatever the policy says.
+/// </summary>
+bool BatchShouldCommit(const RingBatch *batch, const CoalescePolicy *policy);
+
+/// <summary>Counters of blocks transferred and doorbells rung.</summary>
+const IntercoreStats *GetIntercoreStats(void);
+
+/// <summary>
+/// Add several messages to the shared buffer with a single doorbell.
+/// </summary>
+/// <returns>Number of messages enqueued, from the start of <paramref name="messages" />; fewer
+/// than <paramref name="count" /> if the buffer is full.</returns>
+uint32_t EnqueueDataBatch(BufferHeader *inbound, BufferHeader *outbound, uint32_t bufSize,
+                          const IntercoreMessage *messages, uint32_t count);
+
+/// <summary>
+/// Remove up to <paramref name="maxCount" /> messages from the shared buffer with a single
+/// doorbell. The messages are copied back to back into <paramref name="dest" />.
+/// </summary>
+/// <param name="dest">Destination for the message data.</param>
+/// <param name="destSize">Size of <paramref name="dest" /> in bytes.</param>
+/// <param name="sizes">Receives the size of each message.</param>
+/// <param name="maxCount">Number of entries in <paramref name="sizes" />.</param>
+/// <returns>Number of messages dequeued. A message which does not fit in the remaining space
+/// is left in the shared buffer.</returns>
+uint32_t DequeueDataBatch(BufferHeader *outbound, BufferHeader *inbound, uint32_t bufSize,
+                          void *dest, uint32_t destSize, uint32_t *sizes, uint32_t maxCount);
+
 #endif // #ifndef MT3620_INTERCORE_H
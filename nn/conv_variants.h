@@ -0,0 +1,13 @@
+// Convolution kernel per layer (nn_conv_variant_t), written by
+// cifar10-autotune from estimated Cortex-M4 cycles. Regenerate with
+//   cifar10-autotune -o nn/conv_variants.h
+// after changing the model.
+
+#ifndef __CONV_VARIANTS_H__
+#define __CONV_VARIANTS_H__
+
+#define CONV1_VARIANT NN_CONV_RGB  // 5444690 estimated cycles
+#define CONV2_VARIANT NN_CONV_FAST  // 6444280 estimated cycles
+#define CONV3_VARIANT NN_CONV_FAST  // 1555920 estimated cycles
+
+#endif
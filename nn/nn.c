@@ -1,4 +1,14 @@
 #include "nn.h"
+#include "conv_variants.h"
+#include "gate_weights.h"
+#include "exit_weights.h"
+
+#ifdef HOST_CYCLE_COUNT
+// Scalar work outside the counted kernels, for the host M4 cycle estimator.
+#define COUNT(op, n) (m4_op_counts[M4_OP_##op] += (n))
+#else
+#define COUNT(op, n) ((void)0)
+#endif
 
 static uint8_t mean[DATA_OUT_CH*DATA_OUT_DIM*DATA_OUT_DIM] = MEAN_DATA;
 
@@ -14,12 +24,145 @@ static q7_t conv3_bias[CONV3_OUT_CH] = CONV3_BIAS;
 static q7_t ip1_wt[IP1_IN_DIM*IP1_OUT_DIM] = IP1_WT;
 static q7_t ip1_bias[IP1_OUT_DIM] = IP1_BIAS;
 
+// Gate of the cascade (nn_cascade_run): conv1's filters at stride 4, an
+// average pool to 4x4 and a classifier of its own, about 2.5% of the work of
+// the full model.
+#define GATE_CONV_STRIDE 4
+#define GATE_CONV_OUT_DIM 8
+#define GATE_POOL_OUT_DIM 4
+#define GATE_FC_IN_DIM (GATE_POOL_OUT_DIM*GATE_POOL_OUT_DIM*CONV1_OUT_CH)
+
+static q7_t gate_fc_wt[GATE_FC_IN_DIM*IP1_OUT_DIM] = GATE_FC_WT;
+static q7_t gate_fc_bias[IP1_OUT_DIM] = GATE_FC_BIAS;
+
+// Early exit heads of cifar10_model: the trunk's activation averaged down to
+// 4x4 and a classifier of its own.
+#define EXIT_POOL_OUT_DIM 4
+#define EXIT1_FC_IN_DIM (EXIT_POOL_OUT_DIM*EXIT_POOL_OUT_DIM*POOL1_IN_CH)
+#define EXIT2_FC_IN_DIM (EXIT_POOL_OUT_DIM*EXIT_POOL_OUT_DIM*POOL2_IN_CH)
+
+static q7_t exit1_fc_wt[EXIT1_FC_IN_DIM*IP1_OUT_DIM] = EXIT1_FC_WT;
+static q7_t exit1_fc_bias[IP1_OUT_DIM] = EXIT1_FC_BIAS;
+static q7_t exit2_fc_wt[EXIT2_FC_IN_DIM*IP1_OUT_DIM] = EXIT2_FC_WT;
+static q7_t exit2_fc_bias[IP1_OUT_DIM] = EXIT2_FC_BIAS;
+
 //Add input_data and output_data in top main.cpp file
 //uint8_t input_data[DATA_OUT_CH*DATA_OUT_DIM*DATA_OUT_DIM];
 //q7_t output_data[IP1_OUT_DIM];
 
-q7_t col_buffer[3200];
-q7_t scratch_buffer[40960];
+static const nn_layer_t cifar10_layers[] = {
+  { .name = "conv1", .type = NN_LAYER_CONV, .variant = CONV1_VARIANT, .in_buf = NN_BUF_INPUT, .out_buf = NN_BUF1,
+    .in_dim = CONV1_IN_DIM, .in_ch = CONV1_IN_CH, .out_dim = CONV1_OUT_DIM, .out_ch = CONV1_OUT_CH,
+    .ker_dim = CONV1_KER_DIM, .pad = CONV1_PAD, .stride = CONV1_STRIDE,
+    .bias_lshift = CONV1_BIAS_LSHIFT, .out_rshift = CONV1_OUT_RSHIFT, .wt = conv1_wt, .bias = conv1_bias },
+  { .name = "pool1", .type = NN_LAYER_MAXPOOL, .in_buf = NN_BUF1, .out_buf = NN_BUF2,
+    .in_dim = POOL1_IN_DIM, .in_ch = POOL1_IN_CH, .out_dim = POOL1_OUT_DIM, .out_ch = POOL1_IN_CH,
+    .ker_dim = POOL1_KER_DIM, .pad = POOL1_PAD, .stride = POOL1_STRIDE },
+  { .name = "relu1", .type = NN_LAYER_RELU, .in_buf = NN_BUF2, .out_buf = NN_BUF2,
+    .in_dim = RELU1_OUT_DIM, .in_ch = RELU1_OUT_CH, .out_dim = RELU1_OUT_DIM, .out_ch = RELU1_OUT_CH },
+  { .name = "conv2", .type = NN_LAYER_CONV, .variant = CONV2_VARIANT, .in_buf = NN_BUF2, .out_buf = NN_BUF1,
+    .in_dim = CONV2_IN_DIM, .in_ch = CONV2_IN_CH, .out_dim = CONV2_OUT_DIM, .out_ch = CONV2_OUT_CH,
+    .ker_dim = CONV2_KER_DIM, .pad = CONV2_PAD, .stride = CONV2_STRIDE,
+    .bias_lshift = CONV2_BIAS_LSHIFT, .out_rshift = CONV2_OUT_RSHIFT, .wt = conv2_wt, .bias = conv2_bias },
+  { .name = "relu2", .type = NN_LAYER_RELU, .in_buf = NN_BUF1, .out_buf = NN_BUF1,
+    .in_dim = RELU2_OUT_DIM, .in_ch = RELU2_OUT_CH, .out_dim = RELU2_OUT_DIM, .out_ch = RELU2_OUT_CH },
+  { .name = "pool2", .type = NN_LAYER_AVEPOOL, .in_buf = NN_BUF1, .out_buf = NN_BUF2,
+    .in_dim = POOL2_IN_DIM, .in_ch = POOL2_IN_CH, .out_dim = POOL2_OUT_DIM, .out_ch = POOL2_IN_CH,
+    .ker_dim = POOL2_KER_DIM, .pad = POOL2_PAD, .stride = POOL2_STRIDE },
+  { .name = "conv3", .type = NN_LAYER_CONV, .variant = CONV3_VARIANT, .in_buf = NN_BUF2, .out_buf = NN_BUF1,
+    .in_dim = CONV3_IN_DIM, .in_ch = CONV3_IN_CH, .out_dim = CONV3_OUT_DIM, .out_ch = CONV3_OUT_CH,
+    .ker_dim = CONV3_KER_DIM, .pad = CONV3_PAD, .stride = CONV3_STRIDE,
+    .bias_lshift = CONV3_BIAS_LSHIFT, .out_rshift = CONV3_OUT_RSHIFT, .wt = conv3_wt, .bias = conv3_bias },
+  { .name = "relu3", .type = NN_LAYER_RELU, .in_buf = NN_BUF1, .out_buf = NN_BUF1,
+    .in_dim = RELU3_OUT_DIM, .in_ch = RELU3_OUT_CH, .out_dim = RELU3_OUT_DIM, .out_ch = RELU3_OUT_CH },
+  { .name = "pool3", .type = NN_LAYER_AVEPOOL, .in_buf = NN_BUF1, .out_buf = NN_BUF2,
+    .in_dim = POOL3_IN_DIM, .in_ch = POOL3_IN_CH, .out_dim = POOL3_OUT_DIM, .out_ch = POOL3_IN_CH,
+    .ker_dim = POOL3_KER_DIM, .pad = POOL3_PAD, .stride = POOL3_STRIDE },
+  { .name = "ip1", .type = NN_LAYER_FC, .in_buf = NN_BUF2, .out_buf = NN_BUF_OUTPUT,
+    .in_dim = IP1_IN_DIM, .out_dim = IP1_OUT_DIM,
+    .bias_lshift = IP1_BIAS_LSHIFT, .out_rshift = IP1_OUT_RSHIFT, .wt = ip1_wt, .bias = ip1_bias },
+  { .name = "softmax", .type = NN_LAYER_SOFTMAX, .in_buf = NN_BUF_OUTPUT, .out_buf = NN_BUF_OUTPUT,
+    .in_dim = IP1_OUT_DIM, .out_dim = IP1_OUT_DIM },
+};
+
+// The trunk holds its tensor in BUF2 after relu1 and pool2, and conv2/conv3
+// overwrite BUF1 next, so the heads pool into BUF1.
+static const nn_layer_t exit1_layers[] = {
+  { .name = "x1pool", .type = NN_LAYER_AVEPOOL, .in_buf = NN_BUF2, .out_buf = NN_BUF1,
+    .in_dim = POOL1_OUT_DIM, .in_ch = POOL1_IN_CH, .out_dim = EXIT_POOL_OUT_DIM, .out_ch = POOL1_IN_CH,
+    .ker_dim = POOL1_OUT_DIM / EXIT_POOL_OUT_DIM, .pad = 0, .stride = POOL1_OUT_DIM / EXIT_POOL_OUT_DIM },
+  { .name = "x1fc", .type = NN_LAYER_FC, .in_buf = NN_BUF1, .out_buf = NN_BUF_OUTPUT,
+    .in_dim = EXIT1_FC_IN_DIM, .out_dim = IP1_OUT_DIM,
+    .bias_lshift = EXIT1_FC_BIAS_LSHIFT, .out_rshift = EXIT1_FC_OUT_RSHIFT, .wt = exit1_fc_wt, .bias = exit1_fc_bias },
+  { .name = "x1softmax", .type = NN_LAYER_SOFTMAX, .in_buf = NN_BUF_OUTPUT, .out_buf = NN_BUF_OUTPUT,
+    .in_dim = IP1_OUT_DIM, .out_dim = IP1_OUT_DIM },
+};
+
+static const nn_layer_t exit2_layers[] = {
+  { .name = "x2pool", .type = NN_LAYER_AVEPOOL, .in_buf = NN_BUF2, .out_buf = NN_BUF1,
+    .in_dim = POOL2_OUT_DIM, .in_ch = POOL2_IN_CH, .out_dim = EXIT_POOL_OUT_DIM, .out_ch = POOL2_IN_CH,
+    .ker_dim = POOL2_OUT_DIM / EXIT_POOL_OUT_DIM, .pad = 0, .stride = POOL2_OUT_DIM / EXIT_POOL_OUT_DIM },
+  { .name = "x2fc", .type = NN_LAYER_FC, .in_buf = NN_BUF1, .out_buf = NN_BUF_OUTPUT,
+    .in_dim = EXIT2_FC_IN_DIM, .out_dim = IP1_OUT_DIM,
+    .bias_lshift = EXIT2_FC_BIAS_LSHIFT, .out_rshift = EXIT2_FC_OUT_RSHIFT, .wt = exit2_fc_wt, .bias = exit2_fc_bias },
+  { .name = "x2softmax", .type = NN_LAYER_SOFTMAX, .in_buf = NN_BUF_OUTPUT, .out_buf = NN_BUF_OUTPUT,
+    .in_dim = IP1_OUT_DIM, .out_dim = IP1_OUT_DIM },
+};
+
+static const nn_exit_t cifar10_exits[] = {
+  { .name = "exit1", .after = 2, .layers = exit1_layers, .layer_count = sizeof(exit1_layers) / sizeof(exit1_layers[0]) },
+  { .name = "exit2", .after = 5, .layers = exit2_layers, .layer_count = sizeof(exit2_layers) / sizeof(exit2_layers[0]) },
+};
+
+const nn_model_t cifar10_model = {
+  .layers = cifar10_layers,
+  .layer_count = sizeof(cifar10_layers) / sizeof(cifar10_layers[0]),
+  .exits = cifar10_exits,
+  .exit_count = sizeof(cifar10_exits) / sizeof(cifar10_exits[0]),
+};
+
+const uint8_t cifar10_exits_trained = EXITS_TRAINED;
+
+static const nn_layer_t gate_layers[] = {
+  { .name = "gconv", .type = NN_LAYER_CONV, .variant = NN_CONV_RGB, .in_buf = NN_BUF_INPUT, .out_buf = NN_BUF1,
+    .in_dim = CONV1_IN_DIM, .in_ch = CONV1_IN_CH, .out_dim = GATE_CONV_OUT_DIM, .out_ch = CONV1_OUT_CH,
+    .ker_dim = CONV1_KER_DIM, .pad = CONV1_PAD, .stride = GATE_CONV_STRIDE,
+    .bias_lshift = CONV1_BIAS_LSHIFT, .out_rshift = CONV1_OUT_RSHIFT, .wt = conv1_wt, .bias = conv1_bias },
+  { .name = "gpool", .type = NN_LAYER_AVEPOOL, .in_buf = NN_BUF1, .out_buf = NN_BUF2,
+    .in_dim = GATE_CONV_OUT_DIM, .in_ch = CONV1_OUT_CH, .out_dim = GATE_POOL_OUT_DIM, .out_ch = CONV1_OUT_CH,
+    .ker_dim = 2, .pad = 0, .stride = 2 },
+  { .name = "grelu", .type = NN_LAYER_RELU, .in_buf = NN_BUF2, .out_buf = NN_BUF2,
+    .in_dim = GATE_POOL_OUT_DIM, .in_ch = CONV1_OUT_CH, .out_dim = GATE_POOL_OUT_DIM, .out_ch = CONV1_OUT_CH },
+  { .name = "gfc", .type = NN_LAYER_FC, .in_buf = NN_BUF2, .out_buf = NN_BUF_OUTPUT,
+    .in_dim = GATE_FC_IN_DIM, .out_dim = IP1_OUT_DIM,
+    .bias_lshift = GATE_FC_BIAS_LSHIFT, .out_rshift = GATE_FC_OUT_RSHIFT, .wt = gate_fc_wt, .bias = gate_fc_bias },
+  { .name = "gsoftmax", .type = NN_LAYER_SOFTMAX, .in_buf = NN_BUF_OUTPUT, .out_buf = NN_BUF_OUTPUT,
+    .in_dim = IP1_OUT_DIM, .out_dim = IP1_OUT_DIM },
+};
+
+const nn_model_t cifar10_gate_model = {
+  .layers = gate_layers,
+  .layer_count = sizeof(gate_layers) / sizeof(gate_layers[0]),
+};
+
+const uint8_t cifar10_gate_trained = GATE_TRAINED;
+
+const nn_kernels_t nn_cmsis_kernels = {
+  .name = "cmsis",
+  .conv_rgb = arm_convolve_HWC_q7_RGB,
+  .conv_basic = arm_convolve_HWC_q7_basic,
+  .conv_fast = arm_convolve_HWC_q7_fast,
+  .conv_basic_nonsquare = arm_convolve_HWC_q7_basic_nonsquare,
+  .conv_fast_nonsquare = arm_convolve_HWC_q7_fast_nonsquare,
+  .conv_1x1 = arm_convolve_1x1_HWC_q7_fast_nonsquare,
+  .maxpool = arm_maxpool_q7_HWC,
+  .avepool = arm_avepool_q7_HWC,
+  .relu = arm_relu_q7,
+  .fc_opt = arm_fully_connected_q7_opt,
+  .softmax = arm_softmax_q7,
+};
+
+static nn_context_t default_context;
 
 void mean_subtract(q7_t* image_data) {
   for(int i=0; i<DATA_OUT_CH*DATA_OUT_DIM*DATA_OUT_DIM; i++) {
@@ -27,19 +170,285 @@ void mean_subtract(q7_t* image_data) {
   }
 }
 
-void run_nn(q7_t* input_data, q7_t* output_data) {
-  q7_t* buffer1 = scratch_buffer;
-  q7_t* buffer2 = buffer1 + 32768;
+void nn_window_mean_subtract(q7_t* frame, uint16_t dim) {
+  for (uint32_t y = 0; y < dim; y++) {
+    const uint8_t* row = &mean[(y % DATA_OUT_DIM) * DATA_OUT_DIM * DATA_OUT_CH];
+    for (uint32_t x = 0; x < dim; x++) {
+      const uint8_t* m = &row[(x % DATA_OUT_DIM) * DATA_OUT_CH];
+      q7_t* p = &frame[(y * dim + x) * DATA_OUT_CH];
+      for (int c = 0; c < DATA_OUT_CH; c++) {
+        p[c] = (q7_t)__SSAT( ((int)((uint8_t)p[c] - m[c]) >> DATA_RSHIFT), 8);
+      }
+    }
+  }
+}
+
+static q7_t* get_buffer(nn_context_t* ctx, uint8_t buf, q7_t* input_data, q7_t* output_data) {
+  switch (buf) {
+  case NN_BUF_INPUT:  return input_data;
+  case NN_BUF_OUTPUT: return output_data;
+  case NN_BUF1:       return ctx->scratch_buffer;
+  default:            return ctx->scratch_buffer + 32768;
+  }
+}
+
+static const char* const conv_variant_names[NN_CONV_VARIANT_COUNT] = {
+  "auto", "rgb", "basic", "fast", "basic_nonsquare", "fast_nonsquare", "1x1",
+};
+
+const char* nn_conv_variant_name(uint8_t variant) {
+  return (variant < NN_CONV_VARIANT_COUNT) ? conv_variant_names[variant] : "?";
+}
+
+int nn_conv_variant_ok(const nn_layer_t* l, uint8_t variant) {
+  int fast = (l->in_ch % 4 == 0) && (l->out_ch % 2 == 0);
+
+  switch (variant) {
+  case NN_CONV_AUTO:
+  case NN_CONV_BASIC:
+  case NN_CONV_BASIC_NONSQUARE:
+    return 1;
+  case NN_CONV_RGB:
+    return l->in_ch == 3;
+  case NN_CONV_FAST:
+  case NN_CONV_FAST_NONSQUARE:
+    return fast;
+  case NN_CONV_1X1:
+    return fast && l->ker_dim == 1 && l->pad == 0 && l->stride == 1;
+  default:
+    return 0;
+  }
+}
+
+static void run_conv(nn_context_t* ctx, const nn_kernels_t* k, const nn_layer_t* l, const q7_t* in, q7_t* out) {
+  q15_t* col_buffer = (q15_t*)ctx->col_buffer;
+  uint8_t variant = l->variant;
+
+  if (ctx->conv != NULL) {
+    ctx->conv(ctx, l, in, out);
+    return;
+  }
+  if (variant == NN_CONV_AUTO) {
+    variant = (l->in_ch == 3) ? NN_CONV_RGB : NN_CONV_FAST;
+  }
+
+  switch (variant) {
+  case NN_CONV_RGB:
+    k->conv_rgb(in, l->in_dim, l->in_ch, l->wt, l->out_ch, l->ker_dim, l->pad, l->stride, l->bias, l->bias_lshift, l->out_rshift, out, l->out_dim, col_buffer, NULL);
+    break;
+  case NN_CONV_BASIC:
+    k->conv_basic(in, l->in_dim, l->in_ch, l->wt, l->out_ch, l->ker_dim, l->pad, l->stride, l->bias, l->bias_lshift, l->out_rshift, out, l->out_dim, col_buffer, NULL);
+    break;
+  case NN_CONV_BASIC_NONSQUARE:
+    k->conv_basic_nonsquare(in, l->in_dim, l->in_dim, l->in_ch, l->wt, l->out_ch, l->ker_dim, l->ker_dim, l->pad, l->pad, l->stride, l->stride, l->bias, l->bias_lshift, l->out_rshift, out, l->out_dim, l->out_dim, col_buffer, NULL);
+    break;
+  case NN_CONV_FAST_NONSQUARE:
+    k->conv_fast_nonsquare(in, l->in_dim, l->in_dim, l->in_ch, l->wt, l->out_ch, l->ker_dim, l->ker_dim, l->pad, l->pad, l->stride, l->stride, l->bias, l->bias_lshift, l->out_rshift, out, l->out_dim, l->out_dim, col_buffer, NULL);
+    break;
+  case NN_CONV_1X1:
+    k->conv_1x1(in, l->in_dim, l->in_dim, l->in_ch, l->wt, l->out_ch, 1, 1, 0, 0, 1, 1, l->bias, l->bias_lshift, l->out_rshift, out, l->out_dim, l->out_dim, col_buffer, NULL);
+    break;
+  default:
+    k->conv_fast(in, l->in_dim, l->in_ch, l->wt, l->out_ch, l->ker_dim, l->pad, l->stride, l->bias, l->bias_lshift, l->out_rshift, out, l->out_dim, col_buffer, NULL);
+    break;
+  }
+}
+
+void nn_run_layer(nn_context_t* ctx, const nn_layer_t* l, q7_t* in, q7_t* out) {
+  const nn_kernels_t* k = nn_kernels(ctx);
+
+  switch (l->type) {
+  case NN_LAYER_CONV:
+    run_conv(ctx, k, l, in, out);
+    break;
+  case NN_LAYER_MAXPOOL:
+    k->maxpool(in, l->in_dim, l->in_ch, l->ker_dim, l->pad, l->stride, l->out_dim, ctx->col_buffer, out);
+    break;
+  case NN_LAYER_AVEPOOL:
+    k->avepool(in, l->in_dim, l->in_ch, l->ker_dim, l->pad, l->stride, l->out_dim, ctx->col_buffer, out);
+    break;
+  case NN_LAYER_RELU:
+    k->relu(out, l->out_dim*l->out_dim*l->out_ch);
+    break;
+  case NN_LAYER_FC:
+    k->fc_opt(in, l->wt, l->in_dim, l->out_dim, l->bias_lshift, l->out_rshift, l->bias, out, (q15_t*)ctx->col_buffer);
+    break;
+  case NN_LAYER_SOFTMAX:
+    k->softmax(in, l->out_dim, out);
+    break;
+  }
+}
+
+// The arithmetic of the CMSIS-NN DSP pooling kernels: each row of a window is
+// pooled first, then the row results, so average pooling truncates twice as
+// they do. Windows are clipped to the input.
+void nn_pool_region(const nn_layer_t* l, const q7_t* in, q7_t* out, nn_rect_t r) {
+  const int avg = l->type == NN_LAYER_AVEPOOL;
+  const int ch = l->in_ch;
+
+  for (int oy = r.y0; oy < r.y1; oy++) {
+    int ky0 = oy * l->stride - l->pad;
+    int ky1 = ky0 + l->ker_dim;
+    ky0 = (ky0 < 0) ? 0 : ky0;
+    ky1 = (ky1 > l->in_dim) ? l->in_dim : ky1;
+    for (int ox = r.x0; ox < r.x1; ox++) {
+      int kx0 = ox * l->stride - l->pad;
+      int kx1 = kx0 + l->ker_dim;
+      kx0 = (kx0 < 0) ? 0 : kx0;
+      kx1 = (kx1 > l->in_dim) ? l->in_dim : kx1;
+      q7_t* dst = out + (oy * l->out_dim + ox) * ch;
+      for (int c = 0; c < ch; c++) {
+        int acc = avg ? 0 : -128;
+        for (int ky = ky0; ky < ky1; ky++) {
+          const q7_t* src = in + (ky * l->in_dim) * ch + c;
+          int row = avg ? 0 : -128;
+          for (int kx = kx0; kx < kx1; kx++) {
+            int v = src[kx * ch];
+            row = avg ? row + v : (v > row ? v : row);
+          }
+          if (avg) {
+            acc += row / (kx1 - kx0);
+          } else {
+            acc = (row > acc) ? row : acc;
+          }
+        }
+        dst[c] = (q7_t)(avg ? acc / (ky1 - ky0) : acc);
+      }
+    }
+  }
+  if (avg) {
+    COUNT(AVEPOOL_ELEM, (r.x1 - r.x0) * (r.y1 - r.y0) * ch * (l->ker_dim + 1));
+  } else {
+    COUNT(MAXPOOL_ELEM, (r.x1 - r.x0) * (r.y1 - r.y0) * ch * l->ker_dim * l->ker_dim);
+  }
+}
+
+void nn_run_exit(nn_context_t* ctx, const nn_exit_t* exit, q7_t* input_data, q7_t* output_data) {
+  for (uint8_t i = 0; i < exit->layer_count; i++) {
+    const nn_layer_t* l = &exit->layers[i];
+    q7_t* in = get_buffer(ctx, l->in_buf, input_data, output_data);
+    q7_t* out = get_buffer(ctx, l->out_buf, input_data, output_data);
+    if (l->type == NN_LAYER_MAXPOOL || l->type == NN_LAYER_AVEPOOL) {
+      nn_pool_region(l, in, out, (nn_rect_t){ 0, 0, (uint8_t)l->out_dim, (uint8_t)l->out_dim });
+    } else {
+      nn_run_layer(ctx, l, in, out);
+    }
+  }
+}
+
+// Run the heads of the exits after layer `i` the policy enables, and whether
+// one of them was confident enough to stop at.
+static int take_exit(const nn_model_t* model, nn_exit_policy_t* policy, nn_context_t* ctx, uint8_t i,
+                     q7_t* input_data, q7_t* output_data) {
+  for (uint8_t e = 0; e < model->exit_count; e++) {
+    const nn_exit_t* x = &model->exits[e];
+    if (x->after != i || policy->margin[e] == 0) {
+      continue;
+    }
+    nn_run_exit(ctx, x, input_data, output_data);
+    if (nn_margin(output_data, x->layers[x->layer_count - 1].out_dim) >= policy->margin[e]) {
+      policy->last_exit = e;
+      policy->taken[e]++;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int nn_run(const nn_model_t* model, nn_context_t* ctx, q7_t* input_data, q7_t* output_data) {
+  nn_exit_policy_t* policy = (model->exit_count > 0) ? ctx->exits : NULL;
+
+  for (uint8_t i = 0; i < model->layer_count; i++) {
+    const nn_layer_t* l = &model->layers[i];
+    if (i > 0 && ctx->layer_hook != NULL && ctx->layer_hook(ctx, i) != 0) {
+      return NN_ABANDONED;
+    }
+    nn_run_layer(ctx, l, get_buffer(ctx, l->in_buf, input_data, output_data),
+                 get_buffer(ctx, l->out_buf, input_data, output_data));
+    if (policy != NULL && take_exit(model, policy, ctx, i, input_data, output_data)) {
+      return NN_DONE;
+    }
+  }
+  if (policy != NULL) {
+    policy->last_exit = model->exit_count;
+    policy->taken[model->exit_count]++;
+  }
+  return NN_DONE;
+}
+
+void nn_image_stats(const uint8_t* image, uint16_t pixels, nn_image_stats_t* stats) {
+  // 1024 pixels of 255^2 fit easily in 32 bits.
+  uint32_t sum[3] = { 0 }, squares[3] = { 0 };
+  for (uint16_t i = 0; i < pixels; i++) {
+    for (int c = 0; c < 3; c++) {
+      uint32_t v = image[i * 3 + c];
+      sum[c] += v;
+      squares[c] += v * v;
+    }
+  }
+  for (int c = 0; c < 3; c++) {
+    uint32_t mean = sum[c] / pixels;
+    stats->mean[c] = (uint8_t)mean;
+    stats->variance[c] = (uint16_t)(squares[c] / pixels - mean * mean);
+  }
+}
+
+uint8_t nn_top_k(const q7_t* scores, uint16_t count, uint8_t k, uint16_t* indices) {
+  uint8_t found = 0;
+  if (k == 0 || count == 0) {
+    return 0;
+  }
+  if (k > count) {
+    k = (uint8_t)count;
+  }
+  for (uint16_t i = 0; i < count; i++) {
+    // Most scores lose to the k-th best so far and cost one comparison.
+    if (found == k && scores[i] <= scores[indices[k - 1]]) {
+      continue;
+    }
+    uint8_t pos = (found < k) ? found++ : k - 1;
+    while (pos > 0 && scores[i] > scores[indices[pos - 1]]) {
+      indices[pos] = indices[pos - 1];
+      pos--;
+    }
+    indices[pos] = i;
+  }
+  return found;
+}
+
+uint8_t nn_margin(const q7_t* scores, uint16_t count) {
+  uint16_t top[2];
+  if (nn_top_k(scores, count, 2, top) < 2) {
+    return 0;
+  }
+  return (uint8_t)(scores[top[0]] - scores[top[1]]);
+}
+
+int nn_cascade_run(nn_cascade_t* cascade, nn_context_t* ctx, q7_t* input_data, q7_t* output_data) {
+  int status = nn_run(cascade->gate, ctx, input_data, output_data);
+  if (status != NN_DONE) {
+    return status;
+  }
+  cascade->last_gated = nn_margin(output_data, cascade->gate->layers[cascade->gate->layer_count - 1].out_dim) >=
+                        cascade->margin;
+  if (cascade->last_gated) {
+    cascade->gated++;
+    return NN_DONE;
+  }
+  cascade->passed++;
+  return (cascade->delta != NULL) ? nn_delta_run(cascade->delta, ctx, input_data, output_data)
+                                  : nn_run(cascade->model, ctx, input_data, output_data);
+}
+
+nn_context_t* nn_default_context(void) {
+  return &default_context;
+}
+
+int run_nn(q7_t* input_data, q7_t* output_data) {
+  return run_nn_ctx(&default_context, input_data, output_data);
+}
+
+int run_nn_ctx(nn_context_t* ctx, q7_t* input_data, q7_t* output_data) {
   mean_subtract(input_data);
-  arm_convolve_HWC_q7_RGB(input_data, CONV1_IN_DIM, CONV1_IN_CH, conv1_wt, CONV1_OUT_CH, CONV1_KER_DIM, CONV1_PAD, CONV1_STRIDE, conv1_bias, CONV1_BIAS_LSHIFT, CONV1_OUT_RSHIFT, buffer1, CONV1_OUT_DIM, (q15_t*)col_buffer, NULL);
-  arm_maxpool_q7_HWC(buffer1, POOL1_IN_DIM, POOL1_IN_CH, POOL1_KER_DIM, POOL1_PAD, POOL1_STRIDE, POOL1_OUT_DIM, col_buffer, buffer2);
-  arm_relu_q7(buffer2, RELU1_OUT_DIM*RELU1_OUT_DIM*RELU1_OUT_CH);
-  arm_convolve_HWC_q7_fast(buffer2, CONV2_IN_DIM, CONV2_IN_CH, conv2_wt, CONV2_OUT_CH, CONV2_KER_DIM, CONV2_PAD, CONV2_STRIDE, conv2_bias, CONV2_BIAS_LSHIFT, CONV2_OUT_RSHIFT, buffer1, CONV2_OUT_DIM, (q15_t*)col_buffer, NULL);
-  arm_relu_q7(buffer1, RELU2_OUT_DIM*RELU2_OUT_DIM*RELU2_OUT_CH);
-  arm_avepool_q7_HWC(buffer1, POOL2_IN_DIM, POOL2_IN_CH, POOL2_KER_DIM, POOL2_PAD, POOL2_STRIDE, POOL2_OUT_DIM, col_buffer, buffer2);
-  arm_convolve_HWC_q7_fast(buffer2, CONV3_IN_DIM, CONV3_IN_CH, conv3_wt, CONV3_OUT_CH, CONV3_KER_DIM, CONV3_PAD, CONV3_STRIDE, conv3_bias, CONV3_BIAS_LSHIFT, CONV3_OUT_RSHIFT, buffer1, CONV3_OUT_DIM, (q15_t*)col_buffer, NULL);
-  arm_relu_q7(buffer1, RELU3_OUT_DIM*RELU3_OUT_DIM*RELU3_OUT_CH);
-  arm_avepool_q7_HWC(buffer1, POOL3_IN_DIM, POOL3_IN_CH, POOL3_KER_DIM, POOL3_PAD, POOL3_STRIDE, POOL3_OUT_DIM, col_buffer, buffer2);
-  arm_fully_connected_q7_opt(buffer2, ip1_wt, IP1_IN_DIM, IP1_OUT_DIM, IP1_BIAS_LSHIFT, IP1_OUT_RSHIFT, ip1_bias, output_data, (q15_t*)col_buffer);
-  arm_softmax_q7(output_data, IP1_OUT_DIM, output_data);
+  return nn_run(&cifar10_model, ctx, input_data, output_data);
 }
@@ -6,6 +6,386 @@
 #include "weights.h"
 #include "arm_nnfunctions.h"
 
-void run_nn(q7_t* input_data, q7_t* output_data);
+typedef enum {
+  NN_LAYER_CONV,
+  NN_LAYER_MAXPOOL,
+  NN_LAYER_AVEPOOL,
+  NN_LAYER_RELU,
+  NN_LAYER_FC,
+  NN_LAYER_SOFTMAX,
+} nn_layer_type_t;
+
+// Tensor a layer reads from or writes to. BUF1/BUF2 are the two halves of the
+// context scratch buffer that successive layers ping-pong between.
+typedef enum {
+  NN_BUF_INPUT,
+  NN_BUF_OUTPUT,
+  NN_BUF1,
+  NN_BUF2,
+} nn_buf_t;
+
+// Convolution kernel a conv layer is run with. NN_CONV_AUTO keeps the
+// original rule (RGB for 3 input channels, fast otherwise); the others are
+// picked per layer by the host autotuner (host/cifar10_autotune.c). All of
+// them compute identical outputs, they only differ in speed and constraints.
+typedef enum {
+  NN_CONV_AUTO,
+  NN_CONV_RGB,             // ch_in == 3
+  NN_CONV_BASIC,
+  NN_CONV_FAST,            // ch_in % 4 == 0, ch_out % 2 == 0
+  NN_CONV_BASIC_NONSQUARE,
+  NN_CONV_FAST_NONSQUARE,  // ch_in % 4 == 0, ch_out % 2 == 0
+  NN_CONV_1X1,             // as fast, and 1x1 kernel, no padding, stride 1
+  NN_CONV_VARIANT_COUNT,
+} nn_conv_variant_t;
+
+// One layer of a model description. Dimensions follow the CMSIS-NN naming:
+// square HWC tensors of in_dim x in_dim x in_ch. For FC layers in_dim is the
+// vector length and out_dim the number of outputs.
+typedef struct {
+  const char* name;
+  uint8_t type;
+  uint8_t in_buf;
+  uint8_t out_buf;
+  uint8_t variant;  // nn_conv_variant_t, conv layers only
+  uint16_t in_dim;
+  uint16_t in_ch;
+  uint16_t out_dim;
+  uint16_t out_ch;
+  uint16_t ker_dim;
+  uint16_t pad;
+  uint16_t stride;
+  uint16_t bias_lshift;
+  uint16_t out_rshift;
+  const q7_t* wt;
+  const q7_t* bias;
+} nn_layer_t;
+
+// Most early exits a model can have, see nn_exit_t.
+#define NN_MAX_EXITS 4
+
+// Early exit of a model: a small classifier head on the output of layer
+// `after`. The head reads that tensor without changing it, may use whichever
+// of NN_BUF1/NN_BUF2 the trunk does not hold there, and ends with a softmax
+// into NN_BUF_OUTPUT. Pooling layers of a head run through nn_pool_region().
+typedef struct {
+  const char* name;
+  uint8_t after;
+  const nn_layer_t* layers;
+  uint8_t layer_count;
+} nn_exit_t;
+
+typedef struct {
+  const nn_layer_t* layers;
+  uint8_t layer_count;
+  // Early exits in layer order, taken per nn_context_t::exits.
+  const nn_exit_t* exits;
+  uint8_t exit_count;
+} nn_model_t;
+
+// Signatures of the CMSIS-NN q7 kernels nn_run() calls.
+typedef arm_status (*nn_conv_kernel_fn)(const q7_t* in, const uint16_t dim_im_in, const uint16_t ch_im_in,
+                                        const q7_t* wt, const uint16_t ch_im_out, const uint16_t dim_kernel,
+                                        const uint16_t padding, const uint16_t stride, const q7_t* bias,
+                                        const uint16_t bias_shift, const uint16_t out_shift, q7_t* out,
+                                        const uint16_t dim_im_out, q15_t* bufferA, q7_t* bufferB);
+typedef arm_status (*nn_conv_nonsquare_kernel_fn)(const q7_t* in, const uint16_t dim_im_in_x, const uint16_t dim_im_in_y,
+                                                  const uint16_t ch_im_in, const q7_t* wt, const uint16_t ch_im_out,
+                                                  const uint16_t dim_kernel_x, const uint16_t dim_kernel_y,
+                                                  const uint16_t padding_x, const uint16_t padding_y,
+                                                  const uint16_t stride_x, const uint16_t stride_y, const q7_t* bias,
+                                                  const uint16_t bias_shift, const uint16_t out_shift, q7_t* out,
+                                                  const uint16_t dim_im_out_x, const uint16_t dim_im_out_y,
+                                                  q15_t* bufferA, q7_t* bufferB);
+typedef void (*nn_pool_kernel_fn)(q7_t* in, const uint16_t dim_im_in, const uint16_t ch_im_in,
+                                  const uint16_t dim_kernel, const uint16_t padding, const uint16_t stride,
+                                  const uint16_t dim_im_out, q7_t* bufferA, q7_t* out);
+typedef void (*nn_relu_kernel_fn)(q7_t* data, uint16_t size);
+typedef arm_status (*nn_fc_kernel_fn)(const q7_t* vec, const q7_t* mat, const uint16_t dim_vec,
+                                      const uint16_t num_of_rows, const uint16_t bias_shift,
+                                      const uint16_t out_shift, const q7_t* bias, q7_t* out, q15_t* vec_buffer);
+typedef void (*nn_softmax_kernel_fn)(const q7_t* in, const uint16_t dim_vec, q7_t* out);
+
+// Kernel set used by nn_run(). nn_cmsis_kernels is the default and the only
+// one on the RT core; the host build can substitute bit-exact SIMD versions.
+typedef struct {
+  const char* name;
+  nn_conv_kernel_fn conv_rgb;
+  nn_conv_kernel_fn conv_basic;
+  nn_conv_kernel_fn conv_fast;
+  nn_conv_nonsquare_kernel_fn conv_basic_nonsquare;
+  nn_conv_nonsquare_kernel_fn conv_fast_nonsquare;
+  nn_conv_nonsquare_kernel_fn conv_1x1;
+  nn_pool_kernel_fn maxpool;
+  nn_pool_kernel_fn avepool;
+  nn_relu_kernel_fn relu;
+  nn_fc_kernel_fn fc_opt;
+  nn_softmax_kernel_fn softmax;
+} nn_kernels_t;
+
+extern const nn_kernels_t nn_cmsis_kernels;
+
+typedef struct nn_context nn_context_t;
+
+// Which early exits nn_run() takes, see nn_context_t::exits.
+typedef struct {
+  // Per exit, the lead of the head's top softmax score over its second, q7,
+  // from which the head's answer is kept and the rest of the model skipped.
+  // 0 leaves the exit's head unrun.
+  uint8_t margin[NN_MAX_EXITS];
+  // The exit the last run of a model with exits took, or its exit_count if
+  // it ran to the end, and how many runs took each.
+  uint8_t last_exit;
+  uint32_t taken[NN_MAX_EXITS + 1];
+} nn_exit_policy_t;
+
+// Convolution override, see nn_context_t::conv.
+typedef void (*nn_conv_fn)(nn_context_t* ctx, const nn_layer_t* layer, const q7_t* in, q7_t* out);
+
+// Called by nn_run() at each layer boundary with the index of the layer about
+// to run. Returning nonzero abandons the inference, see nn_context_t::layer_hook.
+typedef int (*nn_layer_hook_fn)(nn_context_t* ctx, uint8_t next_layer);
+
+// nn_run() result.
+#define NN_DONE       0
+#define NN_ABANDONED  (-1)
+
+// Working memory for one inference. run_nn() uses a single static context;
+// callers running several inferences concurrently (e.g. the host tools) give
+// each thread its own zero-initialised context and call run_nn_ctx().
+struct nn_context {
+  q7_t col_buffer[3200] __ALIGNED(4);
+  q7_t scratch_buffer[40960] __ALIGNED(4);
+  // When set, convolution layers call this instead of the CMSIS-NN kernel.
+  // Left NULL on the RT core; the host build uses it to split layers across
+  // threads.
+  nn_conv_fn conv;
+  // Kernel set, NULL selects nn_cmsis_kernels.
+  const nn_kernels_t* kernels;
+  // When set, consulted before every layer but the first. The RT core uses it
+  // to give up on an image a newer one has superseded; the output buffer is
+  // left partially written.
+  nn_layer_hook_fn layer_hook;
+  // When set, nn_run() runs the heads of the model's early exits this policy
+  // enables and stops at the first confident one. nn_delta_run() ignores it,
+  // as it needs every layer's activations.
+  nn_exit_policy_t* exits;
+};
+
+static inline const nn_kernels_t* nn_kernels(const nn_context_t* ctx) {
+  return (ctx->kernels != NULL) ? ctx->kernels : &nn_cmsis_kernels;
+}
+
+// cifar10_model has two early exits, "exit1" after relu1 and "exit2" after
+// pool2: an average pool to 4x4 and a classifier each (nn/exit_weights.h,
+// written by cifar10-exits).
+extern const nn_model_t cifar10_model;
+// Nonzero once nn/exit_weights.h holds trained heads. The placeholder ones are
+// never confident, so enabling an exit would only add its head's cost.
+extern const uint8_t cifar10_exits_trained;
+// Small first stage for nn_cascade_run(): conv1's filters at stride 4, then a
+// pool and a classifier trained to agree with cifar10_model
+// (nn/gate_weights.h, written by cifar10-gate).
+extern const nn_model_t cifar10_gate_model;
+// Nonzero once nn/gate_weights.h holds trained weights. The placeholder ones
+// are never confident, so a cascade would only add the gate's cost.
+extern const uint8_t cifar10_gate_trained;
+
+// Whether `layer` meets the shape constraints of conv `variant`.
+int nn_conv_variant_ok(const nn_layer_t* layer, uint8_t variant);
+const char* nn_conv_variant_name(uint8_t variant);
+
+void mean_subtract(q7_t* image_data);
+int run_nn(q7_t* input_data, q7_t* output_data);
+int run_nn_ctx(nn_context_t* ctx, q7_t* input_data, q7_t* output_data);
+
+// Per-channel statistics of an RGB image, see nn_image_stats().
+typedef struct {
+  uint8_t mean[3];
+  uint16_t variance[3];
+} nn_image_stats_t;
+
+// Mean and variance of each channel of an HWC uint8 RGB image of `pixels`
+// pixels, before mean_subtract(). One pass of integer sums and sums of
+// squares, a few cycles per byte; the RT core uses it to turn away dark or
+// uniform frames without running the network.
+void nn_image_stats(const uint8_t* image, uint16_t pixels, nn_image_stats_t* stats);
+
+// Indices of the `k` highest of `count` scores, best first, in `indices`. Ties
+// go to the lower index, as with a plain argmax. A single pass with insertion
+// into the k best so far, so cost stays O(count) for small k whatever the
+// class count. Returns the number of indices written, min(k, count).
+uint8_t nn_top_k(const q7_t* scores, uint16_t count, uint8_t k, uint16_t* indices);
+
+// The static context run_nn() uses, for installing a layer hook.
+nn_context_t* nn_default_context(void);
+
+// Run the layers of `model` on already mean-subtracted input. Returns NN_DONE,
+// or NN_ABANDONED if the layer hook stopped it. With an exit policy in the
+// context, output_data may hold the answer of an early exit's head.
+int nn_run(const nn_model_t* model, nn_context_t* ctx, q7_t* input_data, q7_t* output_data);
+
+// Run one layer on whole tensors, as nn_run() does. Pooling kernels overwrite
+// their input.
+void nn_run_layer(nn_context_t* ctx, const nn_layer_t* layer, q7_t* in, q7_t* out);
+
+// Columns [x0, x1) and rows [y0, y1) of a layer's output.
+typedef struct {
+  uint8_t x0, y0, x1, y1;
+} nn_rect_t;
+
+// Outputs of `r` of a pooling layer, the same as the CMSIS-NN kernels compute
+// but without overwriting the input.
+void nn_pool_region(const nn_layer_t* layer, const q7_t* in, q7_t* out, nn_rect_t r);
+
+// Run the head of `exit` of a model, on the tensors nn_run() left after the
+// exit's layer. The trunk's tensor is left as it was.
+void nn_run_exit(nn_context_t* ctx, const nn_exit_t* exit, q7_t* input_data, q7_t* output_data);
+
+// Dirty rectangles tracked per layer: the input is diffed in this many bands
+// of rows, one bounding box each.
+#define NN_DELTA_RECTS 4
+#define NN_DELTA_LAYERS 16
+
+// Dirty share of a conv layer's output, in percent, from which the layer is
+// run whole with its own kernel rather than rectangle by rectangle.
+#define NN_DELTA_FULL_PERCENT 90
+
+// The last input and the output of every conv and pool layer of
+// cifar10_model, kept between nn_delta_run() calls.
+#define NN_DELTA_ARENA (DATA_OUT_CH*DATA_OUT_DIM*DATA_OUT_DIM + CONV1_OUT_CH*CONV1_OUT_DIM*CONV1_OUT_DIM + \
+                        POOL1_IN_CH*POOL1_OUT_DIM*POOL1_OUT_DIM + CONV2_OUT_CH*CONV2_OUT_DIM*CONV2_OUT_DIM + \
+                        POOL2_IN_CH*POOL2_OUT_DIM*POOL2_OUT_DIM + CONV3_OUT_CH*CONV3_OUT_DIM*CONV3_OUT_DIM + \
+                        POOL3_IN_CH*POOL3_OUT_DIM*POOL3_OUT_DIM)
+
+// State of incremental inference, see nn_delta_run(). About 52 KB for
+// cifar10_model.
+typedef struct {
+  const nn_model_t* model;
+  q7_t* previous;
+  // Output of each layer; in-place layers share their input's, and layers
+  // writing the network output have none.
+  q7_t* act[NN_DELTA_LAYERS];
+  // Whether previous and act[] hold the last input and its activations.
+  uint8_t valid;
+  // See NN_DELTA_FULL_PERCENT.
+  uint8_t full_percent;
+  // Share of a full inference's conv work the last run did, in percent.
+  uint8_t last_percent;
+  // Runs that recomputed everything (first input, or too much changed),
+  // part of the network, and only the layers past the last pool because
+  // nothing changed.
+  uint32_t full_runs, partial_runs, unchanged_runs;
+  q7_t arena[NN_DELTA_ARENA] __ALIGNED(4);
+} nn_delta_t;
+
+// Lay out `delta` for `model`. Returns 0, or -1 if the model needs more than
+// the arena or its layers are not a chain of square conv/pool/relu layers
+// followed by fully connected and softmax ones.
+int nn_delta_init(nn_delta_t* delta, const nn_model_t* model);
+
+// Forget the last input, so that the next run is a full one.
+static inline void nn_delta_reset(nn_delta_t* delta) {
+  delta->valid = 0;
+}
+
+// As nn_run(), but only recomputes what changed since the last call. The
+// input is diffed against the last one into up to NN_DELTA_RECTS dirty
+// rectangles, which are grown through each conv and pool layer by its kernel,
+// stride and padding; only those regions of the kept activations are
+// computed again, with the same kernels, so the output is bit-identical to
+// nn_run(). A layer whose dirty area exceeds full_percent is run whole.
+// Layers past the last pool always run. The context's scratch buffer is used
+// for staging, and an abandoned run leaves the next one full.
+int nn_delta_run(nn_delta_t* delta, nn_context_t* ctx, q7_t* input_data, q7_t* output_data);
+
+// Lead of the top score over the runner-up.
+uint8_t nn_margin(const q7_t* scores, uint16_t count);
+
+// A cheap gate model in front of the full one, see nn_cascade_run().
+typedef struct {
+  const nn_model_t* gate;
+  const nn_model_t* model;
+  // When set, the full model runs through nn_delta_run() with this state,
+  // which must be laid out for `model`.
+  nn_delta_t* delta;
+  // Lead of the gate's top softmax score over its second, q7, from which the
+  // gate's answer is kept.
+  uint8_t margin;
+  // Whether the last run kept the gate's answer, and how many runs did and
+  // did not.
+  uint8_t last_gated;
+  uint32_t gated, passed;
+} nn_cascade_t;
+
+// Run the gate on already mean-subtracted input, then the full model too
+// unless the gate's margin reaches cascade->margin. Either way output_data
+// holds the answer. The gate leaves the input as it was and both models use
+// ctx, so a layer hook sees the gate's layers first. Returns NN_DONE or
+// NN_ABANDONED.
+int nn_cascade_run(nn_cascade_t* cascade, nn_context_t* ctx, q7_t* input_data, q7_t* output_data);
+
+// run_nn() through nn_delta_run() and the static context.
+int run_nn_delta(nn_delta_t* delta, q7_t* input_data, q7_t* output_data);
+
+// Conv and pool layers of a model run by nn_window_run(), at most.
+#define NN_WINDOW_STAGES 8
+
+// One conv or pool layer over the whole frame, with the relu after it if any.
+typedef struct {
+  const nn_layer_t* layer;
+  uint16_t in_dim, out_dim;
+  uint8_t relu;
+  // Output rows kept, in a ring at `ring` in the scratch buffer: as many as
+  // the next stage's kernel reads, or a window's height for the last stage.
+  uint8_t rows;
+  uint16_t ring;
+  uint16_t next_row;
+} nn_window_stage_t;
+
+// Sliding-window classification of a square frame larger than the model's
+// input, see nn_window_run().
+typedef struct {
+  const nn_model_t* model;
+  uint16_t dim;
+  // Pixels between window positions (the product of the layer strides), and
+  // positions per side.
+  uint8_t stride;
+  uint8_t cells;
+  // Side of a window in the last stage's output, and the first layer after
+  // the stages, the classifier.
+  uint8_t window;
+  uint8_t fc;
+  uint8_t stage_count;
+  // Scratch buffer offsets of the conv slab and the classifier's input.
+  uint16_t slab, vector;
+  nn_window_stage_t stages[NN_WINDOW_STAGES];
+} nn_window_t;
+
+// Lay out `window` for frames of dim x dim pixels. Returns 0, or -1 if the
+// model is not a chain of conv/pool/relu layers followed by a classifier on
+// the last one's whole output, if dim does not scale every layer's output by
+// a whole number, or if the rows kept do not fit the scratch buffer (beyond
+// 112 pixels for cifar10_model, whose frames must be multiples of 8).
+int nn_window_init(nn_window_t* window, const nn_model_t* model, uint16_t dim);
+
+// Classify every model-sized window of a mean-subtracted frame whose corner
+// is a multiple of window->stride pixels, with the conv and pool layers run
+// once over the whole frame. Each stage computes its rows as the next one
+// needs them and keeps only a ring of them, in the context's scratch buffer;
+// the classifier then runs on each window's part of the last stage's output.
+// heatmap receives cells x cells score vectors, row by row. Windows inside
+// the frame see their neighbours' pixels where a single run_nn() would see
+// padding, and off the 32-pixel grid a shifted mean (nn_window_mean_subtract),
+// so their scores can differ a little from cropping and classifying them one
+// by one. Returns NN_DONE or NN_ABANDONED; the layer hook is
+// consulted before each row of the last stage's output but the first.
+int nn_window_run(nn_window_t* window, nn_context_t* ctx, q7_t* frame, q7_t* heatmap);
+
+// mean_subtract() for a dim x dim frame: the mean image is tiled every 32
+// pixels, so a window whose corner is a multiple of 32 gets exactly the mean
+// nn_run() would subtract. Other windows get the mean image shifted and
+// wrapped, which costs them some agreement with cropping.
+void nn_window_mean_subtract(q7_t* frame, uint16_t dim);
 
 #endif
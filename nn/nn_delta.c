@@ -0,0 +1,280 @@
+#include "nn.h"
+
+// Incremental inference, see nn_delta_run(). Conv regions are computed with
+// the nonsquare kernels on a zero-padded slab, as host/nn_parallel.c does for
+// bands of rows; every output is the same integer sum as in a full run.
+
+#ifdef HOST_CYCLE_COUNT
+// Scalar work the region code does outside the counted kernels, for the
+// host M4 cycle estimator.
+#define COUNT(op, n) (m4_op_counts[M4_OP_##op] += (n))
+#else
+#define COUNT(op, n) ((void)0)
+#endif
+
+#define SCRATCH_SIZE sizeof(((nn_context_t*)0)->scratch_buffer)
+
+static int is_pool(const nn_layer_t* l) {
+  return l->type == NN_LAYER_MAXPOOL || l->type == NN_LAYER_AVEPOOL;
+}
+
+static int is_spatial(const nn_layer_t* l) {
+  return l->type == NN_LAYER_CONV || l->type == NN_LAYER_RELU || is_pool(l);
+}
+
+int nn_delta_init(nn_delta_t* delta, const nn_model_t* model) {
+  const nn_layer_t* first = &model->layers[0];
+  uint32_t used = first->in_dim * first->in_dim * first->in_ch;
+  int spatial = 1;
+
+  if (model->layer_count > NN_DELTA_LAYERS || first->type != NN_LAYER_CONV || used > NN_DELTA_ARENA) {
+    return -1;
+  }
+  delta->model = model;
+  delta->previous = delta->arena;
+
+  for (uint8_t i = 0; i < model->layer_count; i++) {
+    const nn_layer_t* l = &model->layers[i];
+    if (is_spatial(l)) {
+      uint32_t slab = l->ker_dim * (l->in_dim + 2 * l->pad) * l->in_ch;
+      uint32_t whole = l->in_dim * l->in_dim * l->in_ch;
+      if (!spatial || l->in_dim > 255 || l->out_dim > 255 ||
+          (l->type == NN_LAYER_CONV && slab > SCRATCH_SIZE) || (is_pool(l) && whole > SCRATCH_SIZE) ||
+          ((l->type == NN_LAYER_RELU) != (l->in_buf == l->out_buf))) {
+        return -1;
+      }
+    } else {
+      spatial = 0;
+    }
+
+    if (l->in_buf == l->out_buf) {
+      delta->act[i] = (i > 0) ? delta->act[i - 1] : NULL;
+    } else if (l->out_buf == NN_BUF_OUTPUT) {
+      delta->act[i] = NULL;
+    } else {
+      uint32_t size = l->out_dim * l->out_dim * l->out_ch;
+      if (used + size > NN_DELTA_ARENA) {
+        return -1;
+      }
+      delta->act[i] = delta->arena + used;
+      used += size;
+    }
+  }
+
+  delta->valid = 0;
+  delta->full_percent = NN_DELTA_FULL_PERCENT;
+  delta->last_percent = 0;
+  delta->full_runs = delta->partial_runs = delta->unchanged_runs = 0;
+  return 0;
+}
+
+// Bounding box of the changed pixels in each of NN_DELTA_RECTS bands of rows.
+// Returns the number of bands with a change.
+static uint8_t diff_input(const q7_t* last, const q7_t* input, uint16_t dim, uint16_t ch, nn_rect_t* rects) {
+  const uint16_t band = (dim + NN_DELTA_RECTS - 1) / NN_DELTA_RECTS;
+  uint8_t count = 0;
+
+  for (uint16_t y0 = 0; y0 < dim; y0 += band) {
+    uint16_t y1 = (y0 + band < dim) ? y0 + band : dim;
+    nn_rect_t r = { .x0 = (uint8_t)dim, .y0 = (uint8_t)dim, .x1 = 0, .y1 = 0 };
+    for (uint16_t y = y0; y < y1; y++) {
+      for (uint16_t x = 0; x < dim; x++) {
+        const uint32_t at = (y * dim + x) * ch;
+        uint16_t c = 0;
+        while (c < ch && last[at + c] == input[at + c]) {
+          c++;
+        }
+        if (c < ch) {
+          r.x0 = (x < r.x0) ? x : r.x0;
+          r.x1 = (x + 1 > r.x1) ? x + 1 : r.x1;
+          r.y0 = (y < r.y0) ? y : r.y0;
+          r.y1 = y + 1;
+        }
+      }
+    }
+    if (r.x1 > 0) {
+      rects[count++] = r;
+    }
+  }
+  COUNT(MEAN_ELEM, dim * dim * ch);
+  return count;
+}
+
+// First output of `l` whose window, starting at o * stride - pad, reaches
+// input coordinate `x0`.
+static int first_output(const nn_layer_t* l, int x0) {
+  int v = x0 + l->pad - l->ker_dim + 1;
+  return (v <= 0) ? 0 : (v + l->stride - 1) / l->stride;
+}
+
+// One past the last output of `l` whose window starts before `x1`.
+static int end_output(const nn_layer_t* l, int x1) {
+  int v = (x1 - 1 + l->pad) / l->stride + 1;
+  return (v < l->out_dim) ? v : l->out_dim;
+}
+
+// The outputs of `l` that read any input in `rects`, as rectangles that do not
+// overlap. Returns their number.
+static uint8_t grow_rects(const nn_layer_t* l, nn_rect_t* rects, uint8_t count) {
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    nn_rect_t r = {
+      .x0 = first_output(l, rects[i].x0), .y0 = first_output(l, rects[i].y0),
+      .x1 = end_output(l, rects[i].x1), .y1 = end_output(l, rects[i].y1),
+    };
+    if (r.x0 < r.x1 && r.y0 < r.y1) {
+      rects[n++] = r;
+    }
+  }
+
+  // Windows overlap, so neighbouring bands usually grow into each other.
+  // Recomputing an output twice would only cost time; merging may cover a
+  // little more, but then each output is computed once.
+  int merged;
+  do {
+    merged = 0;
+    for (uint8_t i = 0; i < n && !merged; i++) {
+      for (uint8_t j = i + 1; j < n && !merged; j++) {
+        nn_rect_t* a = &rects[i];
+        nn_rect_t* b = &rects[j];
+        if (a->x0 < b->x1 && b->x0 < a->x1 && a->y0 < b->y1 && b->y0 < a->y1) {
+          a->x0 = (b->x0 < a->x0) ? b->x0 : a->x0;
+          a->y0 = (b->y0 < a->y0) ? b->y0 : a->y0;
+          a->x1 = (b->x1 > a->x1) ? b->x1 : a->x1;
+          a->y1 = (b->y1 > a->y1) ? b->y1 : a->y1;
+          rects[j] = rects[--n];
+          // The union may now reach rectangles already checked.
+          merged = 1;
+        }
+      }
+    }
+  } while (merged);
+  return n;
+}
+
+static uint32_t rects_area(const nn_rect_t* rects, uint8_t count) {
+  uint32_t area = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    area += (uint32_t)(rects[i].x1 - rects[i].x0) * (rects[i].y1 - rects[i].y0);
+  }
+  return area;
+}
+
+// Outputs of `r`, one row at a time: the input rows and columns the row
+// reads, with zeros where the layer pads, are copied to a slab in the scratch
+// buffer, and the nonsquare kernel runs on it without padding, writing the
+// row of outputs in place.
+static void conv_rect(nn_context_t* ctx, const nn_kernels_t* k, const nn_layer_t* l, const q7_t* in, q7_t* out,
+                      nn_rect_t r) {
+  q7_t* slab = ctx->scratch_buffer;
+  const int ch = l->in_ch;
+  const int w = r.x1 - r.x0;
+  const int cols = (w - 1) * l->stride + l->ker_dim;
+  const int left = r.x0 * l->stride - l->pad;
+  // Slab columns [lo, hi) come from the input, the others are padding.
+  const int lo = (left < 0) ? -left : 0;
+  const int hi = (left + cols > l->in_dim) ? l->in_dim - left : cols;
+  nn_conv_nonsquare_kernel_fn conv = (l->in_ch % 4 == 0 && l->out_ch % 2 == 0) ? k->conv_fast_nonsquare
+                                                                               : k->conv_basic_nonsquare;
+
+  for (int y = r.y0; y < r.y1; y++) {
+    const int top = y * l->stride - l->pad;
+    for (int ky = 0; ky < l->ker_dim; ky++) {
+      q7_t* dst = slab + ky * cols * ch;
+      int src = top + ky;
+      if (src < 0 || src >= l->in_dim) {
+        __builtin_memset(dst, 0, cols * ch);
+        continue;
+      }
+      __builtin_memset(dst, 0, lo * ch);
+      __builtin_memcpy(dst + lo * ch, in + (src * l->in_dim + left + lo) * ch, (hi - lo) * ch);
+      __builtin_memset(dst + hi * ch, 0, (cols - hi) * ch);
+    }
+    conv(slab, cols, l->ker_dim, ch, l->wt, l->out_ch, l->ker_dim, l->ker_dim, 0, 0, l->stride, l->stride,
+         l->bias, l->bias_lshift, l->out_rshift, out + (y * l->out_dim + r.x0) * l->out_ch, w, 1,
+         (q15_t*)ctx->col_buffer, NULL);
+  }
+  // Loaded and stored a word at a time
+  COUNT(WORD, (r.y1 - r.y0) * l->ker_dim * cols * ch / 2);
+}
+
+int nn_delta_run(nn_delta_t* delta, nn_context_t* ctx, q7_t* input_data, q7_t* output_data) {
+  const nn_model_t* m = delta->model;
+  const nn_kernels_t* k = nn_kernels(ctx);
+  const nn_layer_t* first = &m->layers[0];
+  nn_rect_t rects[NN_DELTA_RECTS];
+  uint8_t count = 0;
+  int whole = !delta->valid;
+  uint32_t done = 0, total = 0;
+
+  if (!whole) {
+    count = diff_input(delta->previous, input_data, first->in_dim, first->in_ch, rects);
+  }
+  // Until this run completes, previous and act[] do not match.
+  delta->valid = 0;
+  if (whole || count > 0) {
+    __builtin_memcpy(delta->previous, input_data, first->in_dim * first->in_dim * first->in_ch);
+  }
+
+  for (uint8_t i = 0; i < m->layer_count; i++) {
+    const nn_layer_t* l = &m->layers[i];
+    if (i > 0 && ctx->layer_hook != NULL && ctx->layer_hook(ctx, i) != 0) {
+      return NN_ABANDONED;
+    }
+    q7_t* in = (i == 0) ? input_data : (delta->act[i - 1] != NULL) ? delta->act[i - 1] : output_data;
+    q7_t* out = (delta->act[i] != NULL) ? delta->act[i] : output_data;
+
+    if (l->type == NN_LAYER_CONV || is_pool(l)) {
+      const uint32_t outputs = l->out_dim * l->out_dim;
+      const uint32_t macs = (l->type == NN_LAYER_CONV) ? l->ker_dim * l->ker_dim * l->in_ch * l->out_ch : 0;
+
+      if (!whole) {
+        count = grow_rects(l, rects, count);
+        whole = l->type == NN_LAYER_CONV && rects_area(rects, count) * 100 >= outputs * delta->full_percent;
+      }
+      total += outputs * macs;
+      if (whole) {
+        done += outputs * macs;
+        if (is_pool(l)) {
+          // The kernels overwrite their input, which is kept for the next run.
+          __builtin_memcpy(ctx->scratch_buffer, in, l->in_dim * l->in_dim * l->in_ch);
+          in = ctx->scratch_buffer;
+        }
+        nn_run_layer(ctx, l, in, out);
+      } else {
+        done += rects_area(rects, count) * macs;
+        for (uint8_t j = 0; j < count; j++) {
+          if (l->type == NN_LAYER_CONV) {
+            conv_rect(ctx, k, l, in, out, rects[j]);
+          } else {
+            nn_pool_region(l, in, out, rects[j]);
+          }
+        }
+      }
+    } else if (l->type == NN_LAYER_RELU && !whole) {
+      for (uint8_t j = 0; j < count; j++) {
+        for (int y = rects[j].y0; y < rects[j].y1; y++) {
+          k->relu(out + (y * l->out_dim + rects[j].x0) * l->out_ch, (rects[j].x1 - rects[j].x0) * l->out_ch);
+        }
+      }
+    } else {
+      nn_run_layer(ctx, l, in, out);
+    }
+  }
+
+  delta->last_percent = (total > 0) ? (uint8_t)((uint64_t)done * 100 / total) : 0;
+  if (done == total) {
+    delta->full_runs++;
+  } else if (done == 0) {
+    delta->unchanged_runs++;
+  } else {
+    delta->partial_runs++;
+  }
+  delta->valid = 1;
+  return NN_DONE;
+}
+
+int run_nn_delta(nn_delta_t* delta, q7_t* input_data, q7_t* output_data) {
+  mean_subtract(input_data);
+  return nn_delta_run(delta, nn_default_context(), input_data, output_data);
+}
@@ -0,0 +1,241 @@
+#include "nn.h"
+
+// Sliding-window classification, see nn_window_run(). Rows are pulled through
+// the stages on demand: computing a row of one stage first computes the rows
+// of the previous one it reads, so each row of every layer is computed once
+// and only a few of them are held at a time.
+
+#ifdef HOST_CYCLE_COUNT
+// Scalar work outside the counted kernels, for the host M4 cycle estimator.
+#define COUNT(op, n) (m4_op_counts[M4_OP_##op] += (n))
+#else
+#define COUNT(op, n) ((void)0)
+#endif
+
+#define SCRATCH_SIZE sizeof(((nn_context_t*)0)->scratch_buffer)
+#define MAX_KERNEL 16
+
+static uint32_t align4(uint32_t n) {
+  return (n + 3) & ~3u;
+}
+
+// Columns of the zero-padded slab a conv stage's output row reads.
+static uint32_t slab_cols(const nn_window_stage_t* st) {
+  return (uint32_t)(st->out_dim - 1) * st->layer->stride + st->layer->ker_dim;
+}
+
+int nn_window_init(nn_window_t* w, const nn_model_t* model, uint16_t dim) {
+  uint16_t in = dim;
+  uint8_t i;
+
+  w->model = model;
+  w->dim = dim;
+  w->stage_count = 0;
+  if (model->layer_count == 0 || model->layers[0].type != NN_LAYER_CONV || dim < model->layers[0].in_dim) {
+    return -1;
+  }
+
+  for (i = 0; i < model->layer_count; i++) {
+    const nn_layer_t* l = &model->layers[i];
+    if (l->type == NN_LAYER_RELU && w->stage_count > 0) {
+      w->stages[w->stage_count - 1].relu = 1;
+      continue;
+    }
+    if (l->type != NN_LAYER_CONV && l->type != NN_LAYER_MAXPOOL && l->type != NN_LAYER_AVEPOOL) {
+      break;
+    }
+    // Every layer must keep the model's proportions, so that a window of the
+    // frame maps to whole rows and columns of each output.
+    if (w->stage_count == NN_WINDOW_STAGES || l->ker_dim > MAX_KERNEL ||
+        ((uint32_t)in * l->out_dim) % l->in_dim != 0) {
+      return -1;
+    }
+    nn_window_stage_t* st = &w->stages[w->stage_count++];
+    st->layer = l;
+    st->in_dim = in;
+    st->out_dim = (uint16_t)((uint32_t)in * l->out_dim / l->in_dim);
+    st->relu = 0;
+    in = st->out_dim;
+  }
+
+  const nn_window_stage_t* last = &w->stages[w->stage_count - 1];
+  const nn_layer_t* fc = &model->layers[i];
+  w->fc = i;
+  w->window = (uint8_t)last->layer->out_dim;
+  if (i == model->layer_count || fc->type != NN_LAYER_FC ||
+      fc->in_dim != (uint32_t)w->window * w->window * last->layer->out_ch || dim % last->out_dim != 0) {
+    return -1;
+  }
+  for (i = w->fc + 1; i < model->layer_count; i++) {
+    if (model->layers[i].in_buf != NN_BUF_OUTPUT || model->layers[i].out_buf != NN_BUF_OUTPUT) {
+      return -1;
+    }
+  }
+  w->stride = (uint8_t)(dim / last->out_dim);
+  w->cells = (uint8_t)(last->out_dim - w->window + 1);
+
+  uint32_t offset = 0, slab = 0;
+  for (uint8_t s = 0; s < w->stage_count; s++) {
+    nn_window_stage_t* st = &w->stages[s];
+    st->rows = (s + 1 < w->stage_count) ? (uint8_t)w->stages[s + 1].layer->ker_dim : w->window;
+    st->ring = (uint16_t)offset;
+    offset += align4((uint32_t)st->rows * st->out_dim * st->layer->out_ch);
+    if (st->layer->type == NN_LAYER_CONV) {
+      uint32_t size = (uint32_t)st->layer->ker_dim * slab_cols(st) * st->layer->in_ch;
+      slab = (size > slab) ? size : slab;
+    }
+  }
+  w->slab = (uint16_t)offset;
+  w->vector = (uint16_t)(offset + align4(slab));
+  return (w->vector + fc->in_dim <= SCRATCH_SIZE) ? 0 : -1;
+}
+
+static q7_t* stage_row(const nn_window_stage_t* st, q7_t* scratch, uint16_t y) {
+  return scratch + st->ring + (uint32_t)(y % st->rows) * st->out_dim * st->layer->out_ch;
+}
+
+// Row `y` of a conv stage: the input rows it reads are copied to the slab,
+// with zeros where the layer pads, and the nonsquare kernel runs on them
+// without padding.
+static void conv_row(nn_context_t* ctx, const nn_kernels_t* k, const nn_window_stage_t* st, const q7_t* const* in,
+                     q7_t* slab, q7_t* out) {
+  const nn_layer_t* l = st->layer;
+  const uint32_t ch = l->in_ch;
+  const uint32_t cols = slab_cols(st);
+  // Columns past the last window's reach are not copied.
+  const uint32_t copy = (st->in_dim + l->pad > cols) ? cols - l->pad : st->in_dim;
+  nn_conv_nonsquare_kernel_fn conv = (l->in_ch % 4 == 0 && l->out_ch % 2 == 0) ? k->conv_fast_nonsquare
+                                                                               : k->conv_basic_nonsquare;
+
+  for (uint16_t ky = 0; ky < l->ker_dim; ky++) {
+    q7_t* dst = slab + ky * cols * ch;
+    if (in[ky] == NULL) {
+      __builtin_memset(dst, 0, cols * ch);
+      continue;
+    }
+    __builtin_memset(dst, 0, l->pad * ch);
+    __builtin_memcpy(dst + l->pad * ch, in[ky], copy * ch);
+    __builtin_memset(dst + (l->pad + copy) * ch, 0, (cols - l->pad - copy) * ch);
+  }
+  conv(slab, (uint16_t)cols, l->ker_dim, l->in_ch, l->wt, l->out_ch, l->ker_dim, l->ker_dim, 0, 0, l->stride,
+       l->stride, l->bias, l->bias_lshift, l->out_rshift, out, st->out_dim, 1, (q15_t*)ctx->col_buffer, NULL);
+  // Loaded and stored a word at a time
+  COUNT(WORD, l->ker_dim * cols * ch / 2);
+}
+
+// Row of a pooling stage from the `n` input rows its windows cover, with the
+// arithmetic of nn_pool_region().
+static void pool_row(const nn_window_stage_t* st, const q7_t* const* in, int n, q7_t* out) {
+  const nn_layer_t* l = st->layer;
+  const int avg = l->type == NN_LAYER_AVEPOOL;
+  const int ch = l->in_ch;
+
+  for (int ox = 0; ox < st->out_dim; ox++) {
+    int kx0 = ox * l->stride - l->pad;
+    int kx1 = kx0 + l->ker_dim;
+    kx0 = (kx0 < 0) ? 0 : kx0;
+    kx1 = (kx1 > st->in_dim) ? st->in_dim : kx1;
+    for (int c = 0; c < ch; c++) {
+      int acc = avg ? 0 : -128;
+      for (int ky = 0; ky < n; ky++) {
+        const q7_t* src = in[ky] + c;
+        int row = avg ? 0 : -128;
+        for (int kx = kx0; kx < kx1; kx++) {
+          int v = src[kx * ch];
+          row = avg ? row + v : (v > row ? v : row);
+        }
+        if (avg) {
+          acc += row / (kx1 - kx0);
+        } else {
+          acc = (row > acc) ? row : acc;
+        }
+      }
+      out[ox * ch + c] = (q7_t)(avg ? acc / n : acc);
+    }
+  }
+  if (avg) {
+    COUNT(AVEPOOL_ELEM, st->out_dim * ch * (l->ker_dim + 1));
+  } else {
+    COUNT(MAXPOOL_ELEM, st->out_dim * ch * l->ker_dim * l->ker_dim);
+  }
+}
+
+// Compute the next row of stage `s`, and first the rows of the stages before
+// it that the row reads.
+static void next_row(nn_window_t* w, nn_context_t* ctx, const nn_kernels_t* k, q7_t* frame, uint8_t s) {
+  nn_window_stage_t* st = &w->stages[s];
+  const nn_layer_t* l = st->layer;
+  const q7_t* in[MAX_KERNEL];
+  const int top = st->next_row * l->stride - l->pad;
+  int end = top + l->ker_dim;
+  end = (end > st->in_dim) ? st->in_dim : end;
+
+  if (s > 0) {
+    while (w->stages[s - 1].next_row < end) {
+      next_row(w, ctx, k, frame, s - 1);
+    }
+  }
+
+  q7_t* out = stage_row(st, ctx->scratch_buffer, st->next_row);
+  int n = 0;
+  for (int y = top; y < top + l->ker_dim; y++) {
+    const q7_t* row = NULL;
+    if (y >= 0 && y < st->in_dim) {
+      row = (s == 0) ? frame + (uint32_t)y * st->in_dim * l->in_ch
+                     : stage_row(&w->stages[s - 1], ctx->scratch_buffer, (uint16_t)y);
+    }
+    // Conv windows read padding as zeros, pooling windows are clipped.
+    if (row != NULL || l->type == NN_LAYER_CONV) {
+      in[n++] = row;
+    }
+  }
+  if (l->type == NN_LAYER_CONV) {
+    conv_row(ctx, k, st, in, ctx->scratch_buffer + w->slab, out);
+  } else {
+    pool_row(st, in, n, out);
+  }
+  if (st->relu) {
+    k->relu(out, st->out_dim * l->out_ch);
+  }
+  st->next_row++;
+}
+
+int nn_window_run(nn_window_t* w, nn_context_t* ctx, q7_t* frame, q7_t* heatmap) {
+  const nn_kernels_t* k = nn_kernels(ctx);
+  const nn_model_t* m = w->model;
+  const uint8_t last = w->stage_count - 1;
+  nn_window_stage_t* st = &w->stages[last];
+  const uint16_t classes = m->layers[m->layer_count - 1].out_dim;
+  const uint32_t ch = st->layer->out_ch;
+  q7_t* vector = ctx->scratch_buffer + w->vector;
+
+  for (uint8_t s = 0; s < w->stage_count; s++) {
+    w->stages[s].next_row = 0;
+  }
+
+  for (uint16_t y = 0; y < st->out_dim; y++) {
+    if (y > 0 && ctx->layer_hook != NULL && ctx->layer_hook(ctx, (uint8_t)(st->layer - m->layers)) != 0) {
+      return NN_ABANDONED;
+    }
+    next_row(w, ctx, k, frame, last);
+    if (y + 1 < w->window) {
+      continue;
+    }
+
+    // Each window's part of the last rows, in the HWC order of a whole run
+    const uint16_t top = y + 1 - w->window;
+    for (uint8_t x = 0; x < w->cells; x++) {
+      q7_t* cell = heatmap + ((uint32_t)top * w->cells + x) * classes;
+      for (uint8_t r = 0; r < w->window; r++) {
+        __builtin_memcpy(vector + r * w->window * ch, stage_row(st, ctx->scratch_buffer, top + r) + x * ch,
+                         w->window * ch);
+      }
+      COUNT(WORD, w->window * w->window * ch / 2);
+      nn_run_layer(ctx, &m->layers[w->fc], vector, cell);
+      for (uint8_t i = w->fc + 1; i < m->layer_count; i++) {
+        nn_run_layer(ctx, &m->layers[i], cell, cell);
+      }
+    }
+  }
+  return NN_DONE;
+}
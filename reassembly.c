@@ -0,0 +1,177 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+
+#include "reassembly.h"
+
+static inline uint32_t Rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t Mix32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+// 64-bit hash of one fragment, seeded with its index so that the fragments of a request can be
+// combined with XOR in any order. Two 32-bit multiply-rotate lanes over whole words, about 1k
+// cycles per fragment on the M4 while the data is still in cache from the copy.
+static uint64_t HashFragment(const uint8_t *data, uint32_t length, uint32_t index)
+{
+    uint32_t h1 = 0x9E3779B9u * (index + 1);
+    uint32_t h2 = 0x7F4A7C15u ^ index;
+
+    for (uint32_t offset = 0; offset < length; offset += sizeof(uint32_t)) {
+        // The last word of an odd-sized fragment is padded with zeros.
+        uint32_t w = 0;
+        uint32_t n = (length - offset < sizeof(w)) ? length - offset : sizeof(w);
+        __builtin_memcpy(&w, &data[offset], n);
+        h1 = Rotl32(h1 ^ (w * 0xCC9E2D51u), 15) * 5 + 0xE6546B64u;
+        h2 = Rotl32(h2 + (w * 0x1B873593u), 13) * 0x85EBCA77u;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    return ((uint64_t)Mix32(h1 + h2) << 32) | Mix32(h2 ^ Rotl32(h1, 7));
+}
+
+void ReassemblyInit(ReassemblyTable *table)
+{
+    __builtin_memset(table, 0, sizeof(*table));
+}
+
+static ReassemblySlot *FindSlot(ReassemblyTable *table, uint32_t requestId)
+{
+    for (int i = 0; i < REASSEMBLY_SLOTS; i++) {
+        if (table->slots[i].inUse && table->slots[i].requestId == requestId) {
+            return &table->slots[i];
+        }
+    }
+    return NULL;
+}
+
+bool ReassemblyHasRoom(const ReassemblyTable *table, const FrameHeader *header)
+{
+    for (int i = 0; i < REASSEMBLY_SLOTS; i++) {
+        const ReassemblySlot *slot = &table->slots[i];
+        if (!slot->inUse || !slot->complete || slot->requestId == header->requestId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A free slot, or the oldest incomplete one (which the caller reports as evicted).
+static ReassemblySlot *AllocateSlot(ReassemblyTable *table, ReassemblyEviction *evicted)
+{
+    ReassemblySlot *oldest = NULL;
+
+    for (int i = 0; i < REASSEMBLY_SLOTS; i++) {
+        ReassemblySlot *slot = &table->slots[i];
+        if (!slot->inUse) {
+            return slot;
+        }
+        if (!slot->complete &&
+            (oldest == NULL || (int32_t)(slot->sequence - oldest->sequence) < 0)) {
+            oldest = slot;
+        }
+    }
+    if (oldest == NULL) {
+        return NULL;
+    }
+
+    evicted->valid = true;
+    evicted->requestId = oldest->requestId;
+    __builtin_memcpy(evicted->envelope, oldest->envelope, FRAME_ENVELOPE_SIZE);
+    table->evicted++;
+    return oldest;
+}
+
+// Expected payload length of a fragment; all but the last carry a full fragment.
+static bool FragmentLengthValid(const FrameHeader *header)
+{
+    if (header->fragmentIndex + 1 < header->fragmentCount) {
+        return header->payloadLength == FRAME_FRAGMENT_SIZE;
+    }
+    return header->payloadLength > 0 && header->payloadLength <= FRAME_FRAGMENT_SIZE &&
+           header->fragmentIndex * FRAME_FRAGMENT_SIZE + header->payloadLength <= REASSEMBLY_MAX_SIZE;
+}
+
+uint8_t *ReassemblyPrepare(ReassemblyTable *table, const FrameHeader *header,
+                           const uint8_t *envelope, ReassemblyEviction *evicted, uint8_t *error)
+{
+    evicted->valid = false;
+    *error = 0;
+
+    if (header->version != FRAME_VERSION) {
+        *error = FRAME_ERROR_VERSION;
+        table->rejected++;
+        return NULL;
+    }
+    if (header->fragmentCount == 0 || header->fragmentCount > REASSEMBLY_MAX_FRAGMENTS ||
+        header->fragmentIndex >= header->fragmentCount || !FragmentLengthValid(header)) {
+        *error = FRAME_ERROR_BAD_FRAGMENT;
+        table->rejected++;
+        return NULL;
+    }
+
+    ReassemblySlot *slot = FindSlot(table, header->requestId);
+    if (slot == NULL) {
+        slot = AllocateSlot(table, evicted);
+        if (slot == NULL) {
+            return NULL;
+        }
+        slot->inUse = true;
+        slot->complete = false;
+        slot->requestId = header->requestId;
+        slot->fragmentCount = header->fragmentCount;
+        slot->flags = header->flags;
+        slot->receivedMask = 0;
+        slot->size = 0;
+        slot->hash = 0;
+        slot->sequence = table->nextSequence++;
+        __builtin_memcpy(slot->envelope, envelope, FRAME_ENVELOPE_SIZE);
+    } else if (slot->fragmentCount != header->fragmentCount) {
+        *error = FRAME_ERROR_BAD_FRAGMENT;
+        table->rejected++;
+        return NULL;
+    } else if (slot->receivedMask & (1U << header->fragmentIndex)) {
+        table->duplicates++;
+        return NULL;
+    }
+
+    return &slot->data[header->fragmentIndex * FRAME_FRAGMENT_SIZE];
+}
+
+ReassemblySlot *ReassemblyCommit(ReassemblyTable *table, const FrameHeader *header)
+{
+    ReassemblySlot *slot = FindSlot(table, header->requestId);
+    if (slot == NULL) {
+        return NULL;
+    }
+
+    slot->receivedMask |= 1U << header->fragmentIndex;
+    slot->size += header->payloadLength;
+    slot->hash ^= HashFragment(&slot->data[header->fragmentIndex * FRAME_FRAGMENT_SIZE], header->payloadLength,
+                               header->fragmentIndex);
+
+    if (slot->receivedMask != (1U << slot->fragmentCount) - 1) {
+        return NULL;
+    }
+    slot->complete = true;
+    table->completed++;
+    return slot;
+}
+
+void ReassemblyRelease(ReassemblyTable *table, ReassemblySlot *slot)
+{
+    (void)table;
+    slot->inUse = false;
+}
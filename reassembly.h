@@ -0,0 +1,107 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef REASSEMBLY_H
+#define REASSEMBLY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "intercore-protocol.h"
+
+/// <summary>Number of requests that can be partially received at the same time.</summary>
+#define REASSEMBLY_SLOTS 4
+
+/// <summary>Largest request, in bytes, a slot can hold.</summary>
+#define REASSEMBLY_MAX_SIZE (32 * 32 * 3)
+
+#define REASSEMBLY_MAX_FRAGMENTS \
+    ((REASSEMBLY_MAX_SIZE + FRAME_FRAGMENT_SIZE - 1) / FRAME_FRAGMENT_SIZE)
+
+/// <summary>One request being reassembled.</summary>
+typedef struct {
+    /// <summary>Request data, fragments are copied here directly from the shared buffer.</summary>
+    uint8_t data[REASSEMBLY_MAX_SIZE] __attribute__((aligned(4)));
+    /// <summary>Envelope of the first fragment received, used to address the reply.</summary>
+    uint8_t envelope[FRAME_ENVELOPE_SIZE];
+    uint32_t requestId;
+    /// <summary>Bit n is set once fragment n has been received.</summary>
+    uint32_t receivedMask;
+    /// <summary>Bytes received so far.</summary>
+    uint32_t size;
+    /// <summary>Order in which slots were opened, used to pick one to evict.</summary>
+    uint32_t sequence;
+    uint8_t fragmentCount;
+    /// <summary>64-bit hash of the data, built up as fragments are committed and final once the
+    /// request is complete. Fragment hashes are combined independently of arrival order.
+    /// </summary>
+    uint64_t hash;
+    /// <summary>Cycle counter when the request was queued for inference, kept by the caller.
+    /// </summary>
+    uint32_t readyCycle;
+    /// <summary>FRAME_FLAG_* bits of the first fragment received.</summary>
+    uint8_t flags;
+    bool inUse;
+    /// <summary>All fragments received; the slot is never evicted until released.</summary>
+    bool complete;
+} ReassemblySlot;
+
+/// <summary>A partially received request that was dropped to make room for another.</summary>
+typedef struct {
+    bool valid;
+    uint32_t requestId;
+    uint8_t envelope[FRAME_ENVELOPE_SIZE];
+} ReassemblyEviction;
+
+/// <summary>The table of requests in flight.</summary>
+typedef struct {
+    ReassemblySlot slots[REASSEMBLY_SLOTS];
+    uint32_t nextSequence;
+    /// <summary>Counters for diagnostics.</summary>
+    uint32_t completed;
+    uint32_t duplicates;
+    uint32_t rejected;
+    uint32_t evicted;
+} ReassemblyTable;
+
+/// <summary>Empty the table.</summary>
+void ReassemblyInit(ReassemblyTable *table);
+
+/// <summary>
+/// Whether <see cref="ReassemblyPrepare" /> can place a fragment: its request already has a
+/// slot, or a slot is free or holds an incomplete request that can be evicted. Complete
+/// requests waiting for inference are never evicted, so the caller should leave the fragment
+/// in the shared buffer and retry once a slot has been released.
+/// </summary>
+bool ReassemblyHasRoom(const ReassemblyTable *table, const FrameHeader *header);
+
+/// <summary>
+/// <para>Find where the payload of a fragment must be copied. The fragment's request is
+/// looked up by ID and a slot is opened for it if needed; when all slots are busy the oldest
+/// incomplete one is evicted and returned through <paramref name="evicted" /> so the caller can report
+/// it before the slot is reused.</para>
+/// <para>Once the payload is in place, call <see cref="ReassemblyCommit" />.</para>
+/// </summary>
+/// <param name="table">The reassembly table.</param>
+/// <param name="header">Header of the received fragment.</param>
+/// <param name="envelope">Envelope of the received fragment.</param>
+/// <param name="evicted">Describes the request evicted to make room, if any.</param>
+/// <param name="error">On failure, the <see cref="FrameError" /> to report.</param>
+/// <returns>The destination for the payload, or NULL if the fragment must be dropped
+/// (duplicate) or rejected (<paramref name="error" /> is nonzero). Call only when
+/// <see cref="ReassemblyHasRoom" /> is true.</returns>
+uint8_t *ReassemblyPrepare(ReassemblyTable *table, const FrameHeader *header,
+                           const uint8_t *envelope, ReassemblyEviction *evicted, uint8_t *error);
+
+/// <summary>
+/// Mark a fragment whose payload has been copied to the destination returned by
+/// <see cref="ReassemblyPrepare" /> as received.
+/// </summary>
+/// <returns>The slot if the request is now complete, NULL otherwise. A complete slot stays
+/// allocated until <see cref="ReassemblyRelease" />.</returns>
+ReassemblySlot *ReassemblyCommit(ReassemblyTable *table, const FrameHeader *header);
+
+/// <summary>Free a slot returned by <see cref="ReassemblyCommit" />.</summary>
+void ReassemblyRelease(ReassemblyTable *table, ReassemblySlot *slot);
+
+#endif // #ifndef REASSEMBLY_H
@@ -0,0 +1,65 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#include <stddef.h>
+
+#include "resultcache.h"
+
+void ResultCacheReset(ResultCache *cache, uint8_t maxDistance)
+{
+    for (int i = 0; i < RESULT_CACHE_ENTRIES; i++) {
+        cache->entries[i].valid = false;
+    }
+    cache->maxDistance = maxDistance;
+}
+
+const int8_t *ResultCacheLookup(ResultCache *cache, uint64_t key)
+{
+    ResultCacheEntry *best = NULL;
+    int bestDistance = cache->maxDistance + 1;
+
+    for (int i = 0; i < RESULT_CACHE_ENTRIES && bestDistance > 0; i++) {
+        ResultCacheEntry *entry = &cache->entries[i];
+        if (!entry->valid) {
+            continue;
+        }
+        int distance = (entry->key == key) ? 0 : __builtin_popcountll(entry->key ^ key);
+        if (distance < bestDistance) {
+            best = entry;
+            bestDistance = distance;
+        }
+    }
+
+    if (best == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    best->lastUsed = ++cache->clock;
+    return &best->output[0];
+}
+
+void ResultCacheInsert(ResultCache *cache, uint64_t key, const int8_t *output)
+{
+    ResultCacheEntry *victim = &cache->entries[0];
+
+    for (int i = 0; i < RESULT_CACHE_ENTRIES; i++) {
+        ResultCacheEntry *entry = &cache->entries[i];
+        if (entry->valid && entry->key == key) {
+            victim = entry;
+            break;
+        }
+        if (!entry->valid) {
+            if (victim->valid) {
+                victim = entry;
+            }
+        } else if (victim->valid && (int32_t)(entry->lastUsed - victim->lastUsed) < 0) {
+            victim = entry;
+        }
+    }
+
+    victim->key = key;
+    victim->valid = true;
+    victim->lastUsed = ++cache->clock;
+    __builtin_memcpy(&victim->output[0], output, RESULT_CACHE_OUTPUTS);
+}
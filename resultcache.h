@@ -0,0 +1,70 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// <summary>Results the cache holds; the least recently used is replaced.</summary>
+#define RESULT_CACHE_ENTRIES 8
+
+/// <summary>Network outputs stored per result.</summary>
+#define RESULT_CACHE_OUTPUTS 10
+
+/// <summary>One cached result.</summary>
+typedef struct {
+    /// <summary>Hash of the input image.</summary>
+    uint64_t key;
+    /// <summary>Cache clock at the last lookup or insert that used the entry.</summary>
+    uint32_t lastUsed;
+    bool valid;
+    /// <summary>Network output for the image.</summary>
+    int8_t output[RESULT_CACHE_OUTPUTS];
+} ResultCacheEntry;
+
+/// <summary>
+/// <para>Small LRU cache of network outputs, keyed by a 64-bit hash of the input image. Keys
+/// are either exact hashes, or perceptual hashes compared by Hamming distance so that
+/// near-duplicate images hit as well.</para>
+/// <para>A zero-initialised cache is empty and matches exact keys.</para>
+/// </summary>
+typedef struct {
+    ResultCacheEntry entries[RESULT_CACHE_ENTRIES];
+    uint32_t clock;
+    /// <summary>Largest number of differing key bits accepted as a hit, 0 for exact keys.
+    /// </summary>
+    uint8_t maxDistance;
+    /// <summary>Lookups that found a result, and lookups that did not.</summary>
+    uint32_t hits;
+    uint32_t misses;
+} ResultCache;
+
+/// <summary>
+/// Drop every entry and set how keys are matched. The counters are kept.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="maxDistance">Largest number of differing key bits accepted as a hit.</param>
+void ResultCacheReset(ResultCache *cache, uint8_t maxDistance);
+
+/// <summary>
+/// Look up the result for an image. With a nonzero maximum distance the closest key within it
+/// is taken.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="key">Hash of the image.</param>
+/// <returns>The <see cref="RESULT_CACHE_OUTPUTS" /> outputs, or NULL on a miss. They remain
+/// valid until the next insert.</returns>
+const int8_t *ResultCacheLookup(ResultCache *cache, uint64_t key);
+
+/// <summary>
+/// Store the result for an image, replacing the entry with the same key or else the least
+/// recently used one.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="key">Hash of the image.</param>
+/// <param name="output">The <see cref="RESULT_CACHE_OUTPUTS" /> network outputs.</param>
+void ResultCacheInsert(ResultCache *cache, uint64_t key, const int8_t *output);
+
+#endif // #ifndef RESULTCACHE_H